@@ -19,9 +19,9 @@ using namespace std;
 #include <vector>
 #include <map>
 #include <set>
-#include "pin.H"
-#include "../InstLib/instlib.H"
+#include "sieve-port.h"
 #include "RD.h"
+#include "checkpoint.h"
 
 
 // This will be sufficient to map upto 16GB of program memory
@@ -111,13 +111,41 @@ ReuseDistance::~ReuseDistance()
 
 }
 
+//
+//  Calculate binary log of number. 
+//
+UINT
+Ilog(uint64_t arg)
+{
+    UINT i=0;
+    uint64_t a=arg;
+    if (a == 0) return 0;
+    while(a)
+    {
+        i++;
+        a = a >> 1;
+    }
+    return i-1;
+}
+
 //
 //Initialize program statistics and program control structures.
 //
-ReuseDistance::ReuseDistance(UINT32 block, std::ofstream *outFile, string name) : tag_shift(block), ident(name), toBeFreed(), isfile(outFile)
+ReuseDistance::ReuseDistance(UINT32 block, std::ofstream *outFile, string name, UINT64 max) : tag_shift(block), ident(name), toBeFreed(),
+  max_lines(max), recycled_tags(), isfile(outFile)
 {
   start_inst_count = get_inscount();
 
+//
+//  The deepest line is the last of a full level, so the bound is a power
+//  of two of at least two lines.
+//
+  saturated_level = 0;
+  if (max_lines) {
+    assert(max_lines >= 2 && (max_lines & (max_lines - 1)) == 0);
+    saturated_level = Ilog(max_lines) + 1;
+  }
+
   hash_table = new entry*[HASH_TABLE_SIZE];
   ht_idx_mask = HASH_TABLE_SIZE - 1;
   for (UINT i=0; i<HASH_TABLE_SIZE; i++) {
@@ -130,6 +158,15 @@ ReuseDistance::ReuseDistance(UINT32 block, std::ofstream *outFile, string name)
   }
 
   free_list = NULL;
+  reuse_histo = new UINT64[MAX_RD_BUCKETS];
+  init_chain();
+} // VOID RD_Init_Statistics() {
+
+//
+//  Set up an empty LRU-chain and zero the statistics.
+//
+VOID ReuseDistance::init_chain()
+{
   endbob = get_new_entry();
   endbob->level = -999;
   bhist_position[1] = endbob;
@@ -137,9 +174,11 @@ ReuseDistance::ReuseDistance(UINT32 block, std::ofstream *outFile, string name)
   bhist_position[0]->level = -1;
   bhist_position[0]->LRU_fptr = endbob;
   bhist_position[1]->LRU_bptr = bhist_position[0];
+  for (UINT i=2; i<64; i++) {
+    bhist_position[i] = NULL;
+  }
   bheidx = 1;
 
-  reuse_histo = new UINT64[MAX_RD_BUCKETS];
   for (UINT i=0; i<MAX_RD_BUCKETS; i++) {
     reuse_histo[i] = 0;                 // Initialize bins to zero count.
   }
@@ -147,28 +186,48 @@ ReuseDistance::ReuseDistance(UINT32 block, std::ofstream *outFile, string name)
   LRU_chain = bhist_position[0];
   total_unique_lines = 0;
   num_memory_accesses = 0;
+  chain_lines = 0;
+  lines_recycled = 0;
+  recycled_tags.clear();
 
   total_reorder_distance = 0;
   numb_reorders = 0;
   sicount = 1;
-} // VOID RD_Init_Statistics() {
+}
 
 //
-//  Calculate binary log of number. 
+//  Put every entry back on the free list.  Only the hash lists of lines
+//  in the LRU-chain are set, so only those are cleared.
 //
-UINT
-Ilog(uint64_t arg)
+VOID ReuseDistance::release_chain()
 {
-    UINT i=0;
-    uint64_t a=arg;
-    if (a == 0) return 0;
-    while(a)
-    {
-        i++;
-        a = a >> 1;
-    }
-    return i-1;
+  for (entry* wptr = LRU_chain; wptr != NULL; wptr = wptr->LRU_fptr)
+    hash_table[wptr->tag & ht_idx_mask] = NULL;
+
+  free_list = NULL;
+  for (UINT i=0; i<toBeFreed.size(); i++) {
+    toBeFreed[i]->hash_ptr = free_list;
+    free_list = toBeFreed[i];
+  }
 }
+
+//
+//  Forget every line, keeping the allocated entries for reuse.
+//
+VOID ReuseDistance::Reset()
+{
+  release_chain();
+  init_chain();
+}
+
+VOID ReuseDistance::ClearCounts()
+{
+  for (UINT i=0; i<MAX_RD_BUCKETS; i++) {
+    reuse_histo[i] = 0;
+  }
+  num_memory_accesses = 0;
+}
+
 //
 //  This routine cleans up any movement of the binary-log position
 //  pointers in the LRU-chain.  A new entry has been placed at the MRU
@@ -245,6 +304,77 @@ VOID ReuseDistance::update_bhist_positions(UINT64 tlevel)
 //  cerr << endl;
 }
 
+//
+//  Bounded mode: take the deepest line out of the hash table and mark
+//  its tag as recycled.  Once the chain holds max_lines lines its last
+//  level is full, and update_bhist_positions left the last level
+//  position on its last line.
+//
+entry* ReuseDistance::recycle_deepest_line()
+{
+  entry* victim = bhist_position[bheidx-1];
+  assert(victim->level == (INT64)bheidx-1);
+
+  entry** link = &hash_table[victim->tag & ht_idx_mask];
+  while (*link != victim)
+    link = &(*link)->hash_ptr;
+  *link = victim->hash_ptr;
+  victim->hash_ptr = NULL;
+
+  vector<UINT64> &page = recycled_tags[victim->tag / RECYCLED_PAGE_LINES];
+  if (page.empty())
+    page.resize(RECYCLED_PAGE_LINES / 64);
+  UINT64 bit = victim->tag % RECYCLED_PAGE_LINES;
+  page[bit >> 6] |= 1ULL << (bit & 63);
+  lines_recycled++;
+  return victim;
+}
+
+//
+//  Whether a line not in the chain was recycled before.
+//
+bool ReuseDistance::was_recycled(UINT64 tag)
+{
+  auto page = recycled_tags.find(tag / RECYCLED_PAGE_LINES);
+  if (page == recycled_tags.end())
+    return false;
+  UINT64 bit = tag % RECYCLED_PAGE_LINES;
+  return (page->second[bit >> 6] >> (bit & 63)) & 1;
+}
+
+//
+//  Move a line of the LRU-chain to its MRU position.  The binary log
+//  positions up to its former level are left to update_bhist_positions.
+//
+VOID ReuseDistance::move_to_mru(entry* wptr)
+{
+  if (wptr != LRU_chain) {
+//
+//  Check if entry hit is at end of row then move row pointer backward.
+//
+    if (wptr == bhist_position[wptr->level]) {
+      bhist_position[wptr->level] = wptr->LRU_bptr;
+    }
+//
+//  First remove from present position in LRU-chain.
+//
+    if (wptr->LRU_bptr != NULL) {
+      wptr->LRU_bptr->LRU_fptr = wptr->LRU_fptr;  // remove in fwd dir.
+    }
+    if (wptr->LRU_fptr != NULL) {
+      wptr->LRU_fptr->LRU_bptr = wptr->LRU_bptr;  // remove in bwd dir.
+    }
+//
+//  Move to MRU position of LRU-chain.
+//
+    wptr->LRU_fptr = LRU_chain;
+    wptr->LRU_fptr->LRU_bptr = wptr;
+    wptr->LRU_bptr = NULL;
+    wptr->level = 0;
+    LRU_chain = wptr;
+  } // if (wptr != LRU_chain) {
+}
+
 //
 //  This routine processes a new access.
 //
@@ -298,14 +428,12 @@ INT ReuseDistance::ProcessMemoryAccess(VOID *ip, UINT64 addr, INT64 rdsize)
 //cerr << "made it to point two with tag: " << hex << tag << dec 
 //     << " and first_time flag: " << first_time << endl;
   if (first_time) {
-    entry* new_entry = get_new_entry();
+    bool recycled = (max_lines != 0) && was_recycled(tag);
+    bool full = (max_lines != 0) && (chain_lines == max_lines);
+    entry* new_entry = full ? recycle_deepest_line() : get_new_entry();
     new_entry->tag = tag;
     new_entry->hash_ptr = hash_table[hidx];
     hash_table[hidx] = new_entry;
-    new_entry->LRU_fptr = LRU_chain;
-    LRU_chain->LRU_bptr = new_entry;
-    new_entry->LRU_bptr = NULL;
-    new_entry->level = 0;
     new_entry->avg_dist = 0;
     new_entry->min_dist = (UINT64) -1;
     new_entry->max_dist = 0;
@@ -316,14 +444,36 @@ INT ReuseDistance::ProcessMemoryAccess(VOID *ip, UINT64 addr, INT64 rdsize)
     } else {
       new_entry->access_size = -1;
     }
-    LRU_chain = new_entry;
-    total_unique_lines++;
-
+//
+//  A recycled line was reused further than the chain reaches.
+//
+    if (recycled) {
+      reuse_histo[SATURATE_RD(saturated_level)]++;
+      retRD = saturated_level;
+    } else {
+      total_unique_lines++;
+    }
 
+    if (full) {
+//
+//  The entry was the deepest line, so moving it to the MRU position
+//  shifts every other line down one as a hit at its level does.
+//
+      UINT64 level = new_entry->level;
+      move_to_mru(new_entry);
+      update_bhist_positions(level);
+    } else {
+      new_entry->LRU_fptr = LRU_chain;
+      LRU_chain->LRU_bptr = new_entry;
+      new_entry->LRU_bptr = NULL;
+      new_entry->level = 0;
+      LRU_chain = new_entry;
+      chain_lines++;
 //
 //  Clean up the binary-hist positions for entire chain.
 //
-    update_bhist_positions(bheidx+1);
+      update_bhist_positions(bheidx+1);
+    }
   } else {                              // was a hit in chain.
 //
 //  For all hits in LRU-chain, need to update reuse_histo with 
@@ -361,35 +511,7 @@ INT ReuseDistance::ProcessMemoryAccess(VOID *ip, UINT64 addr, INT64 rdsize)
 //
 //  Move entry to MRU position of LRU-chain if not there already.
 //
-//cerr << "made it to point twoB with tag: " << hex << tag << dec 
-//     << " and hit was at level: " << wptr->level << endl;
-//cerr << " and hit at level: " << wptr->level;
-    if (wptr != LRU_chain) {
-//
-//  Check if entry hit is at end of row then move row pointer backward.
-//
-      if (wptr == bhist_position[wptr->level]) {
-        bhist_position[wptr->level] = wptr->LRU_bptr;
-      }
-//
-//  First remove from present position in LRU-chain.
-//
-      if (wptr->LRU_bptr != NULL) {
-        wptr->LRU_bptr->LRU_fptr = wptr->LRU_fptr;  // remove in fwd dir.
-      }
-      if (wptr->LRU_fptr != NULL) {
-        wptr->LRU_fptr->LRU_bptr = wptr->LRU_bptr;  // remove in bwd dir.
-      }
-//cerr << "made it to point twoC with tag: " << hex << tag << dec << endl;
-//
-//  Move to MRU position of LRU-chain.
-//
-      wptr->LRU_fptr = LRU_chain;
-      wptr->LRU_fptr->LRU_bptr = wptr;
-      wptr->LRU_bptr = NULL;
-      wptr->level = 0;
-      LRU_chain = wptr;
-    } // if (wptr != LRU_chain) {
+    move_to_mru(wptr);
 //
 //  Clean up the binary-hist positions up to level of hit.
 //
@@ -403,6 +525,194 @@ INT ReuseDistance::ProcessMemoryAccess(VOID *ip, UINT64 addr, INT64 rdsize)
 //cerr << endl;
 } // INT RD_process_memory_access(VOID *ip, UINT64 addr, INT64 rdsize) {
 
+//
+//  Move the line of addr to the MRU position of the LRU-chain as an
+//  access would, without counting it in the statistics.
+//
+VOID ReuseDistance::Touch(UINT64 addr)
+{
+  INT rd = ProcessMemoryAccess(NULL, addr, 0);
+  num_memory_accesses--;
+  if (rd >= 0)
+    reuse_histo[SATURATE_RD(rd)]--;
+  else
+    total_unique_lines--;
+}
+
+//
+//  Add the statistics of accesses whose reuse distances were found
+//  elsewhere, see ParallelStackDistance.
+//
+VOID ReuseDistance::AddCounts(const UINT64 *histo, UINT64 accesses)
+{
+  for (UINT i=0; i<MAX_RD_BUCKETS; i++)
+    reuse_histo[i] += histo[i];
+  num_memory_accesses += accesses;
+}
+
+//
+//  Checkpoint of the module.  The LRU-chain is written from MRU to the
+//  end, unused entries (level < 0) only by their level, lines with their
+//  tag as a delta to the previous line; the binary log positions become
+//  indices into the chain.
+//
+VOID ReuseDistance::Save(CheckpointWriter &out)
+{
+  out.u64(tag_shift);
+  out.u64(start_inst_count);
+  out.u64(sicount);
+  out.u64(total_reorder_distance);
+  out.u64(numb_reorders);
+  out.u64(total_unique_lines);
+  out.u64(num_memory_accesses);
+  for (UINT i=0; i<MAX_RD_BUCKETS; i++)
+    out.u64(reuse_histo[i]);
+  out.u64(max_lines);
+  out.u64(chain_lines);
+  out.u64(lines_recycled);
+  out.u64(recycled_tags.size());
+  for (auto &page : recycled_tags) {
+    out.u64(page.first);
+    out.raw(page.second.data(), page.second.size() * sizeof(UINT64));
+  }
+
+  UINT64 length = 0;
+  for (entry* wptr = LRU_chain; wptr != NULL; wptr = wptr->LRU_fptr)
+    length++;
+  out.u64(length);
+
+  // the positions follow the chain in level order, a second walk finds any that do not
+  UINT64 position[64];
+  UINT next = 0;
+  UINT64 index = 0, prev_tag = 0;
+  for (entry* wptr = LRU_chain; wptr != NULL; wptr = wptr->LRU_fptr, index++) {
+    while (next <= bheidx && wptr == bhist_position[next])
+      position[next++] = index;
+
+    out.s64(wptr->level);
+    if (wptr->level < 0)
+      continue;
+    out.s64(wptr->tag - prev_tag);
+    prev_tag = wptr->tag;
+    out.u64(wptr->num_reuses);
+    if (wptr->num_reuses) {
+      out.u64(wptr->min_dist);
+      out.u64(wptr->max_dist);
+      out.f64(wptr->avg_dist);
+    }
+    out.u64(wptr->chunk_usage);
+    out.s64(wptr->access_size);
+  }
+  for (; next <= bheidx; next++) {
+    index = 0;
+    for (entry* wptr = LRU_chain; wptr != bhist_position[next]; wptr = wptr->LRU_fptr)
+      index++;
+    position[next] = index;
+  }
+
+  out.u64(bheidx);
+  for (UINT i=0; i<=bheidx; i++)
+    out.u64(position[i]);
+}
+
+bool ReuseDistance::Load(CheckpointReader &in)
+{
+  if (in.u64() != tag_shift)
+    return false;
+  start_inst_count = in.u64();
+  sicount = in.u64();
+  total_reorder_distance = in.u64();
+  numb_reorders = in.u64();
+  total_unique_lines = in.u64();
+  num_memory_accesses = in.u64();
+  for (UINT i=0; i<MAX_RD_BUCKETS; i++)
+    reuse_histo[i] = in.u64();
+  if (in.u64() != max_lines)
+    return false;
+  chain_lines = in.u64();
+  lines_recycled = in.u64();
+  recycled_tags.clear();
+  UINT64 pages = in.u64();
+  for (UINT64 i=0; i<pages && in.ok(); i++) {
+    vector<UINT64> &page = recycled_tags[in.u64()];
+    page.resize(RECYCLED_PAGE_LINES / 64);
+    in.raw(page.data(), page.size() * sizeof(UINT64));
+  }
+
+  release_chain();
+  UINT64 length = in.u64();
+  vector<entry*> chain;
+  chain.reserve(length);
+  UINT64 prev_tag = 0;
+  for (UINT64 i=0; i<length && in.ok(); i++) {
+    entry* e = get_new_entry();
+    e->level = in.s64();
+    if (e->level >= 0) {
+      e->tag = prev_tag + in.s64();
+      prev_tag = e->tag;
+      e->num_reuses = in.u64();
+      e->min_dist = (UINT64) -1;
+      e->max_dist = 0;
+      e->avg_dist = 0;
+      if (e->num_reuses) {
+        e->min_dist = in.u64();
+        e->max_dist = in.u64();
+        e->avg_dist = in.f64();
+      }
+      e->chunk_usage = in.u64();
+      e->access_size = in.s64();
+    }
+    chain.push_back(e);
+  }
+  if (!in.ok() || chain.size() < 2)
+    return false;
+
+  // link the chain; the lines go into the hash lists last to first, so the MRU ones lead
+  for (UINT64 i=0; i<chain.size(); i++) {
+    chain[i]->LRU_bptr = (i > 0) ? chain[i-1] : NULL;
+    chain[i]->LRU_fptr = (i + 1 < chain.size()) ? chain[i+1] : NULL;
+  }
+  for (UINT64 i=chain.size(); i-- > 0;) {
+    entry* e = chain[i];
+    if (e->level < 0)
+      continue;
+    UINT hidx = e->tag & ht_idx_mask;
+    e->hash_ptr = hash_table[hidx];
+    hash_table[hidx] = e;
+  }
+  LRU_chain = chain.front();
+  endbob = chain.back();
+
+  bheidx = in.u64();
+  if (bheidx >= 64)
+    return false;
+  for (UINT i=0; i<64; i++)
+    bhist_position[i] = NULL;
+  for (UINT i=0; i<=bheidx; i++) {
+    UINT64 index = in.u64();
+    if (index >= chain.size())
+      return false;
+    bhist_position[i] = chain[index];
+  }
+  return in.ok();
+}
+
+//
+//  Bulk form of ProcessMemoryAccess for the replay.  The batch is known
+//  ahead, so the hash bucket of a later access is prefetched while the
+//  current one walks its hash list.
+//
+#define RD_PREFETCH_AHEAD 8
+
+VOID ReuseDistance::ProcessMemoryAccesses(const UINT64 *addrs, const UINT8 *sizes, UINT64 n, INT *rds)
+{
+  for (UINT64 i = 0; i < n; i++) {
+    if (i + RD_PREFETCH_AHEAD < n)
+      __builtin_prefetch(&hash_table[(addrs[i + RD_PREFETCH_AHEAD] >> tag_shift) & ht_idx_mask]);
+    rds[i] = ProcessMemoryAccess(NULL, addrs[i], sizes[i]);
+  }
+}
+
 //
 //  This routine checks that the LRU-chain is in proper organization
 //  to allow the process to work.
@@ -489,6 +799,10 @@ VOID ReuseDistance::FinalReport(string reason, std::ofstream *of)
   *l_of << endl;
   *l_of << "Total number of memory accesses: " << num_memory_accesses << endl;
   *l_of << "Total Unique Lines Studied: " << total_unique_lines << endl;
+  if (max_lines) {
+    *l_of << "Maximum Lines Tracked: " << max_lines << endl;
+    *l_of << "Lines Recycled: " << lines_recycled << endl;
+  }
 
   PrintHistogram("", of);
 }
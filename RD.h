@@ -1,13 +1,20 @@
 #ifndef _REUSE_DISTANCE_H
 #define _REUSE_DISTANCE_H
 #include <set>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <unordered_map>
+
+#include "sieve-port.h"
+
+using namespace std;
 
-using namespace INSTLIB;
 #define MAX_RD_BUCKETS 32
+#define RECYCLED_PAGE_LINES 32768
 
-extern ICOUNT icount;
-ADDRINT inline get_inscount() { return icount.Count(); }
-VOID inline activate_inscount() { icount.Activate(); }
+class CheckpointWriter;
+class CheckpointReader;
 
 // TODO: replace with the variable being externed here
 struct entry {
@@ -46,21 +53,49 @@ private:
    uint64_t numb_reorders;
 
    vector<entry *> toBeFreed;       // List of entries to be cleaned-up
- 
+
+   // Bounded mode: at most max_lines lines are kept, the deepest one is
+   // recycled for a new line.  Reuses of recycled lines are counted at
+   // saturated_level; their tags are kept as one bit per line, in pages
+   // of RECYCLED_PAGE_LINES lines.
+   UINT64 max_lines;               // 0 for an unbounded chain.
+   UINT64 chain_lines;             // Lines in the LRU-chain.
+   UINT saturated_level;           // Bucket of reuses beyond max_lines.
+   unordered_map<UINT64, vector<UINT64> > recycled_tags;
+
    entry* get_new_entry();
+   entry* recycle_deepest_line();
+   bool was_recycled(UINT64 tag);
+   VOID move_to_mru(entry* wptr);
+   VOID release_chain();
+   VOID init_chain();
    VOID update_bhist_positions(UINT64 tlevel);
    VOID perform_sanity_check(uint64_t cnt);
 
 public:
    UINT64 total_unique_lines;      // Total number of unique lines.
    UINT64 num_memory_accesses;     // Total number of memory accesses
+   UINT64 lines_recycled;          // Lines dropped at max_lines.
 
    UINT64* reuse_histo;            // Binary log histo of reuse distance.
    std::ofstream *isfile;
 
 
-   ReuseDistance(UINT32 block = 6, std::ofstream *outFile = NULL, string name = "");
+   // max_lines bounds the lines kept, a power of two; 0 keeps every line
+   ReuseDistance(UINT32 block = 6, std::ofstream *outFile = NULL, string name = "", UINT64 max_lines = 0);
    INT ProcessMemoryAccess(VOID *ip, UINT64 addr, INT64 rdsize);
+   // rds[i] = ProcessMemoryAccess(NULL, addrs[i], sizes[i]) for a batch, e.g. a replayed trace chunk
+   VOID ProcessMemoryAccesses(const UINT64 *addrs, const UINT8 *sizes, UINT64 n, INT *rds);
+
+   // support of the chunk parallel replay, see parallel-rd.h
+   VOID Reset();                    // forget all lines and statistics
+   VOID ClearCounts();              // forget the statistics, keep the lines
+   VOID Touch(UINT64 addr);         // make the line MRU without counting an access
+   VOID AddCounts(const UINT64 *histo, UINT64 accesses);
+
+   // the LRU-chain with its binary log positions and the statistics, see checkpoint.h
+   VOID Save(CheckpointWriter &out);
+   bool Load(CheckpointReader &in);
 
    UINT64 calculateMisses(UINT64 rdBucket)
    {
@@ -19,36 +19,9 @@ using namespace std;
 #include <vector>
 #include <map>
 #include <math.h>
-#include "pin.H"
-#include "../InstLib/instlib.H"
+#include "sieve-port.h"
 #include "Set-RD.h"
-
-using namespace INSTLIB;
-
-// Contains knobs to filter out things to instrument
-FILTER filter;
-
-#if defined(__GNUC__)
-#  if defined(__APPLE__)
-#    define ALIGN_LOCK __attribute__ ((aligned(16))) /* apple only supports 16B alignment */
-#  else
-#    define ALIGN_LOCK __attribute__ ((aligned(64)))
-#  endif
-#else
-# define ALIGN_LOCK __declspec(align(64))
-#endif
-
-INT32 FilterUsage()
-{
-    cerr <<
-        ":: FILTER OPTIONS :: \n"
-        "\n";
-
-    cerr << KNOB_BASE::StringKnobSummary() << endl;
-    return -1;
-}
-
-CONTROL control(false, "controller_");
+#include "checkpoint.h"
 
 INT SetRD::process_memory_access(VOID *ip, UINT64 addr, INT64 rdsize)
 {
@@ -58,6 +31,16 @@ INT SetRD::process_memory_access(VOID *ip, UINT64 addr, INT64 rdsize)
    return sets[index]->ProcessMemoryAccess(ip, addr, rdsize);
 }
 
+VOID SetRD::process_memory_accesses(const UINT64 *addrs, const UINT8 *sizes, UINT64 n, INT *rds)
+{
+   if(numSets == 1) {
+      sets[0]->ProcessMemoryAccesses(addrs, sizes, n, rds);
+      return;
+   }
+   for(UINT64 i = 0; i < n; i++)
+      rds[i] = sets[getIndex(addrs[i])]->ProcessMemoryAccess(NULL, addrs[i], sizes[i]);
+}
+
 VOID SetRD::printHistogram(string str, std::ofstream &of)
 {
    for(UINT s = 0; s < numSets; s++)
@@ -66,11 +49,8 @@ VOID SetRD::printHistogram(string str, std::ofstream &of)
 
 VOID SetRD::FinalReport(std::ofstream &of)
 {
-   for(UINT s = 0; s < numSets; s++) {
-      char t[8];
-      sprintf(t,"Set_%u",s);
+   for(UINT s = 0; s < numSets; s++)
       sets[s]->FinalReport("Fini", &of);
-   }
 }
 
 UINT64 SetRD::calculateMisses(UINT rdBucket)
@@ -82,6 +62,18 @@ UINT64 SetRD::calculateMisses(UINT rdBucket)
    return misses;
 }
 
+VOID SetRD::Reset()
+{
+   for(UINT s = 0; s < numSets; s++)
+      sets[s]->Reset();
+}
+
+VOID SetRD::ClearCounts()
+{
+   for(UINT s = 0; s < numSets; s++)
+      sets[s]->ClearCounts();
+}
+
 UINT64 SetRD::getNumMemoryAccesses(void)
 {
    UINT64 accesses = 0;
@@ -90,3 +82,20 @@ UINT64 SetRD::getNumMemoryAccesses(void)
 
    return accesses;
 }
+
+VOID SetRD::Save(CheckpointWriter &out)
+{
+   out.u64(numSets);
+   for(UINT s = 0; s < numSets; s++)
+      sets[s]->Save(out);
+}
+
+bool SetRD::Load(CheckpointReader &in)
+{
+   if(in.u64() != numSets)
+      return false;
+   for(UINT s = 0; s < numSets; s++)
+      if(!sets[s]->Load(in))
+         return false;
+   return true;
+}
@@ -19,19 +19,39 @@ class SetRD {
       return ((addr >> BLOCK_SIZE) & indexMask);
    }
 public:
-   SetRD(UINT ns = 1, UINT bs = 6) : BLOCK_SIZE(bs), numSets(ns), sets(ns), indexMask(0)
+   // max_lines bounds the distance tracked per set, see ReuseDistance
+   SetRD(UINT ns = 1, UINT bs = 6, UINT64 max_lines = 0) : BLOCK_SIZE(bs), numSets(ns), sets(ns), indexMask(0)
    {
       for(UINT s = 0; s < log2(ns); s ++)
          indexMask |= 1ULL << s;
       for(UINT s = 0; s < ns; s ++)
-         sets[s] = new ReuseDistance(BLOCK_SIZE, NULL, "SET_" + std::to_string(s));
+         sets[s] = new ReuseDistance(BLOCK_SIZE, NULL, "SET_" + std::to_string(s), max_lines);
    }
 
    INT process_memory_access(VOID *ip, UINT64 addr, INT64 rdsize);
+   // bulk form, rds[i] is the RD of access i
+   VOID process_memory_accesses(const UINT64 *addrs, const UINT8 *sizes, UINT64 n, INT *rds);
+
+   // the sets are independent, so accesses to different sets may be processed on different threads
+   UINT getNumSets(void) { return numSets; }
+   UINT set_of(UINT64 addr) { return getIndex(addr); }
+   ReuseDistance *get_set(UINT set) { return sets[set]; }
+   INT process_set_access(UINT set, UINT64 addr, INT64 rdsize)
+   {
+      return sets[set]->ProcessMemoryAccess(NULL, addr, rdsize);
+   }
    UINT64 calculateMisses(UINT rdBucket);
+   // forget the lines and statistics of every set
+   VOID Reset();
+   // forget the statistics of every set, keep the lines
+   VOID ClearCounts();
    VOID printHistogram(string str, std::ofstream &of);
    VOID FinalReport(std::ofstream &of);
    UINT64 getNumMemoryAccesses(void);
+
+   // all sets, see checkpoint.h
+   VOID Save(CheckpointWriter &out);
+   bool Load(CheckpointReader &in);
 };
 
 #endif
@@ -0,0 +1,83 @@
+#ifndef _ACCESS_RING_H
+#define _ACCESS_RING_H
+
+#include <atomic>
+
+#include "object-store.h"
+
+// Compact record of one cache line access, as seen after the object lookup
+struct AccessRecord {
+   UINT64 seq;         // global order of the access among all threads
+   UINT64 time;        // instruction count at the access
+   ADDRINT addr;
+   UINT32 id;          // object the access is attributed to
+   UINT16 size;        // bytes accessed in this cache line
+   UINT8 category;     // OBJ_TYPE of the object
+   UINT8 is_read;
+
+   AccessRecord() { }
+   AccessRecord(UINT64 _seq, UINT64 _time, ADDRINT _addr, UINT32 _id, UINT16 _size, UINT8 _category, UINT8 _is_read) :
+      seq(_seq), time(_time), addr(_addr), id(_id), size(_size), category(_category), is_read(_is_read) { }
+};
+
+// Lock free single producer / single consumer ring of access records.
+// The producer writes records privately and makes them visible a segment at a time
+// with publish(), so the shared tail is stored once per segment instead of per record.
+// The consumer reads the visible records in place and frees their slots with release().
+class ALIGN_CACHELINE AccessRing : public CacheLineAligned {
+   AccessRecord *records;
+   UINT64 mask;
+
+   // consumer side
+   std::atomic<UINT64> head ALIGN_CACHELINE;
+
+   // producer side
+   std::atomic<UINT64> tail ALIGN_CACHELINE;   // end of the published records
+   UINT64 write_pos;                           // end of the written records, >= tail
+   UINT64 cached_head;                         // producer's last view of head
+
+public:
+   UINT64 dropped;                             // records refused because the ring was full
+
+   // capacity is rounded up to a power of two
+   AccessRing(UINT64 capacity);
+   ~AccessRing();
+
+   UINT64 capacity() const { return mask + 1; }
+
+   /* producer */
+   bool full()
+   {
+      if(write_pos - cached_head <= mask)
+         return false;
+      cached_head = head.load(std::memory_order_acquire);
+      return write_pos - cached_head > mask;
+   }
+   VOID put(const AccessRecord &rec) { records[write_pos++ & mask] = rec; }
+   UINT64 unpublished() const { return write_pos - tail.load(std::memory_order_relaxed); }
+   VOID publish() { tail.store(write_pos, std::memory_order_release); }
+
+   /* consumer */
+   UINT64 available() const
+   {
+      return tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed);
+   }
+   const AccessRecord &peek(UINT64 i) const
+   {
+      return records[(head.load(std::memory_order_relaxed) + i) & mask];
+   }
+   VOID release(UINT64 n) { head.store(head.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+
+   // seq of the oldest published record still in the ring, ~0 if there is none
+   UINT64 oldest_seq() const
+   {
+      UINT64 h = head.load(std::memory_order_acquire);
+      return (h == tail.load(std::memory_order_acquire)) ? ~0ULL : records[h & mask].seq;
+   }
+
+private:
+   AccessRing(const AccessRing &);
+   AccessRing &operator=(const AccessRing &);
+};
+
+#endif
@@ -0,0 +1,291 @@
+//
+//  Checkpoint and restore of the analysis core state, see checkpoint.h
+//
+
+#include <fcntl.h>
+#include <unistd.h>
+#include "sieve-core.h"
+#include "checkpoint.h"
+
+// the configuration the state depends on; a checkpoint only restores into the same one
+static VOID save_configuration(CheckpointWriter &out)
+{
+    out.u64(LOG2_CACHE_BLOCK_SIZE);
+    out.u64(LOG2_L1_SIZE);
+    out.u64(LOG2_L2_SIZE);
+    out.u64(LOG2_LLC_SIZE);
+    out.u64(enable_rd);
+    out.u64(private_rd);
+    out.u64(num_sets);
+    out.u64(wss_window);
+    out.u64(large_object_size);
+    out.u64(demarcate_large_objects);
+    out.u64(rd_max_lines);
+}
+
+static bool same_configuration(CheckpointReader &in)
+{
+    UINT64 saved[] = { in.u64(), in.u64(), in.u64(), in.u64(), in.u64(), in.u64(), in.u64(), in.u64(), in.u64(), in.u64(),
+                       in.u64() };
+    UINT64 current[] = { LOG2_CACHE_BLOCK_SIZE, LOG2_L1_SIZE, LOG2_L2_SIZE, LOG2_LLC_SIZE, enable_rd, private_rd,
+                         num_sets, wss_window, large_object_size, demarcate_large_objects, rd_max_lines };
+    return in.ok() && memcmp(saved, current, sizeof(saved)) == 0;
+}
+
+static VOID save_objects(CheckpointWriter &out, const vector<ObjectInstance> &objects)
+{
+    out.u64(objects.size());
+    for (auto &object : objects) {
+        out.u64(object.start);
+        out.u64(object.size);
+        out.u64(object.callsiteIP);
+        out.u64(object.id);
+        out.u64(object.type);
+        out.u64(object.category);
+        out.u64(object.valid);
+    }
+}
+
+static VOID load_objects(CheckpointReader &in, vector<ObjectInstance> &objects)
+{
+    objects.clear();
+    UINT64 n = in.u64();
+    for (UINT64 i = 0; i < n && in.ok(); i++) {
+        ADDRINT start = in.u64(), size = in.u64(), ip = in.u64();
+        UINT32 id = in.u64();
+        OBJ_ALLOC_TYPE type = (OBJ_ALLOC_TYPE)in.u64();
+        OBJ_TYPE category = (OBJ_TYPE)in.u64();
+        objects.push_back(ObjectInstance(start, size, ip, id, type, category));
+        objects.back().valid = in.u64();
+    }
+}
+
+static VOID save_context(CheckpointWriter &out, ThreadContext *tc)
+{
+    out.u64(tc->tid);
+    out.u64(tc->accesses);
+    out.u64(tc->writes);
+    for (UINT c = 0; c < OBJ_TYPE_NUM; c++) {
+        out.u64(tc->cat_accesses[c]);
+        out.u64(tc->cat_misses[c]);
+    }
+    out.u64(tc->l1_misses);
+    out.u64(tc->l2_misses);
+    tc->counters->Save(out, object_count);
+
+    out.u64(tc->private_rd != NULL);
+    if (tc->private_rd)
+        tc->private_rd->Save(out);
+
+    tc->wss.Save(out);
+    out.u64(tc->wss_accesses);
+    out.u64(tc->wss_samples.size());
+    for (auto &sample : tc->wss_samples) {
+        out.u64(sample.first);
+        out.u64(sample.second);
+    }
+}
+
+static ThreadContext *load_context(CheckpointReader &in)
+{
+    ThreadContext *tc = new ThreadContext(in.u64());
+    tc->accesses = in.u64();
+    tc->writes = in.u64();
+    for (UINT c = 0; c < OBJ_TYPE_NUM; c++) {
+        tc->cat_accesses[c] = in.u64();
+        tc->cat_misses[c] = in.u64();
+    }
+    tc->l1_misses = in.u64();
+    tc->l2_misses = in.u64();
+    bool ok = tc->counters->Load(in);
+
+    if (in.u64()) {
+        tc->private_rd = new SetRD(num_sets, LOG2_CACHE_BLOCK_SIZE, rd_max_lines);
+        ok = ok && tc->private_rd->Load(in);
+    }
+
+    ok = ok && tc->wss.Load(in);
+    tc->wss_accesses = in.u64();
+    UINT64 samples = in.u64();
+    for (UINT64 i = 0; i < samples && in.ok(); i++) {
+        UINT64 icount = in.u64();
+        tc->wss_samples.push_back(make_pair(icount, in.u64()));
+    }
+
+    if (!ok || !in.ok()) {
+        delete tc;
+        return NULL;
+    }
+    return tc;
+}
+
+VOID save_analysis(CheckpointWriter &out)
+{
+    save_configuration(out);
+    out.u64(object_count);
+    out.u64(small_dynamic_count);
+    out.u64(unaligned_accesses);
+
+    vector<ObjectInstance> live;
+    LiveObjects.get()->get(live);
+    save_objects(out, live);
+    save_objects(out, freedObjects);
+    out.u64(ObjectMeta.size());
+    for (auto &meta : ObjectMeta) {
+        out.str(meta.image_name);
+        out.str(meta.source);
+        out.u64(meta.tsc_malloc);
+        out.u64(meta.tsc_free);
+    }
+
+    for (UINT c = 0; c < OBJ_TYPE_NUM; c++) {
+        OBJ_Cat &category = OBJCategory[c];
+        out.u64(category.objects.size());
+        for (auto id : category.objects)
+            out.u64(id);
+        out.u64(category.size);
+        category.rd->Save(out);
+    }
+    if (enable_rd)
+        GlobalRD->Save(out);
+
+    out.u64(Threads.size());
+    for (auto tc : Threads)
+        save_context(out, tc);
+}
+
+static VOID damaged()
+{
+    cerr << "Checkpoint is damaged or of another build, not restoring\n";
+    exit(1);
+}
+
+VOID load_analysis(CheckpointReader &in)
+{
+    if (!same_configuration(in)) {
+        cerr << "Checkpoint was taken with another configuration (block, cache sizes, -rd, -sets, -private-rd, "
+                "-wss-window, -large-obj-size, -demark-large-obj, -rd-max-distance), not restoring\n";
+        exit(1);
+    }
+    object_count = in.u64();
+    small_dynamic_count = in.u64();
+    unaligned_accesses = in.u64();
+
+    // nothing runs yet, the index is replaced in place
+    vector<ObjectInstance> live;
+    load_objects(in, live);
+    LiveObjects.get()->assign(live);
+    load_objects(in, freedObjects);
+    ObjectMeta.clear();
+    UINT64 metas = in.u64();
+    for (UINT64 i = 0; i < metas && in.ok(); i++) {
+        ObjectMetadata meta;
+        meta.image_name = in.str();
+        meta.source = in.str();
+        meta.tsc_malloc = in.u64();
+        meta.tsc_free = in.u64();
+        ObjectMeta.push_back(meta);
+    }
+    if (!in.ok() || LiveObjects.get()->size() < 2 || ObjectMeta.size() != object_count)
+        damaged();
+
+    for (UINT c = 0; c < OBJ_TYPE_NUM; c++) {
+        OBJ_Cat &category = OBJCategory[c];
+        category.objects.clear();
+        UINT64 n = in.u64();
+        for (UINT64 i = 0; i < n && in.ok(); i++)
+            category.objects.insert(in.u64());
+        category.size = in.u64();
+        if (!category.rd->Load(in))
+            damaged();
+    }
+    if (enable_rd && !GlobalRD->Load(in))
+        damaged();
+
+    Threads.clear();
+    UINT64 threads = in.u64();
+    for (UINT64 t = 0; t < threads && in.ok(); t++) {
+        ThreadContext *tc = load_context(in);
+        if (!tc)
+            damaged();
+        Threads.push_back(tc);
+    }
+    if (!in.ok())
+        damaged();
+}
+
+UINT64 write_checkpoint_file(const string &file, const CheckpointWriter &out)
+{
+    string tmp = file + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cerr << "Unable to create checkpoint " << tmp << endl;
+        return 0;
+    }
+
+    UINT32 version = CHECKPOINT_VERSION, reserved = 0;
+    UINT64 payload_bytes = out.bytes.size();
+    CheckpointWriter header;
+    header.raw(CHECKPOINT_MAGIC, 8);
+    header.raw(&version, sizeof(version));
+    header.raw(&reserved, sizeof(reserved));
+    header.raw(&payload_bytes, sizeof(payload_bytes));
+
+    const vector<UINT8> *parts[] = { &header.bytes, &out.bytes };
+    bool ok = true;
+    for (UINT i = 0; i < 2 && ok; i++) {
+        const UINT8 *p = parts[i]->data();
+        UINT64 left = parts[i]->size();
+        while (left) {
+            ssize_t written = write(fd, p, left);
+            if (written <= 0) {
+                ok = false;
+                break;
+            }
+            p += written;
+            left -= written;
+        }
+    }
+    ok = ok && write(fd, CHECKPOINT_END_MAGIC, 8) == 8;
+    // the data must be on disk before the rename makes it the checkpoint
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), file.c_str()) != 0) {
+        cerr << "Unable to write checkpoint " << file << endl;
+        unlink(tmp.c_str());
+        return 0;
+    }
+    return header.bytes.size() + payload_bytes + 8;
+}
+
+VOID read_checkpoint_file(const string &file, vector<UINT8> &payload)
+{
+    ifstream in(file.c_str(), ios::binary);
+    if (!in) {
+        cerr << "Unable to open checkpoint " << file << endl;
+        exit(1);
+    }
+    char magic[8];
+    UINT32 version = 0, reserved;
+    UINT64 payload_bytes = 0;
+    in.read(magic, 8);
+    in.read((char *)&version, sizeof(version));
+    in.read((char *)&reserved, sizeof(reserved));
+    in.read((char *)&payload_bytes, sizeof(payload_bytes));
+    if (!in || memcmp(magic, CHECKPOINT_MAGIC, 8) != 0) {
+        cerr << file << " is not an SPM-Sieve checkpoint\n";
+        exit(1);
+    }
+    if (version != CHECKPOINT_VERSION) {
+        cerr << file << " has checkpoint version " << version << ", this build reads version " << CHECKPOINT_VERSION << endl;
+        exit(1);
+    }
+
+    payload.resize(payload_bytes);
+    in.read((char *)payload.data(), payload_bytes);
+    in.read(magic, 8);
+    if (!in || memcmp(magic, CHECKPOINT_END_MAGIC, 8) != 0) {
+        cerr << "Checkpoint " << file << " is incomplete, not restoring\n";
+        exit(1);
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+// Checkpoints of the complete analysis state, so that a long offline replay can resume after
+// a crash or a preemption. The state is serialized into one buffer with the varints of the
+// trace format and written to the checkpoint file in one go:
+//
+//   file := "SPMCKPT1" u32 version u32 reserved u64 payload_bytes payload "SPMCKEND"
+//
+// The payload is the driver's position (written by the replay) followed by save_analysis().
+// A file without its end magic is an interrupted write and is refused.
+
+#include <string>
+#include <vector>
+#include <string.h>
+
+#include "trace-format.h"
+
+using namespace std;
+
+#define CHECKPOINT_VERSION     2
+#define CHECKPOINT_MAGIC       "SPMCKPT1"
+#define CHECKPOINT_END_MAGIC   "SPMCKEND"
+
+class CheckpointWriter {
+public:
+   vector<UINT8> bytes;
+
+   VOID u64(UINT64 v)
+   {
+      UINT8 buf[10];
+      bytes.insert(bytes.end(), buf, put_varint(buf, v));
+   }
+   VOID s64(INT64 v) { u64(zigzag(v)); }
+   VOID f64(double v) { raw(&v, sizeof(v)); }
+   VOID raw(const VOID *data, UINT64 length)
+   {
+      bytes.insert(bytes.end(), (const UINT8 *)data, (const UINT8 *)data + length);
+   }
+   VOID str(const string &s)
+   {
+      u64(s.size());
+      raw(s.data(), s.size());
+   }
+};
+
+// Reads back what CheckpointWriter wrote. Running past the end leaves zeros and clears ok()
+class CheckpointReader {
+   const UINT8 *p, *end;
+   bool bad;
+
+public:
+   CheckpointReader(const UINT8 *data, UINT64 length) : p(data), end(data + length), bad(false) { }
+
+   UINT64 u64()
+   {
+      UINT64 v = 0;
+      const UINT8 *next = bad ? NULL : get_varint(p, end, &v);
+      if(!next) {
+         bad = true;
+         return 0;
+      }
+      p = next;
+      return v;
+   }
+   INT64 s64() { return unzigzag(u64()); }
+   double f64()
+   {
+      double v = 0;
+      raw(&v, sizeof(v));
+      return v;
+   }
+   VOID raw(VOID *data, UINT64 length)
+   {
+      if(bad || (UINT64)(end - p) < length) {
+         bad = true;
+         return;
+      }
+      memcpy(data, p, length);
+      p += length;
+   }
+   string str()
+   {
+      UINT64 length = u64();
+      if(bad || (UINT64)(end - p) < length) {
+         bad = true;
+         return "";
+      }
+      string s((const char *)p, length);
+      p += length;
+      return s;
+   }
+
+   bool ok() const { return !bad; }
+   bool at_end() const { return p == end; }
+};
+
+// the state of the analysis core: configuration, objects, categories, RDs and thread contexts
+VOID save_analysis(CheckpointWriter &out);
+
+// replace the state set up by InitAnalysis() with the saved one; exits when the checkpoint
+// was taken with another configuration or is damaged
+VOID load_analysis(CheckpointReader &in);
+
+// write the payload through a temporary file renamed over file, so that a crash while
+// writing leaves the previous checkpoint in place; returns the bytes written, 0 on failure
+UINT64 write_checkpoint_file(const string &file, const CheckpointWriter &out);
+
+// the payload of a checkpoint file; exits when it cannot be read or is not complete
+VOID read_checkpoint_file(const string &file, vector<UINT8> &payload);
+
+#endif
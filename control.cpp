@@ -0,0 +1,144 @@
+//
+//  Runtime control channel, see control.h
+//
+
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "sieve-core.h"
+#include "control.h"
+
+bool parse_control(const string &line, ControlCommand &command)
+{
+    istringstream words(line);
+    string word, extra;
+    if (!(words >> word))
+        return false;
+
+    command.prefix.clear();
+    command.sampling = 0;
+    command.warm = false;
+    if (word == "snapshot") {
+        command.kind = CONTROL_SNAPSHOT;
+        words >> command.prefix;
+    }
+    else if (word == "reset") {
+        command.kind = CONTROL_RESET;
+        if (words >> extra && extra != "warm") {
+            cerr << "Control: reset takes warm or nothing, not \"" << line << "\"\n";
+            return false;
+        }
+        command.warm = (extra == "warm");
+    }
+    else if (word == "disable") command.kind = CONTROL_DISABLE;
+    else if (word == "enable") command.kind = CONTROL_ENABLE;
+    else if (word == "sampling") {
+        command.kind = CONTROL_SAMPLING;
+        if (!(words >> command.sampling) || command.sampling == 0) {
+            cerr << "Control: sampling needs a rate of 1 or more, not \"" << line << "\"\n";
+            return false;
+        }
+    }
+    else {
+        cerr << "Control: unknown command \"" << line << "\", use snapshot, reset, disable, enable or sampling\n";
+        return false;
+    }
+    if (words >> extra) {
+        cerr << "Control: too many arguments in \"" << line << "\"\n";
+        return false;
+    }
+    return true;
+}
+
+VOID run_control(const ControlCommand &command)
+{
+    static UINT64 snapshots = 0;
+    UINT64 icount = get_inscount();
+
+    switch (command.kind) {
+    case CONTROL_SNAPSHOT: {
+        ostringstream prefix;
+        if (command.prefix.empty())
+            prefix << output_prefix << ".snapshot-" << ++snapshots;
+        else
+            prefix << command.prefix;
+        SnapshotAnalysis(prefix.str());
+        cerr << "Control: snapshot " << prefix.str() << " at icount " << icount << endl;
+        break;
+    }
+    case CONTROL_RESET:
+        ResetAnalysis(command.warm);
+        cerr << "Control: " << (command.warm ? "warm " : "") << "reset at icount " << icount << endl;
+        break;
+    case CONTROL_DISABLE:
+        analysis_enabled.store(false, std::memory_order_relaxed);
+        cerr << "Control: analysis disabled at icount " << icount << endl;
+        break;
+    case CONTROL_ENABLE:
+        analysis_enabled.store(true, std::memory_order_relaxed);
+        cerr << "Control: analysis enabled at icount " << icount << endl;
+        break;
+    case CONTROL_SAMPLING:
+        access_sampling.store(command.sampling, std::memory_order_relaxed);
+        cerr << "Control: sampling 1 in " << command.sampling << " accesses at icount " << icount << endl;
+        break;
+    }
+}
+
+bool ControlChannel::open(const string &fifo)
+{
+    path = fifo;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        if (mkfifo(path.c_str(), 0600) != 0) {
+            cerr << "Unable to create control FIFO " << path << endl;
+            return false;
+        }
+        created = true;
+    }
+    else if (!S_ISFIFO(st.st_mode)) {
+        cerr << "Control " << path << " exists and is not a FIFO\n";
+        return false;
+    }
+
+    fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK);
+    keep = (fd >= 0) ? ::open(path.c_str(), O_WRONLY | O_NONBLOCK) : -1;
+    if (keep < 0) {
+        cerr << "Unable to open control FIFO " << path << endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool ControlChannel::next(string &line)
+{
+    if (fd < 0)
+        return false;
+
+    size_t eol;
+    while ((eol = pending.find('\n')) == string::npos) {
+        char buffer[4096];
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0)
+            return false;
+        pending.append(buffer, n);
+    }
+    line = pending.substr(0, eol);
+    pending.erase(0, eol + 1);
+    return true;
+}
+
+VOID ControlChannel::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    if (keep >= 0)
+        ::close(keep);
+    fd = keep = -1;
+    if (created)
+        unlink(path.c_str());
+    created = false;
+}
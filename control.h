@@ -0,0 +1,70 @@
+#ifndef _CONTROL_H
+#define _CONTROL_H
+
+// Runtime control of a long run through a named FIFO (-control <path>), one command per line:
+//
+//   snapshot [prefix]   write the reports of the run so far, to <o>.snapshot-<n> by default
+//                       and a row of the <o>-cache-stats.csv timeline
+//   reset [warm]        zero every count and forget the RD state; the objects stay. A warm
+//                       reset keeps the lines of the RDs, the next accesses are not cold
+//   disable | enable    stop or resume analyzing accesses; allocations are still tracked
+//   sampling <n>        analyze one in n accesses of every thread, 1 analyzes all
+//
+// e.g. echo snapshot > /tmp/spm.ctl. The Pin tool reads the FIFO on an internal thread and
+// stops the application threads and the analysis workers around a snapshot or reset; the
+// replay reads it between chunks. Accesses still buffered for the shared levels at a reset
+// are counted after it.
+
+#include <string>
+
+#include "sieve-port.h"
+
+using namespace std;
+
+enum CONTROL_KIND {
+   CONTROL_SNAPSHOT,
+   CONTROL_RESET,
+   CONTROL_DISABLE,
+   CONTROL_ENABLE,
+   CONTROL_SAMPLING
+};
+
+struct ControlCommand {
+   CONTROL_KIND kind;
+   string prefix;          // of a snapshot, empty for the default
+   UINT64 sampling;
+   bool warm;              // of a reset
+
+   ControlCommand(CONTROL_KIND _kind = CONTROL_SNAPSHOT, bool _warm = false) :
+      kind(_kind), prefix(), sampling(0), warm(_warm) { }
+
+   // the command needs the analysis state to hold still
+   bool quiescent() const { return kind == CONTROL_SNAPSHOT || kind == CONTROL_RESET; }
+};
+
+// false with a message when line is not a command
+bool parse_control(const string &line, ControlCommand &command);
+
+// carry out command; the caller makes the analysis hold still for quiescent() ones
+VOID run_control(const ControlCommand &command);
+
+// The reading end of the FIFO; it also holds a writing end, so that the FIFO never reads
+// end of file once the writers of earlier commands are gone
+class ControlChannel {
+   int fd, keep;
+   string path, pending;
+   bool created;
+
+public:
+   ControlChannel() : fd(-1), keep(-1), path(), pending(), created(false) { }
+   ~ControlChannel() { close(); }
+
+   // open the FIFO at path, creating it when it does not exist; false with a message
+   bool open(const string &path);
+   // the next complete line written to the FIFO, false when there is none yet; never blocks
+   bool next(string &line);
+   // close, removing the FIFO if open() created it
+   VOID close();
+};
+
+#endif
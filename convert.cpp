@@ -0,0 +1,79 @@
+/*
+ * spm-sieve-convert: prints the text reports of a profile (-profile, -text-report 0 or
+ * spm-sieve-merge -profile) in the layouts of the run that wrote it.
+ *
+ *   spm-sieve-convert [options] profile
+ *
+ * Writes the object and category distribution of the main report, and <o>-object-profile.csv.
+ * A merged profile holds one entry per allocation site, reported under the site's ordinal.
+ */
+
+#include "sieve-core.h"
+
+// the instruction count seen by the analysis core, see sieve-port.h
+UINT64 replay_icount;
+
+INT32 Usage()
+{
+    cerr << "Usage: spm-sieve-convert [options] profile\n"
+        "Prints the text report and object profile of an SPM-Sieve profile\n\n"
+        "  -o <file>                output file name, prefix of the object profile [spm-sieve.out]\n"
+        "  -display-all-obj <0|1>   display detailed stats for all objects [0]\n"
+        "  -obj-prof <0|1>          print object profile in a file [1]\n";
+    return -1;
+}
+
+int main(int argc, char *argv[])
+{
+    string file;
+    for (int i = 1; i < argc; i++) {
+        string option = argv[i];
+        if (option[0] != '-') {
+            if (!file.empty())
+                return Usage();
+            file = option;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            cerr << "Missing value for " << option << endl;
+            return Usage();
+        }
+
+        const char *value = argv[++i];
+        if (option == "-o") output_prefix = value;
+        else if (option == "-display-all-obj") display_all_objects = atoi(value);
+        else if (option == "-obj-prof") object_profile = atoi(value);
+        else {
+            cerr << "Unknown option " << option << endl;
+            return Usage();
+        }
+    }
+    if (file.empty())
+        return Usage();
+
+    Profile profile;
+    vector<UINT8> buffer;
+    if (!read_profile(file, profile, buffer))
+        return -1;
+
+    LOG2_CACHE_BLOCK_SIZE = profile.log2_block_size;
+    LOG2_L1_SIZE = profile.log2_l1_size;
+    LOG2_L2_SIZE = profile.log2_l2_size;
+    LOG2_LLC_SIZE = profile.log2_llc_size;
+    demarcate_large_objects = profile.demarcate_large_objects;
+
+    OutFile.open(output_prefix.c_str());
+    OutFile << "Cache Line Size : " << (1 << LOG2_CACHE_BLOCK_SIZE) << endl;
+    OutFile << "L1 Cache Size : " << (1ULL << LOG2_L1_SIZE) << endl;
+    OutFile << "L2 Cache Size : " << (1ULL << LOG2_L2_SIZE) << endl;
+    OutFile << "Shared LLC Size : " << (1ULL << LOG2_LLC_SIZE) << endl;
+    if (!profile.global_rd.empty())
+        Display_Global_RD_Distribution(OutFile, profile, LOG2_L1_SIZE, LOG2_L2_SIZE);
+    else
+        OutFile << "The profile has no RD histograms (-rd 0)\n";
+    OutFile.close();
+
+    if (object_profile)
+        print_object_profile(output_prefix, profile);
+    return 0;
+}
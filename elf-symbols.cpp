@@ -0,0 +1,191 @@
+//
+//  Symbols of an ELF image, see elf-symbols.h
+//
+
+#include <iostream>
+#include <algorithm>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "elf-symbols.h"
+
+// the mapped file; every table is checked to lie within it before it is read
+class ElfFile {
+    const UINT8 *data;
+    size_t bytes;
+
+public:
+    ElfFile() : data(NULL), bytes(0) { }
+    ~ElfFile() { if (data) munmap((VOID *)data, bytes); }
+
+    bool map(const string &file)
+    {
+        int fd = open(file.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+            if (fd >= 0)
+                close(fd);
+            return false;
+        }
+        VOID *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED)
+            return false;
+        data = (const UINT8 *)mem;
+        bytes = st.st_size;
+        return true;
+    }
+
+    // count entries of T at offset, NULL when they do not fit
+    template <typename T>
+    const T *at(UINT64 offset, UINT64 count = 1) const
+    {
+        if (offset > bytes || count > (bytes - offset) / sizeof(T))
+            return NULL;
+        return (const T *)(data + offset);
+    }
+};
+
+static bool by_value(const ElfObject &a, const ElfObject &b)
+{
+    return a.tls != b.tls ? a.tls < b.tls : a.value < b.value;
+}
+
+static bool same_value(const ElfObject &a, const ElfObject &b)
+{
+    return a.tls == b.tls && a.value == b.value;
+}
+
+// the defined OBJECT, TLS and FUNC symbols of one symbol table section
+static VOID read_symbol_table(const ElfFile &elf, const Elf64_Shdr *sections, UINT sec_count, const Elf64_Shdr &table,
+                              ElfImage &image)
+{
+    if (table.sh_entsize != sizeof(Elf64_Sym) || table.sh_link >= sec_count)
+        return;
+    const Elf64_Shdr &strtab = sections[table.sh_link];
+    UINT64 count = table.sh_size / sizeof(Elf64_Sym);
+    const Elf64_Sym *symbols = elf.at<Elf64_Sym>(table.sh_offset, count);
+    const char *names = elf.at<char>(strtab.sh_offset, strtab.sh_size);
+    if (!symbols || !names || strtab.sh_size == 0)
+        return;
+
+    for (UINT64 i = 0; i < count; i++) {
+        const Elf64_Sym &symbol = symbols[i];
+        UINT type = ELF64_ST_TYPE(symbol.st_info);
+        if ((type != STT_OBJECT && type != STT_TLS && type != STT_FUNC) || symbol.st_shndx == SHN_UNDEF ||
+            symbol.st_size == 0 || symbol.st_name >= strtab.sh_size)
+            continue;
+        const char *name = names + symbol.st_name;
+        ElfObject object;
+        object.value = symbol.st_value;
+        object.size = symbol.st_size;
+        object.name = string(name, strnlen(name, strtab.sh_size - symbol.st_name));
+        object.tls = (type == STT_TLS);
+        if (type == STT_FUNC)
+            image.routines.push_back(object);
+        else
+            image.objects.push_back(object);
+    }
+}
+
+// the mapped file when it is a 64 bit ELF image, NULL otherwise
+static const Elf64_Ehdr *elf_header(ElfFile &elf, const string &file)
+{
+    const Elf64_Ehdr *header = NULL;
+    if (elf.map(file))
+        header = elf.at<Elf64_Ehdr>(0);
+    if (!header || memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_ident[EI_CLASS] != ELFCLASS64)
+        return NULL;
+    return header;
+}
+
+static const Elf64_Phdr *elf_segments(const ElfFile &elf, const Elf64_Ehdr *header)
+{
+    if (header->e_phentsize != sizeof(Elf64_Phdr))
+        return NULL;
+    return elf.at<Elf64_Phdr>(header->e_phoff, header->e_phnum);
+}
+
+// the NT_GNU_BUILD_ID note of the PT_NOTE segments, in hex
+static string read_build_id(const ElfFile &elf, const Elf64_Phdr *segments, UINT count)
+{
+    static const char hex[] = "0123456789abcdef";
+    for (UINT p = 0; segments && p < count; p++) {
+        if (segments[p].p_type != PT_NOTE)
+            continue;
+        UINT64 offset = segments[p].p_offset, end = offset + segments[p].p_filesz;
+        while (offset + sizeof(Elf64_Nhdr) <= end) {
+            const Elf64_Nhdr *note = elf.at<Elf64_Nhdr>(offset);
+            if (!note)
+                break;
+            UINT64 name = offset + sizeof(Elf64_Nhdr);
+            UINT64 desc = name + ((note->n_namesz + 3) & ~3ULL);
+            UINT64 next = desc + ((note->n_descsz + 3) & ~3ULL);
+            if (next > end)
+                break;
+            const char *owner = elf.at<char>(name, note->n_namesz);
+            const UINT8 *bytes = elf.at<UINT8>(desc, note->n_descsz);
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && owner && bytes &&
+                memcmp(owner, "GNU", 4) == 0) {
+                string id;
+                for (UINT i = 0; i < note->n_descsz; i++) {
+                    id += hex[bytes[i] >> 4];
+                    id += hex[bytes[i] & 0xf];
+                }
+                return id;
+            }
+            offset = next;
+        }
+    }
+    return "";
+}
+
+bool read_elf_objects(const string &file, ElfImage &image)
+{
+    image.objects.clear();
+    image.routines.clear();
+    image.tls_offset = 0;
+    image.build_id.clear();
+
+    ElfFile elf;
+    const Elf64_Ehdr *header = elf_header(elf, file);
+    if (!header) {
+        cerr << "Unable to read the symbols of " << file << ", not a 64 bit ELF image\n";
+        return false;
+    }
+
+    const Elf64_Shdr *sections = NULL;
+    if (header->e_shentsize == sizeof(Elf64_Shdr))
+        sections = elf.at<Elf64_Shdr>(header->e_shoff, header->e_shnum);
+    for (UINT s = 0; sections && s < header->e_shnum; s++)
+        if (sections[s].sh_type == SHT_SYMTAB || sections[s].sh_type == SHT_DYNSYM)
+            read_symbol_table(elf, sections, header->e_shnum, sections[s], image);
+
+    // .symtab and .dynsym name the exported symbols twice; the .symtab name comes first
+    stable_sort(image.objects.begin(), image.objects.end(), by_value);
+    image.objects.erase(unique(image.objects.begin(), image.objects.end(), same_value), image.objects.end());
+    stable_sort(image.routines.begin(), image.routines.end(), by_value);
+    image.routines.erase(unique(image.routines.begin(), image.routines.end(), same_value), image.routines.end());
+
+    // place of the TLS block of the executable, as the loader computes it for the first module
+    const Elf64_Phdr *segments = elf_segments(elf, header);
+    for (UINT p = 0; segments && p < header->e_phnum; p++)
+        if (segments[p].p_type == PT_TLS && segments[p].p_memsz) {
+            ADDRINT align = MAX(segments[p].p_align, 1);
+            ADDRINT firstbyte = (-segments[p].p_vaddr) & (align - 1);
+            image.tls_offset = ((segments[p].p_memsz - firstbyte + align - 1) & ~(align - 1)) + firstbyte;
+        }
+    image.build_id = read_build_id(elf, segments, header->e_phnum);
+    return true;
+}
+
+bool read_elf_build_id(const string &file, string &build_id)
+{
+    ElfFile elf;
+    const Elf64_Ehdr *header = elf_header(elf, file);
+    build_id = header ? read_build_id(elf, elf_segments(elf, header), header->e_phnum) : "";
+    return !build_id.empty();
+}
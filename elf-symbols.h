@@ -0,0 +1,39 @@
+#ifndef _ELF_SYMBOLS_H
+#define _ELF_SYMBOLS_H
+
+// The symbols of an ELF image, read in process from the .symtab and .dynsym sections of the
+// mapped file: every defined OBJECT, TLS or FUNC symbol with a size, and the GNU build-id note
+// that names the build. Addresses are link time ones; the loader moves a PIE executable or a
+// shared library by its load offset.
+//
+// A TLS symbol has one copy per thread. Its value is the offset in the TLS block of the image;
+// for the main executable the block sits tls_offset bytes below the thread pointer (x86-64,
+// TLS variant II), so the copy of a thread is at thread pointer - tls_offset + value.
+
+#include <string>
+#include <vector>
+
+#include "sieve-port.h"
+
+using namespace std;
+
+struct ElfObject {
+   ADDRINT value, size;         // link time address, or the offset in the TLS block
+   string name;
+   bool tls;
+};
+
+struct ElfImage {
+   vector<ElfObject> objects;   // in (tls, value) order, each address once
+   vector<ElfObject> routines;  // the FUNC symbols, in value order, each address once
+   ADDRINT tls_offset;          // of the executable's TLS block below the thread pointer, 0 without TLS
+   string build_id;             // in hex, empty without the note
+};
+
+// false with a message when file is not a 64 bit ELF image that can be read
+bool read_elf_objects(const string &file, ElfImage &image);
+
+// only the build-id, without reading the symbols; false when file has none
+bool read_elf_build_id(const string &file, string &build_id);
+
+#endif
@@ -0,0 +1,99 @@
+//
+//  Discovery of the heap blocks allocated before the tool attached, see heap-scan.h
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include "heap-scan.h"
+
+// the glibc malloc chunk: prev_size, size | flags, then the block
+#define CHUNK_WORD       sizeof(ADDRINT)
+#define CHUNK_HEADER     (2 * CHUNK_WORD)
+#define CHUNK_ALIGN      (2 * CHUNK_WORD)
+#define CHUNK_MIN        (4 * CHUNK_WORD)
+#define PREV_INUSE       0x1
+#define IS_MMAPPED       0x2
+#define CHUNK_FLAGS      0x7
+// usable bytes of the largest chunk the tcache keeps by default, tidx2usize(TCACHE_MAX_BINS - 1);
+// the fastbins stop well below
+#define TCACHE_MAX_USABLE   (63 * CHUNK_ALIGN + CHUNK_MIN - CHUNK_WORD)
+
+// the chunks of the main arena from start to the top chunk
+static VOID walk_arena(ADDRINT start, ADDRINT end, ADDRINT min_size, HEAP_READER read, vector<HeapBlock> &blocks)
+{
+    ADDRINT chunk = (start + CHUNK_ALIGN - 1) & ~(CHUNK_ALIGN - 1);
+    while (chunk + CHUNK_HEADER <= end) {
+        ADDRINT header[2];
+        if (read(header, (VOID *)chunk, CHUNK_HEADER) != CHUNK_HEADER)
+            return;
+        ADDRINT size = header[1] & ~(ADDRINT)CHUNK_FLAGS;
+        // no chunk there, the walk is lost
+        if (size < CHUNK_MIN || size % CHUNK_ALIGN || chunk + size > end)
+            return;
+
+        // the top chunk runs to the end of the mapping
+        ADDRINT next = chunk + size, next_size;
+        if (next + CHUNK_HEADER > end || read(&next_size, (VOID *)(next + CHUNK_WORD), CHUNK_WORD) != CHUNK_WORD)
+            return;
+        if ((next_size & PREV_INUSE) && size - CHUNK_WORD > min_size)
+            blocks.push_back(HeapBlock{chunk + CHUNK_HEADER, size - CHUNK_WORD, "[heap]"});
+        chunk = next;
+    }
+}
+
+// the chunks mmapped on their own in an anonymous mapping; neighbouring mmaps share a mapping,
+// a page that starts no chunk is skipped
+static VOID find_mmapped(ADDRINT start, ADDRINT end, ADDRINT page, ADDRINT min_size, HEAP_READER read,
+                         vector<HeapBlock> &blocks)
+{
+    ADDRINT chunk = start;
+    while (chunk + CHUNK_HEADER <= end) {
+        ADDRINT header[2];
+        ADDRINT size = 0;
+        if (read(header, (VOID *)chunk, CHUNK_HEADER) == CHUNK_HEADER && header[0] == 0 && (header[1] & IS_MMAPPED))
+            size = header[1] & ~(ADDRINT)CHUNK_FLAGS;
+        if (size == 0 || size % page || chunk + size > end) {
+            chunk += page;
+            continue;
+        }
+        if (size - CHUNK_HEADER > min_size)
+            blocks.push_back(HeapBlock{chunk + CHUNK_HEADER, size - CHUNK_HEADER, "[mmap]"});
+        chunk += size;
+    }
+}
+
+bool scan_heap(ADDRINT min_size, HEAP_READER read, vector<HeapBlock> &blocks)
+{
+    ifstream maps("/proc/self/maps");
+    if (!maps) {
+        cerr << "Unable to read /proc/self/maps, no heap scan\n";
+        return false;
+    }
+    ADDRINT page = sysconf(_SC_PAGESIZE);
+
+    //  start-end perms offset dev inode path, e.g.
+    //  55d1c5a3e000-55d1c5a5f000 rw-p 00000000 00:00 0    [heap]
+    string line;
+    while (getline(maps, line)) {
+        istringstream fields(line);
+        string range, perms, offset, device, path;
+        UINT64 inode = 0;
+        fields >> range >> perms >> offset >> device >> inode;
+        fields >> path;
+
+        size_t dash = range.find('-');
+        if (dash == string::npos || perms.compare(0, 2, "rw") != 0)
+            continue;
+        ADDRINT start = strtoull(range.substr(0, dash).c_str(), NULL, 16);
+        ADDRINT end = strtoull(range.substr(dash + 1).c_str(), NULL, 16);
+
+        // a freed chunk the tcache holds keeps PREV_INUSE set, only larger ones are known in use
+        if (path == "[heap]")
+            walk_arena(start, end, MAX(min_size, TCACHE_MAX_USABLE), read, blocks);
+        else if (path.empty() && inode == 0)
+            find_mmapped(start, end, page, min_size, read, blocks);
+    }
+    return true;
+}
@@ -0,0 +1,36 @@
+#ifndef _HEAP_SCAN_H
+#define _HEAP_SCAN_H
+
+// Discovery of the heap blocks a process allocated before the tool attached to it (pin -pid),
+// whose allocations the hooks never saw. The blocks are rebuilt from the mappings of the
+// process (/proc/self/maps, the tool runs in it) and the glibc malloc chunk headers:
+//
+//   [heap]      the chunks of the main arena, walked from the start of the mapping to the top
+//               chunk; a chunk is in use when the next one has PREV_INUSE set
+//   anonymous   chunks malloc mmapped on their own, IS_MMAPPED set and spanning whole pages
+//
+// Only blocks larger than a minimum size are kept. In the arena that is at least 1032 usable
+// bytes (x86-64), the largest tcache chunk: a chunk freed into the tcache or a fastbin keeps
+// PREV_INUSE set and looks in use, a larger one never does. The chunks of the arenas of
+// other threads are not walked. The memory is read through a copy function that tolerates
+// unmapped addresses, PIN_SafeCopy in the Pin tool.
+
+#include <string>
+#include <vector>
+
+#include "sieve-port.h"
+
+using namespace std;
+
+struct HeapBlock {
+   ADDRINT start, size;         // the usable bytes, as malloc_usable_size()
+   string mapping;              // [heap] or [mmap]
+};
+
+typedef size_t (*HEAP_READER)(VOID *dst, const VOID *src, size_t bytes);
+
+// the blocks in use larger than min_size (in the arena, than the largest tcache chunk too), in
+// address order; false with a message when the mappings cannot be read
+bool scan_heap(ADDRINT min_size, HEAP_READER read, vector<HeapBlock> &blocks);
+
+#endif
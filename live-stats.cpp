@@ -0,0 +1,130 @@
+//
+//  Shared memory ring of live statistics, see live-stats.h
+//
+
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "live-stats.h"
+
+static string segment_path(const string &name)
+{
+    return "/dev/shm/" + name;
+}
+
+bool LivePublisher::open(const string &name, UINT64 interval_ms, UINT log2_block_size, UINT log2_l1_size,
+                         UINT log2_l2_size, UINT log2_llc_size)
+{
+    if (name.empty() || name.find('/') != string::npos) {
+        cerr << "Live statistics name " << name << " must be a plain file name\n";
+        return false;
+    }
+    path = segment_path(name);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(LiveSegment)) != 0) {
+        cerr << "Unable to create live statistics " << path << endl;
+        if (fd >= 0)
+            ::close(fd);
+        return false;
+    }
+    VOID *mem = mmap(NULL, sizeof(LiveSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        cerr << "Unable to map live statistics " << path << endl;
+        unlink(path.c_str());
+        return false;
+    }
+
+    // the file is new and zero filled: every slot is free and published is 0
+    segment = static_cast<LiveSegment *>(mem);
+    segment->version = LIVE_VERSION;
+    segment->slots = LIVE_SLOTS;
+    segment->bytes = sizeof(LiveSegment);
+    segment->pid = getpid();
+    segment->interval_ms = interval_ms;
+    segment->log2_block_size = log2_block_size;
+    segment->log2_l1_size = log2_l1_size;
+    segment->log2_l2_size = log2_l2_size;
+    segment->log2_llc_size = log2_llc_size;
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(segment->magic, LIVE_MAGIC, 8);
+    return true;
+}
+
+VOID LivePublisher::publish(const LiveSnapshot &snapshot)
+{
+    if (!segment)
+        return;
+    UINT64 n = segment->published.load(std::memory_order_relaxed);
+    LiveSlot &slot = segment->slot[n % LIVE_SLOTS];
+
+    UINT64 sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.snapshot = snapshot;
+    slot.snapshot.number = n + 1;
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    segment->published.store(n + 1, std::memory_order_release);
+}
+
+VOID LivePublisher::close()
+{
+    if (!segment)
+        return;
+    unlink(path.c_str());
+    munmap(segment, sizeof(LiveSegment));
+    segment = NULL;
+}
+
+bool LiveReader::open(const string &name)
+{
+    string path = segment_path(name);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "No live statistics " << path << ", is the run started with -live " << name << "?\n";
+        return false;
+    }
+    off_t bytes = lseek(fd, 0, SEEK_END);
+    VOID *mem = (bytes == (off_t)sizeof(LiveSegment)) ?
+        mmap(NULL, sizeof(LiveSegment), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+
+    const LiveSegment *live = static_cast<const LiveSegment *>(mem);
+    if (mem == MAP_FAILED || memcmp(live->magic, LIVE_MAGIC, 8) != 0 || live->version != LIVE_VERSION) {
+        cerr << path << " is not the live statistics of this version of SPM-Sieve\n";
+        if (mem != MAP_FAILED)
+            munmap(mem, sizeof(LiveSegment));
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    segment = live;
+    return true;
+}
+
+LiveReader::~LiveReader()
+{
+    if (segment)
+        munmap(const_cast<LiveSegment *>(segment), sizeof(LiveSegment));
+}
+
+bool LiveReader::read(UINT64 number, LiveSnapshot &snapshot) const
+{
+    UINT64 published = this->published();
+    if (number == 0 || number > published || number + LIVE_SLOTS <= published)
+        return false;
+
+    const LiveSlot &slot = segment->slot[(number - 1) % LIVE_SLOTS];
+    for (;;) {
+        UINT64 before = slot.sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(&snapshot, &slot.snapshot, sizeof(snapshot));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == before)
+            return snapshot.number == number;
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef _LIVE_STATS_H
+#define _LIVE_STATS_H
+
+// Live statistics of a running analysis for external monitors such as spm-sieve-top (top.cpp).
+// The run publishes a snapshot of the global, per category and top object counters every
+// -live-interval into a ring of LIVE_SLOTS snapshots in the shared memory file /dev/shm/<name>.
+// Every slot is a seqlock: the publisher makes its sequence odd, writes the snapshot and makes
+// it even again; a reader copies the snapshot and keeps it only when the sequence was the same
+// even value before and after. The publisher never waits for a reader.
+//
+// Snapshot n (from 1) is in slot (n - 1) % LIVE_SLOTS, published counts the snapshots written.
+// The file is removed at the end of the run; monitors that are attached keep reading it, the
+// last snapshot has final set.
+
+#include <string>
+#include <atomic>
+
+#include "sieve-port.h"
+#include "object-store.h"
+
+using namespace std;
+
+#define LIVE_VERSION       1
+#define LIVE_MAGIC         "SPMLIVE1"
+#define LIVE_SLOTS         64
+#define LIVE_TOP_OBJECTS   16
+#define LIVE_NAME_BYTES    64
+
+// one of the objects with the most accesses
+struct LiveObject {
+   UINT64 id;
+   UINT64 accesses, writes, l1_misses, l2_misses, llc_misses;
+   char name[LIVE_NAME_BYTES];        // symbol@lib, cut to fit
+};
+
+struct LiveSnapshot {
+   UINT64 number;                     // 1 for the first snapshot of the run
+   UINT64 nanoseconds;                // CLOCK_MONOTONIC when taken
+   UINT64 instructions, accesses, writes;
+   UINT64 l1_misses, l2_misses;       // of the private levels
+   UINT64 llc_misses;                 // of the shared level, at the L1 size for the categories
+   UINT64 objects, threads;
+   UINT64 cat_accesses[OBJ_TYPE_NUM], cat_misses[OBJ_TYPE_NUM];
+   UINT32 final;                      // the last snapshot of the run
+   UINT32 top_objects;
+   LiveObject top[LIVE_TOP_OBJECTS];  // by accesses, descending
+};
+
+struct ALIGN_CACHELINE LiveSlot {
+   std::atomic<UINT64> sequence;      // odd while the snapshot is written
+   LiveSnapshot snapshot;
+};
+
+struct LiveSegment {
+   char magic[8];                     // written last, once the segment is set up
+   UINT32 version, slots;
+   UINT64 bytes;                      // sizeof(LiveSegment) of the publisher
+   UINT64 pid, interval_ms;
+   UINT64 log2_block_size, log2_l1_size, log2_l2_size, log2_llc_size;
+   std::atomic<UINT64> published;
+   LiveSlot slot[LIVE_SLOTS];
+};
+
+// The writing side, owned by the publishing thread of the run
+class LivePublisher {
+   LiveSegment *segment;
+   string path;
+
+public:
+   LivePublisher() : segment(NULL), path() { }
+   ~LivePublisher() { close(); }
+
+   // create /dev/shm/<name> for a run of the given cache configuration; false with a message
+   // when it cannot
+   bool open(const string &name, UINT64 interval_ms, UINT log2_block_size, UINT log2_l1_size,
+             UINT log2_l2_size, UINT log2_llc_size);
+   VOID publish(const LiveSnapshot &snapshot);
+   // remove the file, the mappings of attached readers stay valid
+   VOID close();
+};
+
+// The reading side; any number of readers, they never write the segment
+class LiveReader {
+   const LiveSegment *segment;
+
+public:
+   LiveReader() : segment(NULL) { }
+   ~LiveReader();
+
+   // attach to /dev/shm/<name>; false with a message when it is not a live segment
+   bool open(const string &name);
+   const LiveSegment *header() const { return segment; }
+   UINT64 published() const { return segment->published.load(std::memory_order_acquire); }
+
+   // snapshot number, false when it is not published yet or already overwritten
+   bool read(UINT64 number, LiveSnapshot &snapshot) const;
+};
+
+#endif
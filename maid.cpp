@@ -1,9 +1,22 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <unordered_map>
 #include "pin.H"
 #include "pin_isa.H"
 #include "utility.h"
+#include "symbol-cache.h"
+#include "source-cache.h"
+
+static SymbolCache *Symbols;
+static SourceCache Sources;
+
+static VOID pin_source_location(ADDRINT ip, string &file, INT32 &line)
+{
+    PIN_LockClient();
+    PIN_GetSourceLocation(ip, NULL, &line, &file);
+    PIN_UnlockClient();
+}
 
 // Each stack frame reads as follows:
 // ip in function at source:linenum
@@ -19,25 +32,114 @@ struct StackFrame {
         ip(_ip), function(_ip), function_name(""), filename(""), image(""), linenum(0)
     { }
 
+    // from the symbol tables of the image when it has one, else from Pin
     void fill_dwarf_info()
     {
-        PIN_LockClient();
-        PIN_GetSourceLocation(ip, NULL, &linenum, &filename);
-        image = IMG_Name(IMG_FindByAddress(ip));
-        PIN_UnlockClient();
+        SymbolizedFrame frame;
+        if (Symbols->symbolize(ip, pin_source_location, frame)) {
+            image = frame.image;
+            function_name = frame.routine;
+            filename = frame.file;
+            linenum = frame.line;
+        }
+        else {
+            pin_source_location(ip, filename, linenum);
+            PIN_LockClient();
+            image = IMG_Name(IMG_FindByAddress(ip));
+            PIN_UnlockClient();
+            function_name = "";
+        }
 
         if(filename =="") {
             filename = "UNKNOWN";
             linenum = 0;
         }
 
-        function_name = RTN_FindNameByAddress(ip);
+        if (function_name == "")
+            function_name = RTN_FindNameByAddress(ip);
         if (function_name == "")
             function_name = "[Unknown Routine]";
     }
 };
 
-vector<StackFrame> callstack;
+// The shadow call stack of a thread: the (ip, sp) of its frames, sp being where the return
+// address of the frame is. Frames that returned without a matching ret (longjmp, an exception
+// unwinding, a tail call returning for its caller) are found by the stack pointer of the next
+// call or ret: a frame whose return address is below it is gone. The frames are a ring of a
+// fixed depth that keeps the innermost ones; a call or ret never allocates.
+#define SHADOW_STACK_DEPTH 256
+
+struct ShadowFrame {
+    ADDRINT ip;             // the call site in the frame, its entry until it calls
+    ADDRINT sp;
+};
+
+struct ShadowStack {
+    ShadowFrame frames[SHADOW_STACK_DEPTH];
+    UINT32 base, depth;     // the outermost frame kept and the frames kept
+    UINT64 dropped;         // outer frames overwritten by deeper ones
+
+    ShadowStack() : base(0), depth(0), dropped(0) { }
+
+    ShadowFrame &frame(UINT32 i) { return frames[(base + i) % SHADOW_STACK_DEPTH]; }
+    ShadowFrame &top() { return frame(depth - 1); }
+
+    VOID push(ADDRINT ip, ADDRINT sp)
+    {
+        if (depth == SHADOW_STACK_DEPTH) {
+            base = (base + 1) % SHADOW_STACK_DEPTH;
+            depth--;
+            dropped++;
+        }
+        depth++;
+        top().ip = ip;
+        top().sp = sp;
+    }
+
+    // drop the frames whose return address is below sp; with ret also the one at sp, it returns
+    VOID unwind(ADDRINT sp, bool ret)
+    {
+        while (depth && (top().sp < sp || (ret && top().sp == sp)))
+            depth--;
+    }
+};
+
+// Every thread has its own call stack, reached through this TLS key
+static TLS_KEY callstack_key;
+static PIN_LOCK callstacks_lock;
+static vector<ShadowStack *> callstacks;
+
+static ShadowStack &get_callstack(THREADID tid)
+{
+    return *static_cast<ShadowStack *>(PIN_GetThreadData(callstack_key, tid));
+}
+
+static VOID MAID_ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    ShadowStack *callstack = new ShadowStack();
+    PIN_SetThreadData(callstack_key, callstack, tid);
+    PIN_GetLock(&callstacks_lock, tid + 1);
+    callstacks.push_back(callstack);
+    PIN_ReleaseLock(&callstacks_lock);
+}
+
+UINT64 MAID_dropped_frames()
+{
+    UINT64 dropped = 0;
+    PIN_GetLock(&callstacks_lock, 1);
+    for (auto callstack : callstacks)
+        dropped += callstack->dropped;
+    PIN_ReleaseLock(&callstacks_lock);
+    return dropped;
+}
+
+void MAID_Init(SymbolCache *symbols)
+{
+    Symbols = symbols;
+    PIN_InitLock(&callstacks_lock);
+    callstack_key = PIN_ClaimTlsKey();
+    PIN_AddThreadStartFunction(MAID_ThreadStart, 0);
+}
 
 ///////////////////////// Analysis Functions //////////////////////////////////
 
@@ -82,65 +184,114 @@ string find_symbol(string line)
 // return the line at a specific line number from a file
 string return_source_line(string filename, int lineno)
 {
-    string line;
-    int counter = 0;
-    ifstream fin (filename.c_str());
-    if (lineno == 0) return "";
+    return strip(Sources.line(filename, lineno));
+}
+
+// Distinct allocation call stacks, MAID runs under objects_lock. A stack is a run of ips in
+// stack_frames, innermost first; its frames are symbolized once, not at every allocation
+struct CapturedStack {
+    UINT64 hash;
+    UINT32 first, depth;
+    UINT64 allocations;
+    bool named;
+    string symbol;          // see MAID_get_array_symbol()
+};
+
+static vector<ADDRINT> stack_frames, capture;
+static vector<CapturedStack> stacks;
+static unordered_multimap<UINT64, UINT32> stack_ids;
+
+static UINT64 hash_stack(const vector<ADDRINT> &ips)
+{
+    UINT64 hash = 0xcbf29ce484222325ULL;
+    for (auto ip : ips) {
+        hash = (hash ^ ip) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+UINT32 MAID_capture_stack(THREADID tid)
+{
+    ShadowStack &callstack = get_callstack(tid);
+    capture.clear();
+    for (UINT32 f = callstack.depth; f > 0; f--)
+        capture.push_back(callstack.frame(f - 1).ip);
 
-    while(fin.good()) {
-        getline(fin, line);
-        ++counter;
-        if(counter == lineno)
-            return strip(line);
+    UINT64 hash = hash_stack(capture);
+    auto range = stack_ids.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        CapturedStack &stack = stacks[it->second];
+        if (stack.depth == capture.size() && equal(capture.begin(), capture.end(), stack_frames.begin() + stack.first)) {
+            stack.allocations++;
+            return it->second;
+        }
     }
-    return "";
+
+    UINT32 id = stacks.size();
+    stacks.push_back(CapturedStack{hash, (UINT32)stack_frames.size(), (UINT32)capture.size(), 1, false, ""});
+    stack_frames.insert(stack_frames.end(), capture.begin(), capture.end());
+    stack_ids.insert(make_pair(hash, id));
+    return id;
 }
 
 // return array symbol @ imagename being allocated memory in the call stack below malloc
-string MAID_get_array_symbol()
+string MAID_get_array_symbol(UINT32 id)
 {
-    for( auto it = callstack.rbegin(); it < callstack.rend(); ++it) {
+    CapturedStack &stack = stacks[id];
+    if (stack.named)
+        return stack.symbol;
+    stack.named = true;
 
-        it->fill_dwarf_info();
+    for (UINT32 f = 0; f < stack.depth; f++) {
+        StackFrame frame(stack_frames[stack.first + f]);
+        frame.fill_dwarf_info();
 
-        string line = return_source_line(it->filename, it->linenum);
-        if (source_line_has_array_assignment(line))
+        string line = return_source_line(frame.filename, frame.linenum);
+        if (source_line_has_array_assignment(line)) {
             // symbol and the imagename at that frame
-            return find_symbol(line) + " @ " + StripPath(it->image);
+            stack.symbol = find_symbol(line) + " @ " + StripPath(frame.image);
+            break;
+        }
     }
-    return "";
+    return stack.symbol;
 }
 
-void MAID_print_callstack(ostream &outf)
+void MAID_print_stacks(ostream &outf)
 {
-    for( auto it = callstack.rbegin(); it < callstack.rend(); ++it) {
+    for (UINT32 id = 0; id < stacks.size(); id++) {
+        CapturedStack &stack = stacks[id];
+        outf << "STACK_" << id << " allocations=" << stack.allocations << endl;
+        for (UINT32 f = 0; f < stack.depth; f++) {
+            StackFrame frame(stack_frames[stack.first + f]);
+            frame.fill_dwarf_info();
 
-        it->fill_dwarf_info();
-
-        outf << (void*) it->ip << " in " << it->function_name << "(" << StripPath(it->image) << ")" 
-            << " at " <<  it->filename << ":" << it->linenum << " SRC: "
-            << return_source_line(it->filename, it->linenum) << endl;
-            //<< get_source_string_from_ip(it->ip) << endl;
+            outf << (void*) frame.ip << " in " << frame.function_name << "(" << StripPath(frame.image) << ")"
+                << " at " <<  frame.filename << ":" << frame.linenum << " SRC: "
+                << return_source_line(frame.filename, frame.linenum) << endl;
+        }
+        outf << "END_STACK" << endl;
     }
 }
 
-void A_ProcessCall(ADDRINT ip, ADDRINT target, ADDRINT sp, string func_name)
+// sp is the one of the call, the callee's return address goes right below it
+void A_ProcessCall(ADDRINT ip, ADDRINT target, ADDRINT sp, THREADID tid)
 {
+    ShadowStack &callstack = get_callstack(tid);
+    callstack.unwind(sp, false);
+
     // Update the ip of the caller
-    if(callstack.size())
-        callstack.back().ip = ip;
+    if(callstack.depth)
+        callstack.top().ip = ip;
 
     // Push the callee on the stack with its starting address as the ip
-    callstack.push_back(StackFrame(target));
-    
-    //cout << "Called " << Target2RtnName(target) << endl;
+    callstack.push(target, sp - sizeof(ADDRINT));
 }
 
-void A_ProcessReturn(ADDRINT ip, ADDRINT target, ADDRINT sp)
+// sp points at the return address
+void A_ProcessReturn(ADDRINT ip, ADDRINT sp, THREADID tid)
 {
-    // pop the call stack
-    callstack.pop_back();
-    //cout << "Return" << endl;
+    get_callstack(tid).unwind(sp, true);
 }
 
 ///////////////////////// Instrumentation functions ///////////////////////////
@@ -169,6 +320,7 @@ MAID_Instrument_calls(TRACE trace, INS tail)
                 IARG_INST_PTR,
                 IARG_BRANCH_TARGET_ADDR,
                 IARG_REG_VALUE, REG_STACK_PTR,
+                IARG_THREAD_ID,
                 IARG_END);
     }
 
@@ -177,6 +329,7 @@ MAID_Instrument_calls(TRACE trace, INS tail)
                 (AFUNPTR)A_ProcessReturn,
                 IARG_INST_PTR,
                 IARG_REG_VALUE, REG_STACK_PTR,
+                IARG_THREAD_ID,
                 IARG_END);
     }
 }
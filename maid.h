@@ -1,9 +1,22 @@
 #ifndef _MAID_H_
 #define _MAID_H_
 
-string MAID_get_array_symbol();
+class SymbolCache;
 
-void MAID_print_callstack(ostream& outf);
+// frames are symbolized through symbols, see symbol-cache.h
+void MAID_Init(SymbolCache *symbols);
+
+// id of the current call stack of tid in the table of distinct stacks, added when new
+UINT32 MAID_capture_stack(THREADID tid);
+
+// array symbol @ imagename assigned the allocation of stack, worked out once per stack
+string MAID_get_array_symbol(UINT32 stack);
+
+// every distinct stack with its frames symbolized
+void MAID_print_stacks(ostream& outf);
+
+// outer frames the shadow stacks of all threads lost to their fixed depth
+UINT64 MAID_dropped_frames();
 
 void MAID_Instrument_calls(TRACE trace, INS tail);
 
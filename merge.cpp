@@ -0,0 +1,130 @@
+/*
+ * spm-sieve-merge: merges the profiles (-profile) of many runs into one, and prints its
+ * report in the layout of a single run's.
+ *
+ *   spm-sieve-merge [options] profile...
+ *
+ * Objects of different runs are matched by their allocation site (profile.h), so the same
+ * binary under different inputs or address space layouts sums per allocating call. Every
+ * count adds, so merged profiles merge again: -profile writes the merged profile.
+ */
+
+#include <time.h>
+#include "sieve-core.h"
+#include "profile.h"
+
+// the instruction count seen by the analysis core, see sieve-port.h
+UINT64 replay_icount;
+
+INT32 Usage()
+{
+    cerr << "Usage: spm-sieve-merge [options] profile...\n"
+        "Merges SPM-Sieve profiles written with -profile, matching objects by allocation site\n\n"
+        "  -o <file>                output file name [spm-sieve-merge.out]\n"
+        "  -profile <file>          write the merged profile\n"
+        "  -list <file>             merge the profiles named in file too, one per line\n"
+        "  -display-all-obj <0|1>   display detailed stats for all objects [0]\n";
+    return -1;
+}
+
+static const char *option_value(int argc, char *argv[], int i)
+{
+    if (i + 1 >= argc) {
+        cerr << "Missing value for " << argv[i] << endl;
+        exit(Usage());
+    }
+    return argv[i + 1];
+}
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[])
+{
+    vector<string> files;
+    output_prefix = "spm-sieve-merge.out";
+
+    for (int i = 1; i < argc; i++) {
+        string option = argv[i];
+        if (option[0] != '-') {
+            files.push_back(option);
+            continue;
+        }
+
+        const char *value = option_value(argc, argv, i++);
+        if (option == "-o") output_prefix = value;
+        else if (option == "-profile") profile_file = value;
+        else if (option == "-display-all-obj") display_all_objects = atoi(value);
+        else if (option == "-list") {
+            ifstream list(value);
+            if (!list) {
+                cerr << "Unable to open " << value << endl;
+                return -1;
+            }
+            string file;
+            while (getline(list, file))
+                if (!file.empty())
+                    files.push_back(file);
+        }
+        else {
+            cerr << "Unknown option " << option << endl;
+            return Usage();
+        }
+    }
+    if (files.empty())
+        return Usage();
+
+    double start = now_seconds();
+    Profile merged, profile;
+    vector<UINT8> buffer;
+    UINT64 bytes = 0;
+    for (auto &file : files) {
+        if (!read_profile(file, profile, buffer))
+            return -1;
+        if (merged.runs && !merged.same_configuration(profile)) {
+            cerr << "Profile " << file << " was taken with another configuration (block, cache sizes, -rd, -sets, "
+                    "-demark-large-obj) than " << files.front() << endl;
+            return -1;
+        }
+        merged.merge(profile);
+        bytes += buffer.size();
+    }
+    double seconds = now_seconds() - start;
+
+    if (!profile_file.empty() && !write_profile(profile_file, merged)) {
+        cerr << "Unable to write profile " << profile_file << endl;
+        return -1;
+    }
+
+    // the report of one run, with the merged configuration
+    LOG2_CACHE_BLOCK_SIZE = merged.log2_block_size;
+    LOG2_L1_SIZE = merged.log2_l1_size;
+    LOG2_L2_SIZE = merged.log2_l2_size;
+    LOG2_LLC_SIZE = merged.log2_llc_size;
+    demarcate_large_objects = merged.demarcate_large_objects;
+
+    OutFile.open(output_prefix.c_str());
+    OutFile << "MERGE_PROFILES : " << files.size() << endl;
+    OutFile << "MERGE_RUNS : " << merged.runs << endl;
+    OutFile << "MERGE_SITES : " << merged.objects.size() << endl;
+    OutFile << "MERGE_SECONDS : " << seconds << endl;
+    OutFile << "MERGE_PROFILES_PER_S : " << (UINT64)(files.size() / MAX(seconds, 1e-9)) << endl;
+    OutFile << "MERGE_MB_PER_S : " << bytes / MAX(seconds, 1e-9) / 1e6 << endl;
+    OutFile << "Cache Line Size : " << (1 << LOG2_CACHE_BLOCK_SIZE) << endl;
+    OutFile << "L1 Cache Size : " << (1ULL << LOG2_L1_SIZE) << endl;
+    OutFile << "L2 Cache Size : " << (1ULL << LOG2_L2_SIZE) << endl;
+    OutFile << "Shared LLC Size : " << (1ULL << LOG2_LLC_SIZE) << endl;
+    if (!merged.global_rd.empty())
+        Display_Global_RD_Distribution(OutFile, merged, LOG2_L1_SIZE, LOG2_L2_SIZE);
+    else
+        OutFile << "The profiles have no RD histograms (-rd 0)\n";
+    OutFile.close();
+
+    ofstream objects((output_prefix + "-object-profile.csv").c_str());
+    print_profile_sites(objects, merged);
+    return 0;
+}
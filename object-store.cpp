@@ -0,0 +1,322 @@
+//
+//  Storage for the per object state: the compact object index entries,
+//  the cold metadata and the structure-of-arrays hot counters.
+//
+
+#include <iostream>
+#include <string>
+#include <assert.h>
+using namespace std;
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "sieve-port.h"
+#include "object-store.h"
+#include "checkpoint.h"
+
+const char *AllocTypeName[ALLOC_TYPE_NUM] = {
+   "default",
+   "stack",
+   "malloc",
+   "calloc",
+   "posix_memalign",
+   "static",
+   "heap_scan",
+   "realloc",
+   "aligned_alloc",
+   "new",
+   "mmap"
+};
+
+// round a column of n UINT64 entries up to a whole number of cache lines
+static UINT64 column_bytes(UINT64 n)
+{
+   UINT64 bytes = n * sizeof(UINT64);
+   return (bytes + CACHE_LINE_BYTES - 1) & ~((UINT64)CACHE_LINE_BYTES - 1);
+}
+
+static UINT64 *alloc_column(UINT64 n)
+{
+   VOID *mem = NULL;
+   UINT64 bytes = column_bytes(n);
+   if(posix_memalign(&mem, CACHE_LINE_BYTES, bytes) != 0) {
+      cerr << "Unable to allocate " << bytes << " bytes for object counters\n";
+      exit(1);
+   }
+   memset(mem, 0, bytes);
+   return (UINT64 *)mem;
+}
+
+VOID *CacheLineAligned::operator new(size_t bytes)
+{
+   VOID *mem = NULL;
+   if(posix_memalign(&mem, CACHE_LINE_BYTES, bytes) != 0) {
+      cerr << "Unable to allocate " << bytes << " cache line aligned bytes\n";
+      exit(1);
+   }
+   return mem;
+}
+
+VOID CacheLineAligned::operator delete(VOID *mem)
+{
+   free(mem);
+}
+
+ObjectCounters::ObjectCounters(UINT initial) : capacity(0),
+   accesses(NULL), writes(NULL), first_access(NULL), last_access(NULL),
+   l1_misses(NULL), l2_misses(NULL), llc_misses(NULL), reuseDistance(NULL)
+{
+   resize(initial);
+}
+
+ObjectCounters::~ObjectCounters()
+{
+   free(accesses);
+   free(writes);
+   free(first_access);
+   free(last_access);
+   free(l1_misses);
+   free(l2_misses);
+   free(llc_misses);
+   free(reuseDistance);
+}
+
+VOID ObjectCounters::grow(UINT64 *&column, UINT old_entries, UINT new_entries)
+{
+   UINT64 *tmp = alloc_column(new_entries);
+   if(column) {
+      memcpy(tmp, column, old_entries * sizeof(UINT64));
+      free(column);
+   }
+   column = tmp;
+}
+
+VOID ObjectCounters::resize(UINT n)
+{
+   // grow geometrically so that adding objects one by one stays amortized O(1)
+   UINT new_capacity = (capacity == 0) ? 1 : capacity;
+   while(new_capacity < n)
+      new_capacity *= 2;
+   if(new_capacity == capacity)
+      return;
+
+   grow(accesses, capacity, new_capacity);
+   grow(writes, capacity, new_capacity);
+   grow(first_access, capacity, new_capacity);
+   grow(last_access, capacity, new_capacity);
+   grow(l1_misses, capacity, new_capacity);
+   grow(l2_misses, capacity, new_capacity);
+   grow(llc_misses, capacity, new_capacity);
+   grow(reuseDistance, capacity * MAX_RD_BUCKETS, new_capacity * MAX_RD_BUCKETS);
+
+   capacity = new_capacity;
+}
+
+VOID ObjectCounters::clear()
+{
+   UINT64 *columns[] = { accesses, writes, first_access, last_access, l1_misses, l2_misses, llc_misses };
+   for(UINT c = 0; c < sizeof(columns) / sizeof(columns[0]); c++)
+      memset(columns[c], 0, capacity * sizeof(UINT64));
+   memset(reuseDistance, 0, (UINT64)capacity * MAX_RD_BUCKETS * sizeof(UINT64));
+}
+
+VOID ObjectCounters::merge(const ObjectCounters &other)
+{
+   reserve(other.capacity);
+
+   for(UINT id = 0; id < other.capacity; id++) {
+      if(other.first_access[id] && (first_access[id] == 0 || other.first_access[id] < first_access[id]))
+         first_access[id] = other.first_access[id];
+      if(other.last_access[id] > last_access[id])
+         last_access[id] = other.last_access[id];
+      accesses[id] += other.accesses[id];
+      writes[id] += other.writes[id];
+      l1_misses[id] += other.l1_misses[id];
+      l2_misses[id] += other.l2_misses[id];
+      llc_misses[id] += other.llc_misses[id];
+   }
+
+   for(UINT64 i = 0; i < (UINT64)other.capacity * MAX_RD_BUCKETS; i++)
+      reuseDistance[i] += other.reuseDistance[i];
+}
+
+VOID ObjectCounters::Save(CheckpointWriter &out, UINT n) const
+{
+   n = MIN(n, capacity);
+   out.u64(n);
+   const UINT64 *columns[] = { accesses, writes, first_access, last_access, l1_misses, l2_misses, llc_misses };
+   for(UINT c = 0; c < sizeof(columns) / sizeof(columns[0]); c++)
+      for(UINT id = 0; id < n; id++)
+         out.u64(columns[c][id]);
+   for(UINT64 i = 0; i < (UINT64)n * MAX_RD_BUCKETS; i++)
+      out.u64(reuseDistance[i]);
+}
+
+bool ObjectCounters::Load(CheckpointReader &in)
+{
+   UINT n = in.u64();
+   reserve(n);
+   UINT64 *columns[] = { accesses, writes, first_access, last_access, l1_misses, l2_misses, llc_misses };
+   for(UINT c = 0; c < sizeof(columns) / sizeof(columns[0]); c++)
+      for(UINT id = 0; id < n; id++)
+         columns[c][id] = in.u64();
+   for(UINT64 i = 0; i < (UINT64)n * MAX_RD_BUCKETS; i++)
+      reuseDistance[i] = in.u64();
+   return in.ok();
+}
+
+/***********************************************************************
+ *
+ * Description of ObjectIndex::find()
+ * 
+ * Given the addr of a memory reference find() returns the matching array 
+ * or the default bucket in case the addr does not belong to one of the known objects.
+ *
+ * This is essentially an interval search, where the start and end of an object are its interval.
+ * The vectors of a version (base and added) are sorted on the start address in ascending order.
+ * They contain only active objects so they have non-overlapping ranges; a base object whose start
+ * is in removed is gone, an object added since may take its place, so added is searched first.
+ * The first element of the base is a default bucket to capture addresses 
+ * which dont fall into any known object. It has a start address of zero and a null range.
+ *
+ * In one vector the input memory addr can be in one of the following cases:
+ * 1. before the start address of the first object (lowest start addr) - no match
+ * 2. between two object intervals - no match
+ * 3. after the last object's interval - no match
+ * 4. in the middle of an object's interval - the object
+ * 5. the start of an object - the object
+ *
+ * We use upper_bound() to search the sorted vector for the first object starting after addr,
+ * the one before it is the only one that can hold addr (cases 2 to 5); there is none for case 1
+ *
+ **********************************************************************/
+
+static const ObjectInstance *containing(const vector<ObjectInstance> &objects, ADDRINT addr)
+{
+    auto it = std::upper_bound(objects.begin(), objects.end(), addr,
+                               [](ADDRINT a, const ObjectInstance &o) { return a < o.start; });
+    if (it == objects.begin())
+        return NULL;
+    --it;
+    return addr < it->end ? &*it : NULL;
+}
+
+static vector<ObjectInstance>::const_iterator first_from(const vector<ObjectInstance> &objects, ADDRINT start)
+{
+    return std::lower_bound(objects.begin(), objects.end(), ObjectInstance(start, 0, 0), compare_start_address);
+}
+
+const ObjectInstance *ObjectIndex::find(ADDRINT addr) const
+{
+    const ObjectInstance *object;
+    if (!added.empty() && (object = containing(added, addr)))
+        return object;
+    object = containing(*base, addr);
+    if (object && in_base(object))
+        return object;
+    return default_bucket();
+}
+
+const ObjectInstance *ObjectIndex::find_start(ADDRINT start) const
+{
+    auto it = first_from(added, start);
+    if (it != added.end() && it->start == start)
+        return &*it;
+    it = first_from(*base, start);
+    if (it != base->end() && it->start == start && in_base(&*it))
+        return &*it;
+    return NULL;
+}
+
+VOID ObjectIndex::range(ADDRINT low, ADDRINT high, vector<ObjectInstance> &objects) const
+{
+    objects.clear();
+    auto b = first_from(*base, low), b_end = first_from(*base, high);
+    auto a = first_from(added, low), a_end = first_from(added, high);
+    while (b != b_end || a != a_end) {
+        if (b == b_end || (a != a_end && a->start < b->start))
+            objects.push_back(*a++);
+        else if (in_base(&*b))
+            objects.push_back(*b++);
+        else
+            b++;
+    }
+}
+
+VOID ObjectIndex::insert(const ObjectInstance &object)
+{
+    added.insert(first_from(added, object.start), object);
+}
+
+VOID ObjectIndex::erase(ADDRINT start)
+{
+    auto it = first_from(added, start);
+    if (it != added.end() && it->start == start) {
+        added.erase(it);
+        return;
+    }
+    removed.insert(std::lower_bound(removed.begin(), removed.end(), start), start);
+}
+
+VOID ObjectIndex::assign(vector<ObjectInstance> &objects)
+{
+    vector<ObjectInstance> *next = new vector<ObjectInstance>();
+    next->swap(objects);
+    base.reset(next);
+    added.clear();
+    removed.clear();
+    fold_limit = MAX((UINT64)INDEX_DELTA_MIN, (UINT64)sqrt((double)next->size()));
+}
+
+VOID ObjectIndex::fold()
+{
+    vector<ObjectInstance> objects;
+    objects.reserve(size());
+    get(objects);
+    assign(objects);
+}
+
+RCUObjectIndex::RCUObjectIndex() : current(new ObjectIndex()), epoch(1), retired(), readers()
+{
+}
+
+VOID RCUObjectIndex::add_reader(ObjectIndexReader *reader)
+{
+   readers.push_back(reader);
+}
+
+VOID RCUObjectIndex::remove_reader(ObjectIndexReader *reader)
+{
+   readers.erase(std::remove(readers.begin(), readers.end(), reader), readers.end());
+   reclaim();
+}
+
+VOID RCUObjectIndex::publish(ObjectIndex *next)
+{
+   if(next->needs_fold())
+      next->fold();
+   ObjectIndex *old = current.exchange(next, std::memory_order_seq_cst);
+   old->retired_epoch = epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+   retired.push_back(old);
+   reclaim();
+}
+
+// free every retired version that no reader can still hold
+VOID RCUObjectIndex::reclaim()
+{
+   // a quiescent reader holds none, its READER_QUIESCENT never lowers the bound
+   UINT64 oldest = epoch.load(std::memory_order_seq_cst);
+   for(UINT r = 0; r < readers.size(); r++)
+      oldest = MIN(oldest, readers[r]->epoch.load(std::memory_order_seq_cst));
+
+   UINT kept = 0;
+   for(UINT i = 0; i < retired.size(); i++) {
+      if(retired[i]->retired_epoch <= oldest)
+         delete retired[i];
+      else
+         retired[kept++] = retired[i];
+   }
+   retired.resize(kept);
+}
@@ -0,0 +1,281 @@
+#ifndef _OBJECT_STORE_H
+#define _OBJECT_STORE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "RD.h"
+
+using namespace std;
+
+class CheckpointWriter;
+class CheckpointReader;
+
+#define CACHE_LINE_BYTES 64
+
+#if defined(__GNUC__)
+#  define ALIGN_CACHELINE __attribute__ ((aligned(CACHE_LINE_BYTES)))
+#else
+#  define ALIGN_CACHELINE __declspec(align(CACHE_LINE_BYTES))
+#endif
+
+// Heap allocated classes that must start on their own cache line derive from this;
+// plain new does not honour the alignment before C++17
+class CacheLineAligned {
+public:
+   static VOID *operator new(size_t bytes);
+   static VOID operator delete(VOID *mem);
+};
+
+// How an object came into existence; replaces the old "malloc"/"static"/... strings
+enum OBJ_ALLOC_TYPE {
+   ALLOC_DEFAULT,          // bucket for unidentified/small blocks
+   ALLOC_STACK,            // bucket for stack accesses
+   ALLOC_MALLOC,
+   ALLOC_CALLOC,
+   ALLOC_POSIX_MEMALIGN,
+   ALLOC_STATIC,           // static objects found in the binary
+   ALLOC_HEAP_SCAN,        // live before the tool attached, found in the heap, see heap-scan.h
+   ALLOC_REALLOC,
+   ALLOC_ALIGNED_ALLOC,    // aligned_alloc and memalign
+   ALLOC_NEW,              // operator new and new[], all variants
+   ALLOC_MMAP,
+   ALLOC_TYPE_NUM
+};
+
+// printable name of each allocation type, used in the reports
+extern const char *AllocTypeName[ALLOC_TYPE_NUM];
+
+inline bool is_static_alloc(OBJ_ALLOC_TYPE type) { return type == ALLOC_STATIC; }
+
+// OBJECT CATEGORY DEFINITION
+enum OBJ_TYPE {
+   LARGE_STATIC,	// CLASS-AL
+   SMALL_STATIC,	// CLASS-SS
+   LARGE_DYNAMIC,	// CLASS-AL
+   SMALL_DYNAMIC,	// CLASS-SD
+   OBJ_STACK,
+   OBJ_TYPE_NUM
+};
+
+// ObjectInstance is the compact interval entry kept in the (start address sorted) object index.
+// Access counters live in ObjectCounters and cold data in ObjectMetadata, both indexed by id,
+// so moving an object between the live and freed lists only copies these few words.
+class ObjectInstance {
+    public:
+
+        ADDRINT start; //starting address of the malloced block
+        ADDRINT end;
+        ADDRINT size; // size of the malloc
+        ADDRINT callsiteIP; // IP of the call site
+        UINT32 id; // unique ID for each block
+        OBJ_ALLOC_TYPE type; // allocating call, static or heap_scan
+        OBJ_TYPE category; // category the accesses are attributed to, fixed at allocation
+        bool valid; // set to false once the block is freed
+
+        ObjectInstance(ADDRINT _start, ADDRINT _size, ADDRINT _callsiteIP, UINT32 _id = 0,
+                OBJ_ALLOC_TYPE _type = ALLOC_MALLOC, OBJ_TYPE _category = SMALL_DYNAMIC):
+            start(_start), end(_start + _size), size(_size), callsiteIP(_callsiteIP),
+            id(_id), type(_type), category(_category), valid(true)
+            { }
+};
+
+// compare two malloc objects entry based on their starting address
+inline bool compare_start_address(const ObjectInstance & lhs, const ObjectInstance & rhs)
+{
+    return lhs.start < rhs.start;
+}
+
+// minimum number of inserts and removals a version of the index collects before they are folded
+#define INDEX_DELTA_MIN 64
+
+// One immutable version of the set of live objects, sorted on start address.
+// A version is a base shared with the versions before it, the objects inserted since the base
+// was built and the starts of the base objects removed since, so a writer copies only the
+// latter two for one allocation or free. Once they outgrow the square root of the base (at
+// least INDEX_DELTA_MIN) they are folded into a new base, the one full copy.
+// The first two entries of the base are the default bucket (start 0) and the stack bucket (start 1).
+class ObjectIndex {
+   shared_ptr<const vector<ObjectInstance> > base;
+   vector<ObjectInstance> added;   // sorted on start
+   vector<ADDRINT> removed;        // sorted starts of freed base objects
+   UINT64 fold_limit;
+
+   bool in_base(const ObjectInstance *object) const
+   {
+      return removed.empty() || !std::binary_search(removed.begin(), removed.end(), object->start);
+   }
+
+public:
+   UINT64 retired_epoch;           // epoch at which a newer version replaced this one
+
+   ObjectIndex() : base(new vector<ObjectInstance>()), added(), removed(), fold_limit(INDEX_DELTA_MIN), retired_epoch(0) { }
+
+   const ObjectInstance *default_bucket() const { return &(*base)[0]; }
+   const ObjectInstance *stack_bucket() const { return &(*base)[1]; }
+
+   UINT64 size() const { return base->size() - removed.size() + added.size(); }
+
+   // the object addr falls in, the default bucket if none
+   const ObjectInstance *find(ADDRINT addr) const;
+   // the object starting at start, NULL if none
+   const ObjectInstance *find_start(ADDRINT start) const;
+   // the objects starting in [low, high) in address order
+   VOID range(ADDRINT low, ADDRINT high, vector<ObjectInstance> &objects) const;
+   // all of them
+   VOID get(vector<ObjectInstance> &objects) const { range(0, (ADDRINT)-1, objects); }
+
+   // the below are for the writer on its private copy
+   // no live object may start at the start of object
+   VOID insert(const ObjectInstance &object);
+   // start must be the start of a live object
+   VOID erase(ADDRINT start);
+   // replace the content by objects, sorted on start, emptied
+   VOID assign(vector<ObjectInstance> &objects);
+
+   bool needs_fold() const { return added.size() + removed.size() > fold_limit; }
+   VOID fold();
+};
+
+// epoch of a reader holding no version, e.g. a thread blocked in a system call
+#define READER_QUIESCENT (~0ULL)
+
+// Per reader thread slot of the RCU index, on its own cache line.
+// epoch is the last index epoch the reader observed; it only uses the index it cached then.
+// A reader starts quiescent and reads the current version on its first lookup.
+struct ALIGN_CACHELINE ObjectIndexReader {
+   std::atomic<UINT64> epoch;
+   const ObjectIndex *index;
+
+   ObjectIndexReader() : epoch(READER_QUIESCENT), index(NULL) { }
+};
+
+// Read-mostly object index shared by all threads.
+// Lookups never lock: a reader keeps using the version it cached until the global epoch moves.
+// Writers (allocation hooks) serialize on their own lock, publish a modified copy (see ObjectIndex
+// for what it costs), bump the epoch and free old versions once every reader has observed a newer epoch.
+class RCUObjectIndex {
+   std::atomic<ObjectIndex *> current;
+   std::atomic<UINT64> epoch;
+   vector<ObjectIndex *> retired;
+   vector<ObjectIndexReader *> readers;
+
+   VOID reclaim();
+
+public:
+   RCUObjectIndex();
+
+   // lock free lookup of the current version for the calling reader
+   const ObjectIndex *read(ObjectIndexReader *reader)
+   {
+      UINT64 e = epoch.load(std::memory_order_acquire);
+      if(e != reader->epoch.load(std::memory_order_relaxed)) {
+         // announce before loading, so a writer never frees a version we may still pick up
+         reader->epoch.store(e, std::memory_order_seq_cst);
+         reader->index = current.load(std::memory_order_seq_cst);
+      }
+      return reader->index;
+   }
+
+   // the calling reader drops its version until its next lookup, so it holds back no reclaim
+   // while it does not look up (blocked in a system call, say)
+   VOID quiesce(ObjectIndexReader *reader)
+   {
+      reader->index = NULL;
+      reader->epoch.store(READER_QUIESCENT, std::memory_order_seq_cst);
+   }
+
+   // all the below need the caller to serialize writers
+   VOID add_reader(ObjectIndexReader *reader);
+   VOID remove_reader(ObjectIndexReader *reader);
+
+   // current version as seen by the writer
+   ObjectIndex *get() { return current.load(std::memory_order_relaxed); }
+
+   // private copy of the current version for the writer to modify
+   ObjectIndex *copy() { return new ObjectIndex(*get()); }
+
+   // make next the current version, folded if due, and retire the old one
+   VOID publish(ObjectIndex *next);
+};
+
+// Rarely touched per object data; only read while reporting
+#define NO_STACK ((UINT32)-1)
+
+class ObjectMetadata {
+    public:
+        string image_name; // Image name, could be extended further to include most accessing function
+        string source; // Source location of malloc call
+        UINT64 tsc_malloc, tsc_free; // instruction count at malloc and free calls, rather then first usage
+        UINT32 stack_id; // allocation call stack in the MAID stack table, NO_STACK without
+
+#ifdef OBJECT_ALLOC_HISTOGRAM
+        /***** Access Distribution ********/
+        string firstLoc;
+        string lastLoc;
+        map<string, UINT64> accHist;
+        /**********************************/
+#endif
+
+        ObjectMetadata(): image_name("libdummy"), source("dummy.c:123"), tsc_malloc(0), tsc_free(0), stack_id(NO_STACK)
+#ifdef OBJECT_ALLOC_HISTOGRAM
+            , firstLoc(), lastLoc(), accHist()
+#endif
+            { }
+};
+
+// Structure-of-arrays store of the hot per object counters, indexed by object id.
+// Every column starts on its own cache line and is padded to a whole number of lines,
+// so one instance per thread can be updated without false sharing.
+// The reuse distance histograms of all objects are one contiguous block of
+// MAX_RD_BUCKETS entries per object.
+class ALIGN_CACHELINE ObjectCounters : public CacheLineAligned {
+   UINT capacity;           // number of object ids with storage
+
+   VOID grow(UINT64 *&column, UINT old_entries, UINT new_entries);
+
+public:
+   UINT64 *accesses;        // counts the accesses to the object
+   UINT64 *writes;          // how many accesses were writes
+   UINT64 *first_access;    // timestamp for first access of the object, 0 if never accessed
+   UINT64 *last_access;     // timestamp for last access of the object
+   UINT64 *l1_misses;       // RD based fully associative private cache misses
+   UINT64 *l2_misses;
+   UINT64 *llc_misses;      // RD based fully associative shared cache misses
+   UINT64 *reuseDistance;   // capacity * MAX_RD_BUCKETS histogram entries
+
+   ObjectCounters(UINT initial = 1024);
+   ~ObjectCounters();
+
+   // make sure ids [0, n) have storage; new entries are zeroed
+   VOID reserve(UINT n)
+   {
+      if(n > capacity)
+         resize(n);
+   }
+   VOID resize(UINT n);
+
+   UINT size(void) const { return capacity; }
+
+   UINT64 *histogram(UINT id) { return reuseDistance + (UINT64)id * MAX_RD_BUCKETS; }
+   const UINT64 *histogram(UINT id) const { return reuseDistance + (UINT64)id * MAX_RD_BUCKETS; }
+
+   // add the counts of other into this one; timestamps keep the earliest first and latest last access
+   VOID merge(const ObjectCounters &other);
+   // zero every counter, keeping the storage
+   VOID clear();
+
+   // the counters of ids [0, n), see checkpoint.h
+   VOID Save(CheckpointWriter &out, UINT n) const;
+   bool Load(CheckpointReader &in);
+
+private:
+   ObjectCounters(const ObjectCounters &);
+   ObjectCounters &operator=(const ObjectCounters &);
+};
+
+#endif
@@ -0,0 +1,123 @@
+//
+//  Chunk parallel reuse distance of the offline replay, see parallel-rd.h
+//
+
+#include <iostream>
+#include <string>
+#include <assert.h>
+using namespace std;
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "sieve-port.h"
+#include "parallel-rd.h"
+#include "shared-rd.h"
+
+// scratch of one thread of the segment pass
+struct SegmentScratch {
+   ReuseDistance local;
+   WorkingSet seen;
+
+   SegmentScratch(UINT log2_block_size) : local(log2_block_size), seen() { }
+};
+
+// distances within the segment, and its first and last touches
+static VOID segment_pass(RDSegment &segment, SegmentScratch &scratch, UINT log2_block_size)
+{
+   ReuseDistance &local = scratch.local;
+   local.Reset();
+   segment.first.clear();
+   segment.last.clear();
+
+   for(UINT64 k = 0; k < segment.n; k++) {
+      UINT64 i = segment.at(k);
+      segment.rd[i] = local.ProcessMemoryAccess(NULL, segment.addr[i], segment.size[i]);
+      if(segment.rd[i] < 0)
+         segment.first.push_back(k);
+   }
+   memcpy(segment.histo, local.reuse_histo, sizeof(segment.histo));
+
+   // walking backwards, the first time a line shows up is its last touch
+   scratch.seen.clear();
+   for(UINT64 k = segment.n; k-- > 0;) {
+      UINT64 unique = scratch.seen.size();
+      scratch.seen.access(segment.addr[segment.at(k)] >> log2_block_size);
+      if(scratch.seen.size() != unique)
+         segment.last.push_back(k);
+   }
+   reverse(segment.last.begin(), segment.last.end());
+}
+
+// the segments in order against the engine's stack, see parallel-rd.h
+static UINT64 stitch(RDJob &job)
+{
+   UINT64 stitched = 0;
+   ReuseDistance *engine = job.engine;
+   for(auto &segment : job.segments) {
+      for(auto k : segment.first) {
+         UINT64 i = segment.at(k);
+         segment.rd[i] = engine->ProcessMemoryAccess(NULL, segment.addr[i], segment.size[i]);
+      }
+      engine->AddCounts(segment.histo, segment.n - segment.first.size());
+      for(auto k : segment.last)
+         engine->Touch(segment.addr[segment.at(k)]);
+      stitched += segment.first.size();
+   }
+   return stitched;
+}
+
+ParallelStackDistance::ParallelStackDistance(UINT _threads, UINT _log2_block_size) :
+   threads(MAX(_threads, 1)), log2_block_size(_log2_block_size), scratch(), segments_run(0), stitched(0)
+{
+   for(UINT t = 0; t < threads; t++)
+      scratch.push_back(new SegmentScratch(log2_block_size));
+}
+
+ParallelStackDistance::~ParallelStackDistance()
+{
+   for(auto s : scratch)
+      delete s;
+}
+
+VOID ParallelStackDistance::run(vector<RDJob> &jobs)
+{
+   vector<RDSegment *> segments;
+   for(auto &job : jobs)
+      for(auto &segment : job.segments)
+         segments.push_back(&segment);
+   if(segments.empty())
+      return;
+
+   // segment pass over all jobs, then the stitching of each job; both hand out work by an atomic counter
+   std::atomic<UINT64> next_segment(0), next_job(0), total_stitched(0);
+   UINT nthreads = MIN((UINT64)threads, segments.size());
+
+   auto worker = [&](UINT t) {
+      for(UINT64 s; (s = next_segment.fetch_add(1)) < segments.size();)
+         segment_pass(*segments[s], *scratch[t], log2_block_size);
+   };
+   auto stitcher = [&]() {
+      for(UINT64 j; (j = next_job.fetch_add(1)) < jobs.size();)
+         total_stitched += stitch(jobs[j]);
+   };
+
+   vector<std::thread> pool;
+   for(UINT t = 1; t < nthreads; t++)
+      pool.push_back(std::thread(worker, t));
+   worker(0);
+   for(auto &thread : pool)
+      thread.join();
+
+   pool.clear();
+   for(UINT t = 1; t < MIN((UINT64)threads, jobs.size()); t++)
+      pool.push_back(std::thread(stitcher));
+   stitcher();
+   for(auto &thread : pool)
+      thread.join();
+
+   segments_run += segments.size();
+   stitched += total_stitched;
+}
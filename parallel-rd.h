@@ -0,0 +1,70 @@
+#ifndef _PARALLEL_RD_H
+#define _PARALLEL_RD_H
+
+// Chunk parallel reuse distance for the offline replay. Native builds only (SPM_SIEVE_NO_PIN).
+//
+// A stream of accesses to one ReuseDistance engine is cut into segments (e.g. trace chunks).
+// Every segment is run on its own through an empty engine, in parallel: that finds the exact
+// distance of every reuse within the segment, since the lines in between are all in it.
+// What remains are the first touches of each segment. The stitching pass feeds them, segment
+// by segment, to the real engine; there a first touch sees on top of the stack the earlier
+// first touches of its segment and below them the stack at the segment start, which is its
+// distance in the whole stream. The lines of the segment are then touched in the order of
+// their last access, leaving the engine as if it had seen the segment access by access.
+// The RD level only depends on the stack distance, so the levels, histograms and access
+// counts are the ones of sequential processing.
+
+#include <vector>
+
+#include "RD.h"
+
+using namespace std;
+
+// One piece of a stream: accesses addr[k], size[k] for k in index, or 0 .. n - 1 without
+// index; rd[k] receives their RD. index lets a segment pick one set or category of a chunk
+struct RDSegment {
+   const UINT64 *addr;
+   const UINT8 *size;
+   INT *rd;
+   const UINT32 *index;
+   UINT64 n;
+
+   // found by the segment pass, used by the stitching
+   vector<UINT32> first;      // positions of the first touches, in order
+   vector<UINT32> last;       // positions of the last touches, in order
+   UINT64 histo[MAX_RD_BUCKETS];
+
+   RDSegment(const UINT64 *_addr, const UINT8 *_size, INT *_rd, const UINT32 *_index, UINT64 _n) :
+      addr(_addr), size(_size), rd(_rd), index(_index), n(_n), first(), last() { }
+
+   UINT64 at(UINT64 k) const { return index ? index[k] : k; }
+};
+
+// The segments of one engine, in stream order
+struct RDJob {
+   ReuseDistance *engine;
+   vector<RDSegment> segments;
+
+   RDJob(ReuseDistance *_engine) : engine(_engine), segments() { }
+};
+
+struct SegmentScratch;
+
+class ParallelStackDistance {
+   UINT threads;
+   UINT log2_block_size;
+   vector<SegmentScratch *> scratch;   // per thread, kept from run to run
+
+public:
+   UINT64 segments_run, stitched;   // totals over all run() calls
+
+   ParallelStackDistance(UINT _threads, UINT _log2_block_size);
+   ~ParallelStackDistance();
+
+   UINT size() const { return threads; }
+
+   // same result as feeding the segments of every job in order to its engine; the jobs are independent
+   VOID run(vector<RDJob> &jobs);
+};
+
+#endif
@@ -0,0 +1,496 @@
+//
+//  Mergeable run profiles, see profile.h
+//
+
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "sieve-core.h"
+#include "profile.h"
+
+string ProfileObject::key() const
+{
+    string k = AllocTypeName[type];
+    k += '\0';
+    k += name;
+    k += '\0';
+    k += site;
+    return k;
+}
+
+VOID ProfileObject::merge(const ProfileObject &other)
+{
+    objects += other.objects;
+    size += other.size;
+    if (!start)
+        start = other.start;
+    if (other.first_access && (!first_access || other.first_access < first_access))
+        first_access = other.first_access;
+    last_access = MAX(last_access, other.last_access);
+    accesses += other.accesses;
+    writes += other.writes;
+    l1_misses += other.l1_misses;
+    l2_misses += other.l2_misses;
+    llc_misses += other.llc_misses;
+    rd.merge(other.rd);
+}
+
+VOID ProfileCategory::merge(const ProfileCategory &other)
+{
+    objects += other.objects;
+    size += other.size;
+    accesses += other.accesses;
+    misses += other.misses;
+    for (UINT s = 0; s < rd.size(); s++)
+        rd[s].merge(other.rd[s]);
+}
+
+UINT64 ProfileCategory::calculateMisses(UINT bucket) const
+{
+    UINT64 misses = 0;
+    for (auto &histogram : rd)
+        misses += histogram.misses(bucket);
+    return misses;
+}
+
+Profile::Profile() : sites(), log2_block_size(0), log2_l1_size(0), log2_l2_size(0), log2_llc_size(0), num_sets(0),
+    demarcate_large_objects(false), runs(0), instructions(0), accesses(0), writes(0), object_count(0), global_rd(), objects()
+{
+}
+
+bool Profile::same_configuration(const Profile &other) const
+{
+    return log2_block_size == other.log2_block_size && log2_l1_size == other.log2_l1_size &&
+        log2_l2_size == other.log2_l2_size && log2_llc_size == other.log2_llc_size && num_sets == other.num_sets &&
+        demarcate_large_objects == other.demarcate_large_objects && global_rd.size() == other.global_rd.size();
+}
+
+UINT64 Profile::calculateMisses(UINT bucket) const
+{
+    UINT64 misses = 0;
+    for (auto &histogram : global_rd)
+        misses += histogram.misses(bucket);
+    return misses;
+}
+
+VOID Profile::merge(const Profile &other)
+{
+    if (runs == 0) {
+        log2_block_size = other.log2_block_size;
+        log2_l1_size = other.log2_l1_size;
+        log2_l2_size = other.log2_l2_size;
+        log2_llc_size = other.log2_llc_size;
+        num_sets = other.num_sets;
+        demarcate_large_objects = other.demarcate_large_objects;
+        global_rd.resize(other.global_rd.size());
+        for (UINT c = 0; c < OBJ_TYPE_NUM; c++)
+            categories[c].rd.resize(other.categories[c].rd.size());
+    }
+    assert(same_configuration(other));
+
+    // a profile of one run has an entry per object, group them by site first
+    if (sites.size() != objects.size()) {
+        vector<ProfileObject> ungrouped;
+        ungrouped.swap(objects);
+        sites.clear();
+        for (auto &object : ungrouped) {
+            auto it = sites.insert(make_pair(object.key(), objects.size()));
+            if (it.second) {
+                objects.push_back(object);
+                objects.back().id = objects.size() - 1;
+            }
+            else
+                objects[it.first->second].merge(object);
+        }
+    }
+
+    runs += other.runs;
+    instructions += other.instructions;
+    accesses += other.accesses;
+    writes += other.writes;
+    object_count += other.object_count;
+    for (UINT s = 0; s < global_rd.size(); s++)
+        global_rd[s].merge(other.global_rd[s]);
+    for (UINT c = 0; c < OBJ_TYPE_NUM; c++)
+        categories[c].merge(other.categories[c]);
+
+    for (auto &object : other.objects) {
+        auto it = sites.insert(make_pair(object.key(), objects.size()));
+        if (it.second) {
+            objects.push_back(object);
+            objects.back().id = objects.size() - 1;
+        }
+        else
+            objects[it.first->second].merge(object);
+    }
+}
+
+VOID capture_profile(Profile &profile)
+{
+    profile = Profile();
+    profile.log2_block_size = LOG2_CACHE_BLOCK_SIZE;
+    profile.log2_l1_size = LOG2_L1_SIZE;
+    profile.log2_l2_size = LOG2_L2_SIZE;
+    profile.log2_llc_size = LOG2_LLC_SIZE;
+    profile.num_sets = num_sets;
+    profile.demarcate_large_objects = demarcate_large_objects;
+    profile.runs = 1;
+    profile.instructions = get_inscount();
+    profile.accesses = total_accesses;
+    profile.writes = total_writes;
+    profile.object_count = object_count;
+
+    if (enable_rd)
+        for (UINT s = 0; s < GlobalRD->getNumSets(); s++)
+            profile.global_rd.push_back(RDHistogram(GlobalRD->get_set(s)->reuse_histo));
+    for (UINT c = 0; c < OBJ_TYPE_NUM; c++) {
+        OBJ_Cat &category = OBJCategory[c];
+        ProfileCategory &captured = profile.categories[c];
+        captured.objects = category.objects.size();
+        captured.size = category.size;
+        captured.accesses = category.accesses;
+        captured.misses = category.misses;
+        for (UINT s = 0; s < category.rd->getNumSets(); s++)
+            captured.rd.push_back(RDHistogram(category.rd->get_set(s)->reuse_histo));
+    }
+
+    for (auto &object : Objects) {
+        UINT id = object.id;
+        ProfileObject captured;
+        captured.id = id;
+        captured.type = object.type;
+        // only the category of an accessed object is reported, and known for the default and stack buckets
+        if (Counters->accesses[id])
+            captured.category = getObjectCategory(id);
+        else
+            captured.category = (object.category == LARGE_DYNAMIC && !demarcate_large_objects) ? LARGE_STATIC : object.category;
+        captured.name = ObjectMeta[id].image_name;
+        if (name_site)
+            captured.site = name_site(object.callsiteIP);
+        else {
+            ostringstream ip;
+            ip << "0x" << hex << object.callsiteIP;
+            captured.site = ip.str();
+        }
+        captured.objects = 1;
+        captured.size = object.size;
+        captured.start = object.start;
+        captured.first_access = Counters->first_access[id];
+        captured.last_access = Counters->last_access[id];
+        captured.accesses = Counters->accesses[id];
+        captured.writes = Counters->writes[id];
+        captured.l1_misses = Counters->l1_misses[id];
+        captured.l2_misses = Counters->l2_misses[id];
+        captured.llc_misses = Counters->llc_misses[id];
+        captured.rd = RDHistogram(Counters->histogram(id));
+        profile.objects.push_back(captured);
+    }
+}
+
+// Writes a file front to back through one fixed buffer, a write per full block
+class BlockWriter {
+    int fd;
+    vector<char> buffer;
+    UINT64 used;
+    bool failed;
+
+    VOID flush()
+    {
+        const char *p = buffer.data();
+        while (used && !failed) {
+            ssize_t written = write(fd, p, used);
+            failed = written <= 0;
+            p += written;
+            used -= written;
+        }
+    }
+
+public:
+    BlockWriter(const string &file, UINT64 block = 1 << 20) : buffer(block), used(0), failed(false)
+    {
+        fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        failed = fd < 0;
+    }
+
+    VOID put(const VOID *data, UINT64 length)
+    {
+        const char *p = (const char *)data;
+        while (length) {
+            UINT64 n = MIN(length, buffer.size() - used);
+            memcpy(buffer.data() + used, p, n);
+            used += n;
+            p += n;
+            length -= n;
+            if (used == buffer.size())
+                flush();
+        }
+    }
+
+    template <typename T> VOID value(T v) { put(&v, sizeof(v)); }
+
+    // false when any write failed
+    bool close()
+    {
+        flush();
+        if (fd >= 0 && ::close(fd) != 0)
+            failed = true;
+        fd = -1;
+        return !failed;
+    }
+
+    ~BlockWriter() { close(); }
+};
+
+// one column of the objects, field(object) converted to T
+template <typename T, typename F>
+static VOID put_column(BlockWriter &out, const vector<ProfileObject> &objects, F field)
+{
+    for (auto &object : objects)
+        out.value<T>(field(object));
+}
+
+static VOID put_histograms(BlockWriter &out, const vector<RDHistogram> &histograms)
+{
+    for (auto &histogram : histograms)
+        out.put(histogram.counts, sizeof(histogram.counts));
+}
+
+bool write_profile(const string &file, const Profile &profile)
+{
+    // the string table, each symbol and site once
+    unordered_map<string, UINT32> index;
+    vector<const string *> strings;
+    vector<UINT32> names, sites;
+    UINT64 string_bytes = 0;
+    for (auto &object : profile.objects) {
+        const string *fields[] = { &object.name, &object.site };
+        vector<UINT32> *columns[] = { &names, &sites };
+        for (UINT f = 0; f < 2; f++) {
+            auto it = index.insert(make_pair(*fields[f], (UINT32)strings.size()));
+            if (it.second) {
+                strings.push_back(&it.first->first);
+                string_bytes += fields[f]->size();
+            }
+            columns[f]->push_back(it.first->second);
+        }
+    }
+
+    BlockWriter out(file);
+    UINT32 version = PROFILE_VERSION, reserved = 0;
+    out.put(PROFILE_MAGIC, 8);
+    out.value(version);
+    out.value(reserved);
+    UINT64 header[] = { profile.log2_block_size, profile.log2_l1_size, profile.log2_l2_size, profile.log2_llc_size,
+                        profile.num_sets, profile.demarcate_large_objects, profile.runs, profile.instructions,
+                        profile.accesses, profile.writes, profile.object_count, profile.global_rd.size(),
+                        profile.objects.size(), strings.size(), string_bytes };
+    out.put(header, sizeof(header));
+
+    put_histograms(out, profile.global_rd);
+    for (UINT c = 0; c < OBJ_TYPE_NUM; c++) {
+        const ProfileCategory &category = profile.categories[c];
+        UINT64 counters[] = { category.objects, category.size, category.accesses, category.misses, category.rd.size() };
+        out.put(counters, sizeof(counters));
+        put_histograms(out, category.rd);
+    }
+
+    UINT64 end = 0;
+    for (auto s : strings)
+        out.value(end += s->size());
+    for (auto s : strings)
+        out.put(s->data(), s->size());
+
+    const vector<ProfileObject> &objects = profile.objects;
+    put_column<UINT64>(out, objects, [](const ProfileObject &o) { return o.id; });
+    put_column<UINT8>(out, objects, [](const ProfileObject &o) { return o.type; });
+    put_column<UINT8>(out, objects, [](const ProfileObject &o) { return o.category; });
+    out.put(names.data(), names.size() * sizeof(UINT32));
+    out.put(sites.data(), sites.size() * sizeof(UINT32));
+    put_column<UINT64>(out, objects, [](const ProfileObject &o) { return o.objects; });
+    put_column<UINT64>(out, objects, [](const ProfileObject &o) { return o.size; });
+    put_column<UINT64>(out, objects, [](const ProfileObject &o) { return o.start; });
+    put_column<UINT64>(out, objects, [](const ProfileObject &o) { return o.first_access; });
+    put_column<UINT64>(out, objects, [](const ProfileObject &o) { return o.last_access; });
+    put_column<UINT64>(out, objects, [](const ProfileObject &o) { return o.accesses; });
+    put_column<UINT64>(out, objects, [](const ProfileObject &o) { return o.writes; });
+    put_column<UINT64>(out, objects, [](const ProfileObject &o) { return o.l1_misses; });
+    put_column<UINT64>(out, objects, [](const ProfileObject &o) { return o.l2_misses; });
+    put_column<UINT64>(out, objects, [](const ProfileObject &o) { return o.llc_misses; });
+    for (UINT b = 0; b < MAX_RD_BUCKETS; b++)
+        put_column<UINT64>(out, objects, [b](const ProfileObject &o) { return o.rd.counts[b]; });
+
+    out.put(PROFILE_END_MAGIC, 8);
+    return out.close();
+}
+
+// Reads the fixed width values of a profile, clearing ok() past the end
+class ColumnReader {
+    const UINT8 *p, *end;
+    bool bad;
+
+public:
+    ColumnReader(const UINT8 *data, UINT64 length) : p(data), end(data + length), bad(false) { }
+
+    // the next bytes of the file, NULL past its end
+    const UINT8 *take(UINT64 bytes)
+    {
+        if (bad || (UINT64)(end - p) < bytes) {
+            bad = true;
+            return NULL;
+        }
+        const UINT8 *at = p;
+        p += bytes;
+        return at;
+    }
+
+    VOID get(VOID *data, UINT64 bytes)
+    {
+        const UINT8 *at = take(bytes);
+        if (at)
+            memcpy(data, at, bytes);
+    }
+
+    // a column of n values of T into field(object i)
+    template <typename T, typename F>
+    VOID column(vector<ProfileObject> &objects, F field)
+    {
+        const UINT8 *at = take(objects.size() * sizeof(T));
+        for (UINT64 i = 0; at && i < objects.size(); i++) {
+            T v;
+            memcpy(&v, at + i * sizeof(T), sizeof(T));
+            field(objects[i], v);
+        }
+    }
+
+    bool ok() const { return !bad; }
+    bool at_end() const { return p == end; }
+};
+
+static bool get_histograms(ColumnReader &in, vector<RDHistogram> &histograms, UINT64 n, UINT64 limit)
+{
+    if (n > limit)
+        return false;
+    histograms.resize(n);
+    for (auto &histogram : histograms)
+        in.get(histogram.counts, sizeof(histogram.counts));
+    return in.ok();
+}
+
+bool read_profile(const string &file, Profile &profile, vector<UINT8> &buffer)
+{
+    ifstream in(file.c_str(), ios::binary);
+    if (!in) {
+        cerr << "Unable to open profile " << file << endl;
+        return false;
+    }
+    in.seekg(0, ios::end);
+    buffer.resize(in.tellg());
+    in.seekg(0);
+    in.read((char *)buffer.data(), buffer.size());
+
+    ColumnReader columns(buffer.data(), in ? buffer.size() : 0);
+    char magic[8];
+    UINT32 version = 0, reserved;
+    columns.get(magic, 8);
+    columns.get(&version, sizeof(version));
+    columns.get(&reserved, sizeof(reserved));
+    if (!columns.ok() || memcmp(magic, PROFILE_MAGIC, 8) != 0) {
+        cerr << file << " is not an SPM-Sieve profile\n";
+        return false;
+    }
+    if (version != PROFILE_VERSION) {
+        cerr << file << " has profile version " << version << ", this build reads version " << PROFILE_VERSION << endl;
+        return false;
+    }
+
+    UINT64 header[15] = { 0 };
+    columns.get(header, sizeof(header));
+    profile = Profile();
+    profile.log2_block_size = header[0];
+    profile.log2_l1_size = header[1];
+    profile.log2_l2_size = header[2];
+    profile.log2_llc_size = header[3];
+    profile.num_sets = header[4];
+    profile.demarcate_large_objects = header[5];
+    profile.runs = header[6];
+    profile.instructions = header[7];
+    profile.accesses = header[8];
+    profile.writes = header[9];
+    profile.object_count = header[10];
+    UINT64 n = header[12], strings = header[13], string_bytes = header[14];
+
+    bool ok = get_histograms(columns, profile.global_rd, header[11], profile.num_sets);
+    for (UINT c = 0; c < OBJ_TYPE_NUM && ok; c++) {
+        ProfileCategory &category = profile.categories[c];
+        UINT64 counters[5] = { 0 };
+        columns.get(counters, sizeof(counters));
+        category.objects = counters[0];
+        category.size = counters[1];
+        category.accesses = counters[2];
+        category.misses = counters[3];
+        ok = get_histograms(columns, category.rd, counters[4], profile.num_sets);
+    }
+
+    // a damaged count must not make us allocate more than the file could hold
+    vector<string> table;
+    ok = ok && strings <= buffer.size() && n <= buffer.size();
+    if (ok) {
+        const UINT8 *ends = columns.take(strings * sizeof(UINT64));
+        const UINT8 *bytes = columns.take(string_bytes);
+        UINT64 begin = 0;
+        for (UINT64 i = 0; ends && bytes && i < strings; i++) {
+            UINT64 end;
+            memcpy(&end, ends + i * sizeof(UINT64), sizeof(end));
+            if (end < begin || end > string_bytes)
+                break;
+            table.push_back(string((const char *)bytes + begin, end - begin));
+            begin = end;
+        }
+        ok = columns.ok() && table.size() == strings;
+    }
+
+    if (ok) {
+        vector<ProfileObject> &objects = profile.objects;
+        objects.resize(n);
+        columns.column<UINT64>(objects, [](ProfileObject &o, UINT64 v) { o.id = v; });
+        columns.column<UINT8>(objects, [&](ProfileObject &o, UINT8 v) { o.type = v; ok = ok && v < ALLOC_TYPE_NUM; });
+        columns.column<UINT8>(objects, [&](ProfileObject &o, UINT8 v) { o.category = v; ok = ok && v < OBJ_TYPE_NUM; });
+        columns.column<UINT32>(objects, [&](ProfileObject &o, UINT32 v) { if (v < strings) o.name = table[v]; else ok = false; });
+        columns.column<UINT32>(objects, [&](ProfileObject &o, UINT32 v) { if (v < strings) o.site = table[v]; else ok = false; });
+        columns.column<UINT64>(objects, [](ProfileObject &o, UINT64 v) { o.objects = v; });
+        columns.column<UINT64>(objects, [](ProfileObject &o, UINT64 v) { o.size = v; });
+        columns.column<UINT64>(objects, [](ProfileObject &o, UINT64 v) { o.start = v; });
+        columns.column<UINT64>(objects, [](ProfileObject &o, UINT64 v) { o.first_access = v; });
+        columns.column<UINT64>(objects, [](ProfileObject &o, UINT64 v) { o.last_access = v; });
+        columns.column<UINT64>(objects, [](ProfileObject &o, UINT64 v) { o.accesses = v; });
+        columns.column<UINT64>(objects, [](ProfileObject &o, UINT64 v) { o.writes = v; });
+        columns.column<UINT64>(objects, [](ProfileObject &o, UINT64 v) { o.l1_misses = v; });
+        columns.column<UINT64>(objects, [](ProfileObject &o, UINT64 v) { o.l2_misses = v; });
+        columns.column<UINT64>(objects, [](ProfileObject &o, UINT64 v) { o.llc_misses = v; });
+        for (UINT b = 0; b < MAX_RD_BUCKETS; b++)
+            columns.column<UINT64>(objects, [b](ProfileObject &o, UINT64 v) { o.rd.counts[b] = v; });
+    }
+
+    const UINT8 *end_magic = columns.take(8);
+    if (!ok || !end_magic || memcmp(end_magic, PROFILE_END_MAGIC, 8) != 0 || !columns.at_end()) {
+        cerr << "Profile " << file << " is damaged or incomplete\n";
+        return false;
+    }
+    return true;
+}
+
+VOID print_profile_sites(ofstream &out, const Profile &profile)
+{
+    out << "Num Objects,Num Runs,Num Instructions,Accesses,Writes\n";
+    out << profile.object_count << "," << profile.runs << "," << profile.instructions << ","
+        << profile.accesses << "," << profile.writes << "\n";
+    out << "\n";
+
+    out << "Object ID,Site,Objects,Size(bytes),Type,Symbol@Lib,TSC First Access,TSC Last Access,Accesses,Writes,L1 Misses, L2 Misses, LLC Misses\n";
+    for (auto &object : profile.objects)
+        out << "OBJECT_ID_" << object.id << "," << object.site << "," << object.objects << "," << object.size << ","
+            << AllocTypeName[object.type] << "," << object.name << ","
+            << object.first_access << "," << object.last_access << ","
+            << object.accesses << "," << object.writes << ","
+            << object.l1_misses << "," << object.l2_misses << "," << object.llc_misses << "\n";
+}
@@ -0,0 +1,133 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+// Mergeable summary of a run, from which the report of Display_Global_RD_Distribution is
+// printed: the RD histograms of the program and of every category, the category counters and
+// the per object counters. Profiles of many runs (inputs, machines, or the threads and shards
+// of one run written separately) combine with Profile::merge, which adds every count, so the
+// merge is associative and commutative. A merge keys objects by their allocation site, not by
+// their address: the allocation type, the symbol@lib and the site of the allocating call.
+//
+// The file is columnar, of fixed width little endian values, so that it is written and read
+// as a few long runs however many objects there are:
+//
+//   file    := "SPMPROF1" u32 version u32 reserved header histos strings objects "SPMPEND1"
+//   header  := u64 log2_block_size log2_l1_size log2_l2_size log2_llc_size num_sets
+//              demarcate_large_objects runs instructions accesses writes object_count
+//              global_sets objects strings string_bytes
+//   histos  := u64 global_rd[global_sets][MAX_RD_BUCKETS]
+//              { u64 objects size accesses misses sets rd[sets][MAX_RD_BUCKETS] } * OBJ_TYPE_NUM
+//   strings := u64 end[strings] char bytes[string_bytes]     string i is [end[i-1], end[i])
+//   objects := u64 id[n] u8 type[n] u8 category[n] u32 name[n] u32 site[n] u64 count[n] size[n]
+//              start[n] first_access[n] last_access[n] accesses[n] writes[n] l1_misses[n]
+//              l2_misses[n] llc_misses[n] rd[MAX_RD_BUCKETS][n]
+//
+// with n the objects and name and site indices into the string table. spm-sieve-merge
+// (merge.cpp) merges files, spm-sieve-convert (convert.cpp) prints the text reports of one.
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <string.h>
+
+#include "RD.h"
+#include "object-store.h"
+
+using namespace std;
+
+#define PROFILE_VERSION    2
+#define PROFILE_MAGIC      "SPMPROF1"
+#define PROFILE_END_MAGIC  "SPMPEND1"
+
+// binary log histogram of reuse distances
+struct RDHistogram {
+   UINT64 counts[MAX_RD_BUCKETS];
+
+   RDHistogram() { memset(counts, 0, sizeof(counts)); }
+   RDHistogram(const UINT64 *histo) { memcpy(counts, histo, sizeof(counts)); }
+
+   VOID merge(const RDHistogram &other)
+   {
+      for(UINT b = 0; b < MAX_RD_BUCKETS; b++)
+         counts[b] += other.counts[b];
+   }
+
+   // accesses beyond bucket, as ReuseDistance::calculateMisses()
+   UINT64 misses(UINT bucket) const
+   {
+      UINT64 n = 0;
+      for(UINT b = bucket + 1; b < MAX_RD_BUCKETS; b++)
+         n += counts[b];
+      return n;
+   }
+};
+
+// one object of a run, or every object of one allocation site once merged
+struct ProfileObject {
+   UINT64 id;                     // object id, the order of the site in a merged profile
+   UINT type;                     // OBJ_ALLOC_TYPE
+   UINT category;                 // OBJ_TYPE reported, see getObjectCategory()
+   string name;                   // symbol@lib
+   string site;                   // allocating call, see SITE_NAMER in sieve-core.h
+   UINT64 objects, size;          // objects and their total bytes
+   ADDRINT start;                 // of the first object
+   UINT64 first_access, last_access;
+   UINT64 accesses, writes, l1_misses, l2_misses, llc_misses;
+   RDHistogram rd;
+
+   ProfileObject() : id(0), type(0), category(0), name(), site(), objects(0), size(0), start(0), first_access(0),
+      last_access(0), accesses(0), writes(0), l1_misses(0), l2_misses(0), llc_misses(0), rd() { }
+
+   string key() const;
+   VOID merge(const ProfileObject &other);
+};
+
+struct ProfileCategory {
+   UINT64 objects, size, accesses, misses;
+   vector<RDHistogram> rd;        // one per set
+
+   ProfileCategory() : objects(0), size(0), accesses(0), misses(0), rd() { }
+
+   VOID merge(const ProfileCategory &other);
+   UINT64 calculateMisses(UINT bucket) const;
+};
+
+class Profile {
+   unordered_map<string, UINT64> sites;   // key() of the merged objects to their index
+
+public:
+   // the configuration; only profiles of the same one merge
+   UINT log2_block_size, log2_l1_size, log2_l2_size, log2_llc_size, num_sets;
+   bool demarcate_large_objects;
+
+   UINT64 runs;                   // profiles merged into this one
+   UINT64 instructions, accesses, writes;
+   UINT64 object_count;           // objects tracked, with the default and stack buckets
+   vector<RDHistogram> global_rd; // one per set, empty without -rd
+   ProfileCategory categories[OBJ_TYPE_NUM];
+   vector<ProfileObject> objects;
+
+   Profile();
+
+   bool same_configuration(const Profile &other) const;
+   UINT64 calculateMisses(UINT bucket) const;
+
+   // add other; its objects join the objects of the same site. The first profile merged into
+   // an empty one sets the configuration
+   VOID merge(const Profile &other);
+};
+
+// the profile of the analysis, once merge_thread_state() has run
+VOID capture_profile(Profile &profile);
+
+// false when the file cannot be written
+bool write_profile(const string &file, const Profile &profile);
+
+// false with a message when the file cannot be read or is not a profile; buffer holds the file
+bool read_profile(const string &file, Profile &profile, vector<UINT8> &buffer);
+
+// the objects of a merged profile by site, one line each
+VOID print_profile_sites(ofstream &out, const Profile &profile);
+
+#endif
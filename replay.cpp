@@ -0,0 +1,630 @@
+/*
+ * spm-sieve-replay: runs the SPM-Sieve analysis on a trace recorded with -record,
+ * without Pin. The reports are the ones of an online run with the same options.
+ *
+ *   spm-sieve-replay [options] trace
+ *
+ * The trace is replayed in file order: allocation events update the object index
+ * as the hooks of the online run would, accesses go through the same analysis.
+ * The trace time is the instruction count of the recording thread.
+ *
+ * The trace is mapped and its chunks are decoded ahead on -decode-threads threads;
+ * the replay itself consumes the decoded batches in order on the main thread.
+ * With -rd-threads > 1 the RDs of -rd-window access chunks at a time are computed
+ * chunk parallel, see parallel-rd.h; the results are those of the sequential replay.
+ *
+ * -format lackey|drmemtrace|csv replays another tracer's memory trace instead, streamed
+ * through an importer (trace-import.h); allocations then come from -alloc-log.
+ *
+ * -checkpoint writes the complete analysis state every -checkpoint-every chunks, and
+ * -restore resumes from such a checkpoint at the chunk after it (checkpoint.h).
+ *
+ * -live publishes live statistics between chunks for spm-sieve-top (live-stats.h).
+ *
+ * -control reads runtime commands from a FIFO between chunks (control.h).
+ *
+ * -start-icount ends a warm-up with a warm reset at the first chunk past it, as in the Pin tool.
+ */
+
+#include <time.h>
+#include "sieve-core.h"
+#include "trace-reader.h"
+#include "trace-import.h"
+#include "parallel-rd.h"
+#include "checkpoint.h"
+#include "control.h"
+
+// the instruction count seen by the analysis core, see sieve-port.h
+UINT64 replay_icount;
+
+// context of every thread of the trace, by trace tid
+map<UINT32, ThreadContext *> Contexts;
+
+// shared level counters, the role of the Fini context of the online run
+ThreadContext *SharedContext;
+
+UINT64 replayed_accesses = 0, replayed_events = 0, replayed_chunks = 0;
+
+// Chunk parallel RD: the access chunks are counted as they come and held in a window,
+// whose RDs run on ParallelRD once it is full; then the misses are accounted
+struct WindowChunk {
+    TraceBatch batch;
+    ThreadContext *tc;
+    vector< vector<UINT32> > by_set;        // positions of the accesses of each set, with -sets > 1
+    vector< vector<UINT32> > by_category;   // positions of each category and set
+};
+
+ParallelStackDistance *ParallelRD;
+vector<WindowChunk *> Window;
+UINT window_used = 0;
+
+// Checkpoints, taken at chunk boundaries
+string CheckpointFile;
+UINT64 CheckpointEvery = 0;             // chunks between checkpoints
+UINT64 checkpoints = 0, checkpoint_bytes = 0, restored_chunks = 0;
+double checkpoint_seconds = 0, checkpoint_max_seconds = 0;
+
+// Live statistics, published between chunks every live_interval seconds
+LivePublisher *Live;
+double live_interval = 1, live_next = 0;
+
+// Runtime commands, read between chunks every CONTROL_POLL seconds
+#define CONTROL_POLL 0.1
+ControlChannel *Control;
+double control_next = 0;
+
+// End of the warm-up, 0 when there is none or it is over
+UINT64 warmup_icount = 0, warmup_end_icount = 0;
+
+INT32 Usage()
+{
+    cerr << "Usage: spm-sieve-replay [options] trace\n"
+        "Replays a trace written with -record, or imported from another tracer, through the SPM-Sieve analysis\n\n"
+        "  -o <file>                output file name [spm-sieve.out]\n"
+        "  -rd <0|1>                reuse distance calculation [1]\n"
+        "  -l1size <bytes>          L1 cache size simulated [131072]\n"
+        "  -l2size <bytes>          L2 cache size simulated [1048576]\n"
+        "  -llcsize <bytes>         shared last level cache size simulated [8388608]\n"
+        "  -sets <n>                number of sets [1]\n"
+        "  -private-rd <0|1>        model L1/L2 as private per thread caches [1]\n"
+        "  -wss-window <n>          accesses per thread working set sample, 0 disables [10000000]\n"
+        "  -rd-max-distance <bytes> deepest reuse distance tracked, deeper reuses are saturated, 0 tracks all [0]\n"
+        "  -large-obj-size <bytes>  minimum object size to categorize in large [1023]\n"
+        "  -demark-large-obj <0|1>  distinguish between large static and dynamic objects [0]\n"
+        "  -display-all-obj <0|1>   display detailed stats for all objects [0]\n"
+        "  -obj-prof <0|1>          print object profile in a file [1]\n"
+        "  -profile <file>          write the mergeable profile of the run, see spm-sieve-merge\n"
+        "  -live <name>             publish live statistics in /dev/shm/<name> for spm-sieve-top\n"
+        "  -live-interval <ms>      milliseconds between two live statistics snapshots [1000]\n"
+        "  -control <fifo>          read runtime commands (snapshot, reset, disable, enable, sampling <n>) from this FIFO\n"
+        "  -sampling <n>            analyze one in n accesses of every thread [1]\n"
+        "  -start-icount <n>        end of the warm-up: the counts restart from zero, the cache state stays\n"
+        "  -text-report <0|1>       write the text report and object profile; 0 writes only the\n"
+        "                           profile (<o>.prof without -profile), see spm-sieve-convert [1]\n"
+        "  -decode-threads <n>      threads decoding the trace chunks [2]\n"
+        "  -decode-window <n>       decoded chunks buffered ahead of the replay [4 per decode thread]\n"
+        "  -rd-threads <n>          threads computing the RDs chunk parallel, 1 runs them in order [1]\n"
+        "  -rd-window <n>           access chunks per parallel RD run [64]\n"
+        "  -format <f>              trace format: spm (-record), lackey, drmemtrace or csv [spm]\n"
+        "  -alloc-log <file>        allocation events of an imported trace, see trace-import.h\n"
+        "  -block <n>               log2 of the cache block size of an imported trace, at most 6 [6]\n"
+        "  -import-batch <n>        access records per imported batch [16384]\n"
+        "  -checkpoint <file>       write the analysis state to file periodically\n"
+        "  -checkpoint-every <n>    chunks (imported batches) between checkpoints [10000]\n"
+        "  -restore <file>          resume from a checkpoint of a run with the same options and trace\n"
+        "The cache block size of a -record trace is the one of the recording; \"-\" imports from stdin.\n";
+    return -1;
+}
+
+ThreadContext *replay_context(UINT32 tid)
+{
+    auto it = Contexts.find(tid);
+    if (it != Contexts.end())
+        return it->second;
+
+    ThreadContext *tc = new_thread_context(tid);
+    Contexts[tid] = tc;
+    Threads.push_back(tc);
+    return tc;
+}
+
+VOID replay_events(const TraceBatch &batch)
+{
+    for (auto &event : batch.events) {
+        replay_icount = event.time;
+        if (event.type == TRACE_EVENT_ALLOC)
+            add_object(event.start, event.size, event.ip, (OBJ_ALLOC_TYPE)event.alloc_type, event.libname, event.tid);
+        else
+            free_object(event.start, event.tid);
+    }
+    replayed_events += batch.events.size();
+}
+
+// the segment of a window chunk for one engine, index NULL for all accesses
+static RDSegment window_segment(TraceBatch &batch, vector<INT> &rd, const vector<UINT32> *index)
+{
+    if (!index)
+        return RDSegment(&batch.addr[0], &batch.size[0], &rd[0], NULL, batch.accesses());
+    return RDSegment(&batch.addr[0], &batch.size[0], &rd[0], index->empty() ? NULL : &(*index)[0], index->size());
+}
+
+// RDs of the window: one job per engine, holding its segment of every chunk in order
+VOID flush_window()
+{
+    UINT sets = GlobalRD->getNumSets();
+    vector<RDJob> jobs;
+    for (UINT s = 0; s < sets; s++)
+        jobs.push_back(RDJob(GlobalRD->get_set(s)));
+    for (UINT c = 0; c < OBJ_TYPE_NUM; c++)
+        for (UINT s = 0; s < sets; s++)
+            jobs.push_back(RDJob(OBJCategory[c].rd->get_set(s)));
+    map<ThreadContext *, UINT> private_jobs;   // first job of the private sets of a thread
+
+    for (UINT w = 0; w < window_used; w++) {
+        WindowChunk *chunk = Window[w];
+        TraceBatch &batch = chunk->batch;
+        UINT64 n = batch.accesses();
+        if (n == 0) continue;
+
+        chunk->by_set.resize(sets);
+        chunk->by_category.resize(OBJ_TYPE_NUM * sets);
+        for (auto &positions : chunk->by_set) positions.clear();
+        for (auto &positions : chunk->by_category) positions.clear();
+        for (UINT64 i = 0; i < n; i++) {
+            UINT s = GlobalRD->set_of(batch.addr[i]);
+            if (sets > 1)
+                chunk->by_set[s].push_back(i);
+            chunk->by_category[batch.category[i] * sets + s].push_back(i);
+        }
+
+        batch.rd.resize(n);
+        batch.category_rd.resize(n);
+        for (UINT s = 0; s < sets; s++)
+            jobs[s].segments.push_back(window_segment(batch, batch.rd, (sets > 1) ? &chunk->by_set[s] : NULL));
+        for (UINT k = 0; k < OBJ_TYPE_NUM * sets; k++)
+            if (!chunk->by_category[k].empty())
+                jobs[sets + k].segments.push_back(window_segment(batch, batch.category_rd, &chunk->by_category[k]));
+
+        ThreadContext *tc = chunk->tc;
+        if (tc->private_rd) {
+            if (private_jobs.find(tc) == private_jobs.end()) {
+                private_jobs[tc] = jobs.size();
+                for (UINT s = 0; s < sets; s++)
+                    jobs.push_back(RDJob(tc->private_rd->get_set(s)));
+            }
+            batch.private_rd.resize(n);
+            for (UINT s = 0; s < sets; s++)
+                jobs[private_jobs[tc] + s].segments.push_back(
+                        window_segment(batch, batch.private_rd, (sets > 1) ? &chunk->by_set[s] : NULL));
+        }
+    }
+
+    ParallelRD->run(jobs);
+
+    for (UINT w = 0; w < window_used; w++)
+        account_batch(Window[w]->tc, SharedContext, Window[w]->batch);
+    window_used = 0;
+}
+
+// keep the accesses of batch that sample_access() analyzes, in order
+VOID sample_batch(ThreadContext *tc, TraceBatch &batch)
+{
+    UINT64 kept = 0;
+    for (UINT64 i = 0; i < batch.accesses(); i++)
+        if (sample_access(tc)) {
+            batch.addr[kept] = batch.addr[i];
+            batch.ip[kept] = batch.ip[i];
+            batch.time[kept] = batch.time[i];
+            batch.size[kept] = batch.size[i];
+            batch.flags[kept] = batch.flags[i];
+            kept++;
+        }
+    batch.addr.resize(kept);
+    batch.ip.resize(kept);
+    batch.time.resize(kept);
+    batch.size.resize(kept);
+    batch.flags.resize(kept);
+}
+
+VOID replay_accesses(TraceBatch &batch)
+{
+    ThreadContext *tc = replay_context(batch.header.tid);
+    if (batch.accesses())
+        replay_icount = batch.time.back();
+    if (access_sampling > 1 || !analysis_enabled)
+        sample_batch(tc, batch);
+    UINT64 n = batch.accesses();
+
+    // same attribution as accessUnifiedMemory() in the Pin tool; no event falls into a chunk
+    const ObjectIndex *index = LiveObjects.get();
+    batch.id.resize(n);
+    batch.category.resize(n);
+    for (UINT64 i = 0; i < n; i++) {
+        const ObjectInstance *object = (batch.flags[i] & 2) ? index->stack_bucket() : index->find(batch.addr[i]);
+        batch.id[i] = object->id;
+        batch.category[i] = object->category;
+    }
+    replayed_accesses += n;
+
+    if (!ParallelRD) {
+        // one stream in file order, the shared levels need no merge
+        analyze_batch(tc, SharedContext, batch);
+        return;
+    }
+
+    // the window takes over the columns, the decoder gets the window's old ones to refill
+    count_batch(tc, batch);
+    WindowChunk *chunk = Window[window_used++];
+    chunk->tc = tc;
+    chunk->batch.swap(batch);
+    if (window_used == Window.size())
+        flush_window();
+}
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+VOID print_decode_stats(const ParallelTraceDecoder &decoder, double seconds)
+{
+    OutFile << dec << "REPLAY_SECONDS : " << seconds << endl;
+    OutFile << "DECODE_THREADS : " << decoder.stats.size() << endl;
+    for (UINT t = 0; t < decoder.stats.size(); t++) {
+        const DecodeStats &stats = decoder.stats[t];
+        double busy = MAX(stats.seconds, 1e-9);
+        OutFile << "DECODE_THREAD_" << t << "_CHUNKS : " << stats.chunks << endl;
+        OutFile << "DECODE_THREAD_" << t << "_RECORDS : " << stats.records << endl;
+        OutFile << "DECODE_THREAD_" << t << "_RECORDS_PER_S : " << (UINT64)(stats.records / busy) << endl;
+        OutFile << "DECODE_THREAD_" << t << "_GB_PER_S : " << stats.bytes / busy / 1e9 << endl;
+    }
+}
+
+VOID print_replay_stats(const string &trace)
+{
+    OutFile << dec << "REPLAY_TRACE : " << trace << endl;
+    OutFile << "REPLAY_CHUNKS : " << replayed_chunks << endl;
+    OutFile << "REPLAY_ACCESSES : " << replayed_accesses << endl;
+    OutFile << "REPLAY_EVENTS : " << replayed_events << endl;
+    if (warmup_end_icount)
+        OutFile << "WARMUP_END_ICOUNT : " << warmup_end_icount << endl;
+}
+
+VOID print_import_stats(const TraceImporter &importer, double seconds)
+{
+    const ImportStats &stats = importer.stats;
+    double busy = MAX(stats.seconds, 1e-9);
+    OutFile << dec << "REPLAY_SECONDS : " << seconds << endl;
+    OutFile << "IMPORT_FORMAT : " << importer.format << endl;
+    OutFile << "IMPORT_BYTES : " << importer.bytes() << endl;
+    OutFile << "IMPORT_RECORDS : " << stats.records << endl;
+    OutFile << "IMPORT_INSTRUCTIONS : " << stats.instructions << endl;
+    OutFile << "IMPORT_SKIPPED : " << stats.skipped << endl;
+    OutFile << "IMPORT_SECONDS : " << stats.seconds << endl;
+    OutFile << "IMPORT_RECORDS_PER_S : " << (UINT64)(stats.records / busy) << endl;
+    OutFile << "IMPORT_MB_PER_S : " << importer.bytes() / busy / 1e6 << endl;
+    if (importer.alloc_log()) {
+        OutFile << "IMPORT_ALLOC_EVENTS : " << importer.alloc_log()->events << endl;
+        OutFile << "IMPORT_ALLOC_SKIPPED : " << importer.alloc_log()->skipped << endl;
+    }
+}
+
+VOID print_rd_stats()
+{
+    if (!ParallelRD)
+        return;
+    OutFile << "RD_THREADS : " << ParallelRD->size() << endl;
+    OutFile << "RD_SEGMENTS : " << ParallelRD->segments_run << endl;
+    OutFile << "RD_STITCHED_ACCESSES : " << ParallelRD->stitched << endl;
+}
+
+// The whole state after replayed_chunks chunks: the replay position, then the analysis core.
+// The parallel RD window is flushed first, so no access is in flight
+VOID write_checkpoint(const string &format)
+{
+    if (ParallelRD)
+        flush_window();
+
+    double start = now_seconds();
+    CheckpointWriter out;
+    out.str(format);
+    out.u64(replayed_chunks);
+    out.u64(replayed_accesses);
+    out.u64(replayed_events);
+    out.u64(replay_icount);
+    save_analysis(out);
+    UINT64 bytes = write_checkpoint_file(CheckpointFile, out);
+    double seconds = now_seconds() - start;
+
+    if (!bytes)
+        return;
+    checkpoints++;
+    checkpoint_bytes = bytes;
+    checkpoint_seconds += seconds;
+    checkpoint_max_seconds = MAX(checkpoint_max_seconds, seconds);
+    cerr << "Checkpoint after chunk " << replayed_chunks << ": " << bytes << " bytes in " << seconds << " s\n";
+}
+
+// set up the state of the checkpoint in place of a fresh one; returns the chunk to resume at
+UINT64 restore_checkpoint(const string &file, const string &format)
+{
+    vector<UINT8> payload;
+    read_checkpoint_file(file, payload);
+    CheckpointReader in(payload.data(), payload.size());
+
+    if (in.str() != format) {
+        cerr << "Checkpoint " << file << " is not of a -format " << format << " replay\n";
+        exit(1);
+    }
+    replayed_chunks = in.u64();
+    replayed_accesses = in.u64();
+    replayed_events = in.u64();
+    replay_icount = in.u64();
+    load_analysis(in);
+
+    for (auto tc : Threads) {
+        if (tc->tid == INVALID_THREADID)
+            SharedContext = tc;
+        else
+            Contexts[tc->tid] = tc;
+    }
+    if (!SharedContext || !in.at_end()) {
+        cerr << "Checkpoint " << file << " is damaged, not restoring\n";
+        exit(1);
+    }
+    restored_chunks = replayed_chunks;
+    cerr << "Restored " << file << ", resuming after chunk " << replayed_chunks << endl;
+    return replayed_chunks;
+}
+
+VOID print_checkpoint_stats()
+{
+    if (restored_chunks)
+        OutFile << "RESTORED_AFTER_CHUNK : " << restored_chunks << endl;
+    if (CheckpointFile.empty())
+        return;
+    OutFile << "CHECKPOINTS : " << checkpoints << endl;
+    OutFile << "CHECKPOINT_BYTES : " << checkpoint_bytes << endl;
+    OutFile << "CHECKPOINT_SECONDS : " << checkpoint_seconds << endl;
+    OutFile << "CHECKPOINT_MAX_SECONDS : " << checkpoint_max_seconds << endl;
+}
+
+VOID publish_live(bool final)
+{
+    LiveSnapshot snapshot;
+    live_snapshot(snapshot);
+    snapshot.final = final;
+    Live->publish(snapshot);
+    live_next = now_seconds() + live_interval;
+}
+
+// the commands written to the FIFO since the last poll; the RDs of the window are computed
+// before a snapshot or reset so that they count on their side of it
+VOID poll_control()
+{
+    string line;
+    ControlCommand command;
+    while (Control->next(line))
+        if (parse_control(line, command)) {
+            if (command.quiescent() && ParallelRD)
+                flush_window();
+            run_control(command);
+        }
+    control_next = now_seconds() + CONTROL_POLL;
+}
+
+VOID replay_batch(TraceBatch &batch, const string &format)
+{
+    if (batch.header.kind == TRACE_CHUNK_EVENT)
+        replay_events(batch);
+    else
+        replay_accesses(batch);
+    replayed_chunks++;
+
+    if (CheckpointEvery && replayed_chunks % CheckpointEvery == 0)
+        write_checkpoint(format);
+    if (Live && now_seconds() >= live_next)
+        publish_live(false);
+    if (Control && now_seconds() >= control_next)
+        poll_control();
+    if (warmup_icount && replay_icount >= warmup_icount) {
+        if (ParallelRD)
+            flush_window();
+        ResetAnalysis(true);
+        warmup_end_icount = replay_icount;
+        warmup_icount = 0;
+    }
+}
+
+// a -record trace from first_chunk on, decoded ahead on decode_threads
+VOID replay_trace(const string &trace, MappedTrace &mapped, UINT decode_threads, UINT decode_window, UINT64 first_chunk)
+{
+    double start = now_seconds();
+    ParallelTraceDecoder decoder(mapped, decode_threads, decode_window ? decode_window : 4 * decode_threads, first_chunk);
+    while (TraceBatch *batch = decoder.next()) {
+        UINT64 chunk = batch->chunk;
+        replay_batch(*batch, "spm");
+        decoder.release(batch);
+        mapped.done_with(chunk);
+    }
+    decoder.stop();
+    if (ParallelRD)
+        flush_window();
+
+    print_replay_stats(trace);
+    print_decode_stats(decoder, now_seconds() - start);
+    print_rd_stats();
+    print_checkpoint_stats();
+}
+
+// another tracer's trace, parsed on the main thread one bounded batch at a time; the batches
+// before first_chunk are parsed again to get to the position of a restored checkpoint
+VOID import_trace(const string &trace, TraceImporter &importer, UINT64 first_chunk)
+{
+    double start = now_seconds();
+    TraceBatch batch;
+    for (UINT64 c = 0; c < first_chunk; c++)
+        if (!importer.next(batch)) {
+            cerr << "Trace " << trace << " ends before the chunk of the checkpoint\n";
+            exit(1);
+        }
+    while (importer.next(batch))
+        replay_batch(batch, importer.format);
+    if (ParallelRD)
+        flush_window();
+
+    print_replay_stats(trace);
+    print_import_stats(importer, now_seconds() - start);
+    print_rd_stats();
+    print_checkpoint_stats();
+}
+
+// value of option i, exits when it is missing
+static const char *option_value(int argc, char *argv[], int i)
+{
+    if (i + 1 >= argc) {
+        cerr << "Missing value for " << argv[i] << endl;
+        exit(Usage());
+    }
+    return argv[i + 1];
+}
+
+int main(int argc, char *argv[])
+{
+    string trace;
+    UINT64 l1size = 131072, l2size = 1048576, llcsize = 8388608;
+    UINT decode_threads = 2, decode_window = 0;
+    UINT rd_threads = 1, rd_window = 64;
+    string format = "spm", alloc_log;
+    UINT block = 6;
+    UINT64 import_batch = 16384;
+    string restore;
+    UINT64 checkpoint_every = 10000;
+    string live, control;
+    UINT64 sampling = 1;
+
+    for (int i = 1; i < argc; i++) {
+        string option = argv[i];
+        if (option[0] != '-' || option == "-") {
+            trace = option;
+            continue;
+        }
+
+        const char *value = option_value(argc, argv, i++);
+        if (option == "-o") output_prefix = value;
+        else if (option == "-rd") enable_rd = atoi(value);
+        else if (option == "-l1size") l1size = strtoull(value, NULL, 0);
+        else if (option == "-l2size") l2size = strtoull(value, NULL, 0);
+        else if (option == "-llcsize") llcsize = strtoull(value, NULL, 0);
+        else if (option == "-sets") num_sets = strtoul(value, NULL, 0);
+        else if (option == "-private-rd") private_rd = atoi(value);
+        else if (option == "-wss-window") wss_window = strtoull(value, NULL, 0);
+        else if (option == "-rd-max-distance") rd_max_distance = strtoull(value, NULL, 0);
+        else if (option == "-large-obj-size") large_object_size = strtoull(value, NULL, 0);
+        else if (option == "-demark-large-obj") demarcate_large_objects = atoi(value);
+        else if (option == "-display-all-obj") display_all_objects = atoi(value);
+        else if (option == "-obj-prof") object_profile = atoi(value);
+        else if (option == "-profile") profile_file = value;
+        else if (option == "-text-report") text_report = atoi(value);
+        else if (option == "-live") live = value;
+        else if (option == "-control") control = value;
+        else if (option == "-start-icount") warmup_icount = strtoull(value, NULL, 0);
+        else if (option == "-sampling") sampling = MAX(1, strtoull(value, NULL, 0));
+        else if (option == "-live-interval") live_interval = MAX(1, strtoull(value, NULL, 0)) / 1000.0;
+        else if (option == "-decode-threads") decode_threads = MAX(1, atoi(value));
+        else if (option == "-decode-window") decode_window = atoi(value);
+        else if (option == "-rd-threads") rd_threads = MAX(1, atoi(value));
+        else if (option == "-rd-window") rd_window = MAX(1, atoi(value));
+        else if (option == "-format") format = value;
+        else if (option == "-alloc-log") alloc_log = value;
+        else if (option == "-block") block = atoi(value);
+        else if (option == "-import-batch") import_batch = strtoull(value, NULL, 0);
+        else if (option == "-checkpoint") CheckpointFile = value;
+        else if (option == "-checkpoint-every") checkpoint_every = strtoull(value, NULL, 0);
+        else if (option == "-restore") restore = value;
+        else {
+            cerr << "Unknown option " << option << endl;
+            return Usage();
+        }
+    }
+    if (trace.empty())
+        return Usage();
+
+    MappedTrace *mapped = NULL;
+    TraceImporter *importer = NULL;
+    if (format == "spm") {
+        mapped = new MappedTrace(trace);
+        if (!mapped->has_trailer)
+            cerr << "Trace " << trace << " has no index, the recording did not finish\n";
+        LOG2_CACHE_BLOCK_SIZE = mapped->header.log2_block_size;
+    }
+    else {
+        // accesses are cut at the cache lines into pieces of at most 64 bytes, as in the Pin tool
+        if (block > 6) {
+            cerr << "-block " << block << " is larger than 6, the 64 byte lines of the Pin tool\n";
+            return Usage();
+        }
+        LOG2_CACHE_BLOCK_SIZE = block;
+        importer = open_importer(format, trace, alloc_log.empty() ? NULL : new AllocLog(alloc_log), block, import_batch);
+        if (!importer) {
+            cerr << "Unknown trace format " << format << endl;
+            return Usage();
+        }
+    }
+    LOG2_L1_SIZE = log2(l1size);
+    LOG2_L2_SIZE = log2(l2size);
+    LOG2_LLC_SIZE = log2(llcsize);
+
+    InitAnalysis();
+
+    UINT64 first_chunk = 0;
+    if (!restore.empty())
+        first_chunk = restore_checkpoint(restore, format);
+    else {
+        SharedContext = new ThreadContext(INVALID_THREADID);
+        Threads.push_back(SharedContext);
+    }
+    if (!CheckpointFile.empty())
+        CheckpointEvery = MAX(checkpoint_every, 1);
+
+    // the segments are stitched into engines that keep every line
+    if (enable_rd && rd_threads > 1 && rd_max_lines) {
+        cerr << "-rd-max-distance computes the RDs in order, ignoring -rd-threads\n";
+        rd_threads = 1;
+    }
+    if (enable_rd && rd_threads > 1) {
+        ParallelRD = new ParallelStackDistance(rd_threads, LOG2_CACHE_BLOCK_SIZE);
+        for (UINT w = 0; w < rd_window; w++)
+            Window.push_back(new WindowChunk());
+    }
+
+    if (!live.empty()) {
+        Live = new LivePublisher();
+        if (!Live->open(live, live_interval * 1000, LOG2_CACHE_BLOCK_SIZE, LOG2_L1_SIZE, LOG2_L2_SIZE, LOG2_LLC_SIZE))
+            return -1;
+        live_next = now_seconds() + live_interval;
+    }
+
+    access_sampling = sampling;
+    if (!control.empty()) {
+        Control = new ControlChannel();
+        if (!Control->open(control))
+            return -1;
+    }
+
+    if (importer)
+        import_trace(trace, *importer, first_chunk);
+    else
+        replay_trace(trace, *mapped, decode_threads, decode_window, first_chunk);
+
+    if (Live) {
+        publish_live(true);
+        Live->close();
+    }
+    if (Control)
+        Control->close();
+    ReportAnalysis();
+    return 0;
+}
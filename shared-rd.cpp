@@ -0,0 +1,201 @@
+//
+//  Globally ordered merge of the per thread access streams, used to feed
+//  the shared cache level models, and the per thread working set tracking.
+//
+
+#include <iostream>
+#include <string>
+#include <assert.h>
+using namespace std;
+#include <stdlib.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include "sieve-port.h"
+#include "shared-rd.h"
+#include "checkpoint.h"
+
+OrderedAccessMerger::OrderedAccessMerger(UINT _batch_size, ACCESS_CONSUMER _consume) :
+   next_seq(0), producers(), scratch(), batch_size(_batch_size), consume(_consume)
+{
+   PIN_InitLock(&lock);
+}
+
+VOID OrderedAccessMerger::add_producer(MergeProducer *producer)
+{
+   producer->batch.reserve(batch_size);
+   PIN_GetLock(&lock, 1);
+   producers.push_back(producer);
+   PIN_ReleaseLock(&lock);
+}
+
+static bool seq_less(const AccessRecord &a, const AccessRecord &b)
+{
+   return a.seq < b.seq;
+}
+
+// consume all published records older than bound, in seq order; caller holds the lock
+VOID OrderedAccessMerger::drain(UINT64 bound, VOID *arg)
+{
+   scratch.clear();
+   for(UINT p = 0; p < producers.size(); p++) {
+      deque<AccessRecord> &q = producers[p]->published;
+      while(!q.empty() && q.front().seq < bound) {
+         scratch.push_back(q.front());
+         q.pop_front();
+      }
+   }
+
+   // every queue is in seq order already, so this only interleaves them
+   sort(scratch.begin(), scratch.end(), seq_less);
+   for(UINT i = 0; i < scratch.size(); i++)
+      consume(scratch[i], arg);
+}
+
+VOID OrderedAccessMerger::flush(MergeProducer *producer, VOID *arg)
+{
+   PIN_GetLock(&lock, 1);
+
+   producer->published.insert(producer->published.end(), producer->batch.begin(), producer->batch.end());
+   producer->batch.clear();
+   producer->low_watermark.store(~0ULL, std::memory_order_seq_cst);
+
+   drain(safe_bound(), arg);
+
+   PIN_ReleaseLock(&lock);
+}
+
+VOID OrderedAccessMerger::flush_ring(MergeProducer *producer, UINT64 n, VOID *arg)
+{
+   PIN_GetLock(&lock, 1);
+
+   // records leave the ring only under the lock, so safe_bound() always sees them somewhere
+   for(UINT64 i = 0; i < n; i++)
+      producer->published.push_back(producer->ring->peek(i));
+   producer->ring->release(n);
+
+   drain(safe_bound(), arg);
+
+   PIN_ReleaseLock(&lock);
+}
+
+// every record below the returned seq has been handed over; caller holds the lock
+UINT64 OrderedAccessMerger::safe_bound()
+{
+   // Read the counter before the watermarks: a thread whose watermark still reads empty
+   // stamps its next access after this point, so it can not produce anything below bound
+   UINT64 bound = next_seq.load(std::memory_order_seq_cst);
+   for(UINT p = 0; p < producers.size(); p++)
+      bound = MIN(bound, producers[p]->oldest_pending());
+   return bound;
+}
+
+VOID OrderedAccessMerger::finish(VOID *arg)
+{
+   PIN_GetLock(&lock, 1);
+   for(UINT p = 0; p < producers.size(); p++) {
+      MergeProducer *producer = producers[p];
+      producer->published.insert(producer->published.end(), producer->batch.begin(), producer->batch.end());
+      producer->batch.clear();
+      producer->low_watermark.store(~0ULL, std::memory_order_seq_cst);
+   }
+   drain(~0ULL, arg);
+   PIN_ReleaseLock(&lock);
+}
+
+VOID OrderedAccessMerger::after_fork_child(MergeProducer *survivor)
+{
+   producers.clear();
+   survivor->batch.clear();
+   survivor->published.clear();
+   survivor->low_watermark.store(~0ULL, std::memory_order_seq_cst);
+   producers.push_back(survivor);
+   PIN_ReleaseLock(&lock);
+}
+
+AccessRing::AccessRing(UINT64 _capacity) : head(0), tail(0), write_pos(0), cached_head(0), dropped(0)
+{
+   UINT64 slots = 1;
+   while(slots < _capacity)
+      slots *= 2;
+   mask = slots - 1;
+
+   VOID *mem = NULL;
+   if(posix_memalign(&mem, CACHE_LINE_BYTES, slots * sizeof(AccessRecord)) != 0) {
+      cerr << "Unable to allocate an access ring of " << slots << " records\n";
+      exit(1);
+   }
+   records = (AccessRecord *)mem;
+}
+
+AccessRing::~AccessRing()
+{
+   free(records);
+}
+
+ShardRouter::ShardRouter(UINT shards, UINT64 queue_size, UINT64 _segment, ACCESS_CONSUMER _consume) :
+   queues(shards), args(shards, (VOID *)NULL), segment(_segment), consume(_consume), inline_drain(false)
+{
+   for(UINT s = 0; s < shards; s++)
+      queues[s] = new AccessRing(queue_size);
+}
+
+VOID ShardRouter::publish()
+{
+   for(UINT s = 0; s < queues.size(); s++)
+      queues[s]->publish();
+}
+
+UINT64 ShardRouter::drain(UINT shard)
+{
+   AccessRing *queue = queues[shard];
+   UINT64 n = queue->available();
+   for(UINT64 i = 0; i < n; i++)
+      consume(queue->peek(i), args[shard]);
+   queue->release(n);
+   return n;
+}
+
+VOID WorkingSet::rehash(UINT64 slots)
+{
+   vector<UINT64> old_tags;
+   vector<UINT32> old_generations;
+   old_tags.swap(tags);
+   old_generations.swap(generations);
+
+   tags.assign(slots, 0);
+   generations.assign(slots, 0);
+   mask = slots - 1;
+   unique = 0;
+
+   for(UINT64 i = 0; i < old_tags.size(); i++)
+      if(old_generations[i] == generation)
+         access(old_tags[i]);
+}
+
+VOID WorkingSet::clear()
+{
+   unique = 0;
+   if(++generation == 0) {
+      // generation wrapped around, the old stamps would look current again
+      generations.assign(generations.size(), 0);
+      generation = 1;
+   }
+}
+
+VOID WorkingSet::Save(CheckpointWriter &out) const
+{
+   out.u64(unique);
+   for(UINT64 i = 0; i < tags.size(); i++)
+      if(generations[i] == generation)
+         out.u64(tags[i]);
+}
+
+bool WorkingSet::Load(CheckpointReader &in)
+{
+   clear();
+   UINT64 n = in.u64();
+   for(UINT64 i = 0; i < n && in.ok(); i++)
+      access(in.u64());
+   return in.ok() && unique == n;
+}
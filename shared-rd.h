@@ -0,0 +1,209 @@
+#ifndef _SHARED_RD_H
+#define _SHARED_RD_H
+
+#include <vector>
+#include <deque>
+#include <atomic>
+
+#include "object-store.h"
+#include "access-ring.h"
+
+using namespace std;
+
+class CheckpointWriter;
+class CheckpointReader;
+
+// called for every access of the merged stream, in global order
+typedef VOID (*ACCESS_CONSUMER)(const AccessRecord &rec, VOID *arg);
+
+// seqs a thread takes from the global counter at once; its accesses stay in order among
+// themselves and interleave with the other threads' in runs of at most this many
+#define MERGE_SEQ_BLOCK 256
+
+// Per thread side of the merge. The owning thread fills batch without locking;
+// low_watermark is the seq of the first record in batch, or ~0 when batch is empty.
+// In the asynchronous mode the thread writes into ring instead and batch stays unused:
+// low_watermark then covers the unpublished segment of the ring.
+// [block_next, block_end) is what is left of the seqs the thread took, only while low_watermark is set.
+class ALIGN_CACHELINE MergeProducer : public CacheLineAligned {
+public:
+   std::atomic<UINT64> low_watermark;
+   vector<AccessRecord> batch;
+   AccessRing *ring;
+   deque<AccessRecord> published;    // flushed records not yet merged, guarded by the merger lock
+   UINT64 block_next, block_end;
+
+   MergeProducer() : low_watermark(~0ULL), batch(), ring(NULL), published(), block_next(0), block_end(0) { }
+
+   // seq of the oldest record this producer may still hand over
+   UINT64 oldest_pending() const
+   {
+      // watermark first: a segment is published to the ring before its watermark is cleared
+      UINT64 oldest = low_watermark.load(std::memory_order_seq_cst);
+      if(ring)
+         oldest = MIN(oldest, ring->oldest_seq());
+      return oldest;
+   }
+};
+
+// Merges the access streams of all threads into one stream in global (seq) order,
+// feeding the shared cache level models.
+// Threads stamp their accesses from blocks of MERGE_SEQ_BLOCK seqs of a global counter, so
+// the shared cache line is touched once per block, and hand them over in batches;
+// a record is only consumed once no thread can still produce an older one.
+class OrderedAccessMerger {
+   PIN_LOCK lock;
+   std::atomic<UINT64> next_seq;
+   vector<MergeProducer *> producers;
+   vector<AccessRecord> scratch;
+   UINT batch_size;
+   ACCESS_CONSUMER consume;
+
+   VOID drain(UINT64 bound, VOID *arg);
+   UINT64 safe_bound();
+
+   // the first seq of a thread with nothing pending: the watermark is set before the block is
+   // taken, so safe_bound() either sees it or reads the counter before the block
+   UINT64 first_seq(MergeProducer *producer)
+   {
+      producer->low_watermark.store(next_seq.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+      producer->block_next = producer->block_end = 0;
+      return next(producer);
+   }
+
+   UINT64 next(MergeProducer *producer)
+   {
+      if(producer->block_next == producer->block_end) {
+         producer->block_next = next_seq.fetch_add(MERGE_SEQ_BLOCK, std::memory_order_seq_cst);
+         producer->block_end = producer->block_next + MERGE_SEQ_BLOCK;
+      }
+      return producer->block_next++;
+   }
+
+public:
+   OrderedAccessMerger(UINT _batch_size, ACCESS_CONSUMER _consume);
+
+   VOID add_producer(MergeProducer *producer);
+
+   // stamp and queue one access of the calling thread; rec.seq is filled in
+   VOID append(MergeProducer *producer, AccessRecord rec, VOID *arg)
+   {
+      rec.seq = producer->batch.empty() ? first_seq(producer) : next(producer);
+      producer->batch.push_back(rec);
+      if(producer->batch.size() >= batch_size)
+         flush(producer, arg);
+   }
+
+   // asynchronous producers: seq of the next record written to the ring
+   UINT64 stamp(MergeProducer *producer)
+   {
+      return producer->ring->unpublished() == 0 ? first_seq(producer) : next(producer);
+   }
+
+   // asynchronous producers: make the written records visible to the consumer
+   VOID publish_segment(MergeProducer *producer)
+   {
+      producer->ring->publish();
+      producer->low_watermark.store(~0ULL, std::memory_order_seq_cst);
+   }
+
+   // asynchronous consumers: move the n oldest records of the producer's ring into the merge
+   VOID flush_ring(MergeProducer *producer, UINT64 n, VOID *arg);
+
+   // publish the batch of producer and consume whatever became safe; arg is passed to the consumer
+   VOID flush(MergeProducer *producer, VOID *arg);
+
+   // flush every producer and consume everything, only when no thread is appending anymore
+   VOID finish(VOID *arg);
+
+   // fork of the process: the lock is held across it. In the child only the producer of the
+   // forking thread stays, emptied; the other threads and every record are the parent's
+   VOID before_fork() { PIN_GetLock(&lock, 1); }
+   VOID after_fork_parent() { PIN_ReleaseLock(&lock); }
+   VOID after_fork_child(MergeProducer *survivor);
+};
+
+// Routes the merged access stream to N shard workers, one SPSC queue per shard.
+// The producer is whoever holds the merger lock, so the queues see one producer at a time.
+// Records of one shard keep their global order, and a shard that owns whole RD sets
+// therefore computes exactly what a single thread would, whatever the number of shards.
+class ShardRouter {
+   vector<AccessRing *> queues;
+   vector<VOID *> args;
+   UINT64 segment;
+   ACCESS_CONSUMER consume;
+   std::atomic<bool> inline_drain;   // the workers are gone, route() consumes full queues itself
+
+public:
+   ShardRouter(UINT shards, UINT64 queue_size, UINT64 _segment, ACCESS_CONSUMER _consume);
+
+   UINT size() const { return queues.size(); }
+
+   // arg is passed to the consumer for every record of shard
+   VOID set_arg(UINT shard, VOID *arg) { args[shard] = arg; }
+
+   VOID route(UINT shard, const AccessRecord &rec)
+   {
+      AccessRing *queue = queues[shard];
+      while(queue->full()) {
+         queue->publish();
+         if(inline_drain.load(std::memory_order_acquire))
+            drain(shard);
+         else
+            PIN_Yield();
+      }
+      queue->put(rec);
+      if(queue->unpublished() >= segment)
+         queue->publish();
+   }
+
+   // producer side: make every routed record visible to the shards
+   VOID publish();
+
+   // consumer side, one thread per shard: consume everything published, returns the record count
+   UINT64 drain(UINT shard);
+
+   // called once the shard workers have exited; the caller consumes the rest from now on
+   VOID workers_gone() { inline_drain.store(true, std::memory_order_release); }
+};
+
+// Number of unique cache lines a thread touched in the current window.
+// Open addressing set of line tags, cleared in O(1) by bumping the generation.
+class WorkingSet {
+   vector<UINT64> tags;
+   vector<UINT32> generations;
+   UINT32 generation;
+   UINT64 mask;
+   UINT64 unique;
+
+   VOID rehash(UINT64 slots);
+
+public:
+   WorkingSet(UINT64 slots = 4096) : tags(), generations(), generation(1), mask(0), unique(0) { rehash(slots); }
+
+   VOID access(UINT64 tag)
+   {
+      UINT64 i = (tag * 0x9E3779B97F4A7C15ULL) & mask;
+      while(generations[i] == generation) {
+         if(tags[i] == tag)
+            return;
+         i = (i + 1) & mask;
+      }
+      generations[i] = generation;
+      tags[i] = tag;
+      unique++;
+      if(unique * 2 > mask)
+         rehash((mask + 1) * 2);
+   }
+
+   UINT64 size() const { return unique; }
+
+   // start a new window
+   VOID clear();
+
+   // the lines of the current window, see checkpoint.h
+   VOID Save(CheckpointWriter &out) const;
+   bool Load(CheckpointReader &in);
+};
+
+#endif
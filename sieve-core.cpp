@@ -0,0 +1,1003 @@
+//
+//  Analysis core of SPM-Sieve: object tracking and classification, the per access
+//  analysis and the reports. Driven by the Pin tool (spm-sieve.cpp) and by the
+//  offline replay (replay.cpp), see sieve-core.h.
+//
+
+#include "sieve-core.h"
+
+// Configuration
+UINT LOG2_CACHE_BLOCK_SIZE = 6;
+UINT LOG2_L1_SIZE = 17;
+UINT LOG2_L2_SIZE = 20;
+UINT LOG2_LLC_SIZE = 23;
+
+bool enable_rd = true;
+bool private_rd = true;
+UINT num_sets = 1;
+UINT64 wss_window = 10000000;
+UINT64 rd_max_distance = 0;
+UINT64 large_object_size = 1023;
+bool demarcate_large_objects = false, display_all_objects = false, object_profile = true;
+string output_prefix = "spm-sieve.out";
+string profile_file;
+bool text_report = true;
+
+// GLOBAL VARIABLES START
+
+INT L1_RD_BUCKET, L2_RD_BUCKET, LLC_RD_BUCKET;
+UINT64 rd_max_lines = 0;
+
+std::ofstream OutFile;
+
+UINT64 total_accesses =0;
+UINT64 total_writes = 0;
+UINT64 unaligned_accesses = 0;
+UINT64 l1_misses, l2_misses;
+
+UINT object_count = 0;
+UINT small_dynamic_count = 0;
+
+OBJ_Cat *OBJCategory;
+
+// Global Reuse Distance Object
+SetRD *GlobalRD;
+
+// The live objects, read lock free by the analysis routines of all threads
+RCUObjectIndex LiveObjects;
+
+// All objects, live and freed, collected for the final report
+vector<ObjectInstance> Objects;
+
+// Blocks which have been freed; stored separately to ease searching in the currently active list
+vector<ObjectInstance> freedObjects;
+
+// Hot per object counters, indexed by object ID
+ObjectCounters *Counters;
+
+// Cold per object data (symbols, timestamps), indexed by object ID
+vector<ObjectMetadata> ObjectMeta;
+
+// Serializes the allocation hooks, the writers of LiveObjects, freedObjects, ObjectMeta and the categories
+PIN_LOCK objects_lock;
+
+// Every thread's context, kept after the thread exits for the merge at Fini
+vector<ThreadContext *> Threads;
+
+// Serializes the growth of the threads' counters with live_snapshot() reading them
+PIN_LOCK counters_lock;
+
+// Runtime control of the analysis, see control.h
+std::atomic<bool> analysis_enabled(true);
+std::atomic<UINT64> access_sampling(1);
+UINT64 analysis_resets = 0, last_reset_icount = 0;
+bool last_reset_warm = false;
+
+ALLOC_OBSERVER observe_alloc = NULL;
+FREE_OBSERVER observe_free = NULL;
+STACK_CAPTURER capture_alloc_stack = NULL;
+SITE_NAMER name_site = NULL;
+
+VOID InitAnalysis()
+{
+    // Write to a file since cout and cerr maybe closed by the application
+    OutFile.open(output_prefix.c_str());
+    OutFile << hex;
+    OutFile.setf(ios::showbase);
+
+    L1_RD_BUCKET = LOG2_L1_SIZE - LOG2_CACHE_BLOCK_SIZE;
+    L2_RD_BUCKET = LOG2_L2_SIZE - LOG2_CACHE_BLOCK_SIZE;
+    LLC_RD_BUCKET = LOG2_LLC_SIZE - LOG2_CACHE_BLOCK_SIZE;
+
+    // the bound is a power of two of lines, and no smaller than the largest cache modeled
+    if(rd_max_distance) {
+       UINT64 largest = 1ULL << MAX(LOG2_L1_SIZE, MAX(LOG2_L2_SIZE, LOG2_LLC_SIZE));
+       if(rd_max_distance < largest)
+          cerr << "RD max distance " << rd_max_distance << " raised to the largest cache modeled, " << largest << endl;
+       UINT64 lines = MAX(rd_max_distance, largest) >> LOG2_CACHE_BLOCK_SIZE;
+       for(rd_max_lines = 2; rd_max_lines < lines; rd_max_lines <<= 1)
+          ;
+    }
+
+    if(enable_rd)
+       GlobalRD = new SetRD(num_sets, LOG2_CACHE_BLOCK_SIZE, rd_max_lines);
+
+    Counters = new ObjectCounters();
+    PIN_InitLock(&objects_lock);
+    PIN_InitLock(&counters_lock);
+
+    // No thread is running yet, so the index can be set up in place
+    vector<ObjectInstance> buckets;
+
+    // Initialize the bucket entry for unidentified/small blocks
+    buckets.push_back(ObjectInstance(0, 0, 0, object_count, ALLOC_DEFAULT, SMALL_DYNAMIC));
+    ObjectMeta.push_back(ObjectMetadata());
+    object_count++; // dummy increment to block count to keep ID's happy
+
+    // Add stack
+    buckets.push_back(ObjectInstance(1, 0, 0, object_count, ALLOC_STACK, OBJ_STACK));
+    ObjectMeta.push_back(ObjectMetadata());
+    object_count++; // dummy increment to block count to keep ID's happy
+    LiveObjects.get()->assign(buckets);
+
+    OBJCategory = new OBJ_Cat[OBJ_TYPE_NUM];
+
+    OutFile << dec << "*********** SPM-SIEVE Initialization Done ***********\n";
+    cerr << "*********** SPM-SIEVE Initialization Done ***********\n";
+    OutFile << "Cache Line Size : " << (1 << LOG2_CACHE_BLOCK_SIZE) << endl;
+    cerr << "Cache Line Size : " << (1 << LOG2_CACHE_BLOCK_SIZE) << endl;
+    OutFile << "L1 Cache Size : " << (1ULL << LOG2_L1_SIZE) << endl;
+    cerr << "L1 Cache Size : " << (1ULL << LOG2_L1_SIZE) << endl;
+    OutFile << "L2 Cache Size : " << (1ULL << LOG2_L2_SIZE) << endl;
+    cerr << "L2 Cache Size : " << (1ULL << LOG2_L2_SIZE) << endl;
+    OutFile << "Shared LLC Size : " << (1ULL << LOG2_LLC_SIZE) << endl;
+    cerr << "Shared LLC Size : " << (1ULL << LOG2_LLC_SIZE) << endl;
+    if(rd_max_lines) {
+       OutFile << "RD Max Distance : " << (rd_max_lines << LOG2_CACHE_BLOCK_SIZE) << endl;
+       cerr << "RD Max Distance : " << (rd_max_lines << LOG2_CACHE_BLOCK_SIZE) << endl;
+    }
+}
+
+ThreadContext *new_thread_context(THREADID tid)
+{
+    ThreadContext *tc = new ThreadContext(tid);
+    if (enable_rd && private_rd)
+        tc->private_rd = new SetRD(num_sets, LOG2_CACHE_BLOCK_SIZE, rd_max_lines);
+    return tc;
+}
+
+// Passed an Object Id fetch its Category
+OBJ_TYPE getObjectCategory(UINT objId)
+{
+   OBJ_TYPE type;
+   // find which set this belongs to
+   if(objId == 0)
+      type = SMALL_DYNAMIC;
+   else if(objId == 1)
+      type = OBJ_STACK;
+   else if(OBJCategory[LARGE_STATIC].objects.find(objId) != OBJCategory[LARGE_STATIC].objects.end())
+      type = LARGE_STATIC;
+   else if(OBJCategory[SMALL_STATIC].objects.find(objId) != OBJCategory[SMALL_STATIC].objects.end())
+      type = SMALL_STATIC;
+   else if(OBJCategory[LARGE_DYNAMIC].objects.find(objId) != OBJCategory[LARGE_DYNAMIC].objects.end())
+      type = LARGE_DYNAMIC;
+   else {
+      cerr << "Unable to Find Object " << objId << "in any Object Category\n";
+      exit(1);
+   }
+
+   if((type == LARGE_DYNAMIC) && (!demarcate_large_objects))
+      type = LARGE_STATIC;
+
+   return type;
+}
+
+// compare two malloc objects entry based on their first access timestamp
+bool compare_first_access(const ObjectInstance & lhs, const ObjectInstance & rhs) 
+{
+    return Counters->first_access[lhs.id] < Counters->first_access[rhs.id];
+}
+
+// only large and static objects get an entry in the object index
+bool is_indexed_object(ADDRINT size, OBJ_ALLOC_TYPE type)
+{
+    return (size > large_object_size) || is_static_alloc(type);
+}
+
+// category the accesses to an indexed object are attributed to, same as getObjectCategory()
+OBJ_TYPE indexed_object_category(ADDRINT size, OBJ_ALLOC_TYPE type)
+{
+    if(size <= large_object_size)
+       return SMALL_STATIC;
+    if(is_static_alloc(type) || !demarcate_large_objects)
+       return LARGE_STATIC;
+    return LARGE_DYNAMIC;
+}
+
+// add an object to the index draft if it meets the size criteria and account it in its category
+// The caller holds objects_lock; draft is its private copy of the live index for indexed objects,
+// for the rest it is only searched
+void insert_object(ObjectIndex *draft, ADDRINT start, ADDRINT size, ADDRINT ip, OBJ_ALLOC_TYPE type, string libname, THREADID tid)
+{
+    if (observe_alloc)
+        observe_alloc(tid, start, size, ip, type, libname);
+
+    // check if the entry already exists, maybe malloc got called twice for some reason
+    const ObjectInstance *seen = draft->find_start(start);
+    if ( seen ) {
+        DEBUG_PRINT("PIN: Object seen multiple times ID: " << seen->id << endl);
+        return;
+    }
+
+    UINT32 stack = NO_STACK;
+    // new block identified; e.g. MAID keeps the call stack for later identification of the object
+    if((size > large_object_size) && !is_static_alloc(type) && type != ALLOC_HEAP_SCAN && capture_alloc_stack) {
+       stack = capture_alloc_stack(tid);
+       libname = "";
+    }
+
+    if(is_indexed_object(size, type)) {
+       draft->insert(ObjectInstance(start, size, ip, object_count, type, indexed_object_category(size, type)));
+
+       ObjectMetadata meta;
+       // the symbol for a static array has already been added to libname string in read_static_objects()
+       meta.image_name = libname;
+       meta.tsc_malloc = get_inscount();
+       meta.stack_id = stack;
+       ObjectMeta.push_back(meta);
+
+       object_count++;
+       DEBUG_PRINT("PIN: Added " << AllocTypeName[type] << " Object: Size: " << dec << size 
+               << " Start addr: " << hex << start << dec << endl);
+    }
+
+
+    if(size > large_object_size) {
+       if(is_static_alloc(type)) {
+          OBJCategory[LARGE_STATIC].objects.insert(object_count - 1);
+          OBJCategory[LARGE_STATIC].size += size;
+       }
+       else {
+          OBJCategory[LARGE_DYNAMIC].objects.insert(object_count - 1);
+          OBJCategory[LARGE_DYNAMIC].size += size;
+       }
+    }
+    else {
+       if(is_static_alloc(type)) {
+          OBJCategory[SMALL_STATIC].objects.insert(object_count - 1);
+          OBJCategory[SMALL_STATIC].size += size;
+       }
+       // SMALL_DYNAMIC not tracked
+       else {
+          small_dynamic_count++;
+          OBJCategory[SMALL_DYNAMIC].objects.insert(small_dynamic_count - 1);
+          OBJCategory[SMALL_DYNAMIC].size += size;
+       }
+    }
+
+    return;
+}
+
+// add an object to the global object index if it meets the size criteria
+void add_object(ADDRINT start, ADDRINT size, ADDRINT ip, OBJ_ALLOC_TYPE type, string libname, THREADID tid)
+{
+    PIN_GetLock(&objects_lock, tid + 1);
+    if(is_indexed_object(size, type)) {
+       ObjectIndex *draft = LiveObjects.copy();
+       insert_object(draft, start, size, ip, type, libname, tid);
+       LiveObjects.publish(draft);
+    }
+    else
+       insert_object(LiveObjects.get(), start, size, ip, type, libname, tid);
+    PIN_ReleaseLock(&objects_lock);
+}
+
+// add objects in bulk (the symbols of an image, the blocks of a heap scan) in one new version of
+// the index: they go into an index of their own, appended when in address order, which is then
+// merged into the draft once instead of one insert into the middle of it per object
+VOID add_objects(const vector<NewObject> &batch, OBJ_ALLOC_TYPE type, THREADID tid)
+{
+    PIN_GetLock(&objects_lock, tid + 1);
+    ObjectIndex *draft = LiveObjects.copy();
+    ObjectIndex added;
+    for (auto &object : batch) {
+        if (draft->find_start(object.start))
+            continue;
+        insert_object(&added, object.start, object.size, 0, type, object.libname, tid);
+    }
+
+    vector<ObjectInstance> live, new_objects, merged;
+    draft->get(live);
+    added.get(new_objects);
+    merged.reserve(live.size() + new_objects.size());
+    std::merge(live.begin(), live.end(), new_objects.begin(), new_objects.end(),
+               back_inserter(merged), compare_start_address);
+    draft->assign(merged);
+    LiveObjects.publish(draft);
+    PIN_ReleaseLock(&objects_lock);
+}
+
+// at free, remove entry from the object index and insert into freed blocks; false when no object
+// starts at addr, else freed_object, if given, is set to it
+bool free_object(ADDRINT addr, THREADID tid, ObjectInstance *freed_object)
+{
+    PIN_GetLock(&objects_lock, tid + 1);
+
+    if (observe_free)
+        observe_free(tid, addr);
+
+    // Find this block in objects
+    const ObjectInstance *it = LiveObjects.get()->find_start(addr);
+    if(!it) {
+        DEBUG_PRINT("PIN: Freed block does not exist in malloc entries. Addr: " << hex << addr << dec << endl);
+        PIN_ReleaseLock(&objects_lock);
+        return false;
+    }
+
+    ObjectInstance freed = *it;
+    freed.valid = false;
+    ObjectMeta[freed.id].tsc_free = get_inscount();
+    DEBUG_PRINT("PIN: Freed: " << hex << addr << dec << endl);
+
+    // copy it to a new list; will be needed later
+    freedObjects.insert(freedObjects.end(), freed);
+    if (freed_object)
+        *freed_object = freed;
+
+    // erase it from the live objects
+    ObjectIndex *draft = LiveObjects.copy();
+    draft->erase(addr);
+    LiveObjects.publish(draft);
+
+    PIN_ReleaseLock(&objects_lock);
+    return true;
+}
+
+// free the live objects of a type that start in [low, high), e.g. the static ones of an unloaded image
+VOID free_objects(ADDRINT low, ADDRINT high, OBJ_ALLOC_TYPE type, THREADID tid)
+{
+    PIN_GetLock(&objects_lock, tid + 1);
+    // most ranges hold none, e.g. a munmap of a malloc chunk, so a new version is made only if needed
+    vector<ObjectInstance> in_range;
+    LiveObjects.get()->range(low, high, in_range);
+    if (none_of(in_range.begin(), in_range.end(), [type](const ObjectInstance &o) { return o.type == type; })) {
+        PIN_ReleaseLock(&objects_lock);
+        return;
+    }
+    ObjectIndex *draft = LiveObjects.copy();
+    UINT64 now = get_inscount();
+    for (auto &object : in_range) {
+        if (object.type != type)
+            continue;
+        if (observe_free)
+            observe_free(tid, object.start);
+        ObjectInstance freed = object;
+        freed.valid = false;
+        ObjectMeta[freed.id].tsc_free = now;
+        freedObjects.insert(freedObjects.end(), freed);
+        draft->erase(object.start);
+    }
+    LiveObjects.publish(draft);
+    PIN_ReleaseLock(&objects_lock);
+}
+
+// make sure the counters of tc have ids [0, n); they rarely grow, so the lock costs nothing
+static inline VOID reserve_counters(ThreadContext *tc, ObjectCounters *counters, UINT n)
+{
+    if (n > counters->size()) {
+        PIN_GetLock(&counters_lock, tc->tid + 1);
+        counters->resize(n);
+        PIN_ReleaseLock(&counters_lock);
+    }
+}
+
+// The part of analyze_access() that does not depend on the RDs; the caller reserved the counters
+static inline VOID count_access(ThreadContext *tc, ObjectCounters *counters, UINT id, UINT64 time, ADDRINT addr, bool is_read, UINT category)
+{
+    // update accesses, writes and TSC stats
+    tc->accesses++;
+    counters->accesses[id]++;
+    if (!is_read) { tc->writes++; counters->writes[id]++;}
+
+    if (0 == counters->first_access[id])  // update access timestamp
+        counters->first_access[id] = time;
+    counters->last_access[id] = time;
+
+    if (enable_rd)
+        tc->cat_accesses[category]++;
+
+    // working set size over time
+    if (wss_window) {
+        tc->wss.access(addr >> LOG2_CACHE_BLOCK_SIZE);
+        if(++tc->wss_accesses == wss_window) {
+            tc->wss_samples.push_back(make_pair(time, tc->wss.size()));
+            tc->wss.clear();
+            tc->wss_accesses = 0;
+        }
+    }
+}
+
+// accounting of a private level RD
+static inline VOID private_miss(ThreadContext *tc, ObjectCounters *counters, UINT id, INT rd)
+{
+    if(rd > L1_RD_BUCKET) { tc->l1_misses++; counters->l1_misses[id]++; }
+    if(rd > L2_RD_BUCKET) { tc->l2_misses++; counters->l2_misses[id]++; }
+}
+
+// accounting of a shared level RD
+static inline VOID shared_miss(ThreadContext *tc, ObjectCounters *counters, UINT id, UINT category, INT rd)
+{
+    if(rd >= 0)
+        counters->histogram(id)[rd]++;
+    if(rd > L1_RD_BUCKET)
+        tc->cat_misses[category]++;
+    if(rd > LLC_RD_BUCKET)
+        counters->llc_misses[id]++;
+}
+
+// Everything an access feeds once it is attributed to an object, except the shared levels.
+// Runs on the application thread, or with -async on the worker that drains its ring
+VOID analyze_access(ThreadContext *tc, const AccessRecord &rec)
+{
+    UINT id = rec.id;
+
+    // objects may have been added since this thread last grew its counters
+    ObjectCounters *counters = tc->counters;
+    reserve_counters(tc, counters, id + 1);
+
+    count_access(tc, counters, id, rec.time, rec.addr, rec.is_read, rec.category);
+
+    // private levels only see the accesses of this thread
+    if (enable_rd && tc->private_rd)
+        private_miss(tc, counters, id, tc->private_rd->process_memory_access(NULL, rec.addr, rec.size));
+}
+
+// Shared level RD of one access and its accounting; the per category RDs have the same
+// sets as GlobalRD, so one set index selects the state touched in both
+VOID model_shared_access(ThreadContext *tc, const AccessRecord &rec, UINT set)
+{
+    ObjectCounters *counters = tc->counters;
+    reserve_counters(tc, counters, rec.id + 1);
+
+    INT rd = GlobalRD->process_set_access(set, rec.addr, rec.size);
+    OBJCategory[rec.category].rd->process_set_access(set, rec.addr, rec.size);
+    shared_miss(tc, counters, rec.id, rec.category, rd);
+}
+
+// The counting part of analyze_batch(), independent of the RDs
+VOID count_batch(ThreadContext *tc, const TraceBatch &batch)
+{
+    // every id of the batch was attributed before, so it is below object_count
+    ObjectCounters *counters = tc->counters;
+    reserve_counters(tc, counters, object_count);
+
+    for (UINT64 i = 0; i < batch.accesses(); i++)
+        count_access(tc, counters, batch.id[i], batch.time[i], batch.addr[i], !(batch.flags[i] & 1), batch.category[i]);
+}
+
+// The miss accounting of analyze_batch(), from the private_rd and rd columns
+VOID account_batch(ThreadContext *tc, ThreadContext *shared, const TraceBatch &batch)
+{
+    UINT64 n = batch.accesses();
+    if (!enable_rd) return;
+
+    if (tc->private_rd) {
+        ObjectCounters *counters = tc->counters;
+        reserve_counters(tc, counters, object_count);
+        for (UINT64 i = 0; i < n; i++)
+            private_miss(tc, counters, batch.id[i], batch.private_rd[i]);
+    }
+
+    ObjectCounters *shared_counters = shared->counters;
+    reserve_counters(shared, shared_counters, object_count);
+    for (UINT64 i = 0; i < n; i++)
+        shared_miss(shared, shared_counters, batch.id[i], batch.category[i], batch.rd[i]);
+}
+
+// Same as analyze_access() and model_shared_access() on every access of the batch in
+// order; the RDs are independent of the counters, so each RD runs over the whole batch at once
+VOID analyze_batch(ThreadContext *tc, ThreadContext *shared, TraceBatch &batch)
+{
+    UINT64 n = batch.accesses();
+    if (n == 0) return;
+
+    count_batch(tc, batch);
+    if (!enable_rd) return;
+
+    batch.rd.resize(n);
+    if (tc->private_rd) {
+        batch.private_rd.resize(n);
+        tc->private_rd->process_memory_accesses(&batch.addr[0], &batch.size[0], n, &batch.private_rd[0]);
+    }
+    GlobalRD->process_memory_accesses(&batch.addr[0], &batch.size[0], n, &batch.rd[0]);
+    for (UINT64 i = 0; i < n; i++)
+        OBJCategory[batch.category[i]].rd->process_memory_access(NULL, batch.addr[i], batch.size[i]);
+
+    account_batch(tc, shared, batch);
+}
+
+// Sum the per thread counters into the global counters used by the reports
+VOID merge_thread_state()
+{
+    delete Counters;
+    Counters = new ObjectCounters(object_count);
+
+    total_accesses = total_writes = 0;
+    for(UINT c = 0; c < OBJ_TYPE_NUM; c++)
+       OBJCategory[c].accesses = OBJCategory[c].misses = 0;
+
+    for(auto tc : Threads) {
+       Counters->merge(*tc->counters);
+       total_accesses += tc->accesses;
+       total_writes += tc->writes;
+       for(UINT c = 0; c < OBJ_TYPE_NUM; c++) {
+          OBJCategory[c].accesses += tc->cat_accesses[c];
+          OBJCategory[c].misses += tc->cat_misses[c];
+       }
+    }
+}
+
+// the histograms of an RD module, one line per set as SetRD::printHistogram()
+static VOID print_histograms(ofstream &rdFile, string str, const vector<RDHistogram> &histograms)
+{
+    for(UINT s = 0; s < histograms.size(); s++) {
+        rdFile << "Binary Log Histogram of Reuse Distance Module : SET_" << s << " " << str << '\n';
+        rdFile << "BLH: ";
+        for(UINT b = 0; b < MAX_RD_BUCKETS; b++)
+            rdFile << histograms[s].counts[b] << ", ";
+        rdFile << '\n';
+    }
+}
+
+// smallest cache of the category that sees no more misses than the category had
+static UINT estimated_partition_size(const Profile &profile, OBJ_TYPE type)
+{
+    const ProfileCategory &category = profile.categories[type];
+    UINT64 misses = 0, bucket = 0;
+    for(; bucket < MAX_RD_BUCKETS; bucket++) {
+       misses = category.calculateMisses(bucket);
+       if(misses <= category.misses)
+          break;
+    }
+    return 1 << (bucket + profile.log2_block_size);
+}
+
+static VOID display_object_rd_distribution(ofstream &rdFile, const Profile &profile, UINT log2_start_cache_size, UINT log2_end_cache_size)
+{
+    vector<UINT64> tmpMiss(log2_end_cache_size - log2_start_cache_size + 1);	// L1 - L2 all sizes in POW 2
+    const ProfileCategory *category = profile.categories;
+
+    /* Individual Object Statistics */
+    /* $$$$$$ DISPLAY FORMAT $$$$$$ */
+    rdFile << "OBJECT_ID,TS,Accesses,Size,L1 Misses, 2 * L1 Misses, ..., L2 Misses" << '\n';
+    for(auto &object : profile.objects) {
+        if(object.accesses) {
+            UINT index = log2_end_cache_size - log2_start_cache_size;
+            UINT64 misses = 0;
+            const UINT64 *reuseDistance = object.rd.counts;
+            for(UINT m = log2_end_cache_size + 1; m < MAX_RD_BUCKETS; m++)
+                misses += reuseDistance[m];
+            tmpMiss[index] = misses;    // highest Sz
+            index--;
+
+            for(UINT m = log2_end_cache_size; m > log2_start_cache_size; m--) {
+                misses += reuseDistance[m];
+                tmpMiss[index] = misses;	// intermediate Sz, L1
+                index--;
+            }
+
+            if((object.category == LARGE_STATIC) || (object.category == LARGE_DYNAMIC) || display_all_objects) {
+               rdFile << "Object_" << object.id << ", "; // ID
+               rdFile << profile.instructions  << ", ";  // TimeStamp
+               rdFile << object.accesses << ", ";  // Accesses
+               rdFile << object.size;  // Size
+               for(UINT m = 0; m < tmpMiss.size(); m++)
+                   rdFile << ", " << tmpMiss[m];  // Misses at all Levels
+               rdFile << '\n';
+            }
+        }
+    }
+
+    // Print the Header
+    rdFile << "\n$$$$$ Object Category Wise Distribution $$$$$\n";
+    rdFile << "Category,Num_Objects,Category_Size,Accesses,L1 Misses\n";
+    if(profile.demarcate_large_objects) {
+       rdFile << "LARGE_STATIC,"
+              << category[LARGE_STATIC].objects << ","
+              << category[LARGE_STATIC].size << ","
+              << category[LARGE_STATIC].accesses << ","
+              << category[LARGE_STATIC].misses << '\n';
+       rdFile << "LARGE_DYNAMIC,"
+              << category[LARGE_DYNAMIC].objects << ","
+              << category[LARGE_DYNAMIC].size << ","
+              << category[LARGE_DYNAMIC].accesses << ","
+              << category[LARGE_DYNAMIC].misses << '\n';
+    }
+    else
+       rdFile << "LARGE,"
+              << (category[LARGE_STATIC].objects+category[LARGE_DYNAMIC].objects) << ","
+              << (category[LARGE_STATIC].size+category[LARGE_DYNAMIC].size) << ","
+              << category[LARGE_STATIC].accesses << ","
+              << category[LARGE_STATIC].misses << '\n';
+    rdFile << "SMALL_STATIC,"
+           << category[SMALL_STATIC].objects << ","
+           << category[SMALL_STATIC].size << ","
+           << category[SMALL_STATIC].accesses << ","
+           << category[SMALL_STATIC].misses << '\n';
+    rdFile << "SMALL_DYNAMIC,"
+           << category[SMALL_DYNAMIC].objects << ","
+           << category[SMALL_DYNAMIC].size << ","
+           << category[SMALL_DYNAMIC].accesses << ","
+           << category[SMALL_DYNAMIC].misses << '\n';
+    rdFile << "STACK,"
+           << category[OBJ_STACK].objects << ","
+           << category[OBJ_STACK].size << ","
+           << category[OBJ_STACK].accesses << ","
+           << category[OBJ_STACK].misses << '\n';
+
+    rdFile << '\n';
+    print_histograms(rdFile, "CATEGORY_LARGE_STATIC", category[LARGE_STATIC].rd);
+    if(profile.demarcate_large_objects)
+       print_histograms(rdFile, "CATEGORY_LARGE_DYNAMIC", category[LARGE_DYNAMIC].rd);
+    print_histograms(rdFile, "CATEGORY_SMALL_STATIC", category[SMALL_STATIC].rd);
+    print_histograms(rdFile, "CATEGORY_SMALL_DYNAMIC", category[SMALL_DYNAMIC].rd);
+    print_histograms(rdFile, "CATEGORY_STACK", category[OBJ_STACK].rd);
+
+    rdFile << "\nESTIMATED_PARTITION_SIZE :\n";
+    rdFile << "CATEGORY_SMALL_DYNAMIC," << estimated_partition_size(profile, SMALL_DYNAMIC) << '\n';
+    rdFile << "CATEGORY_SMALL_STATIC," << estimated_partition_size(profile, SMALL_STATIC) << '\n';
+    rdFile << "CATEGORY_LARGE_STATIC," << estimated_partition_size(profile, LARGE_STATIC) << '\n';
+    if(profile.demarcate_large_objects)
+       rdFile << "CATEGORY_LARGE_DYNAMIC," << estimated_partition_size(profile, LARGE_DYNAMIC) << '\n';
+    rdFile << "CATEGORY_STACK," << estimated_partition_size(profile, OBJ_STACK) << '\n';
+}
+
+/* Dumps out the all relevant characteristics of the
+ * whole program as well as of the individual objects
+ * of a profile, of this run or merged from many */
+VOID Display_Global_RD_Distribution(ofstream &rdFile, const Profile &profile, UINT log2_start_cache_size, UINT log2_end_cache_size)
+{
+    log2_start_cache_size -= profile.log2_block_size;
+    log2_end_cache_size -= profile.log2_block_size;
+    assert(log2_end_cache_size >= log2_start_cache_size);
+
+    rdFile << dec << "\n\n";
+    rdFile << "$$$$$$ Object Access & Miss Distribution @ : " << profile.instructions << " $$$$$$\n";
+    // Display for Individual Objects
+    display_object_rd_distribution(rdFile, profile, log2_start_cache_size, log2_end_cache_size);
+
+    /* Global Statistics */
+    /* $$$$$$ DISPLAY FORMAT $$$$$$ */
+    rdFile << "# TOTAL BLOCKS,TS,Accesses,L1 Misses,2 * L1 Misses, ... ,L2 Misses" << '\n';
+    vector<UINT64> tmpMiss(log2_end_cache_size - log2_start_cache_size + 1);	// L1, ... , L2
+    UINT index = log2_end_cache_size - log2_start_cache_size;
+    tmpMiss[index] = profile.calculateMisses(log2_end_cache_size);	// L2 Sz
+    index--;
+
+    for(UINT m = log2_end_cache_size - 1; m > log2_start_cache_size; m--) {
+       tmpMiss[index] = profile.calculateMisses(m);	// intermediate Sz
+       index--;
+    }
+
+    assert(index == 0);
+    tmpMiss[index] = profile.calculateMisses(log2_start_cache_size);	// L1 Sz
+
+    // Update global vars
+    l2_misses = tmpMiss.back();
+    l1_misses = tmpMiss.front();
+
+
+    rdFile << "TOTAL_BLOCKS, " << profile.object_count << ", " << profile.instructions << ", " << profile.accesses;
+    for(UINT m = 0; m < tmpMiss.size(); m++)
+        rdFile << ", " << tmpMiss[m];  // Misses at all Levels
+    rdFile << '\n';
+
+    rdFile << dec << "$$$$$$$$$$$$$$$$$$$$$$$\n";
+}
+
+// dumps the instantaneous cache stats to a file; used for plotting timeline behavior of cache
+// counts at the previous row of the timeline, zeroed by a reset
+static ADDRINT prev_accesses = 0;
+static ADDRINT prev_l1_misses = 0;
+static ADDRINT prev_l2_misses = 0;
+
+// the timeline file, opened at its first row
+static ofstream cache_stats;
+static bool cache_stats_header = false;
+
+VOID dump_cache_stats()
+{
+    if(!cache_stats_header) {
+        cache_stats.open(output_prefix + "-cache-stats.csv");
+        cache_stats << "TSC,Accesses,L1 misses,L2 misses" << endl;
+        cache_stats_header = true;
+    }
+
+    cache_stats << get_inscount() << ","
+        << total_accesses - prev_accesses << ","
+        << l1_misses - prev_l1_misses << "," 
+        << l2_misses - prev_l2_misses << endl;
+
+    prev_accesses = total_accesses;
+    prev_l1_misses = l1_misses;
+    prev_l2_misses = l2_misses;
+}
+
+bool AccPrioFunc(const pair<string, UINT64> &a, const pair<string, UINT64> &b)
+{
+    return a.second > b.second;
+}
+
+#ifdef OBJECT_ALLOC_HISTOGRAM
+VOID Display_Access_Histogram(ofstream &rdFile)
+{
+   vector<pair<string, UINT64> > sortedObjects;
+   map<string, UINT64> scopeHist;
+
+   rdFile << "-------- OBJECT ACCESS DISTRIBUTION --------\n";
+   // Object Wise Distribution
+   for(INT i = 0; i < Objects.size(); i++) {
+      ObjectMetadata &meta = ObjectMeta[Objects[i].id];
+      rdFile << "\n **** Object_" << Objects[i].id << " ****\n";
+      rdFile << "First Location," << meta.firstLoc << endl;
+      rdFile << "Last Location," << meta.lastLoc << endl;
+      rdFile << "Num Locs," << meta.accHist.size() << endl;
+
+      sortedObjects.clear();
+      for(auto it: meta.accHist) {
+         sortedObjects.push_back(make_pair(it.first, it.second));
+
+         if(scopeHist.find(it.first) == scopeHist.end())
+            scopeHist[it.first] = it.second;
+         else
+            scopeHist[it.first] += it.second;
+      }
+
+      stable_sort(sortedObjects.begin(), sortedObjects.end(), AccPrioFunc);
+      rdFile << "Histogram\n";
+      for(INT j = 0; j < sortedObjects.size(); j++)
+         rdFile << sortedObjects[j].first << "," << sortedObjects[j].second << endl;
+   }
+   rdFile << endl;
+
+}
+#endif
+
+bool arrayPrioFunc(const pair<int, double> &a, const pair<int, double> &b)
+{
+    return a.second > b.second;
+}
+
+// Check cache line alignment for a given access
+bool is_aligned_p(ADDRINT addr, INT64 len) 
+{
+    //cout << "Addr: " << hex << addr << dec << " Len: " << len << endl;
+    return ( (addr >> LOG2_CACHE_BLOCK_SIZE) == ((addr+len-1) >> LOG2_CACHE_BLOCK_SIZE) );
+}
+
+// Print out the detailed object profile for analysis, of this run or read back from a profile
+VOID print_object_profile(const string &prefix, const Profile &profile)
+{
+    std::ofstream outf;
+    outf.open(prefix + "-object-profile.csv");
+
+    // print HEADER
+    outf << "Num Objects,Num Instructions,Accesses,Writes,L1 Misses, L2 Misses\n";
+    outf << profile.objects.size()  << "," 
+        <<  profile.instructions << ", "<< profile.accesses << "," << profile.writes << ","
+        << l1_misses << "," << l2_misses << "\n";
+    outf << "\n";
+
+    // print per object data; L1/L2 are private per thread caches, the LLC is shared by all threads
+    outf << "Object ID,Object Start,Size(bytes),Type,Symbol@Lib,TSC First Access,TSC Last Access,Accesses,Writes,L1 Misses, L2 Misses, LLC Misses\n";
+
+    for(auto &object : profile.objects) {
+        outf << "OBJECT_ID_" << object.id << ",0x" << hex << object.start << "," << dec << object.size << ","
+            << AllocTypeName[object.type] << "," << object.name << ","
+            << object.first_access << "," << object.last_access << ","
+            << object.accesses << "," << object.writes << ","
+            << object.l1_misses << "," << object.l2_misses << "," << object.llc_misses << "\n";
+    }
+}
+
+// Print the per thread private cache misses and working set size over time
+VOID print_thread_profile(const string &prefix)
+{
+    std::ofstream outf;
+    outf.open(prefix + "-thread-profile.csv");
+
+    // the LLC is shared, its misses are only in the SHARED_LLC row; the private levels only in the THREAD_ rows
+    outf << "Thread,Accesses,Writes,Private L1 Misses,Private L2 Misses,Shared LLC Misses\n";
+    for(auto tc : Threads) {
+        if(tc->tid == INVALID_THREADID) continue;   // Fini and worker contexts only hold shared level counts
+        outf << "THREAD_" << tc->tid << "," << tc->accesses << "," << tc->writes << ","
+            << tc->l1_misses << "," << tc->l2_misses << ",\n";
+    }
+    if (enable_rd)
+        outf << "SHARED_LLC," << total_accesses << "," << total_writes << ",,,"
+            << GlobalRD->calculateMisses(LLC_RD_BUCKET) << "\n";
+    outf.close();
+
+    if (!wss_window) return;
+
+    outf.open(prefix + "-thread-wss.csv");
+    outf << "Thread,Window,ICount,Unique Lines,WSS(bytes)\n";
+    for(auto tc : Threads) {
+        for(UINT w = 0; w < tc->wss_samples.size(); w++)
+            outf << "THREAD_" << tc->tid << "," << w << "," << tc->wss_samples[w].first << ","
+                << tc->wss_samples[w].second << ","
+                << (tc->wss_samples[w].second << LOG2_CACHE_BLOCK_SIZE) << "\n";
+    }
+    outf.close();
+}
+
+// return size of the access from addr till the end of the current cacheline
+UINT get_cur_access_size(ADDRINT addr, UINT size)
+{
+    static UINT LINE_OFFSET_MASK = (1UL << LOG2_CACHE_BLOCK_SIZE) - 1;
+
+    return MIN((size), (64 - (addr & (LINE_OFFSET_MASK))));
+}
+
+// return no of cachelines needed for this access beginning at addr and size long
+UINT get_num_cachelines_for_access(ADDRINT addr, UINT size)
+{
+    static UINT CACHE_BLOCK_SIZE = LOG2_CACHE_BLOCK_SIZE;
+    return (((addr + size - 1) >> CACHE_BLOCK_SIZE) - (addr >> CACHE_BLOCK_SIZE)) + 1;
+}
+
+VOID live_snapshot(LiveSnapshot &snapshot)
+{
+    memset(&snapshot, 0, sizeof(snapshot));
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    snapshot.nanoseconds = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    snapshot.instructions = get_inscount();
+
+    // contexts are never freed, a copy of the list is enough
+    PIN_GetLock(&objects_lock, 1);
+    vector<ThreadContext *> threads(Threads);
+    UINT objects = object_count;
+    PIN_ReleaseLock(&objects_lock);
+    snapshot.objects = objects;
+
+    // the other threads go on counting: every value read is a recent one, not all of the same instant
+    static vector<UINT64> accesses;
+    static vector<UINT> order;
+    accesses.assign(objects, 0);
+    PIN_GetLock(&counters_lock, 1);
+    for (auto tc : threads) {
+        if (tc->tid != INVALID_THREADID)
+            snapshot.threads++;
+        snapshot.accesses += tc->accesses;
+        snapshot.writes += tc->writes;
+        snapshot.l1_misses += tc->l1_misses;
+        snapshot.l2_misses += tc->l2_misses;
+        for (UINT c = 0; c < OBJ_TYPE_NUM; c++) {
+            snapshot.cat_accesses[c] += tc->cat_accesses[c];
+            snapshot.cat_misses[c] += tc->cat_misses[c];
+        }
+        const ObjectCounters *counters = tc->counters;
+        UINT n = MIN(objects, counters->size());
+        for (UINT id = 0; id < n; id++) {
+            accesses[id] += counters->accesses[id];
+            snapshot.llc_misses += counters->llc_misses[id];
+        }
+    }
+
+    order.resize(objects);
+    for (UINT id = 0; id < objects; id++)
+        order[id] = id;
+    UINT top = MIN(objects, LIVE_TOP_OBJECTS);
+    partial_sort(order.begin(), order.begin() + top, order.end(),
+                 [](UINT a, UINT b) { return accesses[a] > accesses[b]; });
+    for (UINT k = 0; k < top && accesses[order[k]]; k++, snapshot.top_objects++) {
+        LiveObject &object = snapshot.top[k];
+        object.id = order[k];
+        for (auto tc : threads) {
+            const ObjectCounters *counters = tc->counters;
+            if (object.id >= counters->size())
+                continue;
+            object.accesses += counters->accesses[object.id];
+            object.writes += counters->writes[object.id];
+            object.l1_misses += counters->l1_misses[object.id];
+            object.l2_misses += counters->l2_misses[object.id];
+            object.llc_misses += counters->llc_misses[object.id];
+        }
+    }
+    PIN_ReleaseLock(&counters_lock);
+
+    PIN_GetLock(&objects_lock, 1);
+    for (UINT k = 0; k < snapshot.top_objects; k++)
+        strncpy(snapshot.top[k].name, ObjectMeta[snapshot.top[k].id].image_name.c_str(), LIVE_NAME_BYTES - 1);
+    PIN_ReleaseLock(&objects_lock);
+}
+
+// The reports of the analysis so far: the main one to out, the others under prefix, and the
+// profile to profile_out unless it is empty
+static VOID write_reports(ofstream &out, const string &prefix, const string &profile_out)
+{
+    merge_thread_state();
+
+    // Join the malloc and free blocks
+    LiveObjects.get()->get(Objects);
+    Objects.insert(Objects.end(), freedObjects.begin(), freedObjects.end());
+
+    // Sort on first_access since that will give a unique ordering
+    // All sorts should be stable_sort after this point
+    // We have a unique order on the objects in the field ID
+    SORT_OBJECTS_ON_KEY(id);
+
+    Profile profile;
+    capture_profile(profile);
+    if (!profile_out.empty() && !write_profile(profile_out, profile))
+        cerr << "Unable to write profile " << profile_out << endl;
+
+    if (enable_rd && text_report) {
+       Display_Global_RD_Distribution(out, profile, LOG2_L1_SIZE, LOG2_L2_SIZE);
+       // dump cache stats timeline in a csv file for later analysis
+       dump_cache_stats();
+#ifdef OBJECT_ALLOC_HISTOGRAM
+       Display_Access_Histogram(out);
+#endif
+    }
+
+    if (object_profile) {
+        if (text_report)
+            print_object_profile(prefix, profile);
+        print_thread_profile(prefix);
+    }
+}
+
+VOID SnapshotAnalysis(const string &prefix)
+{
+    ofstream out(prefix.c_str());
+    out << "SNAPSHOT_ICOUNT : " << get_inscount() << "\n";
+    write_reports(out, prefix, profile_file.empty() && text_report ? "" : prefix + ".prof");
+    Objects.clear();
+}
+
+VOID ResetAnalysis(bool warm)
+{
+    for (auto tc : Threads) {
+        tc->accesses = tc->writes = 0;
+        for (UINT c = 0; c < OBJ_TYPE_NUM; c++)
+            tc->cat_accesses[c] = tc->cat_misses[c] = 0;
+        tc->l1_misses = tc->l2_misses = 0;
+        tc->counters->clear();
+        if (tc->private_rd && warm)
+            tc->private_rd->ClearCounts();
+        else if (tc->private_rd)
+            tc->private_rd->Reset();
+        tc->wss.clear();
+        tc->wss_accesses = 0;
+        tc->wss_samples.clear();
+    }
+    if (enable_rd && warm)
+        GlobalRD->ClearCounts();
+    else if (enable_rd)
+        GlobalRD->Reset();
+    for (UINT c = 0; c < OBJ_TYPE_NUM; c++)
+        if (warm)
+            OBJCategory[c].rd->ClearCounts();
+        else
+            OBJCategory[c].rd->Reset();
+    unaligned_accesses = 0;
+    prev_accesses = prev_l1_misses = prev_l2_misses = 0;
+
+    analysis_resets++;
+    last_reset_icount = get_inscount();
+    last_reset_warm = warm;
+}
+
+VOID ForkAnalysis(const string &prefix)
+{
+    output_prefix = prefix;
+    OutFile.close();
+    OutFile.clear();
+    OutFile.open(output_prefix.c_str());
+    if (cache_stats_header) {
+        cache_stats.close();
+        cache_stats.clear();
+        cache_stats_header = false;
+    }
+
+    // the objects freed so far and every count are the parent's
+    freedObjects.clear();
+    ResetAnalysis();
+    analysis_resets = last_reset_icount = 0;
+    last_reset_warm = false;
+}
+
+VOID ReportAnalysis()
+{
+    if (analysis_resets)
+        OutFile << dec << "ANALYSIS_RESETS : " << analysis_resets << "\nANALYSIS_LAST_RESET_ICOUNT : " << last_reset_icount
+                << "\nANALYSIS_LAST_RESET_WARM : " << last_reset_warm << "\n";
+    if (access_sampling != 1)
+        OutFile << dec << "ACCESS_SAMPLING : " << access_sampling << "\n";
+
+    // without the text report the profile is the output, spm-sieve-convert prints the report from it
+    write_reports(OutFile, output_prefix, profile_file.empty() && !text_report ? output_prefix + ".prof" : profile_file);
+    freedObjects.clear();
+}
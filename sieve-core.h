@@ -0,0 +1,253 @@
+#ifndef _SIEVE_CORE_H
+#define _SIEVE_CORE_H
+
+// Analysis core shared by the Pin tool and the offline replay: the object tracking and
+// classification, the per access analysis and the reports. No Pin dependency, see sieve-port.h.
+
+#include <iostream>
+#include <fstream>
+#include <assert.h>
+#include <utility>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "sieve-port.h"
+#include "Set-RD.h"
+#include "object-store.h"
+#include "shared-rd.h"
+#include "trace-format.h"
+#include "profile.h"
+#include "live-stats.h"
+
+//#define ENABLE_DEBUG_PRINT
+#ifdef ENABLE_DEBUG_PRINT
+#define DEBUG_PRINT(X)	cerr << X
+#else
+#define DEBUG_PRINT(X)
+#endif
+
+/* ===================================================================== */
+/* Configuration, set by the driver before InitAnalysis() */
+/* ===================================================================== */
+
+extern UINT LOG2_CACHE_BLOCK_SIZE;
+extern UINT LOG2_L1_SIZE;
+extern UINT LOG2_L2_SIZE;
+extern UINT LOG2_LLC_SIZE;
+
+extern bool enable_rd;
+extern bool private_rd;                  // model L1/L2 per thread
+extern UINT num_sets;
+extern UINT64 wss_window;
+extern UINT64 rd_max_distance;           // bytes of the deepest RD tracked, 0 tracks all
+extern UINT64 large_object_size;
+extern bool demarcate_large_objects, display_all_objects, object_profile;
+extern string output_prefix;             // name of the main report, prefix of the others
+extern string profile_file;              // mergeable profile of the run written at the end, see profile.h
+extern bool text_report;                 // the report and object profile as text, else only the profile
+
+/* ===================================================================== */
+/* Analysis state */
+/* ===================================================================== */
+
+// RD buckets beyond which an access misses in the simulated caches
+extern INT L1_RD_BUCKET, L2_RD_BUCKET, LLC_RD_BUCKET;
+
+// lines an RD module keeps with rd_max_distance, 0 when unbounded
+extern UINT64 rd_max_lines;
+
+extern std::ofstream OutFile;
+
+// total no of memory accesses, summed over all threads at Fini
+extern UINT64 total_accesses;
+extern UINT64 total_writes;
+extern UINT64 unaligned_accesses;
+extern UINT64 l1_misses, l2_misses;
+
+// total number of blocks
+extern UINT object_count;
+// small dynamic blocks seen; they get no object id, only a number in their category
+extern UINT small_dynamic_count;
+
+class OBJ_Cat {
+public:
+   set<UINT> objects;  // all object ids in this category
+   UINT64 size;        // total size of this category
+   SetRD *rd;  // isolated per category RD
+   UINT64 accesses, misses;
+
+   OBJ_Cat():objects(),size(0),rd(NULL), accesses(0), misses(0)
+   {
+      rd = new SetRD(num_sets, LOG2_CACHE_BLOCK_SIZE, rd_max_lines);
+   }
+};
+
+// Arguments of an allocation call, pushed at its entry and matched at its exit
+struct PendingAlloc {
+   OBJ_ALLOC_TYPE type;
+   ADDRINT size;
+   ADDRINT arg;        // extra argument, e.g. the memptr of posix_memalign, the old block of realloc
+   ADDRINT ip;         // callsite return IP
+   ADDRINT sp;         // stack pointer at entry, the same at the exit
+   bool nested;        // called by another allocation call, e.g. malloc by operator new
+   ObjectInstance taken;   // object of the old block of realloc, out of the index during the call
+
+   PendingAlloc(OBJ_ALLOC_TYPE _type, ADDRINT _size, ADDRINT _arg, ADDRINT _ip, ADDRINT _sp) :
+      type(_type), size(_size), arg(_arg), ip(_ip), sp(_sp), nested(false), taken(0, 0, 0) { }
+};
+
+// Per application thread state; the Pin tool reaches it through its TLS key, the replay by trace tid.
+// Only the owning thread writes it; the counters are merged into the globals at Fini.
+class ALIGN_CACHELINE ThreadContext : public CacheLineAligned {
+public:
+   THREADID tid;
+
+   // the allocation calls in progress, outermost first, to match them to their returns
+   vector<PendingAlloc> alloc_stack;
+
+   ObjectIndexReader reader;   // RCU slot for lock free object lookups
+   ObjectCounters *counters;   // per object counters of this thread
+
+   UINT64 accesses, writes;
+   UINT64 cat_accesses[OBJ_TYPE_NUM], cat_misses[OBJ_TYPE_NUM];
+
+   SetRD *private_rd;          // private L1/L2 levels, only this thread's accesses
+   UINT64 l1_misses, l2_misses;
+   MergeProducer *producer;    // this thread's part of the shared level stream
+
+   TraceChunk *trace;          // access chunk being filled in record mode
+   ADDRINT tls_block;          // start of the executable's TLS block once its objects are added
+
+   UINT64 unsampled;           // accesses left out since the last analyzed one, see sample_access()
+
+   WorkingSet wss;             // unique lines of the current window
+   UINT64 wss_accesses;        // accesses in the current window
+   vector< pair<UINT64, UINT64> > wss_samples;   // (icount, unique lines) per finished window
+
+   ThreadContext(THREADID _tid) : tid(_tid), alloc_stack(),
+      reader(), counters(new ObjectCounters()), accesses(0), writes(0),
+      private_rd(NULL), l1_misses(0), l2_misses(0), producer(new MergeProducer()),
+      trace(NULL), tls_block(0), unsampled(0), wss(), wss_accesses(0), wss_samples()
+   {
+      for(UINT c = 0; c < OBJ_TYPE_NUM; c++)
+         cat_accesses[c] = cat_misses[c] = 0;
+   }
+};
+
+
+extern OBJ_Cat *OBJCategory;
+extern SetRD *GlobalRD;
+extern RCUObjectIndex LiveObjects;
+extern vector<ObjectInstance> Objects;
+extern vector<ObjectInstance> freedObjects;
+extern ObjectCounters *Counters;
+extern vector<ObjectMetadata> ObjectMeta;
+extern PIN_LOCK objects_lock;
+extern vector<ThreadContext *> Threads;
+extern PIN_LOCK counters_lock;           // held while a thread grows its counters, see live_snapshot()
+
+// Runtime control, see control.h: accesses are dropped while the analysis is disabled (the
+// objects are still tracked), and a thread analyzes one in access_sampling of its accesses
+extern std::atomic<bool> analysis_enabled;
+extern std::atomic<UINT64> access_sampling;
+extern UINT64 analysis_resets, last_reset_icount;
+extern bool last_reset_warm;
+
+// Hooks of the driver into the object tracking, NULL when unused.
+// The observers see every allocation and free as it comes in, under objects_lock
+typedef VOID (*ALLOC_OBSERVER)(THREADID tid, ADDRINT start, ADDRINT size, ADDRINT ip, OBJ_ALLOC_TYPE type, const string &libname);
+typedef VOID (*FREE_OBSERVER)(THREADID tid, ADDRINT start);
+// id of the call stack of a new large dynamic object, e.g. MAID's; the object is named after it
+// at report time
+typedef UINT32 (*STACK_CAPTURER)(THREADID tid);
+// allocation site of an allocating call at ip that stays the same across runs, for the profile;
+// without one it is the ip
+typedef string (*SITE_NAMER)(ADDRINT ip);
+
+extern ALLOC_OBSERVER observe_alloc;
+extern FREE_OBSERVER observe_free;
+extern STACK_CAPTURER capture_alloc_stack;
+extern SITE_NAMER name_site;
+
+// whether the next access of tc is analyzed, with the control settings
+inline bool sample_access(ThreadContext *tc)
+{
+   if (!analysis_enabled.load(std::memory_order_relaxed))
+      return false;
+   UINT64 sampling = access_sampling.load(std::memory_order_relaxed);
+   if (sampling <= 1)
+      return true;
+   if (++tc->unsampled < sampling)
+      return false;
+   tc->unsampled = 0;
+   return true;
+}
+
+// Sort function template to provide simple access and default comparison function
+template <typename C, typename F = less<typename C::value_type>> 
+void Sort( C& c, F f = F() )  { sort(begin(c), end(c), f); }
+
+// I want to avoid MACROS, but these MACROS seems like a good use. Any alternatives to do it in pure C++ elegantly?
+// Sort container objectss of class ObjectInstance in DESCENDING ORDER for member key; could be id, start, priority, llc_misses, etc
+#define SORT_OBJECTS_ON_KEY(key) stable_sort(begin(Objects), end(Objects), [] (const ObjectInstance &a, const ObjectInstance &b) {return (a.key) > (b.key);});
+
+// one object of a bulk add, see add_objects()
+struct NewObject {
+   ADDRINT start, size;
+   string libname;
+};
+
+// set up the objects, counters and RDs from the configuration, open OutFile
+VOID InitAnalysis();
+
+// context of a new thread, with its private RD when configured; not yet in Threads
+ThreadContext *new_thread_context(THREADID tid);
+
+OBJ_TYPE getObjectCategory(UINT objId);
+bool is_indexed_object(ADDRINT size, OBJ_ALLOC_TYPE type);
+OBJ_TYPE indexed_object_category(ADDRINT size, OBJ_ALLOC_TYPE type);
+void insert_object(ObjectIndex *draft, ADDRINT start, ADDRINT size, ADDRINT ip, OBJ_ALLOC_TYPE type, string libname, THREADID tid);
+void add_object(ADDRINT start, ADDRINT size, ADDRINT ip, OBJ_ALLOC_TYPE type, string libname, THREADID tid);
+VOID add_objects(const vector<NewObject> &batch, OBJ_ALLOC_TYPE type, THREADID tid);
+bool free_object(ADDRINT addr, THREADID tid, ObjectInstance *freed_object = NULL);
+VOID free_objects(ADDRINT low, ADDRINT high, OBJ_ALLOC_TYPE type, THREADID tid);
+
+VOID analyze_access(ThreadContext *tc, const AccessRecord &rec);
+VOID model_shared_access(ThreadContext *tc, const AccessRecord &rec, UINT set);
+// a batch of one thread's accesses, attributed in batch.id/category; shared gets the shared level counts
+VOID analyze_batch(ThreadContext *tc, ThreadContext *shared, TraceBatch &batch);
+// the two halves of analyze_batch() around the RDs, for a replay that runs the RDs itself
+// and leaves their results in batch.private_rd and batch.rd
+VOID count_batch(ThreadContext *tc, const TraceBatch &batch);
+VOID account_batch(ThreadContext *tc, ThreadContext *shared, const TraceBatch &batch);
+
+UINT get_cur_access_size(ADDRINT addr, UINT size);
+UINT get_num_cachelines_for_access(ADDRINT addr, UINT size);
+
+// the RD report of a profile between the two cache sizes; sets l1_misses and l2_misses
+VOID Display_Global_RD_Distribution(ofstream &rdFile, const Profile &profile, UINT log2_start_cache_size, UINT log2_end_cache_size);
+VOID print_object_profile(const string &prefix, const Profile &profile);
+VOID print_thread_profile(const string &prefix);
+
+// the counters of all threads for the monitors, see live-stats.h; may run on any thread while
+// the analysis goes on, number and final are left to the publisher
+VOID live_snapshot(LiveSnapshot &snapshot);
+
+// merge the threads and write every report; the analysis must be complete
+VOID ReportAnalysis();
+
+// the reports of the analysis so far, the main one to prefix, without ending it; and zeroing
+// every count and the RD state, the objects stay. A warm reset keeps the lines of the RDs, so
+// that the accesses after it are no cold misses. Nothing may run the analysis meanwhile
+VOID SnapshotAnalysis(const string &prefix);
+VOID ResetAnalysis(bool warm = false);
+
+// in the child of a fork: the reports go to prefix and the analysis starts over, the objects live
+// at the fork stay with zero counts. Only the forking thread runs in the child
+VOID ForkAnalysis(const string &prefix);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef _SIEVE_PORT_H
+#define _SIEVE_PORT_H
+
+// The analysis core (RD engines, object store, trace format, reports) builds both into the
+// Pin tool and, with SPM_SIEVE_NO_PIN, into native programs such as spm-sieve-replay.
+// Natively this header supplies the few Pin types and calls the core uses.
+
+#ifdef SPM_SIEVE_NO_PIN
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+typedef uint64_t UINT64; typedef int64_t INT64;
+typedef uint32_t UINT32; typedef int32_t INT32;
+typedef uint16_t UINT16; typedef int16_t INT16;
+typedef uint8_t UINT8;   typedef int8_t INT8;
+typedef unsigned int UINT; typedef int INT;
+typedef uintptr_t ADDRINT;
+typedef void VOID; typedef bool BOOL; typedef char CHAR;
+typedef size_t USIZE;
+typedef UINT32 THREADID;
+
+#define TRUE true
+#define FALSE false
+#define INVALID_THREADID ((THREADID)-1)
+
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+typedef pthread_mutex_t PIN_LOCK;
+inline VOID PIN_InitLock(PIN_LOCK *lock) { pthread_mutex_init(lock, NULL); }
+inline VOID PIN_GetLock(PIN_LOCK *lock, INT32 owner) { pthread_mutex_lock(lock); }
+inline VOID PIN_ReleaseLock(PIN_LOCK *lock) { pthread_mutex_unlock(lock); }
+inline VOID PIN_Yield() { sched_yield(); }
+inline VOID PIN_Sleep(UINT32 ms) { usleep(ms * 1000); }
+
+// instruction count of the record being replayed, maintained by the driver
+extern UINT64 replay_icount;
+inline ADDRINT get_inscount() { return replay_icount; }
+inline VOID activate_inscount() { }
+
+#else
+
+#include "pin.H"
+#include "../InstLib/instlib.H"
+
+using namespace INSTLIB;
+
+extern ICOUNT icount;
+ADDRINT inline get_inscount() { return icount.Count(); }
+VOID inline activate_inscount() { icount.Activate(); }
+
+#endif
+
+#endif
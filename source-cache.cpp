@@ -0,0 +1,82 @@
+//
+//  Indexed source files for MAID, see source-cache.h
+//
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "source-cache.h"
+
+SourceCache::~SourceCache()
+{
+    while (!files.empty())
+        evict();
+}
+
+VOID SourceCache::evict()
+{
+    auto it = files.find(recent.back());
+    if (it->second.data)
+        munmap((VOID *)it->second.data, it->second.bytes);
+    files.erase(it);
+    recent.pop_back();
+    evictions++;
+}
+
+SourceCache::SourceFile &SourceCache::open(const string &path)
+{
+    auto it = files.find(path);
+    if (it != files.end()) {
+        recent.splice(recent.begin(), recent, it->second.recent);
+        return it->second;
+    }
+
+    if (files.size() >= max_files)
+        evict();
+    opens++;
+
+    SourceFile &file = files[path];
+    recent.push_front(path);
+    file.recent = recent.begin();
+    file.data = NULL;
+    file.bytes = 0;
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0)
+        return file;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        VOID *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mem != MAP_FAILED) {
+            file.data = (const char *)mem;
+            file.bytes = st.st_size;
+        }
+    }
+    close(fd);
+
+    // the line starts, the last line may have no newline
+    for (size_t offset = 0; offset < file.bytes; ) {
+        file.starts.push_back(offset);
+        const char *newline = (const char *)memchr(file.data + offset, '\n', file.bytes - offset);
+        offset = newline ? newline - file.data + 1 : file.bytes;
+    }
+    return file;
+}
+
+string SourceCache::line(const string &path, INT32 lineno)
+{
+    lookups++;
+    if (lineno <= 0)
+        return "";
+    SourceFile &file = open(path);
+    if ((size_t)lineno > file.starts.size())
+        return "";
+
+    size_t start = file.starts[lineno - 1];
+    size_t end = (size_t)lineno < file.starts.size() ? file.starts[lineno] - 1 : file.bytes;
+    if (end > start && file.data[end - 1] == '\n')
+        end--;
+    return string(file.data + start, end - start);
+}
@@ -0,0 +1,47 @@
+#ifndef _SOURCE_CACHE_H
+#define _SOURCE_CACHE_H
+
+// Lines of the source files MAID prints and matches allocations in. A file is mapped once
+// and indexed by the offsets of its line starts, so a line is found in constant time however
+// often the file is asked for. At most max_files files stay mapped, the least recently used
+// one is unmapped first; a file that cannot be read is remembered as empty the same way.
+// Not thread safe, MAID calls it under objects_lock.
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+
+#include "sieve-port.h"
+
+using namespace std;
+
+#define SOURCE_CACHE_FILES 64
+
+class SourceCache {
+   struct SourceFile {
+      const char *data;                  // NULL when empty or unreadable
+      size_t bytes;
+      vector<size_t> starts;             // offset of every line
+      list<string>::iterator recent;
+   };
+
+   size_t max_files;
+   list<string> recent;                  // the mapped files, most recently used first
+   unordered_map<string, SourceFile> files;
+
+   SourceFile &open(const string &path);
+   VOID evict();
+
+public:
+   UINT64 lookups, opens, evictions;
+
+   SourceCache(size_t _max_files = SOURCE_CACHE_FILES) :
+      max_files(MAX(_max_files, 1)), recent(), files(), lookups(0), opens(0), evictions(0) { }
+   ~SourceCache();
+
+   // line lineno of path, counted from 1, without its end of line; "" when there is none
+   string line(const string &path, INT32 lineno);
+};
+
+#endif
@@ -9,276 +9,377 @@
 
 ICOUNT icount;
 
-// GLOBAL VARIABLES START
-
-OBJ_Cat *OBJCategory;
-
-// Global Reuse Distance Object
-SetRD *GlobalRD;
+// Contains knobs to filter out things to instrument
+FILTER filter;
 
-// Store all objects here
-vector<ObjectInstance> Objects;
+CONTROL control(false, "controller_");
 
-// Blocks which have been freed; stored separately to ease searching in the currently active list
-vector<ObjectInstance> freedObjects;
-
-// Passed an Object Id fetch its Category
-OBJ_TYPE getObjectCategory(UINT objId)
+// GLOBAL VARIABLES START
+// the analysis state (objects, counters, RDs) lives in sieve-core.cpp
+
+// Globally ordered stream of all threads' accesses, feeding GlobalRD and the per category RDs
+OrderedAccessMerger *SharedStream;
+
+// Context of every thread, reached through the Pin TLS key
+TLS_KEY tls_key;
+
+// Writer of the binary trace in record mode
+TraceWriter *Recorder;
+
+// Context that drains the shared stream at Fini/detach, when no application thread may be around
+ThreadContext *FiniContext;
+
+// Asynchronous mode: application thread contexts in ring registration order, and the workers draining them
+#define MAX_ASYNC_THREADS 4096
+ThreadContext *AsyncContexts[MAX_ASYNC_THREADS];
+std::atomic<UINT> async_count(0);
+vector<AnalysisWorker *> AsyncWorkers;
+std::atomic<bool> async_stop(false);
+bool async_running = false;
+
+// Shard mode (-rd-shards): the merged stream is modeled by shard workers, one queue each
+ShardRouter *Shards;
+vector<AnalysisWorker *> ShardWorkers;
+std::atomic<bool> shard_stop(false);
+bool shards_running = false;
+
+// Live statistics (-live): published by an internal thread, the analysis never waits for it
+LivePublisher *Live;
+PIN_THREAD_UID live_uid;
+std::atomic<bool> live_stop(false);
+bool live_running = false;
+
+// Control channel (-control): read by an internal thread, which pauses the internal workers
+// between two drains for the commands that change the analysis state. The same thread ends the
+// warm-up (-start-icount) and asks for the detach at the budget (-end-icount, -detach-seconds)
+ControlChannel *Control;
+PIN_THREAD_UID control_uid;
+std::atomic<bool> control_stop(false);
+bool control_running = false;
+std::atomic<bool> workers_pause(false);
+std::atomic<UINT> workers_paused(0);
+bool warmup_pending = false, detach_budget = false;
+std::atomic<bool> detach_requested(false), detaching(false);
+UINT64 warmup_end_icount = 0, detach_icount = 0;
+
+// Forked children write <name>.<pid>, see AfterForkInChild()
+bool forked = false;
+NATIVE_PID fork_parent;
+
+// Attached to a running process (pin -pid): the heap blocks allocated before, see heap-scan.h
+bool attached = false;
+UINT64 heap_scan_blocks = 0, heap_scan_bytes = 0;
+
+// Data symbols of the images, see read_static_objects(); the executable's TLS ones have a copy per thread.
+// Their tables come from Symbols, kept across runs with -symbol-cache
+SymbolCache *Symbols;
+UINT64 static_objects = 0;
+double static_object_seconds = 0;
+vector<ElfObject> ExeTLS;
+ADDRINT exe_tls_offset = 0;
+string exe_name;
+
+ThreadContext *get_context(THREADID tid)
 {
-   OBJ_TYPE type;
-   // find which set this belongs to
-   if(objId == 0)
-      type = SMALL_DYNAMIC;
-   else if(objId == 1)
-      type = OBJ_STACK;
-   else if(OBJCategory[LARGE_STATIC].objects.find(objId) != OBJCategory[LARGE_STATIC].objects.end())
-      type = LARGE_STATIC;
-   else if(OBJCategory[SMALL_STATIC].objects.find(objId) != OBJCategory[SMALL_STATIC].objects.end())
-      type = SMALL_STATIC;
-   else if(OBJCategory[LARGE_DYNAMIC].objects.find(objId) != OBJCategory[LARGE_DYNAMIC].objects.end())
-      type = LARGE_DYNAMIC;
-   else {
-      cerr << "Unable to Find Object " << objId << "in any Object Category\n";
-      exit(1);
-   }
-
-   if((type == LARGE_DYNAMIC) && (KnobDemarcateLargeObject.Value() == false))
-      type = LARGE_STATIC;
-
-   return type;
+    return static_cast<ThreadContext *>(PIN_GetThreadData(tls_key, tid));
 }
 
-// Sort function template to provide simple access and default comparison function
-template <typename C, typename F = less<typename C::value_type>> 
-void Sort( C& c, F f = F() )  { sort(begin(c), end(c), f); }
-
-// I want to avoid MACROS, but these MACROS seems like a good use. Any alternatives to do it in pure C++ elegantly?
-// Sort container objectss of class ObjectInstance in DESCENDING ORDER for member key; could be id, start, priority, llc_misses, etc
-#define SORT_OBJECTS_ON_KEY(key) stable_sort(begin(Objects), end(Objects), [] (const ObjectInstance &a, const ObjectInstance &b) {return (a.key) > (b.key);});
+// the name of an output file of this process
+string process_output(const string &name)
+{
+    if (!forked && !KnobOutputPid.Value())
+        return name;
+    ostringstream named;
+    named << name << "." << PIN_GetPid();
+    return named.str();
+}
 
-#define COMPUTE_PRIORITY(exp) for_each( begin(Objects), end(Objects), [] (ObjectInstance &a) {a.priority = (exp);});
+INT32 FilterUsage()
+{
+    cerr <<
+        ":: FILTER OPTIONS :: \n"
+        "\n";
 
+    cerr << KNOB_BASE::StringKnobSummary() << endl;
+    return -1;
+}
 
-// compare two malloc objects entry based on their starting address
-bool compare_start_address(const ObjectInstance & lhs, const ObjectInstance & rhs) 
+// name the objects not named yet after the array their stack assigns, symbolizing each stack once
+VOID name_stack_objects()
 {
-    return lhs.start < rhs.start;
+    PIN_GetLock(&objects_lock, 1);
+    for (auto &meta : ObjectMeta)
+        if (meta.stack_id != NO_STACK && meta.image_name.empty())
+            meta.image_name = MAID_get_array_symbol(meta.stack_id);
+    PIN_ReleaseLock(&objects_lock);
 }
 
-// compare two malloc objects entry based on their first access timestamp
-bool compare_first_access(const ObjectInstance & lhs, const ObjectInstance & rhs) 
+// maid.out: the distinct stacks, then the stack of every object that has one
+VOID write_maid()
 {
-    return lhs.first_access < rhs.first_access;
+    MAID_print_stacks(MaidFile);
+    for (UINT id = 0; id < ObjectMeta.size(); id++)
+        if (ObjectMeta[id].stack_id != NO_STACK)
+            MaidFile << "OBJECT_" << id << " STACK_" << ObjectMeta[id].stack_id << endl;
 }
 
-// TODO: cleanup this function also returns the symbol name
-string dump_callstack(ADDRINT size, ADDRINT ip)
+// allocation site as image+offset, the same in every run of the binary whatever its load address
+string name_alloc_site(ADDRINT ip)
 {
-    if (enable_maid)
-    {
-        // TODO: Some Call stacks miss out on the .plt before malloc - need to investigate
-        // Get the Backtrace for this malloc from MAID
-        MaidFile << "START_OBJECTID_" << object_count << endl;
-        MaidFile << "Malloc - Stack dump initiated " << " pc=" << (void*)ip << " size=" << size << endl;
-        MAID_print_callstack(MaidFile);
-        MaidFile << "END_OBJECT" << endl;
-
-        return MAID_get_array_symbol();
-    }
-    return "";
+    PIN_LockClient();
+    IMG img = IMG_FindByAddress(ip);
+    ostringstream site;
+    if (IMG_Valid(img))
+        site << StripPath(IMG_Name(img)) << "+0x" << hex << (ip - IMG_LowAddress(img));
+    else
+        site << "0x" << hex << ip;
+    PIN_UnlockClient();
+    return site.str();
 }
 
-// add an object to the global object vector if it meets the size criteria
-void add_object(ADDRINT start, ADDRINT size, ADDRINT ip, string type, string libname)
+// Record mode: the accesses of the thread so far go to the trace ahead of its next event
+void record_event(THREADID tid)
 {
-    // check if the entry already exists, maybe malloc got called twice for some reason
-    auto it = lower_bound(Objects.begin(), Objects.end(), ObjectInstance(start, 0, 0), compare_start_address);
-    if ( it != Objects.end() && it->start == start ) {
-        DEBUG_PRINT("PIN: Object seen multiple times ID: " << it->id << endl);
-        return;
-    }
-
-    string malloc_symbol = "";
-    // new block identified; call MAID to print call stack for later identification of the object
-    if((size > KnobLargeObjectSize.Value()) && (type.compare(NON_DYNAMIC) != 0)) {
-       malloc_symbol = dump_callstack(size, ip);
-       libname = "";
-    }
-
-    if((size > KnobLargeObjectSize.Value()) || (type.compare(NON_DYNAMIC) == 0)) {
-       ObjectInstance tmp = ObjectInstance(start, size, ip);
-       tmp.type = type;
-       // the symbol for a static array has already been added to libname string in read_static_objects()
-       tmp.image_name = malloc_symbol + libname;
-
-       Objects.insert(it, tmp);
-
-       object_count++;
-       DEBUG_PRINT("PIN: Added " << type << " Object: Size: " << dec << size 
-               << " Start addr: " << hex << start << dec << endl);
-    }
-
-
-    if(size > KnobLargeObjectSize.Value()) {
-       if(type.compare(NON_DYNAMIC) == 0) {
-          OBJCategory[LARGE_STATIC].objects.insert(object_count - 1);
-          OBJCategory[LARGE_STATIC].size += size;
-       }
-       else {
-          OBJCategory[LARGE_DYNAMIC].objects.insert(object_count - 1);
-          OBJCategory[LARGE_DYNAMIC].size += size;
-       }
-    }
-    else {
-       if(type.compare(NON_DYNAMIC) == 0) {
-          OBJCategory[SMALL_STATIC].objects.insert(object_count - 1);
-          OBJCategory[SMALL_STATIC].size += size;
-       }
-       // SMALL_DYNAMIC not tracked
-       else {
-          static UINT dyn_blk_cnt = 0;
-          dyn_blk_cnt++;
-          OBJCategory[SMALL_DYNAMIC].objects.insert(dyn_blk_cnt - 1);
-          OBJCategory[SMALL_DYNAMIC].size += size;
-       }
-    }
-
-    return;
+    ThreadContext *tc = (tid == INVALID_THREADID) ? NULL : get_context(tid);
+    if (tc && tc->trace && !tc->trace->empty())
+        tc->trace = Recorder->submit(tc->trace, get_inscount());
 }
 
-// stack to match malloc to its return
-vector <ADDRINT> malloc_stack;
-vector <ADDRINT> calloc_stack;
-
-// Function called before entry to malloc
-VOID BeforeMalloc(CHAR * name, ADDRINT size, ADDRINT ip)
+// Record mode hooks of the object tracking; the replay repeats the tracking, so the trace
+// gets every event as it came in
+VOID record_alloc(THREADID tid, ADDRINT start, ADDRINT size, ADDRINT ip, OBJ_ALLOC_TYPE type, const string &libname)
 {
-    // start address is not yet known, will be known after exit
-    malloc_stack.push_back(size);
-    DEBUG_PRINT("PIN: Before Malloc: Size: " <<  dec << size <<  " Return IP: " << hex << ip << dec << endl);
+    record_event(tid);
+    Recorder->alloc_event(tid, get_inscount(), start, size, ip, type, libname);
 }
 
-// function called after exit of malloc
-VOID AfterMalloc(ADDRINT ret, ADDRINT ip)
+VOID record_free(THREADID tid, ADDRINT start)
 {
-    // Get the size of the matching malloc from the stack
-    ADDRINT size = malloc_stack.back();
-    malloc_stack.pop_back();
-
-    add_object(ret, size, ip, MALLOC, "dummy");
+    record_event(tid);
+    Recorder->free_event(tid, get_inscount(), start);
 }
 
-// Function called before entry to calloc
-VOID BeforeCalloc(CHAR * name, ADDRINT nmemb, ADDRINT membsize, ADDRINT ip)
+// An allocation call entered; the start address is not yet known, will be known after exit.
+// The pending calls not enclosing it have returned without their exit being seen (a longjmp, a
+// tail call out of the routine): they are deeper or their return address is gone from the stack.
+// A call inside a pending one is nested, e.g. malloc in operator new, the outer call is reported
+static VOID begin_alloc(ThreadContext *tc, PendingAlloc alloc)
 {
-    ADDRINT size = nmemb*membsize;
-
-    // start address is not yet known, will be known after exit
-    calloc_stack.push_back(size);
-    DEBUG_PRINT("PIN: Before Malloc: Size: " <<  dec << size <<  " Return IP: " << hex << ip << dec << endl);
+    vector<PendingAlloc> &pending = tc->alloc_stack;
+    while (!pending.empty()) {
+        ADDRINT ret_ip = 0;
+        if (pending.back().sp > alloc.sp
+            && PIN_SafeCopy(&ret_ip, (VOID *)pending.back().sp, sizeof(ret_ip)) == sizeof(ret_ip)
+            && ret_ip == pending.back().ip)
+            break;
+        pending.pop_back();
+    }
+    alloc.nested = !pending.empty();
+    pending.push_back(alloc);
 }
 
-// function called after exit of calloc
-VOID AfterCalloc(ADDRINT ret, ADDRINT ip)
+// The allocation call returning at stack pointer sp, false when it was not seen entering
+static bool end_alloc(ThreadContext *tc, ADDRINT sp, PendingAlloc &alloc)
 {
-    // Get the size of the matching calloc from the stack
-    ADDRINT size = calloc_stack.back();
-    calloc_stack.pop_back();
-
-    add_object(ret, size, ip, CALLOC, "dummy");
+    vector<PendingAlloc> &pending = tc->alloc_stack;
+    while (!pending.empty() && pending.back().sp < sp)
+        pending.pop_back();
+    if (pending.empty() || pending.back().sp != sp)
+        return false;
+    alloc = pending.back();
+    pending.pop_back();
+    return true;
 }
 
-vector < pair<ADDRINT, ADDRINT> > memalign_stack;
+// Function called before entry to malloc, realloc, aligned_alloc, memalign, posix_memalign,
+// operator new and mmap; arg as in PendingAlloc
+VOID BeforeAlloc(UINT32 type, ADDRINT size, ADDRINT arg, ADDRINT ip, ADDRINT sp, THREADID tid)
+{
+    ThreadContext *tc = get_context(tid);
+    begin_alloc(tc, PendingAlloc((OBJ_ALLOC_TYPE)type, size, arg, ip, sp));
+
+    // realloc releases the old block before it returns, and a malloc of another thread may get the
+    // address right away: the object leaves the index now, and is put back if the call fails
+    PendingAlloc &alloc = tc->alloc_stack.back();
+    if (type == ALLOC_REALLOC && arg && !alloc.nested)
+        free_object(arg, tid, &alloc.taken);
+    DEBUG_PRINT("PIN: Before " << AllocTypeName[type] << ": Size: " <<  dec << size <<  " Return IP: " << hex << ip << dec << endl);
+}
 
-// Function called before entry to malloc
-VOID BeforePosix_memalign(ADDRINT size, ADDRINT ret, ADDRINT ip)
+// Function called before entry to calloc
+VOID BeforeCalloc(ADDRINT nmemb, ADDRINT membsize, ADDRINT ip, ADDRINT sp, THREADID tid)
 {
-    // start address is not yet known, will be known after exit
-    memalign_stack.push_back(make_pair(size, ret));
-    DEBUG_PRINT("PIN: Before Malloc: Size: " <<  dec << size <<  " Return IP: " << hex << ip << dec << endl);
+    BeforeAlloc(ALLOC_CALLOC, nmemb*membsize, 0, ip, sp, tid);
 }
 
-// function called after exit of malloc
-VOID AfterPosix_memalign(ADDRINT ip)
+// Function called before entry to mmap, only anonymous mappings are objects: a file mapped
+// by the application is not data it allocated
+VOID BeforeMmap(ADDRINT size, ADDRINT flags, ADDRINT ip, ADDRINT sp, THREADID tid)
 {
-    // Get the size of the matching malloc from the stack
-    ADDRINT size = memalign_stack.back().first;
-    ADDRINT ret  = memalign_stack.back().second;
-    // TODO: read the return value
-    //ADDRINT ret  = (long int *) *((long int*)memalign_stack.back().second);
-    memalign_stack.pop_back();
+    if (flags & MAP_ANONYMOUS)
+        BeforeAlloc(ALLOC_MMAP, size, 0, ip, sp, tid);
+}
 
-    string tmp = "dummy";
+// function called after exit of an allocation call, ret is its return value
+VOID AfterAlloc(ADDRINT ret, ADDRINT sp, THREADID tid)
+{
+    // Get the size of the matching call from the stack
+    PendingAlloc alloc(ALLOC_DEFAULT, 0, 0, 0, 0);
+    if (!end_alloc(get_context(tid), sp, alloc) || alloc.nested)
+        return;
 
-    add_object(ret, size, ip, POSIX_MEMALIGN, StripPath(tmp));
+    ADDRINT start = ret;
+    switch (alloc.type) {
+    case ALLOC_POSIX_MEMALIGN:
+        // ret is the error number, the block is stored at memptr
+        start = 0;
+        if (ret == 0)
+            PIN_SafeCopy(&start, (VOID *)alloc.arg, sizeof(start));
+        break;
+    case ALLOC_REALLOC:
+        // the old block was freed at entry; it is still there if the call failed, realloc(p, 0) frees p
+        if (!ret && alloc.size && alloc.taken.start)
+            add_object(alloc.taken.start, alloc.taken.size, alloc.taken.callsiteIP, alloc.taken.type, "dummy", tid);
+        break;
+    case ALLOC_MMAP:
+        if (ret == (ADDRINT)MAP_FAILED)
+            start = 0;
+        break;
+    default:
+        break;
+    }
+    if (start)
+        add_object(start, alloc.size, alloc.ip, alloc.type, "dummy", tid);
 }
 
-// at free, remove entry from ObjectInstance vector and insert into freed blocks
-VOID BeforeFree(CHAR * name, ADDRINT addr)
+// at free, remove entry from the object index and insert into freed blocks
+VOID BeforeFree(CHAR * name, ADDRINT addr, THREADID tid)
 {
     if (0==addr) return;
     DEBUG_PRINT("PIN: Freeing: " << hex << addr << dec << endl);
-    vector<class ObjectInstance>::iterator it;
-
-    // Find this block in objects
-    it = lower_bound(Objects.begin(), Objects.end(), ObjectInstance(addr, 0, 0), compare_start_address);
-    if(it == Objects.end() || it->start != addr) {
-        DEBUG_PRINT("PIN: Freed block does not exist in malloc entries. Addr: " << hex << addr << dec << endl);
-        return;
-    }
 
-    it->valid = false;
-    DEBUG_PRINT("PIN: Freed: " << hex << addr << dec << endl);
-
-    // copy it to a new list; will be needed later
-    freedObjects.insert(freedObjects.end(), *it);
+    free_object(addr, tid);
+}
 
-    // erase it from the Objects list
-    Objects.erase(it);
+// munmap frees the mappings in the range
+VOID BeforeMunmap(ADDRINT addr, ADDRINT size, THREADID tid)
+{
+    free_objects(addr, addr + size, ALLOC_MMAP, tid);
 }
 
 
-// Read static Objects from the binary and add to the list of Objects
-// Static Objects are found by looking up symbols of type OBJECT using readelf
-void read_static_objects(string program_name)
+static double now_seconds()
 {
-    char buffer [L_tmpnam];
-    if (!tmpnam(buffer)) exit(1);
-    string tempfile = string(buffer);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
-    //string cmd = "readelf -s " + program_name + " | grep OBJECT | cut -d: -f 2 > " + tempfile;
-    string cmd = "readelf -s " + program_name + " | grep OBJECT > " + tempfile;
-    DEBUG_PRINT("PIN: Running cmd: " << cmd << endl);
-    int ret = system(cmd.c_str());
-    if (-1 == ret) exit(-1);
+// Read static Objects from an image and add to the list of Objects: its OBJECT symbols, see
+// elf-symbols.h, moved by the load offset. The TLS ones of the executable are kept for the threads
+VOID read_static_objects(IMG img)
+{
+    string image_name = IMG_Name(img);
+    // [vdso] and the like have no file
+    if (image_name.empty() || image_name[0] == '[')
+        return;
 
-    string line;
-    ifstream fin (tempfile.c_str());
+    double start = now_seconds();
+    SymbolTable *table = Symbols->open(image_name);
+    if (!table)
+        return;
 
-    while (fin.good())
-    {
-        getline(fin, line);
-        if (0 == line.size() ) continue;
+    ADDRINT bias = IMG_LoadOffset(img);
+    Symbols->load(table, image_name, IMG_LowAddress(img), IMG_HighAddress(img), bias);
+    string suffix = " @ " + StripPath(image_name);
+    vector<NewObject> batch;
+    for (UINT64 i = 0; i < table->object_count(); i++) {
+        const SymbolRecord &symbol = table->object(i);
+        if (!symbol.tls)
+            batch.push_back(NewObject{symbol.value + bias, symbol.size, table->name(symbol.name) + suffix});
+        else if (IMG_IsMainExecutable(img))
+            ExeTLS.push_back(ElfObject{symbol.value, symbol.size, table->name(symbol.name), true});
+    }
+    if (IMG_IsMainExecutable(img)) {
+        exe_tls_offset = table->tls_offset();
+        exe_name = StripPath(image_name);
+    }
+    add_objects(batch, ALLOC_STATIC, PIN_ThreadId());
 
-        // "readelf -s" entries look like this
-        //  Num:    Value          Size Type    Bind   Vis      Ndx Name
-        //  37: 000000000071e640     4 OBJECT  GLOBAL DEFAULT   26 __svml_feature_flag
+    static_objects += batch.size();
+    static_object_seconds += now_seconds() - start;
+}
 
-        // split string on whitespace
-        vector<string> toks = split(line);
+// the copy of the executable's TLS objects of a thread, below its thread pointer (fs base)
+VOID add_tls_objects(ThreadContext *tc, ADDRINT thread_pointer)
+{
+    if (ExeTLS.empty() || thread_pointer == 0 || tc->tls_block)
+        return;
 
-        UINT64 start = strtoul(toks[1].c_str(), 0, 16); // base = 16; start address is hex but without the 0x prefix
-        UINT64 size  = strtoul(toks[2].c_str(), 0, 0);  // base = 0; size value can be hex or decimal with appropriate prefix
-        string symbol_name = toks[toks.size()-1];
+    tc->tls_block = thread_pointer - exe_tls_offset;
+    string suffix = " [thread " + to_string(tc->tid) + "] @ " + exe_name;
+    vector<NewObject> batch;
+    for (auto &symbol : ExeTLS)
+        batch.push_back(NewObject{tc->tls_block + symbol.value, symbol.size, symbol.name + suffix});
+    add_objects(batch, ALLOC_STATIC, tc->tid);
+}
 
-        // Add the static array to the list of known objects
-        add_object(start, size, 0, "static", symbol_name + " @ " + StripPath(program_name));
-    }
+// the main thread has no TLS yet when it starts, it has by main()
+VOID MainEntry(THREADID tid, ADDRINT thread_pointer)
+{
+    add_tls_objects(get_context(tid), thread_pointer);
+}
 
-    remove(tempfile.c_str());
+// dlclose: the static objects of the image are freed. At exit the images stay, the reports
+// and the MAID stacks still need them
+VOID ImageUnload(IMG img, VOID *v)
+{
+    if (PIN_IsProcessExiting())
+        return;
+    Symbols->unload(IMG_LowAddress(img));
+    free_objects(IMG_LowAddress(img), IMG_HighAddress(img) + 1, ALLOC_STATIC, PIN_ThreadId());
 }
 
-// Instrument the malloc, free and posix_memalign functions
+// The allocation routines: the argument holding the size and the one kept in PendingAlloc.arg,
+// -1 for none. calloc and mmap have hooks of their own
+struct AllocRoutine {
+    const CHAR *name;
+    OBJ_ALLOC_TYPE type;
+    INT32 size_arg, arg;
+};
+
+static const AllocRoutine AllocRoutines[] = {
+    { MALLOC,          ALLOC_MALLOC,         0, -1 },
+    { CALLOC,          ALLOC_CALLOC,         1, -1 },
+    { REALLOC,         ALLOC_REALLOC,        1,  0 },
+    { POSIX_MEMALIGN,  ALLOC_POSIX_MEMALIGN, 2,  0 },
+    { ALIGNED_ALLOC,   ALLOC_ALIGNED_ALLOC,  1, -1 },
+    { MEMALIGN,        ALLOC_ALIGNED_ALLOC,  1, -1 },
+    { MMAP,            ALLOC_MMAP,           1, -1 },
+    { MMAP64,          ALLOC_MMAP,           1, -1 },
+    // operator new and new[], plain, nothrow, aligned and both (x86-64 mangling)
+    { "_Znwm",                              ALLOC_NEW, 0, -1 },
+    { "_Znam",                              ALLOC_NEW, 0, -1 },
+    { "_ZnwmRKSt9nothrow_t",                ALLOC_NEW, 0, -1 },
+    { "_ZnamRKSt9nothrow_t",                ALLOC_NEW, 0, -1 },
+    { "_ZnwmSt11align_val_t",               ALLOC_NEW, 0, -1 },
+    { "_ZnamSt11align_val_t",               ALLOC_NEW, 0, -1 },
+    { "_ZnwmSt11align_val_tRKSt9nothrow_t", ALLOC_NEW, 0, -1 },
+    { "_ZnamSt11align_val_tRKSt9nothrow_t", ALLOC_NEW, 0, -1 },
+};
+
+// free and operator delete, delete[] with their sized, nothrow and aligned variants
+static const CHAR *FreeRoutines[] = {
+    FREE,
+    "_ZdlPv", "_ZdaPv",
+    "_ZdlPvm", "_ZdaPvm",
+    "_ZdlPvRKSt9nothrow_t", "_ZdaPvRKSt9nothrow_t",
+    "_ZdlPvSt11align_val_t", "_ZdaPvSt11align_val_t",
+    "_ZdlPvmSt11align_val_t", "_ZdaPvmSt11align_val_t",
+    "_ZdlPvSt11align_val_tRKSt9nothrow_t", "_ZdaPvSt11align_val_tRKSt9nothrow_t",
+};
+
+// Instrument the allocation and free functions
 // And find all static mem blocks in Images
 VOID Image(IMG img, VOID *v)
 {
@@ -286,87 +387,103 @@ VOID Image(IMG img, VOID *v)
     //DEBUG_PRINT("PIN: Image name " << IMG_Name(img) << endl);
     cerr << "PIN: Image name " << image_name << endl;
 
-    // Initialize ObjectInstance entries for static blocks in the binary
-    if(IMG_Type(img) != IMG_TYPE_SHAREDLIB)
-       read_static_objects(image_name);
+    // Initialize ObjectInstance entries for static blocks in the image
+    read_static_objects(img);
+
+    if (IMG_IsMainExecutable(img) && !ExeTLS.empty()) {
+        RTN mainRtn = RTN_FindByName(img, "main");
+        if (RTN_Valid(mainRtn)) {
+            RTN_Open(mainRtn);
+            RTN_InsertCall(mainRtn, IPOINT_BEFORE, (AFUNPTR)MainEntry,
+                    IARG_THREAD_ID, IARG_REG_VALUE, REG_SEG_FS_BASE, IARG_END);
+            RTN_Close(mainRtn);
+        }
+    }
 
     // Instrument main for MAID
     //if (enable_maid)
         //MAID_Instrument_main(img);
 
-    // instrument MALLOC
-    RTN mallocRtn = RTN_FindByName(img, MALLOC);
-    if (RTN_Valid(mallocRtn))
-    {
-        cerr << "PIN: FOUND Routine " << RTN_Name(mallocRtn) << endl;
-        RTN_Open(mallocRtn);
-
-        // Instrument malloc() to print the input argument value and the return value.
-        RTN_InsertCall(mallocRtn, IPOINT_BEFORE, (AFUNPTR)BeforeMalloc,
-                IARG_ADDRINT, MALLOC,
-                IARG_FUNCARG_ENTRYPOINT_VALUE, 0,  //malloc size
-                IARG_ADDRINT, IARG_RETURN_IP,      // callsite return IP
-                IARG_END);
-        RTN_InsertCall(mallocRtn, IPOINT_AFTER, (AFUNPTR)AfterMalloc,
+    // instrument the allocation routines, once per address: aliases like mmap and mmap64 are found
+    // under every name
+    set<ADDRINT> done;
+    for (const AllocRoutine &routine : AllocRoutines) {
+        RTN rtn = RTN_FindByName(img, routine.name);
+        if (!RTN_Valid(rtn) || !done.insert(RTN_Address(rtn)).second)
+            continue;
+        cerr << "PIN: FOUND Routine " << RTN_Name(rtn) << endl;
+        RTN_Open(rtn);
+
+        // the input arguments at entry, the return value at exit
+        if (routine.type == ALLOC_CALLOC)
+            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)BeforeCalloc,
+                    IARG_FUNCARG_ENTRYPOINT_VALUE, 0,  //calloc number of members
+                    IARG_FUNCARG_ENTRYPOINT_VALUE, 1,  //calloc size of members
+                    IARG_RETURN_IP,                    // callsite return IP
+                    IARG_REG_VALUE, REG_STACK_PTR,
+                    IARG_THREAD_ID,
+                    IARG_END);
+        else if (routine.type == ALLOC_MMAP)
+            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)BeforeMmap,
+                    IARG_FUNCARG_ENTRYPOINT_VALUE, 1,  // length
+                    IARG_FUNCARG_ENTRYPOINT_VALUE, 3,  // flags
+                    IARG_RETURN_IP,
+                    IARG_REG_VALUE, REG_STACK_PTR,
+                    IARG_THREAD_ID,
+                    IARG_END);
+        else if (routine.arg < 0)
+            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)BeforeAlloc,
+                    IARG_UINT32, routine.type,
+                    IARG_FUNCARG_ENTRYPOINT_VALUE, routine.size_arg,
+                    IARG_ADDRINT, 0,
+                    IARG_RETURN_IP,
+                    IARG_REG_VALUE, REG_STACK_PTR,
+                    IARG_THREAD_ID,
+                    IARG_END);
+        else
+            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)BeforeAlloc,
+                    IARG_UINT32, routine.type,
+                    IARG_FUNCARG_ENTRYPOINT_VALUE, routine.size_arg,
+                    IARG_FUNCARG_ENTRYPOINT_VALUE, routine.arg,
+                    IARG_RETURN_IP,
+                    IARG_REG_VALUE, REG_STACK_PTR,
+                    IARG_THREAD_ID,
+                    IARG_END);
+        RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)AfterAlloc,
                 IARG_FUNCRET_EXITPOINT_VALUE,
+                IARG_REG_VALUE, REG_STACK_PTR,
+                IARG_THREAD_ID,
                 IARG_END);
 
-        RTN_Close(mallocRtn);
+        RTN_Close(rtn);
     }
 
-    // instrument CALLOC
-    RTN callocRtn = RTN_FindByName(img, CALLOC);
-    if (RTN_Valid(callocRtn))
-    {
-        cerr << "PIN: FOUND Routine " << RTN_Name(callocRtn) << endl;
-        RTN_Open(callocRtn);
-
-        // Instrument calloc() to print the input argument value and the return value.
-        RTN_InsertCall(callocRtn, IPOINT_BEFORE, (AFUNPTR)BeforeCalloc,
-                IARG_ADDRINT, CALLOC,
-                IARG_FUNCARG_ENTRYPOINT_VALUE, 0,  //calloc number of members
-                IARG_FUNCARG_ENTRYPOINT_VALUE, 1,  //calloc size of members
-                IARG_ADDRINT, IARG_RETURN_IP,      // callsite return IP
-                IARG_END);
-        RTN_InsertCall(callocRtn, IPOINT_AFTER, (AFUNPTR)AfterCalloc,
-                IARG_FUNCRET_EXITPOINT_VALUE,
-                IARG_END);
-
-        RTN_Close(callocRtn);
-    }
-
-    // instrument POSIX_MEMALIGN
-    RTN memalignRtn = RTN_FindByName(img, POSIX_MEMALIGN);
-    if (RTN_Valid(memalignRtn))
-    {
-        cerr << "PIN: FOUND Routine " << RTN_Name(memalignRtn) << endl;
-        RTN_Open(memalignRtn);
-
-        // Instrument calloc() to print the input argument value and the return value.
-        RTN_InsertCall(memalignRtn, IPOINT_BEFORE, (AFUNPTR)BeforePosix_memalign,
-                IARG_ADDRINT, POSIX_MEMALIGN,
-                IARG_FUNCARG_ENTRYPOINT_VALUE, 2,  // posix_memalign size, 3rd arg
-                IARG_FUNCARG_ENTRYPOINT_VALUE, 0,  // the buffer address is stored here, a pointer to a pointer
-                IARG_ADDRINT, IARG_RETURN_IP,      // callsite return IP
-                IARG_END);
-        RTN_InsertCall(memalignRtn, IPOINT_AFTER, (AFUNPTR)AfterPosix_memalign,
-                IARG_END);
-
-        RTN_Close(memalignRtn);
-    }
-
-    // instrument FREE
-    RTN freeRtn = RTN_FindByName(img, FREE);
-    if (RTN_Valid(freeRtn))
-    {
+    // instrument FREE and operator delete
+    for (const CHAR *name : FreeRoutines) {
+        RTN freeRtn = RTN_FindByName(img, name);
+        if (!RTN_Valid(freeRtn) || !done.insert(RTN_Address(freeRtn)).second)
+            continue;
         RTN_Open(freeRtn);
         // Instrument free() to print the input argument value.
         RTN_InsertCall(freeRtn, IPOINT_BEFORE, (AFUNPTR)BeforeFree,
-                IARG_ADDRINT, FREE,
+                IARG_PTR, name,
                 IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+                IARG_THREAD_ID,
                 IARG_END);
         RTN_Close(freeRtn);
     }
+
+    RTN munmapRtn = RTN_FindByName(img, MUNMAP);
+    if (RTN_Valid(munmapRtn))
+    {
+        RTN_Open(munmapRtn);
+        RTN_InsertCall(munmapRtn, IPOINT_BEFORE, (AFUNPTR)BeforeMunmap,
+                IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+                IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+                IARG_THREAD_ID,
+                IARG_END);
+        RTN_Close(munmapRtn);
+    }
 }
 
 /* ===================================================================== */
@@ -374,406 +491,370 @@ VOID Image(IMG img, VOID *v)
 /* ===================================================================== */
 
 
-static VOID display_object_rd_distribution(ofstream &rdFile, UINT64 iCnt, UINT log2_start_cache_size, UINT log2_end_cache_size, vector<ObjectInstance> &objects)
-{
-    vector<UINT64> tmpMiss(log2_end_cache_size - log2_start_cache_size + 1);	// L1 - L2 all sizes in POW 2
-
-    /* Individual Object Statistics */
-    /* $$$$$$ DISPLAY FORMAT $$$$$$ */
-    rdFile << "OBJECT_ID,TS,Accesses,Size,L1 Misses, 2 * L1 Misses, ..., L2 Misses" << endl;
-    for(UINT j = 0; j < objects.size(); j++) {
-        if(objects[j].accesses) {
-            UINT index = log2_end_cache_size - log2_start_cache_size;
-            UINT64 misses = 0;
-            for(UINT m = log2_end_cache_size + 1; m < MAX_RD_BUCKETS; m++)
-                misses += objects[j].reuseDistance[m];
-            tmpMiss[index] = misses;    // highest Sz
-            index--;
-
-            for(UINT m = log2_end_cache_size; m > log2_start_cache_size; m--) {
-                misses += objects[j].reuseDistance[m];
-                tmpMiss[index] = misses;	// intermediate Sz, L1
-                index--;
-            }
-
-            // find which set this belongs to
-            OBJ_TYPE type = getObjectCategory(objects[j].id);
-            if((type == LARGE_STATIC) || (type == LARGE_DYNAMIC) || KnobDisplayAllObjects.Value()) {
-               rdFile << "Object_" << objects[j].id << ", "; // ID
-               rdFile << iCnt  << ", ";  // TimeStamp
-               rdFile << objects[j].accesses << ", ";  // Accesses
-               rdFile << objects[j].size;  // Size
-               for(UINT m = 0; m < tmpMiss.size(); m++)
-                   rdFile << ", " << tmpMiss[m];  // Misses at all Levels
-               rdFile << endl;
-            }
+
+/* ===================================================================== */
+
+// Asynchronous mode: hand the record over to the worker owning this thread's ring
+VOID queue_access(ThreadContext *tc, AccessRecord &rec)
+{
+    MergeProducer *producer = tc->producer;
+    AccessRing *ring = producer->ring;
+
+    while (ring->full()) {
+        // once the workers are gone nobody drains the ring anymore, so drop in any case
+        if (async_drop || async_stop.load(std::memory_order_relaxed)) {
+            ring->dropped++;
+            return;
         }
+        if (enable_rd)
+            SharedStream->publish_segment(producer);
+        else
+            ring->publish();
+        PIN_Yield();
     }
 
-    // Print the Header
-    rdFile << "\n$$$$$ Object Category Wise Distribution $$$$$\n";
-    rdFile << "Category,Num_Objects,Category_Size,Accesses,L1 Misses\n";
-    if(KnobDemarcateLargeObject.Value()) {
-       rdFile << "LARGE_STATIC,"
-              << OBJCategory[LARGE_STATIC].objects.size() << ","
-              << OBJCategory[LARGE_STATIC].size << ","
-              << OBJCategory[LARGE_STATIC].accesses << ","
-              << OBJCategory[LARGE_STATIC].misses << endl;
-       rdFile << "LARGE_DYNAMIC,"
-              << OBJCategory[LARGE_DYNAMIC].objects.size() << ","
-              << OBJCategory[LARGE_DYNAMIC].size << ","
-              << OBJCategory[LARGE_DYNAMIC].accesses << ","
-              << OBJCategory[LARGE_DYNAMIC].misses << endl;
+    if (enable_rd)
+        rec.seq = SharedStream->stamp(producer);
+    ring->put(rec);
+
+    if (ring->unpublished() >= async_segment) {
+        if (enable_rd)
+            SharedStream->publish_segment(producer);
+        else
+            ring->publish();
     }
+}
+
+VOID accessUnifiedMemory(ThreadContext *tc, ADDRINT ip, ADDRINT addr, INT64 size, BOOL is_read, BOOL isStack)
+{
+    // find array for the access; always done here, the object may be gone by the time a worker sees the access
+    const ObjectIndex *index = LiveObjects.read(&tc->reader);
+    const ObjectInstance *object = isStack ? index->stack_bucket() : index->find(addr);
+    UINT id = object->id;
+    AccessRecord rec(0, get_inscount(), addr, id, size, object->category, !!is_read);
+
+#ifdef OBJECT_ALLOC_HISTOGRAM
+    /********** Update all Scope Distribution ************/
+    PIN_LockClient();
+    string scope_in_progress = RTN_FindNameByAddress(ip);
+    PIN_UnlockClient();
+
+    PIN_GetLock(&objects_lock, tc->tid + 1);
+    ObjectMetadata &meta = ObjectMeta[id];
+    if(meta.firstLoc.empty())
+       meta.firstLoc = scope_in_progress;
+    meta.lastLoc = scope_in_progress;
+    if(meta.accHist.find(scope_in_progress) == meta.accHist.end())
+       meta.accHist[scope_in_progress] = 1;
     else
-       rdFile << "LARGE,"
-              << (OBJCategory[LARGE_STATIC].objects.size()+OBJCategory[LARGE_DYNAMIC].objects.size()) << ","
-              << (OBJCategory[LARGE_STATIC].size+OBJCategory[LARGE_DYNAMIC].size) << ","
-              << OBJCategory[LARGE_STATIC].accesses << ","
-              << OBJCategory[LARGE_STATIC].misses << endl;
-    rdFile << "SMALL_STATIC,"
-           << OBJCategory[SMALL_STATIC].objects.size() << ","
-           << OBJCategory[SMALL_STATIC].size << ","
-           << OBJCategory[SMALL_STATIC].accesses << ","
-           << OBJCategory[SMALL_STATIC].misses << endl;
-    rdFile << "SMALL_DYNAMIC,"
-           << OBJCategory[SMALL_DYNAMIC].objects.size() << ","
-           << OBJCategory[SMALL_DYNAMIC].size << ","
-           << OBJCategory[SMALL_DYNAMIC].accesses << ","
-           << OBJCategory[SMALL_DYNAMIC].misses << endl;
-    rdFile << "STACK,"
-           << OBJCategory[OBJ_STACK].objects.size() << ","
-           << OBJCategory[OBJ_STACK].size << ","
-           << OBJCategory[OBJ_STACK].accesses << ","
-           << OBJCategory[OBJ_STACK].misses << endl;
-
-    rdFile << endl;
-    OBJCategory[LARGE_STATIC].rd->printHistogram("CATEGORY_LARGE_STATIC", rdFile);
-    if(KnobDemarcateLargeObject.Value())
-       OBJCategory[LARGE_DYNAMIC].rd->printHistogram("CATEGORY_LARGE_DYNAMIC", rdFile);
-    OBJCategory[SMALL_STATIC].rd->printHistogram("CATEGORY_SMALL_STATIC", rdFile);
-    OBJCategory[SMALL_DYNAMIC].rd->printHistogram("CATEGORY_SMALL_DYNAMIC", rdFile);
-    OBJCategory[OBJ_STACK].rd->printHistogram("CATEGORY_STACK", rdFile);
-
-    UINT64 misses = 0, bucket = 0;
-    for(; bucket < MAX_RD_BUCKETS; bucket++) {
-       misses = OBJCategory[SMALL_DYNAMIC].rd->calculateMisses(bucket);
-       if(misses <= OBJCategory[SMALL_DYNAMIC].misses)
-          break;
-    }
-    rdFile << "\nESTIMATED_PARTITION_SIZE :\n";
-    UINT cacheSize = 1 << (bucket + LOG2_CACHE_BLOCK_SIZE);
-    rdFile << "CATEGORY_SMALL_DYNAMIC," << cacheSize << endl;
-
-    misses = 0, bucket = 0;
-    for(; bucket < MAX_RD_BUCKETS; bucket++) {
-       misses = OBJCategory[SMALL_STATIC].rd->calculateMisses(bucket);
-       if(misses <= OBJCategory[SMALL_STATIC].misses)
-          break;
-    }
-    cacheSize = 1 << (bucket + LOG2_CACHE_BLOCK_SIZE);
-    rdFile << "CATEGORY_SMALL_STATIC," << cacheSize << endl;
-
-    misses = 0, bucket = 0;
-    for(; bucket < MAX_RD_BUCKETS; bucket++) {
-       misses = OBJCategory[LARGE_STATIC].rd->calculateMisses(bucket);
-       if(misses <= OBJCategory[LARGE_STATIC].misses)
-          break;
-    }
-    cacheSize = 1 << (bucket + LOG2_CACHE_BLOCK_SIZE);
-    rdFile << "CATEGORY_LARGE_STATIC," << cacheSize << endl;
-
-    if(KnobDemarcateLargeObject.Value()) {
-       misses = 0, bucket = 0;
-       for(; bucket < MAX_RD_BUCKETS; bucket++) {
-          misses = OBJCategory[LARGE_DYNAMIC].rd->calculateMisses(bucket);
-          if(misses <= OBJCategory[LARGE_DYNAMIC].misses)
-             break;
-       }
-       cacheSize = 1 << (bucket + LOG2_CACHE_BLOCK_SIZE);
-       rdFile << "CATEGORY_LARGE_DYNAMIC," << cacheSize << endl;
-    }
-
-    misses = 0, bucket = 0;
-    for(; bucket < MAX_RD_BUCKETS; bucket++) {
-       misses = OBJCategory[OBJ_STACK].rd->calculateMisses(bucket);
-       if(misses <= OBJCategory[OBJ_STACK].misses)
-          break;
-    }
-    cacheSize = 1 << (bucket + LOG2_CACHE_BLOCK_SIZE);
-    rdFile << "CATEGORY_STACK," << cacheSize << endl;
-}
-
-/* This routine can be called at any point in the 
- * lifetime of program to Dump out the all relevant
- * characteristics of the whole program as well as
- * of the individual objects */
-VOID Display_Global_RD_Distribution(ofstream &rdFile, UINT64 iCnt, UINT log2_start_cache_size, UINT log2_end_cache_size)
-{
-    log2_start_cache_size -= LOG2_CACHE_BLOCK_SIZE;
-    log2_end_cache_size -= LOG2_CACHE_BLOCK_SIZE;
-    assert(log2_end_cache_size >= log2_start_cache_size);
-
-    rdFile << dec << endl << endl;
-    rdFile << "$$$$$$ Object Access & Miss Distribution @ : " << iCnt << " $$$$$$\n";
-    // Display for Individual Objects
-    display_object_rd_distribution(rdFile, iCnt, log2_start_cache_size, log2_end_cache_size, Objects);
-    if(!freedObjects.empty())
-        display_object_rd_distribution(rdFile, iCnt, log2_start_cache_size, log2_end_cache_size, freedObjects);
-
-    /* Global Statistics */
-    /* $$$$$$ DISPLAY FORMAT $$$$$$ */
-    rdFile << "# TOTAL BLOCKS,TS,Accesses,L1 Misses,2 * L1 Misses, ... ,L2 Misses" << endl;
-    vector<UINT64> tmpMiss(log2_end_cache_size - log2_start_cache_size + 1);	// L1, ... , L2
-    UINT index = log2_end_cache_size - log2_start_cache_size;
-    tmpMiss[index] = GlobalRD->calculateMisses(log2_end_cache_size);	// L2 Sz
-    index--;
-
-    for(UINT m = log2_end_cache_size - 1; m > log2_start_cache_size; m--) {
-       tmpMiss[index] = GlobalRD->calculateMisses(m);	// intermediate Sz
-       index--;
-    }
-
-    assert(index == 0);
-    tmpMiss[index] = GlobalRD->calculateMisses(log2_start_cache_size);	// L1 Sz
+       meta.accHist[scope_in_progress]++;
+    PIN_ReleaseLock(&objects_lock);
+#endif
+
+    if (enable_async) {
+        queue_access(tc, rec);
+        return;
+    }
 
-    // Update global vars
-    l2_misses = tmpMiss.back();
-    l1_misses = tmpMiss.front();
+    analyze_access(tc, rec);
+
+    // shared levels see the accesses of all threads in global order, see shared_access()
+    if (enable_rd)
+        SharedStream->append(tc->producer, rec, tc);
+}
 
+// Analyze everything published in the ring of tc; merge is the context collecting the shared level counters.
+// Only the ring's owning worker, or the Fini thread once the workers are gone, may call this
+UINT64 drain_ring(ThreadContext *tc, ThreadContext *merge)
+{
+    AccessRing *ring = tc->producer->ring;
+    UINT64 n = ring->available();
+    if (n == 0)
+        return 0;
 
-    rdFile << "TOTAL_BLOCKS, " << object_count << ", " << iCnt << ", " << total_accesses;
-    for(UINT m = 0; m < tmpMiss.size(); m++)
-        rdFile << ", " << tmpMiss[m];  // Misses at all Levels
-    rdFile << endl;
+    for (UINT64 i = 0; i < n; i++)
+        analyze_access(tc, ring->peek(i));
 
-    rdFile << dec << "$$$$$$$$$$$$$$$$$$$$$$$\n";
+    if (enable_rd)
+        SharedStream->flush_ring(tc->producer, n, merge);
+    else
+        ring->release(n);
+    return n;
 }
 
-// dumps the instantaneous cache stats to a file; used for plotting timeline behavior of cache
-VOID dump_cache_stats()
+// Where the internal workers wait while the control thread changes the analysis state
+inline VOID pause_point()
 {
-    static ofstream of;
-    static bool header=false;
-    static ADDRINT prev_accesses = 0;
-    static ADDRINT prev_l1_misses = 0;
-    static ADDRINT prev_l2_misses = 0;
+    if (!workers_pause.load(std::memory_order_acquire))
+        return;
+    workers_paused.fetch_add(1);
+    while (workers_pause.load(std::memory_order_acquire))
+        PIN_Sleep(1);
+    workers_paused.fetch_sub(1);
+}
 
-    if(!header) {
-        of.open(KnobOutputFile.Value() + "-cache-stats.csv");
-        of << "TSC,Accesses,L1 misses,L2 misses" << endl;
-        header = true;
+// Body of the internal analysis threads
+VOID AsyncWorkerMain(VOID *arg)
+{
+    AnalysisWorker *worker = static_cast<AnalysisWorker *>(arg);
+    UINT stride = AsyncWorkers.size();
+
+    for (;;) {
+        pause_point();
+        // read the flag before scanning: whatever was published before the stop is drained below
+        bool stopping = async_stop.load(std::memory_order_acquire);
+
+        UINT64 drained = 0;
+        UINT n = async_count.load(std::memory_order_acquire);
+        for (UINT i = worker->index; i < n; i += stride)
+            drained += drain_ring(AsyncContexts[i], worker->tc);
+        worker->records += drained;
+
+        if (drained == 0) {
+            if (stopping)
+                break;
+            PIN_Sleep(1);
+        }
     }
+}
 
-    of << get_inscount() << ","
-        << total_accesses - prev_accesses << ","
-        << l1_misses - prev_l1_misses << "," 
-        << l2_misses - prev_l2_misses << endl;
+// Stop the workers once everything published so far is analyzed; safe to call more than once
+VOID stop_async_workers()
+{
+    if (!async_running)
+        return;
+    async_running = false;
 
-    prev_accesses = total_accesses;
-    prev_l1_misses = l1_misses;
-    prev_l2_misses = l2_misses;
+    async_stop.store(true, std::memory_order_release);
+    for (auto worker : AsyncWorkers)
+        PIN_WaitForThreadTermination(worker->uid, PIN_INFINITE_TIMEOUT, NULL);
 }
 
-bool AccPrioFunc(const pair<string, UINT64> &a, const pair<string, UINT64> &b)
+// Fini/detach: no application thread writes its ring anymore, analyze whatever is left on this thread
+VOID flush_async_rings()
 {
-    return a.second > b.second;
+    UINT n = async_count.load(std::memory_order_acquire);
+    for (UINT i = 0; i < n; i++) {
+        ThreadContext *tc = AsyncContexts[i];
+        if (enable_rd)
+            SharedStream->publish_segment(tc->producer);
+        else
+            tc->producer->ring->publish();
+        drain_ring(tc, FiniContext);
+    }
 }
 
+// Called for each access of the globally ordered stream of all threads, under the merger lock.
+// Counters go to the context of the thread doing the merge; they are summed at Fini anyway
+VOID shared_access(const AccessRecord &rec, VOID *arg)
+{
+    UINT set = GlobalRD->set_of(rec.addr);
+    if (Shards)
+        Shards->route(set % Shards->size(), rec);
+    else
+        model_shared_access(static_cast<ThreadContext *>(arg), rec, set);
+}
 
-#ifdef OBJECT_ALLOC_HISTOGRAM
-VOID Display_Access_Histogram(ofstream &rdFile)
-{
-   vector<pair<string, UINT64> > sortedObjects;
-   map<string, UINT64> scopeHist;
-
-   rdFile << "-------- OBJECT ACCESS DISTRIBUTION --------\n";
-   // Object Wise Distribution
-   for(INT i = 0; i < Objects.size(); i++) {
-      rdFile << "\n **** Object_" << Objects[i].id << " ****\n";
-      rdFile << "First Location," << Objects[i].firstLoc << endl;
-      rdFile << "Last Location," << Objects[i].lastLoc << endl;
-      rdFile << "Num Locs," << Objects[i].accHist.size() << endl;
-
-      sortedObjects.clear();
-      for(auto it: Objects[i].accHist) {
-         sortedObjects.push_back(make_pair(it.first, it.second));
-
-         if(scopeHist.find(it.first) == scopeHist.end())
-            scopeHist[it.first] = it.second;
-         else
-            scopeHist[it.first] += it.second;
-      }
+// Consumer of a shard queue; arg is the context of the shard's worker
+VOID shard_access(const AccessRecord &rec, VOID *arg)
+{
+    model_shared_access(static_cast<ThreadContext *>(arg), rec, GlobalRD->set_of(rec.addr));
+}
 
-      stable_sort(sortedObjects.begin(), sortedObjects.end(), AccPrioFunc);
-      rdFile << "Histogram\n";
-      for(INT j = 0; j < sortedObjects.size(); j++)
-         rdFile << sortedObjects[j].first << "," << sortedObjects[j].second << endl;
-   }
-   rdFile << endl;
+// Body of the shard workers
+VOID ShardWorkerMain(VOID *arg)
+{
+    AnalysisWorker *worker = static_cast<AnalysisWorker *>(arg);
+
+    for (;;) {
+        pause_point();
+        bool stopping = shard_stop.load(std::memory_order_acquire);
+        UINT64 drained = Shards->drain(worker->index);
+        worker->records += drained;
+        if (drained == 0) {
+            if (stopping)
+                break;
+            PIN_Sleep(1);
+        }
+    }
+}
 
+// Stop the shard workers; whatever is routed afterwards is modeled by the routing thread
+VOID stop_shard_workers()
+{
+    if (!shards_running)
+        return;
+    shards_running = false;
+
+    shard_stop.store(true, std::memory_order_release);
+    for (auto worker : ShardWorkers)
+        PIN_WaitForThreadTermination(worker->uid, PIN_INFINITE_TIMEOUT, NULL);
+    Shards->workers_gone();
 }
-#endif
 
-bool arrayPrioFunc(const pair<int, double> &a, const pair<int, double> &b)
+// Fini/detach, after the merger finished: model what is still queued
+VOID flush_shards()
 {
-    return a.second > b.second;
+    Shards->publish();
+    for (UINT s = 0; s < Shards->size(); s++)
+        Shards->drain(s);
 }
 
-/* ===================================================================== */
+VOID publish_live(bool final)
+{
+    LiveSnapshot snapshot;
+    live_snapshot(snapshot);
+    snapshot.final = final;
+    Live->publish(snapshot);
+}
 
-// Check cache line alignment for a given access
-bool is_aligned_p(ADDRINT addr, INT64 len) 
-{
-    //cout << "Addr: " << hex << addr << dec << " Len: " << len << endl;
-    return ( (addr >> LOG2_CACHE_BLOCK_SIZE) == ((addr+len-1) >> LOG2_CACHE_BLOCK_SIZE) );
-}
-
-/***********************************************************************
- *
- * Description of find_object()
- * 
- * Given the addr of a memory reference find_object() returns an iterator to the matching array 
- * or the default bucket in case the addr does not belong to one of the known objects.
- *
- * This is essentially an interval search, where the start and end of an object are its interval.
- * The vector "Objects" is sorted on the start address in ascending order.
- * The vector contains only active objects so they have non-overlapping ranges.
- * The first element of the object vector is a default bucket to capture addresses 
- * which dont fall into any known object. It has a start address of zero and a null range.
- * 
- * The input memory addr can be in one of the following cases, according to which we arrange the logic of the search:
- * 1. between zero and the start address of the first object (lowest start addr) - return default bucket
- * 2. between two object intervals - return default bucket
- * 3. after the last object's interval - return default bucket
- * 4. in the middle of an object's interval and the object is not the last object - return the object
- * 5. the start of an object - return the array
- * 6. in the middle of the last object's interval - return the last object
- *
- * We use lower_bound() to search on the sorted(ascending on start addr) vector of objects
- * The key thing to remember is that lower_bound() returns the first object 
- * whose start addr is not less than the addr of the mem reference
- * lower_bound() will return the vector's end sentinel for case 3 and 6 above
- *
- **********************************************************************/
-
-vector<ObjectInstance>::iterator find_object(ADDRINT addr)
-{
-    auto it = lower_bound(Objects.begin(), Objects.end(), ObjectInstance(addr, 0, 0), compare_start_address); 
-
-    // catch case 3 and 6 which both return objects.end(), but whereas case 6 is a match on the last element
-    // case 3 does not match any objects and should return the default bucket
-    if( it == Objects.end() ) {
-        // check for case 6
-        if (addr >= (Objects.end()-1)->start && addr < (Objects.end()-1)->end )
-            return Objects.end() - 1;       
-        else // case 3
-            return Objects.begin();         
-    }
-
-    // adjust iterator for case 4; lower_bound returns the next array and we need to move the iterator one back
-    if (it->start != addr)
-        it--;
-
-    // case 4 and 5 check that addr lies in the array's interval and return it
-    if( addr >= it->start && addr < it->end )
-        return it;
-    // case 1 and 2, no match found, return the default bucket
-    else
-        return Objects.begin();
+// Body of the live statistics publisher; it wakes up often to notice the stop
+VOID LivePublisherMain(VOID *arg)
+{
+    UINT64 interval = MAX(1, KnobLiveInterval.Value()), slept = 0;
+    while (!live_stop.load(std::memory_order_acquire)) {
+        PIN_Sleep(MIN(interval, 100));
+        slept += MIN(interval, 100);
+        if (slept >= interval) {
+            publish_live(false);
+            slept = 0;
+        }
+    }
 }
 
-VOID accessUnifiedMemory(ADDRINT ip, ADDRINT addr, INT64 size, BOOL is_read, BOOL isStack)
+VOID stop_live_publisher()
 {
-    string scope_in_progress = RTN_FindNameByAddress(ip);
+    if (!live_running)
+        return;
+    live_running = false;
 
-    // find array for the access
-    vector<ObjectInstance>::iterator object;
-    if(!isStack)
-       object = find_object(addr);
-    else
-       object = Objects.begin() + 1;
+    live_stop.store(true, std::memory_order_release);
+    PIN_WaitForThreadTermination(live_uid, PIN_INFINITE_TIMEOUT, NULL);
+}
 
-    // update accesses, writes and TSC stats
-    total_accesses++;
-    object->accesses++;
-    if (!is_read) { total_writes++; object->writes++;}
+// Run a control command; a snapshot or reset needs the application threads stopped, which Pin
+// does outside of the analysis routines, and the workers paused
+VOID apply_control(const ControlCommand &command)
+{
+    if (!command.quiescent()) {
+        run_control(command);
+        return;
+    }
 
-    if (0 == object->first_access)  // update access timestamp
-        object->first_access = get_inscount();
-    object->last_access = get_inscount();
+    if (enable_maid && command.kind == CONTROL_SNAPSHOT)
+        name_stack_objects();
 
-#ifdef OBJECT_ALLOC_HISTOGRAM
-    /********** Update all Scope Distribution ************/
-    if(object->firstLoc.empty())
-       object->firstLoc = scope_in_progress;
-    object->lastLoc = scope_in_progress;
-    if(object->accHist.find(scope_in_progress) == object->accHist.end())
-       object->accHist[scope_in_progress] = 1;
-    else
-       object->accHist[scope_in_progress]++;
-#endif
+    THREADID self = PIN_ThreadId();
+    if (!PIN_StopApplicationThreads(self)) {
+        cerr << "Control: unable to stop the application threads, command ignored\n";
+        return;
+    }
+    UINT workers = (async_running ? AsyncWorkers.size() : 0) + (shards_running ? ShardWorkers.size() : 0);
+    workers_pause.store(true, std::memory_order_release);
+    while (workers_paused.load(std::memory_order_acquire) < workers)
+        PIN_Sleep(1);
 
-    // access RD and update RD stats
-    if (enable_rd) {
-        static INT L1_RD_BUCKET = LOG2_L1_SIZE - LOG2_CACHE_BLOCK_SIZE;
-        INT rd = GlobalRD->process_memory_access((VOID *)ip, addr, size);
-        if(rd >= 0)
-            object->reuseDistance[rd]++;
+    run_control(command);
 
-        OBJ_TYPE type = getObjectCategory(object->id);
-        OBJCategory[type].rd->process_memory_access((VOID *)ip, addr, size);
-        OBJCategory[type].accesses++;
-        if(rd > L1_RD_BUCKET)
-           OBJCategory[type].misses++;
+    workers_pause.store(false, std::memory_order_release);
+    PIN_ResumeApplicationThreads(self);
+}
+
+// the warm-up ends with a warm reset; at the budget the next trace to run detaches
+VOID check_budget(time_t start)
+{
+    UINT64 icount = get_inscount();
+    if (warmup_pending && icount >= start_icount) {
+        warmup_pending = false;
+        apply_control(ControlCommand(CONTROL_RESET, true));
+        warmup_end_icount = icount;
+    }
+    if (detach_budget && !detach_requested.load(std::memory_order_relaxed) &&
+        (icount >= end_icount || (KnobDetachSeconds.Value() && time(NULL) - start >= (time_t)KnobDetachSeconds.Value()))) {
+        cerr << "PIN: Detaching at icount " << icount << endl;
+        detach_icount = icount;
+        detach_requested.store(true, std::memory_order_release);
     }
 }
 
-// Print out the detailed object profile for analysis
-VOID print_object_profile()
+// Body of the control thread
+VOID ControlMain(VOID *arg)
 {
-    std::ofstream outf;
-    outf.open(KnobOutputFile.Value() + "-object-profile.csv");
+    string line;
+    ControlCommand command;
+    time_t start = time(NULL);
+    while (!control_stop.load(std::memory_order_acquire)) {
+        while (Control && Control->next(line))
+            if (parse_control(line, command))
+                apply_control(command);
+        check_budget(start);
+        PIN_Sleep(Control ? 100 : 10);
+    }
+}
 
-    // print HEADER
-    outf << "Num Objects,Num Instructions,Accesses,Writes,L1 Misses, L2 Misses\n";
-    outf << Objects.size()  << "," 
-        <<  get_inscount() << ", "<< total_accesses << "," << total_writes << ","
-        << l1_misses << "," << l2_misses << endl;
-    outf << endl;
+// PIN_Detach from an application thread, the first one to run a trace after the budget
+VOID check_detach()
+{
+    if (detach_requested.load(std::memory_order_relaxed) && !detaching.exchange(true))
+        PIN_Detach();
+}
 
-    // print per object data
-    outf << "Object ID,Object Start,Size(bytes),Type,Symbol@Lib,TSC First Access,TSC Last Access,Accesses,Writes,L1 Misses, L2 Misses\n";
+VOID DetachTrace(TRACE trace, VOID *v)
+{
+    TRACE_InsertCall(trace, IPOINT_BEFORE, (AFUNPTR)check_detach, IARG_END);
+}
 
-    for(auto object : Objects) {
-        outf << "OBJECT_ID_" << object.id << ",0x" << hex << object.start << "," << dec << object.size << ","
-            << object.type << "," << object.image_name << ","
-            << object.first_access << "," << object.last_access << "," << object.accesses << "," << object.writes << ","
-            << object.l1_misses << "," << object.l2_misses << endl; 
-    }
+VOID stop_control()
+{
+    if (!control_running)
+        return;
+    control_running = false;
+
+    control_stop.store(true, std::memory_order_release);
+    PIN_WaitForThreadTermination(control_uid, PIN_INFINITE_TIMEOUT, NULL);
+    if (Control)
+        Control->close();
 }
 
-// return size of the access from addr till the end of the current cacheline
-UINT get_cur_access_size(ADDRINT addr, UINT size)
+// Attached: add the blocks the hooks did not see being allocated; the application threads
+// are all under Pin by now, none of them runs the hooks yet
+VOID ApplicationStart(VOID *v)
 {
-    static UINT LINE_OFFSET_MASK = (1UL << KnobBlockSize.Value()) - 1;
+    if (!attached || !KnobHeapScan.Value())
+        return;
 
-    return MIN((size), (64 - (addr & (LINE_OFFSET_MASK))));
+    vector<HeapBlock> blocks;
+    if (!scan_heap(large_object_size, PIN_SafeCopy, blocks))
+        return;
+
+    vector<NewObject> batch;
+    for (auto &block : blocks) {
+        batch.push_back(NewObject{block.start, block.size, block.mapping});
+        heap_scan_bytes += block.size;
+    }
+    add_objects(batch, ALLOC_HEAP_SCAN, PIN_ThreadId());
+    heap_scan_blocks = blocks.size();
+    cerr << "PIN: Heap scan found " << heap_scan_blocks << " blocks of " << heap_scan_bytes << " bytes\n";
 }
 
-// return no of cachelines needed for this access beginning at addr and size long
-UINT get_num_cachelines_for_access(ADDRINT addr, UINT size)
+// Record mode: append the access to the thread's trace chunk, no analysis at all
+inline VOID record_access(ThreadContext *tc, ADDRINT ip, ADDRINT addr, UINT size, BOOL is_read, BOOL isStack)
 {
-    static UINT CACHE_BLOCK_SIZE = KnobBlockSize.Value();
-    return (((addr + size - 1) >> CACHE_BLOCK_SIZE) - (addr >> CACHE_BLOCK_SIZE)) + 1;
+    UINT64 time = get_inscount();
+    tc->trace->access(addr, ip, time, size, !is_read, isStack);
+    if (tc->trace->full())
+        tc->trace = Recorder->submit(tc->trace, time);
 }
 
 /******************************************************************
  * This routine is the instrumentation routine called with the
  * length of the access
 *******************************************************************/
-VOID process_memory_access(VOID * ip, VOID *addr, INT64 size, BOOL isRead, BOOL isStack)
+VOID process_memory_access(VOID * ip, VOID *addr, INT64 size, BOOL isRead, BOOL isStack, THREADID tid)
 {
+    ThreadContext *tc = get_context(tid);
+    if (!sample_access(tc))
+        return;
     ADDRINT a_addr = (ADDRINT)addr;
     // An unaligned access can access multiple cachelines, find out how many
     // and access caches for each of those cachelines
@@ -784,7 +865,10 @@ VOID process_memory_access(VOID * ip, VOID *addr, INT64 size, BOOL isRead, BOOL
 
     for (UINT i = 0; i< numcl; i++) {
         cur_access_size = get_cur_access_size(a_addr, remaining_size);    // find size of bytes accessed in this cacheline
-        accessUnifiedMemory((ADDRINT)ip, a_addr, cur_access_size, isRead, isStack);
+        if (enable_record)
+            record_access(tc, (ADDRINT)ip, a_addr, cur_access_size, isRead, isStack);
+        else
+            accessUnifiedMemory(tc, (ADDRINT)ip, a_addr, cur_access_size, isRead, isStack);
         a_addr += cur_access_size;                                        // advance addr to the next cacheline
         remaining_size -= cur_access_size;                              // reduce size of the access
     }
@@ -811,6 +895,7 @@ VOID InstrumentMemAccesses(INS ins)
             1,
             IARG_BOOL,
             1,
+            IARG_THREAD_ID,
             IARG_END);
       } else {
         INS_InsertPredicatedCall(
@@ -822,6 +907,7 @@ VOID InstrumentMemAccesses(INS ins)
             1,
             IARG_BOOL,
             0,
+            IARG_THREAD_ID,
             IARG_END);
       }
     }
@@ -839,6 +925,7 @@ VOID InstrumentMemAccesses(INS ins)
             1,
             IARG_BOOL,
             0,
+            IARG_THREAD_ID,
             IARG_END);
     }
 
@@ -857,6 +944,7 @@ VOID InstrumentMemAccesses(INS ins)
             0,
             IARG_BOOL,
             1,
+            IARG_THREAD_ID,
             IARG_END);
       } else {
         INS_InsertPredicatedCall(
@@ -868,6 +956,7 @@ VOID InstrumentMemAccesses(INS ins)
             0,
             IARG_BOOL,
             0,
+            IARG_THREAD_ID,
             IARG_END);
       }
     }
@@ -884,36 +973,281 @@ VOID Trace(TRACE trace, VOID * val)
         {
            InstrumentMemAccesses(ins);
         }
+
+        // calls and returns maintain the MAID call stacks
+        if (enable_maid)
+           MAID_Instrument_calls(trace, BBL_InsTail(bbl));
+    }
+}
+
+// Thread start, set up the per thread context
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    ThreadContext *tc = new_thread_context(tid);
+    PIN_SetThreadData(tls_key, tc, tid);
+
+    if (enable_async)
+        tc->producer->ring = new AccessRing(KnobRingSize.Value());
+    if (enable_record)
+        tc->trace = Recorder->thread_chunk(tid, get_inscount());
+
+    if (enable_rd)
+        SharedStream->add_producer(tc->producer);
+
+    // a new thread has its TLS set up by the clone, the main thread not yet, see MainEntry()
+    add_tls_objects(tc, PIN_GetContextReg(ctxt, REG_SEG_FS_BASE));
+
+    PIN_GetLock(&objects_lock, tid + 1);
+    LiveObjects.add_reader(&tc->reader);
+    Threads.push_back(tc);
+    if (enable_async) {
+        UINT slot = async_count.load(std::memory_order_relaxed);
+        if (slot >= MAX_ASYNC_THREADS) {
+            cerr << "More than " << MAX_ASYNC_THREADS << " threads, rerun without -async\n";
+            exit(1);
+        }
+        // publish the context before the slot becomes visible to the workers
+        AsyncContexts[slot] = tc;
+        async_count.store(slot + 1, std::memory_order_release);
+    }
+    PIN_ReleaseLock(&objects_lock);
+}
+
+// Thread exit, the context stays around for the merge but no longer reads the index
+VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+    ThreadContext *tc = get_context(tid);
+    if (enable_async) {
+        if (enable_rd)
+            SharedStream->publish_segment(tc->producer);
+        else
+            tc->producer->ring->publish();
+    }
+    else if (enable_rd)
+        SharedStream->flush(tc->producer, tc);
+    if (enable_record && !tc->trace->empty())
+        tc->trace = Recorder->submit(tc->trace, get_inscount());
+    if (tc->tls_block)
+        free_objects(tc->tls_block, tc->tls_block + exe_tls_offset, ALLOC_STATIC, tid);
+
+    PIN_GetLock(&objects_lock, tid + 1);
+    LiveObjects.remove_reader(&tc->reader);
+    PIN_ReleaseLock(&objects_lock);
+}
+
+// A thread entering a system call may block for long; hand over its buffered
+// accesses so they do not hold back the merge of the other threads, nor its index
+// version the reclaim of the older ones (its next lookup reads the current one)
+VOID SyscallEntry(THREADID tid, CONTEXT *ctxt, INT32 std, VOID *v)
+{
+    ThreadContext *tc = get_context(tid);
+    LiveObjects.quiesce(&tc->reader);
+    // a blocking call is where other threads usually wait on this one, keep its accesses ahead of theirs
+    if (enable_record && !tc->trace->empty())
+        tc->trace = Recorder->submit(tc->trace, get_inscount());
+
+    if (enable_async) {
+        if (tc->producer->ring->unpublished() == 0)
+            return;
+        if (enable_rd)
+            SharedStream->publish_segment(tc->producer);
+        else
+            tc->producer->ring->publish();
     }
+    else if (enable_rd && !tc->producer->batch.empty())
+        SharedStream->flush(tc->producer, tc);
+}
+
+// Internal threads have to be gone before Fini, Pin does not run them anymore after this point
+VOID PrepareForFini(VOID *v)
+{
+    // the async workers feed the shards, so they go first; the control thread pauses them
+    stop_control();
+    stop_live_publisher();
+    stop_async_workers();
+    stop_shard_workers();
+    if (enable_record)
+        Recorder->stop_thread();
+}
+
+// Record mode: hand over what the threads still hold and complete the trace file
+VOID close_trace()
+{
+    for (auto tc : Threads)
+        if (tc->trace && !tc->trace->empty())
+            tc->trace = Recorder->submit(tc->trace, get_inscount());
+    Recorder->close();
+
+    OutFile << dec << "TRACE_FILE : " << process_output(KnobRecord.Value()) << endl;
+    OutFile << "TRACE_ACCESSES : " << Recorder->records << endl;
+    OutFile << "TRACE_EVENTS : " << Recorder->events_written << endl;
+    OutFile << "TRACE_CHUNKS : " << Recorder->chunks() << endl;
+    OutFile << "TRACE_BYTES : " << Recorder->bytes() << endl;
+}
+
+// Records dropped by -async-backpressure drop and throughput of the workers
+VOID print_async_stats()
+{
+    UINT64 dropped = 0;
+    UINT n = async_count.load(std::memory_order_acquire);
+    for (UINT i = 0; i < n; i++)
+        dropped += AsyncContexts[i]->producer->ring->dropped;
+
+    OutFile << dec << "ASYNC_WORKERS : " << AsyncWorkers.size() << endl;
+    OutFile << "ASYNC_DROPPED_ACCESSES : " << dropped << endl;
+    for (auto worker : AsyncWorkers)
+        OutFile << "ASYNC_WORKER_" << worker->index << "_RECORDS : " << worker->records << endl;
+}
+
+VOID print_shard_stats()
+{
+    OutFile << dec << "RD_SHARDS : " << ShardWorkers.size() << endl;
+    for (auto worker : ShardWorkers)
+        OutFile << "RD_SHARD_" << worker->index << "_RECORDS : " << worker->records << endl;
 }
 
 VOID Detach_callback(VOID *v)
 {
+    stop_control();
+    stop_live_publisher();
+    if (enable_record)
+        close_trace();
+    if (enable_async) {
+        stop_async_workers();
+        flush_async_rings();
+    }
+    if (enable_rd)
+        SharedStream->finish(FiniContext);
+    if (Shards) {
+        stop_shard_workers();
+        flush_shards();
+    }
+    if (enable_maid) {
+        name_stack_objects();
+        write_maid();
+        MaidFile.close();
+    }
+    Symbols->save();
 
-    // Join the malloc and free blocks
-    Objects.insert(Objects.end(), freedObjects.begin(), freedObjects.end());
+    if (enable_async)
+        print_async_stats();
+    if (Shards)
+        print_shard_stats();
+    OutFile << dec << "STATIC_OBJECTS : " << static_objects << "\nSTATIC_OBJECT_SECONDS : " << static_object_seconds << endl;
+    if (enable_maid)
+        OutFile << dec << "MAID_DROPPED_FRAMES : " << MAID_dropped_frames() << endl;
+    if (!KnobSymbolCache.Value().empty())
+        OutFile << dec << "SYMBOL_CACHE_HITS : " << Symbols->hits << "\nSYMBOL_CACHE_MISSES : " << Symbols->misses << endl;
+    if (attached)
+        OutFile << dec << "HEAP_SCAN_BLOCKS : " << heap_scan_blocks << "\nHEAP_SCAN_BYTES : " << heap_scan_bytes << endl;
+    if (warmup_end_icount)
+        OutFile << dec << "WARMUP_END_ICOUNT : " << warmup_end_icount << endl;
+    if (detach_icount)
+        OutFile << dec << "DETACH_ICOUNT : " << detach_icount << endl;
+
+    // the counters are complete, monitors see them before the report is written
+    if (Live) {
+        publish_live(true);
+        Live->close();
+    }
 
-    // Sort on first_access since that will give a unique ordering
-    // All sorts should be stable_sort after this point
-    // We have a unique order on the objects in the field ID
-    SORT_OBJECTS_ON_KEY(id);
+    ReportAnalysis();
+}
 
-    freedObjects.clear();
+// Fork of the analyzed process, which Pin follows: the locks of the analysis are held across it,
+// so that the child never finds one taken by a thread it does not have. Lock order as in the
+// analysis: objects, merger, counters
+VOID BeforeFork(THREADID tid, const CONTEXT *ctxt, VOID *v)
+{
+    fork_parent = PIN_GetPid();
 
+    // the child must not write what the parent still buffers
+    OutFile.flush();
     if (enable_maid)
-        MaidFile.close();
+        MaidFile.flush();
+
+    PIN_GetLock(&objects_lock, tid + 1);
+    if (SharedStream)
+        SharedStream->before_fork();
+    PIN_GetLock(&counters_lock, tid + 1);
+    if (enable_record)
+        Recorder->before_fork();
+}
 
-    if (enable_rd) {
-       Display_Global_RD_Distribution(OutFile, get_inscount(), LOG2_L1_SIZE, LOG2_L2_SIZE);
-       // dump cache stats timeline in a csv file for later analysis
-       dump_cache_stats();
-#ifdef OBJECT_ALLOC_HISTOGRAM
-       Display_Access_Histogram(OutFile);
-#endif
+VOID AfterForkInParent(THREADID tid, const CONTEXT *ctxt, VOID *v)
+{
+    if (enable_record)
+        Recorder->after_fork_parent();
+    PIN_ReleaseLock(&counters_lock);
+    if (SharedStream)
+        SharedStream->after_fork_parent();
+    PIN_ReleaseLock(&objects_lock);
+}
+
+// The child is a copy of the parent at the fork, objects and symbols included, so it starts
+// without parsing an image again: only the counts and the RD state start over, and every
+// output gets its pid. It has only the forking thread, the internal threads of the parent are
+// gone: -async and -rd-shards analyze on the application threads, -live and -control stay
+// with the parent, the trace writer of -record is started anew
+VOID AfterForkInChild(THREADID tid, const CONTEXT *ctxt, VOID *v)
+{
+    ThreadContext *self = get_context(tid);
+    forked = true;
+
+    // nobody else to take them
+    PIN_ReleaseLock(&counters_lock);
+    PIN_ReleaseLock(&objects_lock);
+
+    async_running = shards_running = live_running = control_running = false;
+    Live = NULL;
+    Control = NULL;
+    warmup_pending = detach_budget = false;
+
+    // the records in the rings and queues were the parent's to analyze
+    if (enable_async) {
+        enable_async = false;
+        self->producer->ring = NULL;
+    }
+    if (SharedStream)
+        SharedStream->after_fork_child(self->producer);
+    if (Shards) {
+        Shards->workers_gone();
+        flush_shards();
+    }
+
+    for (auto tc : Threads)
+        if (tc != self)
+            LiveObjects.remove_reader(&tc->reader);
+
+    if (enable_maid) {
+        MaidFile.close();
+        MaidFile.open(process_output("maid.out").c_str());
+    }
+    ForkAnalysis(process_output(KnobOutputFile.Value()));
+
+    // the trace of the child starts with the objects live at the fork
+    if (enable_record) {
+        // the access chunks of all threads and the parent's writer go, the latter is left behind
+        for (auto tc : Threads) {
+            delete tc->trace;
+            tc->trace = NULL;
+        }
+        Recorder->after_fork_child();
+
+        UINT64 time = get_inscount();
+        Recorder = new TraceWriter(process_output(KnobRecord.Value()), KnobTraceChunk.Value(), LOG2_CACHE_BLOCK_SIZE);
+        vector<ObjectInstance> live;
+        LiveObjects.get()->get(live);
+        for (UINT i = 2; i < live.size(); i++) {
+            const ObjectInstance &object = live[i];
+            Recorder->alloc_event(tid, time, object.start, object.size, object.callsiteIP, object.type,
+                                  ObjectMeta[object.id].image_name);
+        }
+        self->trace = Recorder->thread_chunk(tid, time);
+        Recorder->start();
     }
 
-    if (KnobObjectProfile.Value())
-        print_object_profile();
+    OutFile << dec << "FORK_PARENT_PID : " << fork_parent << "\nFORK_ICOUNT : " << get_inscount() << endl;
 }
 
 VOID Fini(INT32 code, VOID *v)
@@ -929,50 +1263,108 @@ void InitSPM_Sieve()
 {
     activate_inscount();
 
-    // Write to a file since cout and cerr maybe closed by the application
-    OutFile.open(KnobOutputFile.Value().c_str());
-    OutFile << hex;
-    OutFile.setf(ios::showbase);
-
     // Skip Instruction count
     start_icount = KnobStartIcount.Value();
     end_icount   = KnobEndIcount.Value();
+
+    // configuration of the analysis core
+    output_prefix = process_output(KnobOutputFile.Value());
     LOG2_CACHE_BLOCK_SIZE = KnobBlockSize.Value();
     LOG2_L1_SIZE = log2(KnobL1Size.Value());
     LOG2_L2_SIZE = log2(KnobL2Size.Value());
-
+    LOG2_LLC_SIZE = log2(KnobLLCSize.Value());
+    num_sets = KnobNumSets.Value();
+    private_rd = KnobPrivateRD.Value();
+    wss_window = KnobWSSWindow.Value();
+    rd_max_distance = KnobRDMaxDistance.Value();
+    large_object_size = KnobLargeObjectSize.Value();
+    demarcate_large_objects = KnobDemarcateLargeObject.Value();
+    display_all_objects = KnobDisplayAllObjects.Value();
+    object_profile = KnobObjectProfile.Value();
+    profile_file = KnobProfile.Value();
+    text_report = KnobTextReport.Value();
+    name_site = name_alloc_site;
     enable_rd = KnobEnableRD.Value();
-    if(enable_rd)
-       GlobalRD = new SetRD(KnobNumSets.Value(), KnobBlockSize.Value());
+
+    Symbols = new SymbolCache(KnobSymbolCache.Value());
 
     // Open "maid.out" file
     enable_maid = KnobEnableMAID.Value();
     if (enable_maid) {
-        MaidFile.open("maid.out");
-        cerr << "Maid Enabled : Disabling RD Profiling\n";
+        MAID_Init(Symbols);
+        MaidFile.open(process_output("maid.out").c_str());
+        // an allocation only captures its call stack, see name_stack_objects()
+        capture_alloc_stack = MAID_capture_stack;
+    }
+
+    // Record mode only writes the trace, the analysis happens in the replay
+    enable_record = !KnobRecord.Value().empty();
+    if (enable_record) {
+        cerr << "Record Enabled : Disabling RD Profiling\n";
         enable_rd = false;
+        observe_alloc = record_alloc;
+        observe_free = record_free;
+    }
+
+    InitAnalysis();
+
+    if (enable_record)
+        Recorder = new TraceWriter(process_output(KnobRecord.Value()), KnobTraceChunk.Value(), LOG2_CACHE_BLOCK_SIZE);
+    if (enable_rd)
+        SharedStream = new OrderedAccessMerger(KnobMergeBatch.Value(), shared_access);
+
+    tls_key = PIN_ClaimTlsKey();
+
+    FiniContext = new ThreadContext(INVALID_THREADID);
+    Threads.push_back(FiniContext);
+
+    if (enable_rd && KnobRDShards.Value()) {
+        // a set is never split between shards, more shards than sets would idle
+        UINT shards = MIN(KnobRDShards.Value(), GlobalRD->getNumSets());
+        if (shards < KnobRDShards.Value())
+            cerr << "Only " << shards << " RD shards with " << GlobalRD->getNumSets() << " sets\n";
+
+        Shards = new ShardRouter(shards, KnobRingSize.Value(),
+                MAX(1, MIN(KnobMergeBatch.Value(), KnobRingSize.Value() / 4)), shard_access);
+        for (UINT w = 0; w < shards; w++) {
+            ShardWorkers.push_back(new AnalysisWorker(w));
+            Threads.push_back(ShardWorkers.back()->tc);
+            Shards->set_arg(w, ShardWorkers.back()->tc);
+        }
     }
 
-    // Initialize the bucket entry for unidentified/small blocks
-    Objects.push_back(ObjectInstance(0, 0, 0));
-    (Objects.end()-1)->type = "default";
-    object_count++; // dummy increment to block count to keep ID's happy
+    enable_async = KnobAsync.Value() && !enable_record;
+    if (enable_async) {
+        if (KnobBackpressure.Value() != "block" && KnobBackpressure.Value() != "drop") {
+            cerr << "Unknown -async-backpressure " << KnobBackpressure.Value() << ", use block or drop\n";
+            exit(1);
+        }
+        async_drop = (KnobBackpressure.Value() == "drop");
 
-    // Add stack
-    Objects.push_back(ObjectInstance(1, 0, 0));
-    (Objects.end()-1)->type = "stack";
-    object_count++; // dummy increment to block count to keep ID's happy
+        // publish often enough that a full ring never waits on an unpublished segment for long
+        async_segment = MAX(1, MIN(KnobMergeBatch.Value(), KnobRingSize.Value() / 4));
 
-    OBJCategory = new OBJ_Cat[OBJ_TYPE_NUM];
+        for (UINT w = 0; w < MAX(1, KnobAsyncWorkers.Value()); w++) {
+            AsyncWorkers.push_back(new AnalysisWorker(w));
+            Threads.push_back(AsyncWorkers.back()->tc);
+        }
+    }
 
-    OutFile << dec << "*********** SPM-SIEVE Initialization Done ***********\n";
-    cerr << "*********** SPM-SIEVE Initialization Done ***********\n";
-    OutFile << "Cache Line Size : " << (1 << LOG2_CACHE_BLOCK_SIZE) << endl;
-    cerr << "Cache Line Size : " << (1 << LOG2_CACHE_BLOCK_SIZE) << endl;
-    OutFile << "L1 Cache Size : " << KnobL1Size.Value() << endl;
-    cerr << "L1 Cache Size : " << KnobL1Size.Value() << endl;
-    OutFile << "L2 Cache Size : " << KnobL2Size.Value() << endl;
-    cerr << "L2 Cache Size : " << KnobL2Size.Value() << endl;
+    access_sampling = MAX(1, KnobSampling.Value());
+    if (!KnobControl.Value().empty()) {
+        Control = new ControlChannel();
+        if (!Control->open(KnobControl.Value()))
+            exit(1);
+    }
+    warmup_pending = (start_icount > 0);
+    detach_budget = (end_icount < NO_END_ICOUNT || KnobDetachSeconds.Value() > 0);
+
+    if (!KnobLive.Value().empty() && !enable_record) {
+        Live = new LivePublisher();
+        if (!Live->open(process_output(KnobLive.Value()), KnobLiveInterval.Value(), LOG2_CACHE_BLOCK_SIZE, LOG2_L1_SIZE,
+                        LOG2_L2_SIZE, LOG2_LLC_SIZE))
+            exit(1);
+    }
 }
 
 INT32 Usage()
@@ -994,13 +1386,59 @@ int main(int argc, char *argv[])
 
     // initialize SPM-Sieve
     InitSPM_Sieve();
+    attached = PIN_IsAttaching();
+
+    for (auto worker : AsyncWorkers) {
+        if (PIN_SpawnInternalThread(AsyncWorkerMain, worker, 0, &worker->uid) == INVALID_THREADID) {
+            cerr << "Unable to spawn analysis worker " << worker->index << endl;
+            exit(1);
+        }
+    }
+    async_running = enable_async;
+
+    for (auto worker : ShardWorkers) {
+        if (PIN_SpawnInternalThread(ShardWorkerMain, worker, 0, &worker->uid) == INVALID_THREADID) {
+            cerr << "Unable to spawn RD shard worker " << worker->index << endl;
+            exit(1);
+        }
+    }
+    shards_running = (Shards != NULL);
+
+    if (Live) {
+        if (PIN_SpawnInternalThread(LivePublisherMain, NULL, 0, &live_uid) == INVALID_THREADID) {
+            cerr << "Unable to spawn the live statistics publisher\n";
+            exit(1);
+        }
+        live_running = true;
+    }
+
+    if (Control || warmup_pending || detach_budget) {
+        if (PIN_SpawnInternalThread(ControlMain, NULL, 0, &control_uid) == INVALID_THREADID) {
+            cerr << "Unable to spawn the control thread\n";
+            exit(1);
+        }
+        control_running = true;
+    }
+
+    if (enable_record)
+        Recorder->start();
 
-    if (!enable_maid)
-       TRACE_AddInstrumentFunction(Trace, 0);
+    TRACE_AddInstrumentFunction(Trace, 0);
+    if (detach_budget)
+        TRACE_AddInstrumentFunction(DetachTrace, 0);
     IMG_AddInstrumentFunction(Image, 0);
+    IMG_AddUnloadFunction(ImageUnload, 0);
 
+    PIN_AddApplicationStartFunction(ApplicationStart, 0);
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+    PIN_AddThreadFiniFunction(ThreadFini, 0);
+    PIN_AddSyscallEntryFunction(SyscallEntry, 0);
+    PIN_AddPrepareForFiniFunction(PrepareForFini, 0);
     PIN_AddFiniFunction(Fini, 0);
     PIN_AddDetachFunction(Detach_callback, 0);
+    PIN_AddForkFunction(FPOINT_BEFORE, BeforeFork, 0);
+    PIN_AddForkFunction(FPOINT_AFTER_IN_PARENT, AfterForkInParent, 0);
+    PIN_AddForkFunction(FPOINT_AFTER_IN_CHILD, AfterForkInChild, 0);
 
     // Never returns
     PIN_StartProgram();
@@ -13,27 +13,30 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include "../InstLib/instlib.H"
-#include "Set-RD.h"
+#include "sieve-core.h"
+#include "trace-writer.h"
+#include "control.h"
+#include "heap-scan.h"
+#include "symbol-cache.h"
 
 #include "maid.h"
 #include "utility.h"
 
-//#define ENABLE_DEBUG_PRINT
-#ifdef ENABLE_DEBUG_PRINT
-#define DEBUG_PRINT(X)	cerr << X
-#else
-#define DEBUG_PRINT(X)
-#endif
-
 /* ===================================================================== */
-/* Names of malloc and free */
+/* Names of the allocation functions */
 /* ===================================================================== */
 #define MALLOC "malloc"
 #define CALLOC "calloc"
 #define FREE "free"
 #define POSIX_MEMALIGN "posix_memalign"
-#define NON_DYNAMIC "static"
+#define REALLOC "realloc"
+#define ALIGNED_ALLOC "aligned_alloc"
+#define MEMALIGN "memalign"
+#define MMAP "mmap"
+#define MMAP64 "mmap64"
+#define MUNMAP "munmap"
 
 /* ===================================================================== */
 /* Commandline Switches */
@@ -48,18 +51,47 @@
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
         "o", "spm-sieve.out", "specify output file name");
 
+KNOB<BOOL> KnobOutputPid(KNOB_MODE_WRITEONCE, "pintool",
+        "output-pid", "0", "append .<pid> to the output, maid.out, trace and live statistics names, e.g. with -follow_execv; forked children always do");
+
 // TODO: rename to malloc-stack-trace; change the output file name 
 KNOB<BOOL> KnobEnableMAID(KNOB_MODE_WRITEONCE, "pintool",
         "maid", "0", "control maid run");
+KNOB<string> KnobSymbolCache(KNOB_MODE_WRITEONCE, "pintool",
+        "symbol-cache", "", "directory keeping the symbols and source lines of the images across runs by build-id, see symbol-cache.h");
 
 KNOB<BOOL> KnobObjectProfile(KNOB_MODE_WRITEONCE, "pintool",
         "obj-prof", "1", "print object profile in a file");
 
+KNOB<string> KnobProfile(KNOB_MODE_WRITEONCE, "pintool",
+        "profile", "", "write the mergeable profile of the run to this file, see spm-sieve-merge");
+
+KNOB<BOOL> KnobTextReport(KNOB_MODE_WRITEONCE, "pintool",
+        "text-report", "1", "write the text report and object profile; 0 writes only the profile (<o>.prof without -profile), see spm-sieve-convert");
+
+KNOB<string> KnobLive(KNOB_MODE_WRITEONCE, "pintool",
+        "live", "", "publish live statistics in /dev/shm/<name> for spm-sieve-top");
+
+KNOB<UINT64> KnobLiveInterval(KNOB_MODE_WRITEONCE, "pintool",
+        "live-interval", "1000", "milliseconds between two live statistics snapshots");
+
+KNOB<string> KnobControl(KNOB_MODE_WRITEONCE, "pintool",
+        "control", "", "read runtime commands (snapshot, reset [warm], disable, enable, sampling <n>) from this FIFO, see control.h");
+
+KNOB<UINT64> KnobSampling(KNOB_MODE_WRITEONCE, "pintool",
+        "sampling", "1", "analyze one in n accesses of every thread");
+
 KNOB<UINT64> KnobStartIcount(KNOB_MODE_WRITEONCE, "pintool",
-        "start-icount", "0", "Specify start icount avoid startup phase");
+        "start-icount", "0", "end of the warm-up: the counts restart from zero at this icount, the cache state stays, so no cold misses of the warm-up are reported");
 
 KNOB<UINT64> KnobEndIcount(KNOB_MODE_WRITEONCE, "pintool",
-        "end-icount", "99999999999999", "Specify end icount to end");
+        "end-icount", "99999999999999", "detach at this icount and write the reports, the program runs on natively");
+
+KNOB<UINT64> KnobDetachSeconds(KNOB_MODE_WRITEONCE, "pintool",
+        "detach-seconds", "0", "detach after this many seconds of analysis, 0 never");
+
+KNOB<BOOL> KnobHeapScan(KNOB_MODE_WRITEONCE, "pintool",
+        "heap-scan", "1", "attached to a running process (pin -pid), add the large heap blocks allocated before, see heap-scan.h");
 
 KNOB<UINT64> KnobProfileInterval(KNOB_MODE_WRITEONCE, "pintool",
         "prof-interval", "1000000000", "Dumping of Stats per Window");
@@ -87,6 +119,42 @@ KNOB<UINT64> KnobL1Size(KNOB_MODE_WRITEONCE,"pintool",
 KNOB<UINT64> KnobL2Size(KNOB_MODE_WRITEONCE,"pintool",
                           "l2size","1048576","L2 cache size simulated");
 
+KNOB<UINT64> KnobLLCSize(KNOB_MODE_WRITEONCE,"pintool",
+                          "llcsize","8388608","shared last level cache size simulated");
+
+KNOB<BOOL> KnobPrivateRD(KNOB_MODE_WRITEONCE,"pintool",
+                          "private-rd","1","model L1/L2 as private per thread caches");
+
+KNOB<UINT64> KnobMergeBatch(KNOB_MODE_WRITEONCE,"pintool",
+                          "merge-batch","4096","accesses a thread buffers before merging them into the shared cache model");
+
+KNOB<UINT64> KnobRDMaxDistance(KNOB_MODE_WRITEONCE,"pintool",
+                          "rd-max-distance","0","bytes of the deepest reuse distance tracked, e.g. 8x l2size; deeper reuses count in one saturated bucket, 0 tracks all");
+
+KNOB<UINT64> KnobWSSWindow(KNOB_MODE_WRITEONCE,"pintool",
+                          "wss-window","10000000","accesses per thread working set sample, 0 disables");
+
+KNOB<BOOL> KnobAsync(KNOB_MODE_WRITEONCE,"pintool",
+                          "async","0","analyze accesses on internal worker threads instead of the application threads");
+
+KNOB<UINT64> KnobAsyncWorkers(KNOB_MODE_WRITEONCE,"pintool",
+                          "async-workers","1","number of internal analysis threads with -async");
+
+KNOB<UINT64> KnobRingSize(KNOB_MODE_WRITEONCE,"pintool",
+                          "ring-size","65536","access records buffered per application thread with -async");
+
+KNOB<string> KnobBackpressure(KNOB_MODE_WRITEONCE,"pintool",
+                          "async-backpressure","block","what a thread does when its ring is full: block or drop");
+
+KNOB<UINT64> KnobRDShards(KNOB_MODE_WRITEONCE,"pintool",
+                          "rd-shards","0","threads running the shared level RD sets, 0 runs them on the merging thread");
+
+KNOB<string> KnobRecord(KNOB_MODE_WRITEONCE,"pintool",
+                          "record","","write the access stream and allocation events to this binary trace instead of analyzing them");
+
+KNOB<UINT64> KnobTraceChunk(KNOB_MODE_WRITEONCE,"pintool",
+                          "trace-chunk","1048576","bytes per chunk of the binary trace");
+
 KNOB<UINT64> KnobNumSets(KNOB_MODE_WRITEONCE,"pintool",
                           "sets","1","number of sets");
 
@@ -96,101 +164,31 @@ KNOB<BOOL> KnobStackAccesses(KNOB_MODE_WRITEONCE,"pintool",
 /* Global Variables */
 /* ===================================================================== */
 
-UINT LOG2_CACHE_BLOCK_SIZE;
-UINT LOG2_L1_SIZE;
-UINT LOG2_L2_SIZE;
-
-std::ofstream OutFile;
 std::ofstream MaidFile;
 
-bool enable_maid, enable_rd, enable_roi;
+bool enable_maid, enable_roi, enable_record;
 UINT64 start_icount, end_icount;
+#define NO_END_ICOUNT 99999999999999ULL    // the default of -end-icount
 UINT64 rd_sampling_interval, profile_interval;
 
-string libc_name = "/lib/x86_64-linux-gnu/libc.so.6";
-
-// total no of memory accesses
-UINT64 total_accesses =0;
-UINT64 total_writes = 0;
-UINT64 unaligned_accesses = 0;
-UINT64 l1_misses, l2_misses;
-
-// total number of blocks
-UINT object_count = 0;
+// asynchronous analysis pipeline, see -async
+bool enable_async, async_drop;
+UINT64 async_segment;   // records an application thread writes before publishing them
 
+string libc_name = "/lib/x86_64-linux-gnu/libc.so.6";
 
-// OBJECT CATEGORY DEFINITION
-enum OBJ_TYPE {
-   LARGE_STATIC,	// CLASS-AL
-   SMALL_STATIC,	// CLASS-SS
-   LARGE_DYNAMIC,	// CLASS-AL
-   SMALL_DYNAMIC,	// CLASS-SD
-   OBJ_STACK,
-   OBJ_TYPE_NUM
-};
-
-class OBJ_Cat {
-public:
-   set<UINT> objects;  // all object ids in this category
-   UINT64 size;        // total size of this category
-   SetRD *rd;  // isolated per category RD
-   UINT64 accesses, misses;
-
-   OBJ_Cat():objects(),size(0),rd(NULL), accesses(0), misses(0)
-   {
-      rd = new SetRD(KnobNumSets.Value(), KnobBlockSize.Value());
-   }
-};
-
-// TODO: make this class compact by creating a metadata class to store the rest of non-ferquent data
-// ObjectInstance class stores all the relevant information we need to maintain for an Object
-class ObjectInstance {
-    public:
-
-        ADDRINT start; //starting address of the malloced block
-        ADDRINT end;
-        ADDRINT size; // size of the malloc
-        ADDRINT callsiteIP; // IP of the call site
-        ADDRINT accesses; // counts the accesses to this malloced block
-        ADDRINT totAcc;    // Profiled final accesses
-        ADDRINT writes; // how many accesses were writes
-        string image_name; // Image name, could be extended further to include most accessing function
-        string type; // malloc, calloc, posix_memalign or static
-        string source; // Source location of malloc call
-        long int first_access, last_access; // timestamp for first and last access of the array
-        // TODO: add the below stats
-        long int tsc_malloc, tsc_free; // timestamp for malloc and free calls, rather then first usage
-        // TODO: deprecated
-        bool valid; // set to false once the block is freed
-        UINT32 id; // unique ID for each block
-
-        // RD based fully associative cache
-        UINT64 l1_misses, l2_misses;
-
-        vector<UINT64> reuseDistance;
-        float priority; // to compute array priority based on various functions
-
-#ifdef OBJECT_ALLOC_HISTOGRAM
-        /***** Access Distribution ********/
-        string firstLoc;
-        string lastLoc;
-        map<string, UINT64> accHist;
-        /**********************************/
-#endif
-
-        ObjectInstance(ADDRINT _start, ADDRINT _size, ADDRINT _callsiteIP):
-            start(_start), size(_size), callsiteIP(_callsiteIP),
-            accesses(0),  writes(0), type("malloc"), first_access(0), last_access(0), valid(true),
-            l1_misses(0), l2_misses(0), reuseDistance(MAX_RD_BUCKETS, 0)
-#ifdef ARRAY_ALLOC_HISTOGRAM
-            , firstLoc(), lastLoc(), accHist()
-#endif
-            {
-                end = start + size;
-                image_name = "libdummy";
-                source = "dummy.c:123";
-                id = object_count;
-
-            }
+// Internal analysis thread.
+// Asynchronous mode: worker w drains the rings of the application threads registered at
+// slots w, w + N, w + 2N, ... With -async only the object lookup runs on the application
+// thread; everything the record feeds (counters, private and shared RD, working set) is
+// updated by the worker, which is the only writer of those fields of the thread's context.
+// Shard mode: worker w owns the shared level RD sets s with s % N == w.
+struct AnalysisWorker {
+   UINT index;
+   ThreadContext *tc;          // shared level counters of the records this worker merges
+   PIN_THREAD_UID uid;
+   UINT64 records;             // records analyzed, for the throughput report
+
+   AnalysisWorker(UINT _index) : index(_index), tc(new ThreadContext(INVALID_THREADID)), uid(0), records(0) { }
 };
 #endif
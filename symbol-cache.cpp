@@ -0,0 +1,318 @@
+//
+//  Symbols of the loaded images kept across runs, see symbol-cache.h
+//
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <unordered_map>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "symbol-cache.h"
+
+typedef map<ADDRINT, pair<string, INT32> > LineMap;
+
+// the names in one pool, each once
+class StringPool {
+    vector<char> bytes;
+    unordered_map<string, UINT32> offsets;
+
+public:
+    UINT32 add(const string &s)
+    {
+        auto it = offsets.find(s);
+        if (it != offsets.end())
+            return it->second;
+        UINT32 offset = bytes.size();
+        bytes.insert(bytes.end(), s.begin(), s.end());
+        bytes.push_back('\0');
+        offsets[s] = offset;
+        return offset;
+    }
+
+    const vector<char> &data() const { return bytes; }
+};
+
+static VOID add_records(const vector<ElfObject> &symbols, StringPool &strings, vector<SymbolRecord> &records)
+{
+    for (auto &symbol : symbols)
+        records.push_back(SymbolRecord{symbol.value, symbol.size, strings.add(symbol.name), symbol.tls});
+}
+
+template <typename T>
+static VOID append(vector<char> &out, const T *items, UINT64 count)
+{
+    const char *bytes = (const char *)items;
+    out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+// the file image of the tables
+static VOID serialize(const ElfImage &image, const LineMap &lines, vector<char> &out)
+{
+    StringPool strings;
+    vector<SymbolRecord> objects, routines;
+    vector<LineRecord> line_records;
+    add_records(image.objects, strings, objects);
+    add_records(image.routines, strings, routines);
+    for (auto &line : lines)
+        line_records.push_back(LineRecord{line.first, strings.add(line.second.first), line.second.second});
+
+    SymbolCacheHeader header;
+    memcpy(header.magic, SYMBOL_CACHE_MAGIC, sizeof(header.magic));
+    header.tls_offset = image.tls_offset;
+    header.object_count = objects.size();
+    header.routine_count = routines.size();
+    header.line_count = line_records.size();
+    header.string_bytes = strings.data().size();
+
+    out.clear();
+    append(out, &header, 1);
+    append(out, objects.data(), objects.size());
+    append(out, routines.data(), routines.size());
+    append(out, line_records.data(), line_records.size());
+    append(out, strings.data().data(), strings.data().size());
+}
+
+// written to a file of its own first, so that a reader never maps half of it
+static bool write_file(const string &path, const vector<char> &data)
+{
+    string temp = path + ".tmp." + to_string(getpid());
+    ofstream out(temp.c_str(), ios::binary);
+    out.write(data.data(), data.size());
+    out.close();
+    if (!out || rename(temp.c_str(), path.c_str()) != 0) {
+        cerr << "Unable to write the symbol cache file " << path << endl;
+        remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool SymbolTable::view(const char *data, size_t bytes)
+{
+    const SymbolCacheHeader *h = (const SymbolCacheHeader *)data;
+    if (bytes < sizeof(*h) || memcmp(h->magic, SYMBOL_CACHE_MAGIC, sizeof(h->magic)) != 0)
+        return false;
+    // every count is below the size of the file, the sum cannot overflow
+    if (h->object_count > bytes || h->routine_count > bytes || h->line_count > bytes || h->string_bytes > bytes)
+        return false;
+    UINT64 records = (h->object_count + h->routine_count) * sizeof(SymbolRecord) + h->line_count * sizeof(LineRecord);
+    if (sizeof(*h) + records + h->string_bytes != bytes)
+        return false;
+
+    const SymbolRecord *o = (const SymbolRecord *)(data + sizeof(*h));
+    const SymbolRecord *r = o + h->object_count;
+    const LineRecord *l = (const LineRecord *)(r + h->routine_count);
+    const char *s = (const char *)(l + h->line_count);
+    if (h->string_bytes && s[h->string_bytes - 1] != '\0')
+        return false;
+    for (UINT64 i = 0; i < h->object_count + h->routine_count; i++)
+        if (o[i].name >= h->string_bytes)
+            return false;
+    for (UINT64 i = 0; i < h->line_count; i++)
+        if (l[i].file >= h->string_bytes)
+            return false;
+
+    header = h;
+    objects = o;
+    routines = r;
+    lines = l;
+    strings = s;
+    return true;
+}
+
+VOID SymbolTable::release()
+{
+    if (mapping)
+        munmap(mapping, mapped);
+    mapping = NULL;
+    mapped = 0;
+    built.clear();
+    header = NULL;
+}
+
+bool SymbolTable::read(const string &file)
+{
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    VOID *mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return false;
+
+    release();
+    mapping = mem;
+    mapped = st.st_size;
+    if (!view((const char *)mem, mapped)) {
+        cerr << "Ignoring the invalid symbol cache file " << file << endl;
+        release();
+        return false;
+    }
+    path = file;
+    return true;
+}
+
+VOID SymbolTable::build(const ElfImage &image, const string &file)
+{
+    release();
+    serialize(image, LineMap(), built);
+    view(built.data(), built.size());
+    path = file;
+    if (!path.empty() && !write_file(path, built))
+        path.clear();
+}
+
+bool SymbolTable::save()
+{
+    if (path.empty() || new_lines.empty())
+        return true;
+
+    // the tables as read, with the new lines merged in
+    ElfImage image;
+    image.tls_offset = header->tls_offset;
+    for (UINT64 i = 0; i < header->object_count; i++)
+        image.objects.push_back(ElfObject{objects[i].value, objects[i].size, name(objects[i].name), objects[i].tls != 0});
+    for (UINT64 i = 0; i < header->routine_count; i++)
+        image.routines.push_back(ElfObject{routines[i].value, routines[i].size, name(routines[i].name), false});
+    LineMap all(new_lines);
+    for (UINT64 i = 0; i < header->line_count; i++)
+        all[lines[i].address] = make_pair(string(name(lines[i].file)), lines[i].line);
+
+    vector<char> data;
+    serialize(image, all, data);
+    return write_file(path, data);
+}
+
+const char *SymbolTable::routine(ADDRINT address) const
+{
+    const SymbolRecord *end = routines + header->routine_count;
+    const SymbolRecord *it = upper_bound(routines, end, address,
+                                         [](ADDRINT a, const SymbolRecord &r) { return a < r.value; });
+    if (it == routines || address >= (it - 1)->value + (it - 1)->size)
+        return NULL;
+    return name((it - 1)->name);
+}
+
+bool SymbolTable::line(ADDRINT address, string &file, INT32 &line) const
+{
+    const LineRecord *end = lines + header->line_count;
+    const LineRecord *it = lower_bound(lines, end, address,
+                                       [](const LineRecord &l, ADDRINT a) { return l.address < a; });
+    if (it != end && it->address == address) {
+        file = name(it->file);
+        line = it->line;
+        return true;
+    }
+    auto added = new_lines.find(address);
+    if (added == new_lines.end())
+        return false;
+    file = added->second.first;
+    line = added->second.second;
+    return true;
+}
+
+VOID SymbolTable::add_line(ADDRINT address, const string &file, INT32 line)
+{
+    new_lines[address] = make_pair(file, line);
+}
+
+SymbolCache::SymbolCache(const string &_directory) : directory(_directory), tables(), images(), hits(0), misses(0)
+{
+    PIN_InitLock(&lock);
+    if (!directory.empty() && mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        cerr << "Unable to create the symbol cache directory " << directory << ", not caching\n";
+        directory.clear();
+    }
+}
+
+SymbolCache::~SymbolCache()
+{
+    for (auto table : tables)
+        delete table;
+}
+
+SymbolTable *SymbolCache::open(const string &file)
+{
+    SymbolTable *table = new SymbolTable();
+    string build_id, path;
+    if (!directory.empty() && read_elf_build_id(file, build_id)) {
+        path = directory + "/" + build_id + ".sym";
+        if (table->read(path)) {
+            PIN_GetLock(&lock, 1);
+            tables.push_back(table);
+            hits++;
+            PIN_ReleaseLock(&lock);
+            return table;
+        }
+    }
+
+    ElfImage image;
+    if (!read_elf_objects(file, image)) {
+        delete table;
+        return NULL;
+    }
+    table->build(image, path);
+    PIN_GetLock(&lock, 1);
+    tables.push_back(table);
+    misses++;
+    PIN_ReleaseLock(&lock);
+    return table;
+}
+
+VOID SymbolCache::load(SymbolTable *table, const string &name, ADDRINT low, ADDRINT high, ADDRINT bias)
+{
+    PIN_GetLock(&lock, 1);
+    images[high] = LoadedImage{low, high, bias, name, table};
+    PIN_ReleaseLock(&lock);
+}
+
+VOID SymbolCache::unload(ADDRINT low)
+{
+    PIN_GetLock(&lock, 1);
+    auto it = images.lower_bound(low);
+    if (it != images.end() && it->second.low == low)
+        images.erase(it);
+    PIN_ReleaseLock(&lock);
+}
+
+bool SymbolCache::symbolize(ADDRINT ip, LINE_RESOLVER resolve, SymbolizedFrame &frame)
+{
+    PIN_GetLock(&lock, 1);
+    auto it = images.lower_bound(ip);
+    if (it == images.end() || ip < it->second.low) {
+        PIN_ReleaseLock(&lock);
+        return false;
+    }
+    // tables are never freed, the pointer outlives an unload
+    SymbolTable *table = it->second.table;
+    ADDRINT address = ip - it->second.bias;
+    frame.image = it->second.name;
+    const char *routine = table->routine(address);
+    frame.routine = routine ? routine : "";
+    bool known = table->line(address, frame.file, frame.line);
+    PIN_ReleaseLock(&lock);
+
+    if (!known) {
+        resolve(ip, frame.file, frame.line);
+        PIN_GetLock(&lock, 1);
+        table->add_line(address, frame.file, frame.line);
+        PIN_ReleaseLock(&lock);
+    }
+    return true;
+}
+
+VOID SymbolCache::save()
+{
+    PIN_GetLock(&lock, 1);
+    for (auto table : tables)
+        table->save();
+    PIN_ReleaseLock(&lock);
+}
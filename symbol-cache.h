@@ -0,0 +1,136 @@
+#ifndef _SYMBOL_CACHE_H
+#define _SYMBOL_CACHE_H
+
+// Symbols of the loaded images, kept on disk across runs by ELF build-id (-symbol-cache <dir>).
+// <dir>/<build-id>.sym holds what a run derives from an image, so that later runs map it
+// instead of reading the symbol tables and asking Pin for the source lines again:
+//
+//   objects    the static objects of elf-symbols.h and the executable's TLS offset
+//   routines   the FUNC symbols, the address range of the routine of a frame
+//   lines      file and line of the addresses symbolized so far: MAID asks Pin
+//              (PIN_GetSourceLocation) for an address not in the table, the answer is kept
+//              and written back at the end of the run
+//
+// Addresses are link time ones. A file is one block, read in place once mapped:
+//
+//   SymbolCacheHeader
+//   SymbolRecord  objects[object_count]     in (tls, value) order
+//   SymbolRecord  routines[routine_count]   in value order
+//   LineRecord    lines[line_count]         in address order
+//   char          strings[string_bytes]     NUL terminated names, referenced by offset
+//
+// An image without build-id is read every run. Without a directory the tables only live in
+// memory, the lines are still looked up once per address.
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "sieve-port.h"
+#include "elf-symbols.h"
+
+using namespace std;
+
+#define SYMBOL_CACHE_MAGIC "SPMSYM01"
+
+struct SymbolCacheHeader {
+   char magic[8];
+   UINT64 tls_offset;
+   UINT64 object_count, routine_count, line_count, string_bytes;
+};
+
+struct SymbolRecord {
+   UINT64 value, size;
+   UINT32 name;                 // offset in strings
+   UINT32 tls;
+};
+
+struct LineRecord {
+   UINT64 address;
+   UINT32 file;                 // offset in strings, "" when Pin knew no line
+   INT32 line;
+};
+
+// The symbols of one image, mapped from its cache file or built from the ELF file
+class SymbolTable {
+   VOID *mapping;
+   size_t mapped;
+   vector<char> built;
+   const SymbolCacheHeader *header;
+   const SymbolRecord *objects, *routines;
+   const LineRecord *lines;
+   const char *strings;
+   map<ADDRINT, pair<string, INT32> > new_lines;   // symbolized during this run
+   string path;                                     // of the cache file, empty when not kept
+
+   bool view(const char *data, size_t bytes);
+   VOID release();
+
+public:
+   SymbolTable() : mapping(NULL), mapped(0), built(), header(NULL), objects(NULL), routines(NULL),
+      lines(NULL), strings(NULL), new_lines(), path() { }
+   ~SymbolTable() { release(); }
+
+   // map the cache file at path, false when it is missing or not a valid one
+   bool read(const string &path);
+   // the tables of image, kept at path unless it is empty (a message when it cannot be written)
+   VOID build(const ElfImage &image, const string &path);
+   // write the file again with the lines added since, if any
+   bool save();
+
+   UINT64 object_count() const { return header->object_count; }
+   const SymbolRecord &object(UINT64 i) const { return objects[i]; }
+   const char *name(UINT32 offset) const { return strings + offset; }
+   ADDRINT tls_offset() const { return header->tls_offset; }
+   UINT64 new_line_count() const { return new_lines.size(); }
+
+   // the routine containing address, NULL when none
+   const char *routine(ADDRINT address) const;
+   // the source location of address, false when it was never looked up
+   bool line(ADDRINT address, string &file, INT32 &line) const;
+   VOID add_line(ADDRINT address, const string &file, INT32 line);
+};
+
+// source location of an address the tables do not know yet, e.g. through PIN_GetSourceLocation
+typedef VOID (*LINE_RESOLVER)(ADDRINT ip, string &file, INT32 &line);
+
+struct SymbolizedFrame {
+   string image, routine, file;
+   INT32 line;
+};
+
+// The tables of the images, by the address range they are loaded at
+class SymbolCache {
+   struct LoadedImage {
+      ADDRINT low, high, bias;
+      string name;
+      SymbolTable *table;
+   };
+
+   string directory;
+   PIN_LOCK lock;
+   vector<SymbolTable *> tables;          // every table opened, kept till the end for save()
+   map<ADDRINT, LoadedImage> images;      // by high address
+
+public:
+   UINT64 hits, misses;                   // images mapped from the cache, read from their file
+
+   SymbolCache(const string &directory);
+   ~SymbolCache();
+
+   // the tables of the ELF file, mapped from the cache when it holds its build-id, else read
+   // and kept in it; NULL with a message when the file cannot be read
+   SymbolTable *open(const string &file);
+   // table is the one of the image name loaded at [low, high], moved by bias
+   VOID load(SymbolTable *table, const string &name, ADDRINT low, ADDRINT high, ADDRINT bias);
+   VOID unload(ADDRINT low);
+
+   // image, routine and source location of ip; a line not in the tables comes from resolve,
+   // called without the lock held, and is kept. false when ip is in no loaded image
+   bool symbolize(ADDRINT ip, LINE_RESOLVER resolve, SymbolizedFrame &frame);
+
+   // write back the tables that got new lines
+   VOID save();
+};
+
+#endif
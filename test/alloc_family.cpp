@@ -0,0 +1,70 @@
+/*
+ * One block per allocation call for make alloc-test, each of its own size so that the object
+ * profile row of every call can be told apart: ",<size>,<type>," must be there for all of them.
+ * operator new calls malloc and malloc mmaps the large block, only the outer call is reported.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <new>
+#include <sys/mman.h>
+
+#define KB      1024
+#define ALIGN   4096
+
+static double sum;
+
+static void touch(void *p, size_t size)
+{
+    memset(p, 1, size);
+    for (size_t i = 0; i < size; i += 64)
+        sum += ((unsigned char *)p)[i];
+}
+
+int main()
+{
+    void *m = malloc(200 * KB);
+    touch(m, 200 * KB);
+
+    void *c = calloc(201, KB);
+    touch(c, 201 * KB);
+
+    // grows and moves, the malloc block is freed
+    void *r = realloc(malloc(202 * KB), 2 * 202 * KB);
+    touch(r, 2 * 202 * KB);
+
+    void *pm = NULL;
+    if (posix_memalign(&pm, ALIGN, 203 * KB) != 0)
+        return 1;
+    touch(pm, 203 * KB);
+
+    void *aa = aligned_alloc(ALIGN, 204 * KB);
+    touch(aa, 204 * KB);
+
+    void *ma = memalign(ALIGN, 205 * KB);
+    touch(ma, 205 * KB);
+
+    char *n = new char[206 * KB];
+    touch(n, 206 * KB);
+
+    double *nt = new (std::nothrow) double[207 * KB / sizeof(double)];
+    touch(nt, 207 * KB);
+
+    void *mm = mmap(NULL, 208 * KB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mm == MAP_FAILED)
+        return 1;
+    touch(mm, 208 * KB);
+
+    printf("%f\n", sum);
+    munmap(mm, 208 * KB);
+    delete[] nt;
+    delete[] n;
+    free(ma);
+    free(aa);
+    free(pm);
+    free(r);
+    free(c);
+    free(m);
+    return 0;
+}
@@ -0,0 +1,42 @@
+/*
+ * Large allocations for make maid-test: grid is allocated at the same call site in a loop,
+ * weights through calloc and rows through a helper, so maid.out must hold three distinct
+ * stacks and the objects be named grid, weights and row. Build with -g -O0 for the lines.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N       (1 << 16)
+#define ROUNDS  8
+
+static double *make_row(size_t n)
+{
+    double *row = malloc(n * sizeof(double));
+    for (size_t i = 0; i < n; i++)
+        row[i] = i;
+    return row;
+}
+
+int main()
+{
+    double sum = 0;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        double *grid = malloc(N * sizeof(double));
+        for (int i = 0; i < N; i++)
+            grid[i] = r + i;
+        for (int i = 0; i < N; i++)
+            sum += grid[i];
+        free(grid);
+    }
+
+    double *weights = calloc(N, sizeof(double));
+    double *first = make_row(N);
+    for (int i = 0; i < N; i++)
+        sum += weights[i] * first[i];
+
+    printf("%f\n", sum);
+    free(first);
+    free(weights);
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*-----------------------------------------------------------------------*/
+/* Multithreaded STREAM triad used as the spm-sieve scaling benchmark.   */
+/*                                                                       */
+/* usage: stream_pthreads [num_threads]                                  */
+/*                                                                       */
+/* The total work is fixed at N elements and NTIMES sweeps; it is split  */
+/* evenly over the threads. Every thread mallocs and frees its own       */
+/* arrays, so the allocation hooks and the object index are exercised   */
+/* concurrently as well as the access path.                              */
+/*-----------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#ifndef N
+#   define N	4000000
+#endif
+#ifndef NTIMES
+#   define NTIMES	4
+#endif
+#define MAX_THREADS 256
+
+struct worker {
+    pthread_t thread;
+    long n;
+    double checksum;
+};
+
+static double mysecond(void)
+{
+    struct timeval tp;
+    gettimeofday(&tp, NULL);
+    return (double) tp.tv_sec + (double) tp.tv_usec * 1.e-6;
+}
+
+static void *triad(void *arg)
+{
+    struct worker *w = (struct worker *) arg;
+    long j, k;
+    double *a = malloc(sizeof(double) * w->n);
+    double *b = malloc(sizeof(double) * w->n);
+    double *c = calloc(w->n, sizeof(double));
+
+    if (!a || !b || !c) {
+        fprintf(stderr, "allocation of %ld elements failed\n", w->n);
+        exit(1);
+    }
+
+    for (j = 0; j < w->n; j++) {
+        a[j] = 1.0;
+        b[j] = 2.0;
+    }
+
+    for (k = 0; k < NTIMES; k++)
+        for (j = 0; j < w->n; j++)
+            a[j] = b[j] + 3.0 * c[j] + a[j];
+
+    w->checksum = 0;
+    for (j = 0; j < w->n; j++)
+        w->checksum += a[j];
+
+    free(a);
+    free(b);
+    free(c);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int t, nthreads = (argc > 1) ? atoi(argv[1]) : 1;
+    struct worker workers[MAX_THREADS];
+    double checksum = 0, time;
+
+    if (nthreads < 1 || nthreads > MAX_THREADS) {
+        fprintf(stderr, "number of threads must be in 1..%d\n", MAX_THREADS);
+        return 1;
+    }
+
+    time = mysecond();
+    for (t = 0; t < nthreads; t++) {
+        workers[t].n = N / nthreads;
+        pthread_create(&workers[t].thread, NULL, triad, &workers[t]);
+    }
+    for (t = 0; t < nthreads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        checksum += workers[t].checksum;
+    }
+    time = mysecond() - time;
+
+    printf("threads %d elements %d sweeps %d time %f s checksum %f\n", nthreads, N, NTIMES, time, checksum);
+    return 0;
+}
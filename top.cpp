@@ -0,0 +1,129 @@
+/*
+ * spm-sieve-top: shows the live statistics of a run started with -live <name>.
+ *
+ *   spm-sieve-top [options] name
+ *
+ * Reads the snapshots of the shared memory ring (live-stats.h) without ever holding up the
+ * run. Rates and miss ratios are over the interval since the previous snapshot in the ring,
+ * totals since the start. Ends after the final snapshot of the run.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <signal.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "live-stats.h"
+
+static const char *CategoryName[OBJ_TYPE_NUM] = { "LARGE_STATIC", "SMALL_STATIC", "LARGE_DYNAMIC", "SMALL_DYNAMIC", "STACK" };
+
+INT32 Usage()
+{
+    cerr << "Usage: spm-sieve-top [options] name\n"
+        "Shows the live statistics a run publishes with -live <name>\n\n"
+        "  -n <ms>                  milliseconds between two screens [1000]\n"
+        "  -count <n>               stop after n screens, 0 runs until the run ends [0]\n"
+        "  -batch <0|1>             append the screens instead of redrawing them [0]\n";
+    return -1;
+}
+
+static double percent(UINT64 part, UINT64 whole)
+{
+    return whole ? 100.0 * part / whole : 0;
+}
+
+static VOID show(const LiveSegment &segment, const string &name, const LiveSnapshot &now, const LiveSnapshot *before)
+{
+    const LiveSnapshot zero = LiveSnapshot();
+    const LiveSnapshot &prev = before ? *before : zero;
+    double seconds = before ? (now.nanoseconds - prev.nanoseconds) * 1e-9 : 0;
+    UINT64 accesses = now.accesses - prev.accesses;
+
+    cout << fixed << setprecision(2);
+    cout << "spm-sieve-top " << name << "  pid " << segment.pid << "  snapshot " << now.number
+         << (now.final ? " (final)" : "") << "  threads " << now.threads << "  objects " << now.objects << "\n";
+    cout << "L1 " << (1ULL << segment.log2_l1_size) << "  L2 " << (1ULL << segment.log2_l2_size)
+         << "  LLC " << (1ULL << segment.log2_llc_size) << "  line " << (1ULL << segment.log2_block_size) << "\n\n";
+
+    cout << "Instructions " << now.instructions << "  Accesses " << now.accesses << "  Writes " << now.writes << "\n";
+    if (seconds > 0)
+        cout << "Interval " << seconds << " s  " << accesses / seconds / 1e6 << " M accesses/s  "
+             << (now.instructions - prev.instructions) / seconds / 1e6 << " M instructions/s\n";
+    cout << "Miss ratio %     interval    total\n";
+    UINT64 l1 = now.l1_misses - prev.l1_misses, l2 = now.l2_misses - prev.l2_misses, llc = now.llc_misses - prev.llc_misses;
+    cout << "  L1           " << setw(10) << percent(l1, accesses) << setw(9) << percent(now.l1_misses, now.accesses) << "\n";
+    cout << "  L2           " << setw(10) << percent(l2, accesses) << setw(9) << percent(now.l2_misses, now.accesses) << "\n";
+    cout << "  LLC          " << setw(10) << percent(llc, accesses) << setw(9) << percent(now.llc_misses, now.accesses) << "\n\n";
+
+    cout << left << setw(16) << "Category" << right << setw(16) << "Accesses" << setw(16) << "L1 Misses"
+         << setw(10) << "Miss %" << "\n";
+    for (UINT c = 0; c < OBJ_TYPE_NUM; c++)
+        cout << left << setw(16) << CategoryName[c] << right << setw(16) << now.cat_accesses[c]
+             << setw(16) << now.cat_misses[c] << setw(10) << percent(now.cat_misses[c], now.cat_accesses[c]) << "\n";
+
+    cout << "\n" << left << setw(12) << "Object" << right << setw(16) << "Accesses" << setw(14) << "Writes"
+         << setw(14) << "L1 Misses" << setw(14) << "L2 Misses" << setw(14) << "LLC Misses" << "  Symbol@Lib\n";
+    for (UINT k = 0; k < now.top_objects && k < LIVE_TOP_OBJECTS; k++) {
+        const LiveObject &object = now.top[k];
+        string name(object.name, strnlen(object.name, LIVE_NAME_BYTES));
+        cout << left << setw(12) << object.id << right << setw(16) << object.accesses << setw(14) << object.writes
+             << setw(14) << object.l1_misses << setw(14) << object.l2_misses << setw(14) << object.llc_misses
+             << "  " << name << "\n";
+    }
+    cout << flush;
+}
+
+int main(int argc, char *argv[])
+{
+    string name;
+    UINT64 refresh_ms = 1000, count = 0;
+    bool batch = false;
+    for (int i = 1; i < argc; i++) {
+        string option = argv[i];
+        if (option[0] != '-') {
+            name = option;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            cerr << "Missing value for " << option << endl;
+            return Usage();
+        }
+        const char *value = argv[++i];
+        if (option == "-n") refresh_ms = MAX(1, strtoull(value, NULL, 0));
+        else if (option == "-count") count = strtoull(value, NULL, 0);
+        else if (option == "-batch") batch = atoi(value);
+        else {
+            cerr << "Unknown option " << option << endl;
+            return Usage();
+        }
+    }
+    if (name.empty())
+        return Usage();
+
+    LiveReader reader;
+    if (!reader.open(name))
+        return -1;
+    const LiveSegment &segment = *reader.header();
+
+    LiveSnapshot now, before;
+    UINT64 shown = 0, last = 0;
+    for (;;) {
+        UINT64 n = reader.published();
+        if (n != last && reader.read(n, now)) {
+            last = n;
+            if (!batch)
+                cout << "\033[H\033[2J";
+            show(segment, name, now, reader.read(n - 1, before) ? &before : NULL);
+            if (batch)
+                cout << "\n";
+            if (now.final || (count && ++shown == count))
+                return 0;
+        }
+        else if (kill(segment.pid, 0) != 0 && errno == ESRCH) {
+            cerr << "Run " << segment.pid << " ended without a final snapshot\n";
+            return -1;
+        }
+        usleep(refresh_ms * 1000);
+    }
+}
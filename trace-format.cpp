@@ -0,0 +1,212 @@
+//
+//  Encoder and decoder of the binary trace format, see trace-format.h
+//
+
+#include <iostream>
+#include <string>
+#include <assert.h>
+using namespace std;
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "sieve-port.h"
+#include "trace-format.h"
+
+TraceChunk::TraceChunk(UINT64 bytes) : buffer(MAX(bytes, (UINT64)sizeof(TraceChunkHeader) + TRACE_MAX_ACCESS_BYTES)),
+   used(sizeof(TraceChunkHeader)), records(0), prev_addr(0), prev_ip(0), prev_time(0), tid(0),
+   kind(TRACE_CHUNK_ACCESS), first_time(0)
+{
+}
+
+VOID TraceChunk::reset(UINT16 _kind, UINT32 _tid, UINT64 time)
+{
+   used = sizeof(TraceChunkHeader);
+   records = 0;
+   prev_addr = prev_ip = 0;
+   prev_time = first_time = time;
+   tid = _tid;
+   kind = _kind;
+}
+
+// make room for an event and encode its common part
+UINT8 *TraceChunk::event_header(UINT8 type, UINT32 event_tid, UINT64 time, UINT64 body_bytes)
+{
+   UINT64 needed = used + 1 + 10 + 10 + body_bytes;
+   if(needed > buffer.size())
+      buffer.resize(MAX(needed, buffer.size() * 2));
+
+   UINT8 *p = &buffer[used];
+   *p++ = type;
+   p = put_varint(p, event_tid);
+   p = put_varint(p, zigzag((INT64)(time - prev_time)));
+   prev_time = time;
+   records++;
+   return p;
+}
+
+VOID TraceChunk::alloc_event(UINT32 event_tid, UINT64 time, ADDRINT start, ADDRINT size, ADDRINT ip, UINT8 type, const string &libname)
+{
+   UINT8 *p = event_header(TRACE_EVENT_ALLOC, event_tid, time, 3 * 10 + 1 + 10 + libname.size());
+   p = put_varint(p, start);
+   p = put_varint(p, size);
+   p = put_varint(p, ip);
+   *p++ = type;
+   p = put_varint(p, libname.size());
+   memcpy(p, libname.data(), libname.size());
+   p += libname.size();
+   used = p - &buffer[0];
+}
+
+VOID TraceChunk::free_event(UINT32 event_tid, UINT64 time, ADDRINT start)
+{
+   UINT8 *p = event_header(TRACE_EVENT_FREE, event_tid, time, 10);
+   p = put_varint(p, start);
+   used = p - &buffer[0];
+}
+
+const UINT8 *TraceChunk::seal(UINT64 *bytes)
+{
+   TraceChunkHeader header;
+   header.magic = TRACE_CHUNK_MAGIC;
+   header.kind = kind;
+   header.reserved = 0;
+   header.tid = tid;
+   header.payload_bytes = used - sizeof(TraceChunkHeader);
+   header.records = records;
+   header.first_time = first_time;
+   memcpy(&buffer[0], &header, sizeof(header));
+
+   *bytes = used;
+   return &buffer[0];
+}
+
+bool TraceChunkDecoder::next_access(TraceAccess &access)
+{
+   if(left == 0 || bad)
+      return false;
+
+   UINT64 daddr, dip, dtime;
+   const UINT8 *q = p;
+   UINT8 tag = (q < end) ? *q++ : 0;
+   if(q == p || !(q = get_varint(q, end, &daddr)) || !(q = get_varint(q, end, &dip))
+         || !(q = get_varint(q, end, &dtime))) {
+      bad = true;
+      return false;
+   }
+   p = q;
+   left--;
+
+   prev_addr += unzigzag(daddr);
+   prev_ip += unzigzag(dip);
+   prev_time += unzigzag(dtime);
+
+   access.addr = prev_addr;
+   access.ip = prev_ip;
+   access.time = prev_time;
+   access.size = (tag >> 2) + 1;
+   access.is_write = tag & 1;
+   access.is_stack = tag & 2;
+   return true;
+}
+
+bool TraceChunkDecoder::next_event(TraceEvent &event)
+{
+   if(left == 0 || bad)
+      return false;
+
+   UINT64 tid, dtime, start, size = 0, ip = 0, length;
+   const UINT8 *q = p;
+   event.type = (q < end) ? *q++ : 0xff;
+   if(q == p || !(q = get_varint(q, end, &tid)) || !(q = get_varint(q, end, &dtime))
+         || !(q = get_varint(q, end, &start))) {
+      bad = true;
+      return false;
+   }
+
+   event.alloc_type = 0;
+   event.libname.clear();
+   if(event.type == TRACE_EVENT_ALLOC) {
+      if(!(q = get_varint(q, end, &size)) || !(q = get_varint(q, end, &ip)) || q >= end) {
+         bad = true;
+         return false;
+      }
+      event.alloc_type = *q++;
+      if(!(q = get_varint(q, end, &length)) || length > (UINT64)(end - q)) {
+         bad = true;
+         return false;
+      }
+      event.libname.assign((const char *)q, length);
+      q += length;
+   }
+   else if(event.type != TRACE_EVENT_FREE) {
+      bad = true;
+      return false;
+   }
+   p = q;
+   left--;
+
+   prev_time += unzigzag(dtime);
+   event.tid = tid;
+   event.start = start;
+   event.size = size;
+   event.ip = ip;
+   event.time = prev_time;
+   return true;
+}
+
+VOID TraceBatch::swap(TraceBatch &other)
+{
+   std::swap(chunk, other.chunk);
+   std::swap(header, other.header);
+   std::swap(corrupt, other.corrupt);
+   addr.swap(other.addr);
+   ip.swap(other.ip);
+   time.swap(other.time);
+   size.swap(other.size);
+   flags.swap(other.flags);
+   events.swap(other.events);
+   id.swap(other.id);
+   category.swap(other.category);
+   rd.swap(other.rd);
+   private_rd.swap(other.private_rd);
+   category_rd.swap(other.category_rd);
+}
+
+bool decode_chunk(const TraceChunkHeader &header, const UINT8 *payload, TraceBatch &batch)
+{
+   TraceChunkDecoder decoder(header, payload);
+   batch.header = header;
+   batch.addr.clear();
+   batch.ip.clear();
+   batch.time.clear();
+   batch.size.clear();
+   batch.flags.clear();
+   batch.events.clear();
+
+   if(header.kind == TRACE_CHUNK_EVENT) {
+      batch.events.resize(header.records);
+      UINT64 n = 0;
+      while(n < header.records && decoder.next_event(batch.events[n]))
+         n++;
+      batch.events.resize(n);
+   }
+   else {
+      batch.addr.reserve(header.records);
+      batch.ip.reserve(header.records);
+      batch.time.reserve(header.records);
+      batch.size.reserve(header.records);
+      batch.flags.reserve(header.records);
+
+      TraceAccess access;
+      while(decoder.next_access(access)) {
+         batch.addr.push_back(access.addr);
+         batch.ip.push_back(access.ip);
+         batch.time.push_back(access.time);
+         batch.size.push_back(access.size);
+         batch.flags.push_back((access.is_stack ? 2 : 0) | (access.is_write ? 1 : 0));
+      }
+   }
+
+   batch.corrupt = decoder.corrupt();
+   return !batch.corrupt;
+}
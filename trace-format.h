@@ -0,0 +1,235 @@
+#ifndef _TRACE_FORMAT_H
+#define _TRACE_FORMAT_H
+
+/***********************************************************************
+ *
+ * SPM-Sieve binary trace format, version 1
+ *
+ * Written by -record, read back by the offline replay (spm-sieve-replay). All integers are
+ * in host byte order (little endian on the supported x86 targets).
+ *
+ *   file         := file_header chunk* index trailer
+ *   file_header  := "SPMTRACE" u32 version u32 header_bytes u32 log2_block_size u32 flags u64 reserved
+ *   chunk        := chunk_header payload
+ *   chunk_header := u32 magic("CHNK") u16 kind u16 reserved u32 tid u32 payload_bytes u64 records u64 first_time
+ *   index        := index_entry*                     one per chunk, in file order
+ *   index_entry  := u64 offset u32 tid u16 kind u16 reserved u64 records u64 first_time
+ *   trailer      := u64 index_offset u64 index_entries "SPMINDEX"
+ *
+ * A trace without trailer (the process died) can still be read by walking the chunk headers.
+ *
+ * Every chunk decodes on its own: the delta state starts at addr = ip = 0 and time = first_time.
+ * varint is LEB128, zigzag maps signed deltas to small unsigned numbers.
+ *
+ * Access chunk (kind 0), the accesses of one thread, each within one cache line:
+ *   access := u8 tag varint(zigzag(addr - prev_addr)) varint(zigzag(ip - prev_ip)) varint(zigzag(time - prev_time))
+ *   tag    := bit 0 write, bit 1 stack access, bits 2..7 size - 1
+ *
+ * Event chunk (kind 1), allocation events of all threads in the order they took effect:
+ *   event  := u8 type varint tid varint(zigzag(time - prev_time)) body
+ *   ALLOC  := varint start varint size varint ip u8 alloc_type(OBJ_ALLOC_TYPE) varint length bytes(libname)
+ *   FREE   := varint start
+ *
+ * Ordering: the chunks of one thread and the events are in program order.
+ * A thread hands over its chunk before each of its own allocation events, at every
+ * system call and when the chunk is full, so accesses of other threads are ordered
+ * against an event at chunk granularity.
+ *
+ **********************************************************************/
+
+#include <vector>
+#include <string>
+
+using namespace std;
+
+#define TRACE_VERSION        1
+#define TRACE_MAGIC          "SPMTRACE"
+#define TRACE_INDEX_MAGIC    "SPMINDEX"
+#define TRACE_CHUNK_MAGIC    0x4b4e4843   // "CHNK"
+
+enum TRACE_CHUNK_KIND {
+   TRACE_CHUNK_ACCESS,
+   TRACE_CHUNK_EVENT
+};
+
+enum TRACE_EVENT_TYPE {
+   TRACE_EVENT_ALLOC,
+   TRACE_EVENT_FREE
+};
+
+// longest encoded access: tag and three 10 byte varints
+#define TRACE_MAX_ACCESS_BYTES 31
+
+struct TraceFileHeader {
+   char magic[8];
+   UINT32 version;
+   UINT32 header_bytes;
+   UINT32 log2_block_size;
+   UINT32 flags;
+   UINT64 reserved;
+};
+
+struct TraceChunkHeader {
+   UINT32 magic;
+   UINT16 kind;
+   UINT16 reserved;
+   UINT32 tid;
+   UINT32 payload_bytes;
+   UINT64 records;
+   UINT64 first_time;
+};
+
+struct TraceIndexEntry {
+   UINT64 offset;
+   UINT32 tid;
+   UINT16 kind;
+   UINT16 reserved;
+   UINT64 records;
+   UINT64 first_time;
+};
+
+struct TraceTrailer {
+   UINT64 index_offset;
+   UINT64 index_entries;
+   char magic[8];
+};
+
+inline UINT64 zigzag(INT64 v) { return ((UINT64)v << 1) ^ (UINT64)(v >> 63); }
+inline INT64 unzigzag(UINT64 v) { return (INT64)(v >> 1) ^ -(INT64)(v & 1); }
+
+inline UINT8 *put_varint(UINT8 *p, UINT64 v)
+{
+   while(v >= 0x80) {
+      *p++ = (UINT8)(v | 0x80);
+      v >>= 7;
+   }
+   *p++ = (UINT8)v;
+   return p;
+}
+
+// decode a varint; returns NULL when it runs past end
+inline const UINT8 *get_varint(const UINT8 *p, const UINT8 *end, UINT64 *v)
+{
+   UINT64 value = 0;
+   for(UINT shift = 0; p < end && shift < 64; shift += 7) {
+      UINT8 byte = *p++;
+      value |= (UINT64)(byte & 0x7f) << shift;
+      if(!(byte & 0x80)) {
+         *v = value;
+         return p;
+      }
+   }
+   return NULL;
+}
+
+// One chunk being encoded: the chunk header followed by the payload, in a buffer that is
+// allocated once and reused for every chunk
+class TraceChunk {
+   vector<UINT8> buffer;
+   UINT64 used;
+
+public:
+   UINT64 records;
+   UINT64 prev_addr, prev_ip, prev_time;
+   UINT32 tid;
+   UINT16 kind;
+   UINT64 first_time;
+
+   TraceChunk(UINT64 bytes);
+
+   // start a new chunk of the given kind
+   VOID reset(UINT16 _kind, UINT32 _tid, UINT64 time);
+
+   // true when another access may not fit
+   bool full() const { return used + TRACE_MAX_ACCESS_BYTES > buffer.size(); }
+   bool empty() const { return records == 0; }
+
+   VOID access(ADDRINT addr, ADDRINT ip, UINT64 time, UINT32 size, bool is_write, bool is_stack)
+   {
+      UINT8 *p = &buffer[used];
+      *p++ = (UINT8)(((size - 1) << 2) | (is_stack ? 2 : 0) | (is_write ? 1 : 0));
+      p = put_varint(p, zigzag((INT64)(addr - prev_addr)));
+      p = put_varint(p, zigzag((INT64)(ip - prev_ip)));
+      p = put_varint(p, zigzag((INT64)(time - prev_time)));
+      used = p - &buffer[0];
+      prev_addr = addr;
+      prev_ip = ip;
+      prev_time = time;
+      records++;
+   }
+
+   // event chunks grow as needed, events are rare
+   VOID alloc_event(UINT32 event_tid, UINT64 time, ADDRINT start, ADDRINT size, ADDRINT ip, UINT8 type, const string &libname);
+   VOID free_event(UINT32 event_tid, UINT64 time, ADDRINT start);
+
+   // fill in the chunk header; returns the whole chunk
+   const UINT8 *seal(UINT64 *bytes);
+
+private:
+   UINT8 *event_header(UINT8 type, UINT32 event_tid, UINT64 time, UINT64 body_bytes);
+};
+
+// One decoded access
+struct TraceAccess {
+   ADDRINT addr, ip;
+   UINT64 time;
+   UINT32 size;
+   bool is_write, is_stack;
+};
+
+// One decoded allocation event
+struct TraceEvent {
+   UINT8 type;
+   UINT32 tid;
+   UINT64 time;
+   ADDRINT start, size, ip;   // size and ip only for TRACE_EVENT_ALLOC
+   UINT8 alloc_type;
+   string libname;
+};
+
+// Decodes the payload of one chunk. The records come out in chunk order; next_*() returns
+// false at the end of the payload, corrupt() tells a truncated or damaged chunk apart
+class TraceChunkDecoder {
+   const UINT8 *p, *end;
+   UINT64 prev_addr, prev_ip, prev_time;
+   UINT64 left;
+   bool bad;
+
+public:
+   TraceChunkDecoder(const TraceChunkHeader &header, const UINT8 *payload) :
+      p(payload), end(payload + header.payload_bytes), prev_addr(0), prev_ip(0),
+      prev_time(header.first_time), left(header.records), bad(false) { }
+
+   bool next_access(TraceAccess &access);
+   bool next_event(TraceEvent &event);
+   bool corrupt() const { return bad || (left == 0 && p != end); }
+};
+
+// One decoded chunk in columns, reused from chunk to chunk so that the columns are
+// allocated once. Access chunks fill the access columns, event chunks the events
+struct TraceBatch {
+   UINT64 chunk;                   // index of the chunk in the trace
+   TraceChunkHeader header;
+   bool corrupt;
+
+   vector<UINT64> addr, ip, time;
+   vector<UINT8> size;
+   vector<UINT8> flags;            // bit 0 write, bit 1 stack access, as in the tag
+   vector<TraceEvent> events;
+
+   // attribution and RDs of the accesses, filled in by the consumer
+   vector<UINT32> id;
+   vector<UINT8> category;
+   vector<INT> rd;                 // shared levels
+   vector<INT> private_rd;         // private levels of the thread
+   vector<INT> category_rd;        // per category RD, only its histogram is used
+
+   VOID swap(TraceBatch &other);
+
+   UINT64 accesses() const { return addr.size(); }
+};
+
+// decode a whole chunk into batch; false when the chunk is corrupt
+bool decode_chunk(const TraceChunkHeader &header, const UINT8 *payload, TraceBatch &batch);
+
+#endif
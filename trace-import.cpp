@@ -0,0 +1,481 @@
+//
+//  Importers of other tracers' memory traces for the offline replay, see trace-import.h
+//
+
+#include <iostream>
+#include <string>
+#include <assert.h>
+using namespace std;
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include "sieve-port.h"
+#include "object-store.h"
+#include "trace-import.h"
+
+static double now_seconds()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+ImportFile::ImportFile(const string &file, UINT64 buffer_bytes) :
+   fd(-1), buffer(buffer_bytes), begin(0), end(0), eof(false), name(file), bytes(0)
+{
+   fd = (file == "-") ? 0 : open(file.c_str(), O_RDONLY);
+   if(fd < 0) {
+      cerr << "Unable to open " << file << endl;
+      exit(1);
+   }
+#ifdef POSIX_FADV_SEQUENTIAL
+   posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+ImportFile::~ImportFile()
+{
+   if(fd > 0)
+      close(fd);
+}
+
+// move the unread bytes to the front and read behind them; false when nothing came in
+bool ImportFile::fill()
+{
+   if(eof)
+      return false;
+   if(begin > 0) {
+      memmove(&buffer[0], &buffer[begin], end - begin);
+      end -= begin;
+      begin = 0;
+   }
+   ssize_t got;
+   do
+      got = ::read(fd, &buffer[end], buffer.size() - end);
+   while(got < 0 && errno == EINTR);
+   if(got <= 0) {
+      if(got < 0)
+         cerr << "Read error on " << name << ", importing what was read\n";
+      eof = true;
+      return false;
+   }
+   end += got;
+   bytes += got;
+   return true;
+}
+
+bool ImportFile::line(const char *&text, UINT64 &length)
+{
+   UINT64 scanned = begin;
+   for(;;) {
+      const char *newline = (const char *)memchr(buffer.data() + scanned, '\n', end - scanned);
+      if(newline) {
+         text = buffer.data() + begin;
+         length = newline - text;
+         begin = newline - &buffer[0] + 1;
+         return true;
+      }
+      // fill() moves the unread bytes to the front, what was scanned stays scanned
+      scanned = end - begin;
+      if(end - begin == buffer.size() || !fill()) {
+         // a line filling the whole buffer, or the last line without newline
+         if(end == begin)
+            return false;
+         text = buffer.data() + begin;
+         length = end - begin;
+         begin = end;
+         return true;
+      }
+   }
+}
+
+bool ImportFile::read(VOID *data, UINT64 length)
+{
+   assert(length <= buffer.size());
+   while(end - begin < length)
+      if(!fill())
+         return false;
+   memcpy(data, &buffer[begin], length);
+   begin += length;
+   return true;
+}
+
+// Number parsing within [p, end) of a line, which is not NUL terminated.
+// Each returns the position after the number, NULL when there is none
+static const char *skip_blanks(const char *p, const char *end)
+{
+   while(p < end && (*p == ' ' || *p == '\t'))
+      p++;
+   return p;
+}
+
+static const char *parse_hex(const char *p, const char *end, UINT64 &v)
+{
+   const char *start = p;
+   v = 0;
+   for(; p < end; p++) {
+      char c = *p;
+      UINT digit;
+      if(c >= '0' && c <= '9') digit = c - '0';
+      else if(c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+      else if(c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+      else break;
+      v = (v << 4) | digit;
+   }
+   return (p == start) ? NULL : p;
+}
+
+static const char *parse_decimal(const char *p, const char *end, UINT64 &v)
+{
+   const char *start = p;
+   v = 0;
+   for(; p < end && *p >= '0' && *p <= '9'; p++)
+      v = v * 10 + (*p - '0');
+   return (p == start) ? NULL : p;
+}
+
+// decimal, or hex with a 0x prefix
+static const char *parse_number(const char *p, const char *end, UINT64 &v)
+{
+   if(end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+      return parse_hex(p + 2, end, v);
+   return parse_decimal(p, end, v);
+}
+
+/*
+ * Allocation log
+ */
+
+AllocLog::AllocLog(const string &file) : in(file, 1 << 16), pending(false), position(0), event(), events(0), skipped(0)
+{
+   advance();
+}
+
+// read the next event line
+VOID AllocLog::advance()
+{
+   const char *text;
+   UINT64 length;
+   pending = false;
+   while(in.line(text, length)) {
+      const char *p = skip_blanks(text, text + length), *end = text + length;
+      if(p == end || *p == '#')
+         continue;
+
+      UINT64 at, start, value;
+      const char *word;
+      if(!(p = parse_number(p, end, at)) || (word = skip_blanks(p, end)) == end) {
+         skipped++;
+         continue;
+      }
+      p = word;
+      while(p < end && *p != ' ' && *p != '\t')
+         p++;
+      string type(word, p - word);
+      if(!(p = parse_number(skip_blanks(p, end), end, start))) {
+         skipped++;
+         continue;
+      }
+
+      event = TraceEvent();
+      event.start = start;
+      if(type == "free")
+         event.type = TRACE_EVENT_FREE;
+      else {
+         UINT t = ALLOC_MALLOC;
+         while(t < ALLOC_TYPE_NUM && type != AllocTypeName[t])
+            t++;
+         if(t == ALLOC_TYPE_NUM || !(p = parse_number(skip_blanks(p, end), end, event.size))) {
+            skipped++;
+            continue;
+         }
+         event.type = TRACE_EVENT_ALLOC;
+         event.alloc_type = t;
+      }
+
+      // optional tid, allocation site and name
+      const char *q = parse_number(skip_blanks(p, end), end, value);
+      if(q) {
+         event.tid = value;
+         if((p = parse_number(skip_blanks(q, end), end, value))) {
+            event.ip = value;
+            p = skip_blanks(p, end);
+            event.libname.assign(p, end - p);
+         }
+      }
+
+      if(at < position)
+         cerr << "Allocation log " << in.name << " is out of order at position " << at << endl;
+      position = at;
+      pending = true;
+      return;
+   }
+}
+
+VOID AllocLog::take(UINT64 at, UINT64 time, vector<TraceEvent> &out)
+{
+   while(due(at)) {
+      event.time = time;
+      out.push_back(event);
+      events++;
+      advance();
+   }
+}
+
+/*
+ * Importers
+ */
+
+TraceImporter::TraceImporter(const string &_format, const string &file, AllocLog *_log, UINT _log2_block_size, UINT64 _batch_accesses) :
+   log(_log), log2_block_size(_log2_block_size), batch_accesses(MAX(_batch_accesses, 1)), chunks(0),
+   held(), holding(false), in(file, 1 << 20), time(0), format(_format), stats()
+{
+}
+
+TraceImporter::~TraceImporter()
+{
+}
+
+// one access or, for a modify, a read and a write; each cut at the cache lines, as the Pin tool does
+VOID TraceImporter::append(TraceBatch &batch, const ImportRecord &record, bool is_write)
+{
+   UINT64 line = 1ULL << log2_block_size;
+   ADDRINT addr = record.addr;
+   UINT64 left = MAX(record.size, 1);
+   while(left) {
+      UINT64 size = MIN(left, line - (addr & (line - 1)));
+      batch.addr.push_back(addr);
+      batch.ip.push_back(record.ip);
+      batch.time.push_back(record.time);
+      batch.size.push_back(size);
+      batch.flags.push_back(is_write ? 1 : 0);
+      addr += size;
+      left -= size;
+   }
+}
+
+bool TraceImporter::next(TraceBatch &batch)
+{
+   double start = now_seconds();
+
+   batch.chunk = chunks;
+   batch.corrupt = false;
+   memset(&batch.header, 0, sizeof(batch.header));
+   batch.header.magic = TRACE_CHUNK_MAGIC;
+   batch.addr.clear();
+   batch.ip.clear();
+   batch.time.clear();
+   batch.size.clear();
+   batch.flags.clear();
+   batch.events.clear();
+
+   if(!holding)
+      holding = read_record(held);
+
+   // the events due before the next record come first, on their own; at the end all that are left
+   UINT64 at = holding ? stats.records : ~0ULL;
+   if(log && log->due(at)) {
+      batch.header.kind = TRACE_CHUNK_EVENT;
+      batch.header.first_time = holding ? held.time : time;
+      log->take(at, batch.header.first_time, batch.events);
+      batch.header.records = batch.events.size();
+      chunks++;
+      stats.seconds += now_seconds() - start;
+      return true;
+   }
+   if(!holding) {
+      stats.seconds += now_seconds() - start;
+      return false;
+   }
+
+   // the records of one thread, up to the batch size or the next event
+   batch.header.kind = TRACE_CHUNK_ACCESS;
+   batch.header.tid = held.tid;
+   batch.header.first_time = held.time;
+   while(holding && held.tid == batch.header.tid && stats.records - at < batch_accesses) {
+      if(stats.records != at && log && log->due(stats.records))
+         break;
+      if(held.flags & 2) {
+         append(batch, held, false);
+         append(batch, held, true);
+      }
+      else
+         append(batch, held, held.flags & 1);
+      stats.records++;
+      holding = read_record(held);
+   }
+   batch.header.records = batch.accesses();
+   stats.accesses += batch.accesses();
+   chunks++;
+   stats.seconds += now_seconds() - start;
+   return true;
+}
+
+// valgrind --tool=lackey --trace-mem=yes; a single thread, the time counts the I lines
+class LackeyImporter : public TraceImporter {
+   ADDRINT ip;
+
+public:
+   LackeyImporter(const string &file, AllocLog *log, UINT log2_block_size, UINT64 batch_accesses) :
+      TraceImporter("lackey", file, log, log2_block_size, batch_accesses), ip(0) { }
+
+   bool read_record(ImportRecord &record)
+   {
+      const char *text;
+      UINT64 length;
+      while(in.line(text, length)) {
+         const char *p = text, *end = text + length;
+         UINT64 addr, size;
+         if(length < 3) {
+            stats.skipped++;
+            continue;
+         }
+         char kind = (p[0] == ' ') ? p[1] : p[0];
+         p = skip_blanks(p + 1 + (p[0] == ' '), end);
+         if(!(p = parse_hex(p, end, addr)) || p == end || *p != ',' || !parse_decimal(p + 1, end, size)) {
+            stats.skipped++;
+            continue;
+         }
+
+         if(kind == 'I') {
+            ip = addr;
+            time++;
+            stats.instructions++;
+            continue;
+         }
+         if(kind != 'L' && kind != 'S' && kind != 'M') {
+            stats.skipped++;
+            continue;
+         }
+         record.addr = addr;
+         record.ip = ip;
+         record.time = time;
+         record.size = size;
+         record.tid = 0;
+         record.flags = (kind == 'S') ? 1 : (kind == 'M') ? 2 : 0;
+         return true;
+      }
+      return false;
+   }
+};
+
+// DynamoRIO drcachesim trace entries, the subset of trace_type_t in DR's trace_entry.h read here
+enum DR_TRACE_TYPE {
+   DR_TRACE_TYPE_READ = 0,
+   DR_TRACE_TYPE_WRITE = 1,
+   DR_TRACE_TYPE_INSTR = 10,                   // 10 .. 16: instruction, the kinds of branches
+   DR_TRACE_TYPE_INSTR_RETURN = 16,
+   DR_TRACE_TYPE_INSTR_BUNDLE = 17,            // size more instructions
+   DR_TRACE_TYPE_THREAD = 22,                  // addr is the tid of the entries that follow
+   DR_TRACE_TYPE_INSTR_NO_FETCH = 29,
+   DR_TRACE_TYPE_INSTR_SYSENTER = 31
+};
+
+struct DrTraceEntry {
+   UINT16 type;
+   UINT16 size;
+   UINT64 addr;
+} __attribute__((packed));
+
+// drcachesim offline traces after raw2trace; prefetches, markers and flushes are skipped
+class DrMemtraceImporter : public TraceImporter {
+   ADDRINT ip;
+   UINT32 tid;
+
+public:
+   DrMemtraceImporter(const string &file, AllocLog *log, UINT log2_block_size, UINT64 batch_accesses) :
+      TraceImporter("drmemtrace", file, log, log2_block_size, batch_accesses), ip(0), tid(0) { }
+
+   bool read_record(ImportRecord &record)
+   {
+      DrTraceEntry entry;
+      while(in.read(&entry, sizeof(entry))) {
+         switch(entry.type) {
+         case DR_TRACE_TYPE_READ:
+         case DR_TRACE_TYPE_WRITE:
+            record.addr = entry.addr;
+            record.ip = ip;
+            record.time = time;
+            record.size = entry.size;
+            record.tid = tid;
+            record.flags = (entry.type == DR_TRACE_TYPE_WRITE) ? 1 : 0;
+            return true;
+         case DR_TRACE_TYPE_INSTR_BUNDLE:
+            time += entry.size;
+            stats.instructions += entry.size;
+            break;
+         case DR_TRACE_TYPE_THREAD:
+            tid = entry.addr;
+            break;
+         default:
+            if((entry.type >= DR_TRACE_TYPE_INSTR && entry.type <= DR_TRACE_TYPE_INSTR_RETURN) ||
+               (entry.type >= DR_TRACE_TYPE_INSTR_NO_FETCH && entry.type <= DR_TRACE_TYPE_INSTR_SYSENTER)) {
+               ip = entry.addr;
+               time++;
+               stats.instructions++;
+            }
+            else
+               stats.skipped++;
+         }
+      }
+      return false;
+   }
+};
+
+// addr,size,rw[,tid]; the time is the record number
+class CsvImporter : public TraceImporter {
+public:
+   CsvImporter(const string &file, AllocLog *log, UINT log2_block_size, UINT64 batch_accesses) :
+      TraceImporter("csv", file, log, log2_block_size, batch_accesses) { }
+
+   bool read_record(ImportRecord &record)
+   {
+      const char *text;
+      UINT64 length;
+      while(in.line(text, length)) {
+         const char *p = text, *end = text + length;
+         UINT64 addr, size, tid = 0;
+         if(!(p = parse_number(skip_blanks(p, end), end, addr)) || (p = skip_blanks(p, end)) == end || *p != ',' ||
+            !(p = parse_decimal(skip_blanks(p + 1, end), end, size)) || (p = skip_blanks(p, end)) == end || *p != ',' ||
+            (p = skip_blanks(p + 1, end)) == end) {
+            stats.skipped++;
+            continue;
+         }
+         char rw = *p++;
+         if(rw != 'r' && rw != 'R' && rw != 'w' && rw != 'W' && rw != '0' && rw != '1') {
+            stats.skipped++;
+            continue;
+         }
+         p = skip_blanks(p, end);
+         if(p < end && *p == ',')
+            parse_number(skip_blanks(p + 1, end), end, tid);
+
+         record.addr = addr;
+         record.ip = 0;
+         record.time = time++;
+         record.size = size;
+         record.tid = tid;
+         record.flags = (rw == 'w' || rw == 'W' || rw == '1') ? 1 : 0;
+         return true;
+      }
+      return false;
+   }
+};
+
+TraceImporter *open_importer(const string &format, const string &file, AllocLog *log,
+                             UINT log2_block_size, UINT64 batch_accesses)
+{
+   if(format == "lackey")
+      return new LackeyImporter(file, log, log2_block_size, batch_accesses);
+   if(format == "drmemtrace")
+      return new DrMemtraceImporter(file, log, log2_block_size, batch_accesses);
+   if(format == "csv")
+      return new CsvImporter(file, log, log2_block_size, batch_accesses);
+   return NULL;
+}
@@ -0,0 +1,131 @@
+#ifndef _TRACE_IMPORT_H
+#define _TRACE_IMPORT_H
+
+// Importers of memory traces written by other tracers, for the offline replay. Native builds
+// only (SPM_SIEVE_NO_PIN). An importer streams its input through a fixed buffer and hands out
+// the same batches the decoder of a -record trace produces, so memory stays bounded whatever
+// the trace length.
+//
+//   lackey      valgrind --tool=lackey --trace-mem=yes output: "I  addr,size", " L addr,size",
+//               " S addr,size", " M addr,size" (a load and a store); other lines are skipped
+//   drmemtrace  DynamoRIO drcachesim offline trace after raw2trace, uncompressed: packed
+//               { u16 type; u16 size; u64 addr } entries, see DR's trace_entry.h
+//   csv         addr,size,rw[,tid] per line; rw is r/w or 0/1, a header line is skipped
+//
+// None of these carry allocation events. They come from an allocation log (-alloc-log), a text
+// file of events keyed by their position in the access stream:
+//
+//   <position> <malloc|calloc|posix_memalign|realloc|aligned_alloc|new|mmap|static> <start> <size> [<tid> [<site ip> [<name>]]]
+//   <position> free <start> [<tid>]
+//
+// position is the number of data access records of the trace before the event (a lackey M line
+// is one record); the lines are in position order, '#' starts a comment. Numbers take a 0x prefix.
+
+#include <string>
+#include <vector>
+
+#include "trace-format.h"
+
+using namespace std;
+
+// A file (or stdin for "-") read front to back through one fixed buffer
+class ImportFile {
+   int fd;
+   vector<char> buffer;
+   UINT64 begin, end;          // unread bytes in the buffer
+   bool eof;
+
+   bool fill();
+
+public:
+   string name;
+   UINT64 bytes;               // read from the file so far
+
+   // exits when the file cannot be opened
+   ImportFile(const string &file, UINT64 buffer_bytes);
+   ~ImportFile();
+
+   // the next line without its newline, valid until the next call; false at the end.
+   // Lines longer than the buffer are cut into pieces
+   bool line(const char *&text, UINT64 &length);
+
+   // exactly length bytes, false at the end of the file
+   bool read(VOID *data, UINT64 length);
+};
+
+// The allocation log, read one event ahead
+class AllocLog {
+   ImportFile in;
+   bool pending;
+   UINT64 position;            // of the pending event
+   TraceEvent event;
+
+   VOID advance();
+
+public:
+   UINT64 events, skipped;
+
+   AllocLog(const string &file);
+
+   // an event is due before the access record at position
+   bool due(UINT64 at) const { return pending && position <= at; }
+
+   // move the events due at position into events, stamped with time
+   VOID take(UINT64 at, UINT64 time, vector<TraceEvent> &out);
+};
+
+// one data access record of a foreign trace
+struct ImportRecord {
+   ADDRINT addr, ip;
+   UINT64 time;                // instructions of the thread before the access, or the record number
+   UINT32 size, tid;
+   UINT8 flags;                // bit 0 write, bit 1 modify: a read then a write of the same bytes
+};
+
+struct ImportStats {
+   UINT64 records;             // data access records
+   UINT64 instructions;        // instruction records, they only advance the time
+   UINT64 skipped;             // lines or entries of no use to the replay, or that do not parse
+   UINT64 accesses;            // cache line accesses handed to the replay
+   double seconds;             // spent in parsing
+
+   ImportStats() : records(0), instructions(0), skipped(0), accesses(0), seconds(0) { }
+};
+
+class TraceImporter {
+   AllocLog *log;
+   UINT log2_block_size;
+   UINT64 batch_accesses;
+   UINT64 chunks;
+   ImportRecord held;          // read ahead, it did not fit the last batch
+   bool holding;
+
+   VOID append(TraceBatch &batch, const ImportRecord &record, bool is_write);
+
+protected:
+   ImportFile in;
+   UINT64 time;                // per format, see ImportRecord
+
+   // the next data access record of the input, false at its end
+   virtual bool read_record(ImportRecord &record) = 0;
+
+public:
+   string format;
+   ImportStats stats;
+
+   TraceImporter(const string &_format, const string &file, AllocLog *_log, UINT _log2_block_size, UINT64 _batch_accesses);
+   virtual ~TraceImporter();
+
+   // the next batch in stream order: the accesses of one thread split at cache lines, or the
+   // allocation events due; false at the end of the trace
+   bool next(TraceBatch &batch);
+
+   UINT64 bytes() const { return in.bytes; }
+   const AllocLog *alloc_log() const { return log; }
+};
+
+// importer for format (lackey, drmemtrace or csv), NULL for an unknown format; log may be NULL
+TraceImporter *open_importer(const string &format, const string &file, AllocLog *log,
+                             UINT log2_block_size, UINT64 batch_accesses);
+
+#endif
@@ -0,0 +1,175 @@
+//
+//  Memory mapped trace reader and the parallel chunk decoder of the offline replay
+//
+
+#include <iostream>
+#include <string>
+#include <assert.h>
+using namespace std;
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include "sieve-port.h"
+#include "trace-reader.h"
+
+MappedTrace::MappedTrace(const string &file) : data(NULL), bytes(0), released(0), has_trailer(false)
+{
+   int fd = open(file.c_str(), O_RDONLY);
+   struct stat st;
+   if(fd < 0 || fstat(fd, &st) != 0) {
+      cerr << "Unable to open trace file " << file << endl;
+      exit(1);
+   }
+   bytes = st.st_size;
+   if(bytes < sizeof(header)) {
+      cerr << file << " is not an SPM-Sieve trace\n";
+      exit(1);
+   }
+
+   VOID *map = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if(map == MAP_FAILED) {
+      cerr << "Unable to map trace file " << file << endl;
+      exit(1);
+   }
+   data = (const UINT8 *)map;
+   // the decoders move through the file front to back, read ahead aggressively
+   madvise(map, bytes, MADV_SEQUENTIAL);
+
+   memcpy(&header, data, sizeof(header));
+   if(memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+      cerr << file << " is not an SPM-Sieve trace\n";
+      exit(1);
+   }
+   if(header.version != TRACE_VERSION) {
+      cerr << file << " has trace version " << header.version << ", this build reads version " << TRACE_VERSION << endl;
+      exit(1);
+   }
+
+   // the trailer bounds the chunks; without it they are walked until the first bad header
+   UINT64 end = bytes;
+   TraceTrailer trailer;
+   if(bytes >= header.header_bytes + sizeof(trailer)) {
+      memcpy(&trailer, data + bytes - sizeof(trailer), sizeof(trailer));
+      if(memcmp(trailer.magic, TRACE_INDEX_MAGIC, sizeof(trailer.magic)) == 0 && trailer.index_offset <= bytes) {
+         has_trailer = true;
+         end = trailer.index_offset;
+      }
+   }
+
+   // chunk headers follow payloads of any length, so they are copied out rather than cast in place
+   UINT64 offset = header.header_bytes;
+   TraceChunkHeader chunk;
+   while(offset + sizeof(chunk) <= end) {
+      memcpy(&chunk, data + offset, sizeof(chunk));
+      if(chunk.magic != TRACE_CHUNK_MAGIC || offset + sizeof(chunk) + chunk.payload_bytes > end) {
+         cerr << "Corrupt trace chunk at offset " << offset << ", replaying the chunks before it\n";
+         break;
+      }
+      chunks.push_back(chunk);
+      offsets.push_back(offset);
+      offset += sizeof(chunk) + chunk.payload_bytes;
+   }
+}
+
+MappedTrace::~MappedTrace()
+{
+   munmap((VOID *)data, bytes);
+}
+
+VOID MappedTrace::done_with(UINT64 c)
+{
+   static const UINT64 page = sysconf(_SC_PAGESIZE);
+
+   UINT64 end = (offsets[c] + chunk_bytes(c)) & ~(page - 1);
+   if(end <= released)
+      return;
+   madvise((VOID *)(data + released), end - released, MADV_DONTNEED);
+   released = end;
+}
+
+static double now_seconds()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+ParallelTraceDecoder::ParallelTraceDecoder(const MappedTrace &_trace, UINT nthreads, UINT _window, UINT64 first_chunk) :
+   trace(_trace), window(MAX(_window, 1)), slots(window), ready(new std::atomic<UINT64>[window]),
+   next_chunk(first_chunk), released(first_chunk), stopping(false), consumed(first_chunk), threads(), stats(MAX(nthreads, 1))
+{
+   for(UINT s = 0; s < window; s++)
+      ready[s].store(0, std::memory_order_relaxed);
+   for(UINT t = 0; t < stats.size(); t++)
+      threads.push_back(std::thread(&ParallelTraceDecoder::decode_main, this, t));
+}
+
+ParallelTraceDecoder::~ParallelTraceDecoder()
+{
+   stop();
+   delete [] ready;
+}
+
+VOID ParallelTraceDecoder::decode_main(UINT index)
+{
+   DecodeStats &mine = stats[index];
+   UINT64 n = trace.chunks.size();
+
+   for(;;) {
+      UINT64 c = next_chunk.fetch_add(1, std::memory_order_relaxed);
+      if(c >= n)
+         return;
+
+      // the slot is free once the consumer released the chunk window places before
+      while(c >= released.load(std::memory_order_acquire) + window) {
+         if(stopping.load(std::memory_order_relaxed))
+            return;
+         PIN_Yield();
+      }
+
+      double start = now_seconds();
+      TraceBatch &batch = slots[c % window];
+      batch.chunk = c;
+      if(!decode_chunk(trace.chunks[c], trace.payload(c), batch))
+         cerr << "Corrupt trace chunk " << c << " at offset " << trace.offsets[c] << endl;
+      mine.seconds += now_seconds() - start;
+      mine.chunks++;
+      mine.records += batch.accesses() + batch.events.size();
+      mine.bytes += trace.chunk_bytes(c);
+
+      ready[c % window].store(c + 1, std::memory_order_release);
+   }
+}
+
+TraceBatch *ParallelTraceDecoder::next()
+{
+   if(consumed >= trace.chunks.size())
+      return NULL;
+
+   UINT s = consumed % window;
+   while(ready[s].load(std::memory_order_acquire) != consumed + 1)
+      PIN_Yield();
+   consumed++;
+   return &slots[s];
+}
+
+VOID ParallelTraceDecoder::release(TraceBatch *batch)
+{
+   // the consumer may have swapped the columns out, so only the slot identifies the batch
+   assert(batch == &slots[(consumed - 1) % window]);
+   released.store(consumed, std::memory_order_release);
+}
+
+VOID ParallelTraceDecoder::stop()
+{
+   stopping.store(true, std::memory_order_relaxed);
+   for(UINT t = 0; t < threads.size(); t++)
+      if(threads[t].joinable())
+         threads[t].join();
+}
@@ -0,0 +1,79 @@
+#ifndef _TRACE_READER_H
+#define _TRACE_READER_H
+
+// Offline side of the binary trace: the file is mapped, never read into buffers, and
+// its chunks are decoded in parallel. Native builds only (SPM_SIEVE_NO_PIN).
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include "trace-format.h"
+
+using namespace std;
+
+// A trace file mapped read only. The chunk list comes from the index, or from
+// walking the chunk headers when the recording did not finish
+class MappedTrace {
+   const UINT8 *data;
+   UINT64 bytes;
+   UINT64 released;            // everything below was handed back to the kernel
+
+public:
+   TraceFileHeader header;
+   bool has_trailer;
+   vector<TraceChunkHeader> chunks;
+   vector<UINT64> offsets;     // file offset of every chunk header
+
+   // exits when the file is not a trace of a supported version
+   MappedTrace(const string &file);
+   ~MappedTrace();
+
+   UINT64 size() const { return bytes; }
+   UINT64 chunk_bytes(UINT64 c) const { return sizeof(TraceChunkHeader) + chunks[c].payload_bytes; }
+   const UINT8 *payload(UINT64 c) const { return data + offsets[c] + sizeof(TraceChunkHeader); }
+
+   // the chunks up to c are consumed, drop their pages so a long replay does not fill the page cache
+   VOID done_with(UINT64 c);
+};
+
+// decode work of one thread
+struct DecodeStats {
+   UINT64 chunks, records, bytes;
+   double seconds;             // time spent decoding, without the waits
+
+   DecodeStats() : chunks(0), records(0), bytes(0), seconds(0) { }
+};
+
+// Decodes the chunks of a mapped trace on N threads into a window of reusable batches.
+// Any thread decodes any chunk, the consumer gets them back in file order from first_chunk on:
+// chunk c goes to slot c % window once the consumer released chunk c - window.
+class ParallelTraceDecoder {
+   const MappedTrace &trace;
+   UINT window;
+   vector<TraceBatch> slots;
+   std::atomic<UINT64> *ready;         // 1 + chunk decoded into the slot
+   std::atomic<UINT64> next_chunk;     // next chunk a thread claims
+   std::atomic<UINT64> released;       // chunks the consumer is done with
+   std::atomic<bool> stopping;
+   UINT64 consumed;                    // consumer side: next chunk it takes
+   vector<std::thread> threads;
+
+   VOID decode_main(UINT index);
+
+public:
+   vector<DecodeStats> stats;          // per decode thread, complete after stop()
+
+   ParallelTraceDecoder(const MappedTrace &_trace, UINT nthreads, UINT _window, UINT64 first_chunk = 0);
+   ~ParallelTraceDecoder();
+
+   // the next chunk in file order, NULL at the end; valid until release()
+   TraceBatch *next();
+   VOID release(TraceBatch *batch);
+
+   // wait for the decode threads, also when the consumer stops early
+   VOID stop();
+};
+
+#endif
@@ -0,0 +1,208 @@
+//
+//  Background writer of the binary trace recorded with -record
+//
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <assert.h>
+using namespace std;
+#include <string.h>
+#include <vector>
+#include "pin.H"
+#include "trace-writer.h"
+
+// chunks the application threads may queue ahead of the writer before they wait for it
+#define TRACE_MAX_QUEUED 64
+
+TraceWriter::TraceWriter(const string &file, UINT64 _chunk_bytes, UINT log2_block_size) :
+   queue(), queued(0), spare(), events(NULL), chunk_bytes(_chunk_bytes), out(), offset(0), index(),
+   stop(false), running(false), uid(0), records(0), events_written(0)
+{
+   PIN_InitLock(&lock);
+
+   out.open(file.c_str(), ios::out | ios::binary | ios::trunc);
+   if(!out.good()) {
+      cerr << "Unable to open trace file " << file << endl;
+      exit(1);
+   }
+
+   TraceFileHeader header;
+   memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+   header.version = TRACE_VERSION;
+   header.header_bytes = sizeof(header);
+   header.log2_block_size = log2_block_size;
+   header.flags = 0;
+   header.reserved = 0;
+   out.write((const char *)&header, sizeof(header));
+   offset = sizeof(header);
+
+   events = get_chunk(TRACE_CHUNK_EVENT, 0, 0);
+}
+
+// caller holds the lock, or no other thread runs yet
+TraceChunk *TraceWriter::get_chunk(UINT16 kind, UINT32 tid, UINT64 time)
+{
+   TraceChunk *chunk;
+   if(spare.empty())
+      chunk = new TraceChunk(chunk_bytes);
+   else {
+      chunk = spare.back();
+      spare.pop_back();
+   }
+   chunk->reset(kind, tid, time);
+   return chunk;
+}
+
+// caller holds the lock
+VOID TraceWriter::queue_events()
+{
+   if(events->empty())
+      return;
+   queue.push_back(events);
+   events = get_chunk(TRACE_CHUNK_EVENT, 0, events->prev_time);
+}
+
+TraceChunk *TraceWriter::thread_chunk(UINT32 tid, UINT64 time)
+{
+   PIN_GetLock(&lock, tid + 1);
+   TraceChunk *chunk = get_chunk(TRACE_CHUNK_ACCESS, tid, time);
+   PIN_ReleaseLock(&lock);
+   return chunk;
+}
+
+TraceChunk *TraceWriter::submit(TraceChunk *chunk, UINT64 time)
+{
+   UINT32 tid = chunk->tid;
+
+   // do not let a fast application run away from the disk
+   while(running && queued.load(std::memory_order_relaxed) >= TRACE_MAX_QUEUED)
+      PIN_Yield();
+
+   PIN_GetLock(&lock, tid + 1);
+   queue_events();
+   queue.push_back(chunk);
+   queued.store(queue.size(), std::memory_order_relaxed);
+   TraceChunk *next = get_chunk(TRACE_CHUNK_ACCESS, tid, time);
+   PIN_ReleaseLock(&lock);
+   return next;
+}
+
+VOID TraceWriter::alloc_event(UINT32 tid, UINT64 time, ADDRINT start, ADDRINT size, ADDRINT ip, UINT8 type, const string &libname)
+{
+   PIN_GetLock(&lock, tid + 1);
+   events->alloc_event(tid, time, start, size, ip, type, libname);
+   PIN_ReleaseLock(&lock);
+}
+
+VOID TraceWriter::free_event(UINT32 tid, UINT64 time, ADDRINT start)
+{
+   PIN_GetLock(&lock, tid + 1);
+   events->free_event(tid, time, start);
+   PIN_ReleaseLock(&lock);
+}
+
+// write every queued chunk; only one thread at a time, the writer thread or close()
+UINT64 TraceWriter::write_queued()
+{
+   vector<TraceChunk *> batch;
+   PIN_GetLock(&lock, 1);
+   batch.swap(queue);
+   queued.store(0, std::memory_order_relaxed);
+   PIN_ReleaseLock(&lock);
+
+   for(UINT i = 0; i < batch.size(); i++) {
+      TraceChunk *chunk = batch[i];
+      UINT64 bytes;
+      const UINT8 *data = chunk->seal(&bytes);
+
+      TraceIndexEntry entry;
+      entry.offset = offset;
+      entry.tid = chunk->tid;
+      entry.kind = chunk->kind;
+      entry.reserved = 0;
+      entry.records = chunk->records;
+      entry.first_time = chunk->first_time;
+      index.push_back(entry);
+
+      out.write((const char *)data, bytes);
+      offset += bytes;
+      if(chunk->kind == TRACE_CHUNK_EVENT)
+         events_written += chunk->records;
+      else
+         records += chunk->records;
+   }
+
+   PIN_GetLock(&lock, 1);
+   spare.insert(spare.end(), batch.begin(), batch.end());
+   PIN_ReleaseLock(&lock);
+   return batch.size();
+}
+
+VOID TraceWriter::WriterMain(VOID *arg)
+{
+   TraceWriter *writer = static_cast<TraceWriter *>(arg);
+   for(;;) {
+      bool stopping = writer->stop.load(std::memory_order_acquire);
+      if(writer->write_queued() == 0) {
+         if(stopping)
+            break;
+         PIN_Sleep(1);
+      }
+   }
+}
+
+VOID TraceWriter::start()
+{
+   if(PIN_SpawnInternalThread(WriterMain, this, 0, &uid) == INVALID_THREADID) {
+      cerr << "Unable to spawn the trace writer thread\n";
+      exit(1);
+   }
+   running = true;
+}
+
+VOID TraceWriter::stop_thread()
+{
+   if(!running)
+      return;
+   stop.store(true, std::memory_order_release);
+   PIN_WaitForThreadTermination(uid, PIN_INFINITE_TIMEOUT, NULL);
+   running = false;
+}
+
+VOID TraceWriter::close()
+{
+   stop_thread();
+
+   PIN_GetLock(&lock, 1);
+   queue_events();
+   PIN_ReleaseLock(&lock);
+   write_queued();
+
+   TraceTrailer trailer;
+   trailer.index_offset = offset;
+   trailer.index_entries = index.size();
+   memcpy(trailer.magic, TRACE_INDEX_MAGIC, sizeof(trailer.magic));
+
+   if(!index.empty())
+      out.write((const char *)&index[0], index.size() * sizeof(TraceIndexEntry));
+   out.write((const char *)&trailer, sizeof(trailer));
+   offset += index.size() * sizeof(TraceIndexEntry) + sizeof(trailer);
+   out.close();
+}
+
+VOID TraceWriter::after_fork_child()
+{
+   for(UINT i = 0; i < queue.size(); i++)
+      delete queue[i];
+   for(UINT i = 0; i < spare.size(); i++)
+      delete spare[i];
+   queue.clear();
+   spare.clear();
+   queued.store(0, std::memory_order_relaxed);
+   delete events;
+   events = NULL;
+   // the chunks the writer thread was writing at the fork are lost with it
+   running = false;
+   PIN_ReleaseLock(&lock);
+}
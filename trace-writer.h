@@ -0,0 +1,72 @@
+#ifndef _TRACE_WRITER_H
+#define _TRACE_WRITER_H
+
+#include <fstream>
+#include <vector>
+#include <atomic>
+
+#include "trace-format.h"
+
+using namespace std;
+
+// Writes the chunks of the record mode to the trace file on a Pin internal thread.
+// Application threads fill their own access chunk without locking and swap it for an empty
+// one when it is full; allocation events of all threads go into one shared event chunk
+// that is queued ahead of the next access chunk, see the ordering notes in trace-format.h.
+class TraceWriter {
+   PIN_LOCK lock;
+   vector<TraceChunk *> queue;        // sealed chunks waiting for the writer thread
+   std::atomic<UINT64> queued;        // queue.size(), for the unlocked backpressure check
+   vector<TraceChunk *> spare;        // written chunks, reused for new ones
+   TraceChunk *events;                // events not queued yet
+   UINT64 chunk_bytes;
+
+   // writer thread side
+   std::ofstream out;
+   UINT64 offset;
+   vector<TraceIndexEntry> index;
+   std::atomic<bool> stop;
+   bool running;
+   PIN_THREAD_UID uid;
+
+   TraceChunk *get_chunk(UINT16 kind, UINT32 tid, UINT64 time);
+   VOID queue_events();
+   UINT64 write_queued();
+
+   static VOID WriterMain(VOID *arg);
+
+public:
+   UINT64 records, events_written;     // statistics for the report
+
+   TraceWriter(const string &file, UINT64 _chunk_bytes, UINT log2_block_size);
+
+   // empty access chunk for a new thread
+   TraceChunk *thread_chunk(UINT32 tid, UINT64 time);
+
+   // queue the filled chunk of a thread, behind every event logged so far; returns it reset
+   TraceChunk *submit(TraceChunk *chunk, UINT64 time);
+
+   VOID alloc_event(UINT32 tid, UINT64 time, ADDRINT start, ADDRINT size, ADDRINT ip, UINT8 type, const string &libname);
+   VOID free_event(UINT32 tid, UINT64 time, ADDRINT start);
+
+   VOID start();
+
+   // stop the writer thread; chunks queued later are written by close()
+   VOID stop_thread();
+
+   // write whatever is left, the index and the trailer; no thread may submit anymore
+   VOID close();
+
+   // fork of the process: the lock is held across it, so the child finds the queues whole
+   VOID before_fork() { PIN_GetLock(&lock, 1); }
+   VOID after_fork_parent() { PIN_ReleaseLock(&lock); }
+   // in the child this writer is the parent's: free its chunks, without waiting for the writer
+   // thread the child does not have. The object and its stream stay behind on purpose, closing
+   // the stream would flush the bytes the parent buffered into the parent's trace
+   VOID after_fork_child();
+
+   UINT64 bytes() const { return offset; }
+   UINT64 chunks() const { return index.size(); }
+};
+
+#endif
@@ -21,8 +21,10 @@ string StripPath(const string &path)
 // strip whitespace from left and right of the string
 string strip(const string &str, string delimiters)
 {
-    int first = str.find_first_not_of( delimiters );
-    int last  = str.find_last_not_of ( delimiters );
+    size_t first = str.find_first_not_of( delimiters );
+    size_t last  = str.find_last_not_of ( delimiters );
+    if (first == string::npos)
+        return "";
 
     return str.substr( first, last - first + 1);
 }